@@ -162,7 +162,7 @@ exsltDynMapFunction(xmlXPathParserContextPtr ctxt, int nargs)
     }
     xsltRegisterLocalRVT(tctxt, container);
     if (nodeset && nodeset->nodeNr > 0) {
-        xmlXPathNodeSetSort(nodeset);
+        xsltCtxtDocumentSortFunction(tctxt, nodeset);
         ctxt->context->contextSize = nodeset->nodeNr;
         ctxt->context->proximityPosition = 0;
         for (i = 0; i < nodeset->nodeNr; i++) {
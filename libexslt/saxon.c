@@ -17,6 +17,7 @@
 #include <libxslt/xsltutils.h>
 #include <libxslt/xsltInternals.h>
 #include <libxslt/extensions.h>
+#include <libxslt/documents.h>
 
 #include "exslt.h"
 
@@ -251,7 +252,8 @@ exsltSaxonLineNumberFunction(xmlXPathParserContextPtr ctxt, int nargs) {
 	}
 	cur = nodelist->nodeTab[0];
 	for (i = 1;i < nodelist->nodeNr;i++) {
-	    int ret = xmlXPathCmpNodes(cur, nodelist->nodeTab[i]);
+	    int ret = xsltCmpDocumentOrder(xsltXPathGetTransformContext(ctxt),
+					   cur, nodelist->nodeTab[i]);
 	    if (ret == -1)
 		cur = nodelist->nodeTab[i];
 	}
@@ -21,6 +21,141 @@
 
 #include "exslt.h"
 
+#include <string.h>
+#include <limits.h>
+
+/*
+ * A growable string used to build function results in one allocation
+ * when the total length is known upfront, and with geometric growth
+ * otherwise, instead of reallocating and rescanning the result on every
+ * xmlStrcat().
+ */
+typedef struct _exsltStrBuilder exsltStrBuilder;
+typedef exsltStrBuilder *exsltStrBuilderPtr;
+struct _exsltStrBuilder {
+    xmlChar *content;		/* the string being built */
+    int use;			/* the number of bytes used */
+    int size;			/* the number of bytes allocated minus one */
+};
+
+/**
+ * exsltStrBuilderInit:
+ * @builder: a string builder
+ * @size: the expected length of the result in bytes
+ *
+ * Initializes @builder with room for @size bytes.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+static int
+exsltStrBuilderInit(exsltStrBuilderPtr builder, int size) {
+    if (size < 0)
+	size = 0;
+    builder->content = (xmlChar *) xmlMalloc(size + 1);
+    if (builder->content == NULL) {
+	builder->use = builder->size = 0;
+	return(-1);
+    }
+    builder->content[0] = 0;
+    builder->use = 0;
+    builder->size = size;
+    return(0);
+}
+
+/**
+ * exsltStrBuilderAdd:
+ * @builder: a string builder
+ * @str: the string to append
+ * @len: the length of @str in bytes or -1 if it is 0-terminated
+ *
+ * Appends @str to @builder, growing it if needed. After an error the
+ * builder is emptied and further calls fail.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+static int
+exsltStrBuilderAdd(exsltStrBuilderPtr builder, const xmlChar *str, int len) {
+    if (builder->content == NULL)
+	return(-1);
+    if (str == NULL)
+	return(0);
+    if (len < 0)
+	len = xmlStrlen(str);
+    if (len > builder->size - builder->use) {
+	xmlChar *tmp;
+	int size = builder->size * 2;
+
+	if (size < builder->use + len)
+	    size = builder->use + len;
+	tmp = (xmlChar *) xmlRealloc(builder->content, size + 1);
+	if (tmp == NULL) {
+	    xmlFree(builder->content);
+	    builder->content = NULL;
+	    return(-1);
+	}
+	builder->content = tmp;
+	builder->size = size;
+    }
+    memcpy(builder->content + builder->use, str, len);
+    builder->use += len;
+    return(0);
+}
+
+/**
+ * exsltStrBuilderFinish:
+ * @builder: a string builder
+ *
+ * Terminates the string built so far and hands it over to the caller.
+ *
+ * Returns the string, to be freed by the caller, or NULL in case of error.
+ */
+static xmlChar *
+exsltStrBuilderFinish(exsltStrBuilderPtr builder) {
+    xmlChar *ret = builder->content;
+
+    if (ret != NULL)
+	ret[builder->use] = 0;
+    builder->content = NULL;
+    builder->use = builder->size = 0;
+    return(ret);
+}
+
+/**
+ * exsltStrAddToken:
+ * @container: the result tree fragment holding the tokens
+ * @name: the "token" element name, owned by the container's dictionary
+ * @token: the start of the token in the source string
+ * @len: the length of the token in bytes
+ * @ret: the node-set receiving the new element
+ *
+ * Appends a token element containing the @len first bytes of @token
+ * to @container. The element name is interned once by the caller and
+ * the text is copied directly from the source string, so no temporary
+ * termination or name lookup is needed per token.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+static int
+exsltStrAddToken(xmlDocPtr container, const xmlChar *name,
+                 const xmlChar *token, int len, xmlXPathObjectPtr ret)
+{
+    xmlNodePtr node, text;
+
+    node = xmlNewDocNodeEatName(container, NULL, (xmlChar *) name, NULL);
+    if (node == NULL)
+        return(-1);
+    text = xmlNewDocTextLen(container, token, len);
+    if (text == NULL) {
+        xmlFreeNode(node);
+        return(-1);
+    }
+    node->children = node->last = text;
+    text->parent = node;
+    xmlAddChild((xmlNodePtr) container, node);
+    xmlXPathNodeSetAddUnique(ret->nodesetval, node);
+    return(0);
+}
+
 /**
  * exsltStrTokenizeFunction:
  * @ctxt: an XPath parser context
@@ -33,11 +168,18 @@ static void
 exsltStrTokenizeFunction(xmlXPathParserContextPtr ctxt, int nargs)
 {
     xsltTransformContextPtr tctxt;
-    xmlChar *str, *delimiters, *cur;
-    const xmlChar *token, *delimiter;
-    xmlNodePtr node;
+    xmlChar *str, *delimiters;
+    const xmlChar *cur, *token, *delimiter, *name;
     xmlDocPtr container;
     xmlXPathObjectPtr ret = NULL;
+    /*
+    * Lookup table on the first byte of each delimiter: 1 for ASCII
+    * delimiters, which match on the byte alone, 2 for lead bytes of
+    * multi-byte delimiters which need a full UTF-8 compare. Continuation
+    * bytes are never set, so scanning byte by byte only ever stops on
+    * character boundaries.
+    */
+    unsigned char delimTable[256];
     int clen;
 
     if ((nargs < 1) || (nargs > 2)) {
@@ -74,43 +216,60 @@ exsltStrTokenizeFunction(xmlXPathParserContextPtr ctxt, int nargs)
         xsltRegisterLocalRVT(tctxt, container);
         ret = xmlXPathNewNodeSet(NULL);
         if (ret != NULL) {
-            for (cur = str, token = str; *cur != 0; cur += clen) {
-	        clen = xmlUTF8Size(cur);
-		if (*delimiters == 0) {	/* empty string case */
-		    xmlChar ctmp;
-		    ctmp = *(cur+clen);
-		    *(cur+clen) = 0;
-                    node = xmlNewDocRawNode(container, NULL,
-                                       (const xmlChar *) "token", cur);
-		    xmlAddChild((xmlNodePtr) container, node);
-		    xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-                    *(cur+clen) = ctmp; /* restore the changed byte */
-                    token = cur + clen;
-                } else for (delimiter = delimiters; *delimiter != 0;
-				delimiter += xmlUTF8Size(delimiter)) {
-                    if (!xmlUTF8Charcmp(cur, delimiter)) {
-                        if (cur == token) {
-                            /* discard empty tokens */
-                            token = cur + clen;
-                            break;
-                        }
-                        *cur = 0;	/* terminate the token */
-                        node = xmlNewDocRawNode(container, NULL,
-                                           (const xmlChar *) "token", token);
-			xmlAddChild((xmlNodePtr) container, node);
-			xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-                        *cur = *delimiter; /* restore the changed byte */
-                        token = cur + clen;
-                        break;
-                    }
-                }
-            }
-            if (token != cur) {
-		node = xmlNewDocRawNode(container, NULL,
-				    (const xmlChar *) "token", token);
-                xmlAddChild((xmlNodePtr) container, node);
-	        xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-            }
+	    name = xmlDictLookup(container->dict,
+				 (const xmlChar *) "token", -1);
+	    if (name == NULL)
+		goto error;
+
+	    if (*delimiters == 0) {	/* empty string case */
+		for (cur = str; *cur != 0; cur += clen) {
+		    clen = xmlUTF8Size(cur);
+		    if (clen <= 0)
+			break;
+		    if (exsltStrAddToken(container, name, cur, clen, ret) < 0)
+			goto error;
+		}
+	    } else {
+		memset(delimTable, 0, sizeof(delimTable));
+		for (delimiter = delimiters; *delimiter != 0;
+		     delimiter += clen) {
+		    clen = xmlUTF8Size(delimiter);
+		    if (clen <= 0)
+			break;
+		    if (*delimiter < 0x80)
+			delimTable[*delimiter] = 1;
+		    else
+			delimTable[*delimiter] = 2;
+		}
+
+		for (cur = str, token = str; *cur != 0; cur++) {
+		    if (delimTable[*cur] == 0)
+			continue;
+		    if (delimTable[*cur] == 2) {
+			for (delimiter = delimiters; *delimiter != 0;
+			     delimiter += xmlUTF8Size(delimiter)) {
+			    if (!xmlUTF8Charcmp(cur, delimiter))
+				break;
+			}
+			if (*delimiter == 0)
+			    continue;
+			clen = xmlUTF8Size(cur);
+		    } else {
+			clen = 1;
+		    }
+		    /* discard empty tokens */
+		    if ((cur != token) &&
+			(exsltStrAddToken(container, name, token, cur - token,
+					  ret) < 0))
+			goto error;
+		    cur += clen - 1;
+		    token = cur + 1;
+		}
+		if ((token != cur) &&
+		    (exsltStrAddToken(container, name, token, cur - token,
+				      ret) < 0))
+		    goto error;
+	    }
 	    /*
 	     * Mark it as a function result in order to avoid garbage
 	     * collecting of tree fragments
@@ -128,6 +287,13 @@ fail:
         valuePush(ctxt, ret);
     else
         valuePush(ctxt, xmlXPathNewNodeSet(NULL));
+    return;
+
+error:
+    xmlXPathFreeObject(ret);
+    ret = NULL;
+    xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+    goto fail;
 }
 
 /**
@@ -141,12 +307,12 @@ fail:
 static void
 exsltStrSplitFunction(xmlXPathParserContextPtr ctxt, int nargs) {
     xsltTransformContextPtr tctxt;
-    xmlChar *str, *delimiter, *cur;
-    const xmlChar *token;
-    xmlNodePtr node;
+    xmlChar *str, *delimiter;
+    const xmlChar *cur, *token, *name;
     xmlDocPtr container;
     xmlXPathObjectPtr ret = NULL;
     int delimiterLength;
+    xmlChar first, firstAlt;
 
     if ((nargs < 1) || (nargs > 2)) {
         xmlXPathSetArityError(ctxt);
@@ -186,41 +352,46 @@ exsltStrSplitFunction(xmlXPathParserContextPtr ctxt, int nargs) {
         xsltRegisterLocalRVT(tctxt, container);
         ret = xmlXPathNewNodeSet(NULL);
         if (ret != NULL) {
-            for (cur = str, token = str; *cur != 0; cur++) {
-		if (delimiterLength == 0) {
-		    if (cur != token) {
-			xmlChar tmp = *cur;
-			*cur = 0;
-                        node = xmlNewDocRawNode(container, NULL,
-                                           (const xmlChar *) "token", token);
-			xmlAddChild((xmlNodePtr) container, node);
-			xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-			*cur = tmp;
-			token++;
-		    }
+	    name = xmlDictLookup(container->dict,
+				 (const xmlChar *) "token", -1);
+	    if (name == NULL)
+		goto error;
+
+	    if (delimiterLength == 0) {
+		for (cur = str; *cur != 0; cur++) {
+		    if (exsltStrAddToken(container, name, cur, 1, ret) < 0)
+			goto error;
 		}
-		else if (!xmlStrncasecmp(cur, delimiter, delimiterLength)) {
-		    if (cur == token) {
-			/* discard empty tokens */
-			cur = cur + delimiterLength - 1;
-			token = cur + 1;
+	    } else {
+		/*
+		* The delimiter is matched case-insensitively; only try a
+		* full compare where the first byte matches either case.
+		*/
+		first = delimiter[0];
+		if ((first >= 'A') && (first <= 'Z'))
+		    firstAlt = first + ('a' - 'A');
+		else if ((first >= 'a') && (first <= 'z'))
+		    firstAlt = first - ('a' - 'A');
+		else
+		    firstAlt = first;
+
+		for (cur = str, token = str; *cur != 0; cur++) {
+		    if ((*cur != first) && (*cur != firstAlt))
 			continue;
-		    }
-		    *cur = 0;
-		    node = xmlNewDocRawNode(container, NULL,
-				       (const xmlChar *) "token", token);
-		    xmlAddChild((xmlNodePtr) container, node);
-		    xmlXPathNodeSetAddUnique(ret->nodesetval, node);
-		    *cur = *delimiter;
+		    if (xmlStrncasecmp(cur, delimiter, delimiterLength))
+			continue;
+		    /* discard empty tokens */
+		    if ((cur != token) &&
+			(exsltStrAddToken(container, name, token, cur - token,
+					  ret) < 0))
+			goto error;
 		    cur = cur + delimiterLength - 1;
 		    token = cur + 1;
-                }
-            }
-	    if (token != cur) {
-		node = xmlNewDocRawNode(container, NULL,
-				   (const xmlChar *) "token", token);
-		xmlAddChild((xmlNodePtr) container, node);
-		xmlXPathNodeSetAddUnique(ret->nodesetval, node);
+		}
+		if ((token != cur) &&
+		    (exsltStrAddToken(container, name, token, cur - token,
+				      ret) < 0))
+		    goto error;
 	    }
 	    /*
 	     * Mark it as a function result in order to avoid garbage
@@ -239,6 +410,13 @@ fail:
         valuePush(ctxt, ret);
     else
         valuePush(ctxt, xmlXPathNewNodeSet(NULL));
+    return;
+
+error:
+    xmlXPathFreeObject(ret);
+    ret = NULL;
+    xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+    goto fail;
 }
 
 /**
@@ -351,8 +529,9 @@ exsltStrDecodeUriFunction (xmlXPathParserContextPtr ctxt, int nargs) {
  */
 static void
 exsltStrPaddingFunction (xmlXPathParserContextPtr ctxt, int nargs) {
-    int number, str_len = 0, str_size = 0;
+    int number, str_len = 0, str_size = 0, repeat, partial;
     xmlChar *str = NULL, *ret = NULL;
+    exsltStrBuilder builder;
 
     if ((nargs < 1) || (nargs > 2)) {
 	xmlXPathSetArityError(ctxt);
@@ -379,16 +558,25 @@ exsltStrPaddingFunction (xmlXPathParserContextPtr ctxt, int nargs) {
 	return;
     }
 
-    while (number >= str_len) {
-	ret = xmlStrncat(ret, str, str_size);
-	number -= str_len;
-    }
-    if (number > 0) {
-	str_size = xmlUTF8Strsize(str, number);
-	ret = xmlStrncat(ret, str, str_size);
+    /* the result size is known: whole copies plus a partial one */
+    repeat = number / str_len;
+    partial = xmlUTF8Strsize(str, number % str_len);
+    if ((repeat > (INT_MAX - partial) / str_size) ||
+        (exsltStrBuilderInit(&builder, repeat * str_size + partial) < 0)) {
+	xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+	xmlFree(str);
+	return;
     }
+    while (repeat-- > 0)
+	exsltStrBuilderAdd(&builder, str, str_size);
+    exsltStrBuilderAdd(&builder, str, partial);
 
-    xmlXPathReturnString(ctxt, ret);
+    ret = exsltStrBuilderFinish(&builder);
+    if (ret == NULL) {
+	xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+    } else {
+	xmlXPathReturnString(ctxt, ret);
+    }
 
     if (str != NULL)
 	xmlFree(str);
@@ -405,6 +593,7 @@ static void
 exsltStrAlignFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     xmlChar *str, *padding, *alignment, *ret;
     int str_l, padding_l;
+    exsltStrBuilder builder;
 
     if ((nargs < 2) || (nargs > 3)) {
 	xmlXPathSetArityError(ctxt);
@@ -432,25 +621,43 @@ exsltStrAlignFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     if (str_l > padding_l) {
 	ret = xmlUTF8Strndup (str, padding_l);
     } else {
+	int str_s, padding_s, left_s, right_s;
+
+	/*
+	* The result is the padding with the string inserted in it, its
+	* size is known before building it.
+	*/
+	str_s = xmlStrlen (str);
+	padding_s = xmlStrlen (padding);
 	if (xmlStrEqual(alignment, (const xmlChar *) "right")) {
-	    ret = xmlUTF8Strndup (padding, padding_l - str_l);
-	    ret = xmlStrcat (ret, str);
+	    left_s = xmlUTF8Strsize (padding, padding_l - str_l);
+	    right_s = padding_s;
 	} else if (xmlStrEqual(alignment, (const xmlChar *) "center")) {
 	    int left = (padding_l - str_l) / 2;
-	    int right_start;
 
-	    ret = xmlUTF8Strndup (padding, left);
-	    ret = xmlStrcat (ret, str);
-
-	    right_start = xmlUTF8Strsize (padding, left + str_l);
-	    ret = xmlStrcat (ret, padding + right_start);
+	    left_s = xmlUTF8Strsize (padding, left);
+	    right_s = xmlUTF8Strsize (padding, left + str_l);
 	} else {
-	    int str_s;
+	    left_s = 0;
+	    right_s = xmlUTF8Strsize (padding, str_l);
+	}
 
-	    str_s = xmlUTF8Strsize(padding, str_l);
-	    ret = xmlStrdup (str);
-	    ret = xmlStrcat (ret, padding + str_s);
+	if (exsltStrBuilderInit(&builder,
+		left_s + str_s + (padding_s - right_s)) == 0) {
+	    exsltStrBuilderAdd(&builder, padding, left_s);
+	    exsltStrBuilderAdd(&builder, str, str_s);
+	    exsltStrBuilderAdd(&builder, padding + right_s,
+			       padding_s - right_s);
 	}
+	ret = exsltStrBuilderFinish(&builder);
+    }
+
+    if (ret == NULL) {
+	xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+	xmlFree(str);
+	xmlFree(padding);
+	xmlFree(alignment);
+	return;
     }
 
     xmlXPathReturnString (ctxt, ret);
@@ -460,6 +667,37 @@ exsltStrAlignFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     xmlFree(alignment);
 }
 
+/**
+ * exsltStrNodeValue:
+ * @node: a node
+ *
+ * Returns the string value of @node when it is stored as is in the tree,
+ * or NULL if it has to be computed with xmlXPathCastNodeToString().
+ */
+static const xmlChar *
+exsltStrNodeValue(xmlNodePtr node) {
+    switch (node->type) {
+	case XML_TEXT_NODE:
+	case XML_CDATA_SECTION_NODE:
+	case XML_COMMENT_NODE:
+	case XML_PI_NODE:
+	    return((node->content != NULL) ?
+		   node->content : (const xmlChar *) "");
+	case XML_ATTRIBUTE_NODE:
+	    if (node->children == NULL)
+		return((const xmlChar *) "");
+	    if ((node->children->type == XML_TEXT_NODE) &&
+		(node->children->next == NULL) &&
+		(node->children->content != NULL))
+		return(node->children->content);
+	    return(NULL);
+	case XML_NAMESPACE_DECL:
+	    return(((xmlNsPtr) node)->href);
+	default:
+	    return(NULL);
+    }
+}
+
 /**
  * exsltStrConcatFunction:
  * @ctxt: an XPath parser context
@@ -473,7 +711,9 @@ static void
 exsltStrConcatFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     xmlXPathObjectPtr obj;
     xmlChar *ret = NULL;
-    int i;
+    const xmlChar *value;
+    exsltStrBuilder builder;
+    int i, size = 0;
 
     if (nargs  != 1) {
 	xmlXPathSetArityError(ctxt);
@@ -488,22 +728,53 @@ exsltStrConcatFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     obj = valuePop (ctxt);
 
     if (xmlXPathNodeSetIsEmpty(obj->nodesetval)) {
+	xmlXPathFreeObject (obj);
 	xmlXPathReturnEmptyString(ctxt);
 	return;
     }
 
+    /*
+    * Size the result from the string values which are available without
+    * copying; the other nodes are converted while appending.
+    */
     for (i = 0; i < obj->nodesetval->nodeNr; i++) {
-	xmlChar *tmp;
-	tmp = xmlXPathCastNodeToString(obj->nodesetval->nodeTab[i]);
+	value = exsltStrNodeValue(obj->nodesetval->nodeTab[i]);
+	if (value != NULL)
+	    size += xmlStrlen(value);
+    }
 
-	ret = xmlStrcat (ret, tmp);
+    if (exsltStrBuilderInit(&builder, size) < 0)
+	goto error;
 
-	xmlFree(tmp);
+    for (i = 0; i < obj->nodesetval->nodeNr; i++) {
+	value = exsltStrNodeValue(obj->nodesetval->nodeTab[i]);
+	if (value != NULL) {
+	    exsltStrBuilderAdd(&builder, value, -1);
+	} else {
+	    xmlChar *tmp;
+
+	    tmp = xmlXPathCastNodeToString(obj->nodesetval->nodeTab[i]);
+	    if (tmp == NULL) {
+		xmlFree(exsltStrBuilderFinish(&builder));
+		goto error;
+	    }
+	    exsltStrBuilderAdd(&builder, tmp, -1);
+	    xmlFree(tmp);
+	}
     }
 
+    ret = exsltStrBuilderFinish(&builder);
+    if (ret == NULL)
+	goto error;
+
     xmlXPathFreeObject (obj);
 
     xmlXPathReturnString(ctxt, ret);
+    return;
+
+error:
+    xmlXPathFreeObject (obj);
+    xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
 }
 
 /**
@@ -549,6 +820,352 @@ exsltStrReturnString(xmlXPathParserContextPtr ctxt, const xmlChar *str,
     return(0);
 }
 
+/*
+ * Multi-string matcher used by str:replace() for large search lists.
+ *
+ * The search strings are compiled reversed into an Aho-Corasick automaton
+ * which is then run backwards over the input. The deepest terminal state
+ * reached at a byte position is the longest search string starting at
+ * that position, so the leftmost-longest replacement semantic is kept
+ * while the cost stays linear in the input length whatever the number
+ * of search strings.
+ */
+
+/*
+ * Minimum number of search strings for which the automaton is used
+ * instead of comparing every search string at every position.
+ */
+#define EXSLT_STR_MATCHER_MIN 4
+
+/*
+ * Maximum number of compiled matchers kept per transformation.
+ */
+#define EXSLT_STR_MATCHER_CACHE_MAX 64
+
+typedef struct _exsltStrMatchEdge exsltStrMatchEdge;
+struct _exsltStrMatchEdge {
+    int target;			/* the destination state */
+    int next;			/* the next edge of the same state or -1 */
+    xmlChar c;			/* the byte labelling the edge */
+};
+
+typedef struct _exsltStrMatchState exsltStrMatchState;
+struct _exsltStrMatchState {
+    int edges;			/* the first outgoing edge or -1 */
+    int fail;			/* the failure link */
+    int pattern;		/* the search string ending here or -1 */
+    int output;			/* the deepest terminal suffix state or -1 */
+};
+
+typedef struct _exsltStrMatcher exsltStrMatcher;
+typedef exsltStrMatcher *exsltStrMatcherPtr;
+struct _exsltStrMatcher {
+    int nbStates;
+    int maxStates;
+    exsltStrMatchState *states;
+    int nbEdges;
+    int maxEdges;
+    exsltStrMatchEdge *edges;
+    int root[256];		/* dense transitions of the root state */
+};
+
+/**
+ * exsltStrMatcherFree:
+ * @matcher: a matcher
+ *
+ * Frees a matcher and its tables.
+ */
+static void
+exsltStrMatcherFree(exsltStrMatcherPtr matcher) {
+    if (matcher == NULL)
+	return;
+    if (matcher->states != NULL)
+	xmlFree(matcher->states);
+    if (matcher->edges != NULL)
+	xmlFree(matcher->edges);
+    xmlFree(matcher);
+}
+
+/**
+ * exsltStrMatcherChild:
+ * @matcher: a matcher
+ * @state: a state
+ * @c: a byte
+ *
+ * Returns the goto transition of @state on @c or -1 if there is none.
+ */
+static int
+exsltStrMatcherChild(exsltStrMatcherPtr matcher, int state, xmlChar c) {
+    int edge;
+
+    if (state == 0)
+	return(matcher->root[c] != 0 ? matcher->root[c] : -1);
+    for (edge = matcher->states[state].edges; edge >= 0;
+	 edge = matcher->edges[edge].next) {
+	if (matcher->edges[edge].c == c)
+	    return(matcher->edges[edge].target);
+    }
+    return(-1);
+}
+
+/**
+ * exsltStrMatcherNext:
+ * @matcher: a compiled matcher
+ * @state: the current state
+ * @c: the next input byte
+ *
+ * Returns the state reached from @state on @c, following failure links.
+ */
+static int
+exsltStrMatcherNext(exsltStrMatcherPtr matcher, int state, xmlChar c) {
+    int next;
+
+    while (1) {
+	next = exsltStrMatcherChild(matcher, state, c);
+	if (next >= 0)
+	    return(next);
+	if (state == 0)
+	    return(0);
+	state = matcher->states[state].fail;
+    }
+}
+
+/**
+ * exsltStrMatcherAddState:
+ * @matcher: a matcher
+ *
+ * Returns the index of a new empty state or -1 in case of error.
+ */
+static int
+exsltStrMatcherAddState(exsltStrMatcherPtr matcher) {
+    exsltStrMatchState *state;
+
+    if (matcher->nbStates >= matcher->maxStates) {
+	exsltStrMatchState *tmp;
+
+	tmp = (exsltStrMatchState *) xmlRealloc(matcher->states,
+		    matcher->maxStates * 2 * sizeof(exsltStrMatchState));
+	if (tmp == NULL)
+	    return(-1);
+	matcher->states = tmp;
+	matcher->maxStates *= 2;
+    }
+    state = &matcher->states[matcher->nbStates];
+    state->edges = -1;
+    state->fail = 0;
+    state->pattern = -1;
+    state->output = -1;
+    return(matcher->nbStates++);
+}
+
+/**
+ * exsltStrMatcherAddEdge:
+ * @matcher: a matcher
+ * @from: the source state
+ * @c: the byte labelling the edge
+ *
+ * Returns the index of the new target state or -1 in case of error.
+ */
+static int
+exsltStrMatcherAddEdge(exsltStrMatcherPtr matcher, int from, xmlChar c) {
+    exsltStrMatchEdge *edge;
+    int to;
+
+    to = exsltStrMatcherAddState(matcher);
+    if (to < 0)
+	return(-1);
+    if (from == 0) {
+	matcher->root[c] = to;
+	return(to);
+    }
+    if (matcher->nbEdges >= matcher->maxEdges) {
+	exsltStrMatchEdge *tmp;
+
+	tmp = (exsltStrMatchEdge *) xmlRealloc(matcher->edges,
+		    matcher->maxEdges * 2 * sizeof(exsltStrMatchEdge));
+	if (tmp == NULL)
+	    return(-1);
+	matcher->edges = tmp;
+	matcher->maxEdges *= 2;
+    }
+    edge = &matcher->edges[matcher->nbEdges];
+    edge->c = c;
+    edge->target = to;
+    edge->next = matcher->states[from].edges;
+    matcher->states[from].edges = matcher->nbEdges++;
+    return(to);
+}
+
+/**
+ * exsltStrMatcherCompile:
+ * @search: the array of search strings
+ * @slen: the array of search string lengths
+ * @n: the number of search strings
+ *
+ * Compiles the reversed search strings into an automaton. Empty search
+ * strings are ignored, and for duplicates the first one wins.
+ *
+ * Returns the new matcher or NULL in case of error.
+ */
+static exsltStrMatcherPtr
+exsltStrMatcherCompile(xmlChar **search, const int *slen, int n) {
+    exsltStrMatcherPtr matcher;
+    int *queue = NULL;
+    int i, j, state, next, head, tail, edge, total = 1;
+
+    for (i = 0; i < n; i++)
+	total += slen[i];
+
+    matcher = (exsltStrMatcherPtr) xmlMalloc(sizeof(exsltStrMatcher));
+    if (matcher == NULL)
+	return(NULL);
+    memset(matcher, 0, sizeof(exsltStrMatcher));
+    matcher->maxStates = total;
+    matcher->states = (exsltStrMatchState *)
+	xmlMalloc(matcher->maxStates * sizeof(exsltStrMatchState));
+    matcher->maxEdges = total;
+    matcher->edges = (exsltStrMatchEdge *)
+	xmlMalloc(matcher->maxEdges * sizeof(exsltStrMatchEdge));
+    if ((matcher->states == NULL) || (matcher->edges == NULL))
+	goto error;
+    if (exsltStrMatcherAddState(matcher) != 0)
+	goto error;
+
+    /* build the trie of the reversed search strings */
+    for (i = 0; i < n; i++) {
+	if (slen[i] == 0)
+	    continue;
+	state = 0;
+	for (j = slen[i] - 1; j >= 0; j--) {
+	    next = exsltStrMatcherChild(matcher, state, search[i][j]);
+	    if (next < 0)
+		next = exsltStrMatcherAddEdge(matcher, state, search[i][j]);
+	    if (next < 0)
+		goto error;
+	    state = next;
+	}
+	if (matcher->states[state].pattern < 0)
+	    matcher->states[state].pattern = i;
+    }
+
+    /* compute failure links and outputs breadth first */
+    queue = (int *) xmlMalloc(matcher->nbStates * sizeof(int));
+    if (queue == NULL)
+	goto error;
+    head = tail = 0;
+    for (i = 0; i < 256; i++) {
+	if (matcher->root[i] != 0)
+	    queue[tail++] = matcher->root[i];
+    }
+    while (head < tail) {
+	exsltStrMatchState *cur = &matcher->states[queue[head++]];
+
+	if (cur->pattern >= 0)
+	    cur->output = cur - matcher->states;
+	else
+	    cur->output = matcher->states[cur->fail].output;
+	for (edge = cur->edges; edge >= 0; edge = matcher->edges[edge].next) {
+	    next = matcher->edges[edge].target;
+	    matcher->states[next].fail = exsltStrMatcherNext(matcher,
+		    cur->fail, matcher->edges[edge].c);
+	    queue[tail++] = next;
+	}
+    }
+    xmlFree(queue);
+
+    return(matcher);
+
+error:
+    if (queue != NULL)
+	xmlFree(queue);
+    exsltStrMatcherFree(matcher);
+    return(NULL);
+}
+
+/**
+ * exsltStrMatcherLongest:
+ * @matcher: a compiled matcher
+ * @str: the input string
+ * @len: the length of @str in bytes
+ *
+ * Scans @str backwards and records for every byte position the index of
+ * the longest search string starting there.
+ *
+ * Returns an array of @len indexes, -1 where nothing matches, or NULL
+ * in case of error. The caller must free it.
+ */
+static int *
+exsltStrMatcherLongest(exsltStrMatcherPtr matcher, const xmlChar *str,
+                       int len) {
+    int *longest;
+    int i, state = 0, output;
+
+    longest = (int *) xmlMalloc((len > 0 ? len : 1) * sizeof(int));
+    if (longest == NULL)
+	return(NULL);
+    for (i = len - 1; i >= 0; i--) {
+	state = exsltStrMatcherNext(matcher, state, str[i]);
+	output = matcher->states[state].output;
+	longest[i] = (output >= 0) ? matcher->states[output].pattern : -1;
+    }
+    return(longest);
+}
+
+/**
+ * exsltStrGetMatcher:
+ * @tctxt: an XSLT transformation context
+ * @search: the array of search strings
+ * @slen: the array of search string lengths
+ * @n: the number of search strings
+ * @cached: set to 1 if the returned matcher is owned by the cache
+ *
+ * Looks up a matcher for this exact list of search strings in the
+ * per-transformation cache, compiling and caching it if needed.
+ *
+ * Returns the matcher or NULL in case of error.
+ */
+static exsltStrMatcherPtr
+exsltStrGetMatcher(xsltTransformContextPtr tctxt, xmlChar **search,
+                   const int *slen, int n, int *cached) {
+    xmlHashTablePtr cache;
+    exsltStrMatcherPtr matcher;
+    xmlChar *key, *cur;
+    int i, size = 1;
+
+    *cached = 0;
+    cache = (xmlHashTablePtr) xsltGetExtData(tctxt,
+	    (const xmlChar *) EXSLT_STRINGS_NAMESPACE);
+    if (cache == NULL)
+	return(exsltStrMatcherCompile(search, slen, n));
+
+    /* the key is the list of length-prefixed search strings */
+    for (i = 0; i < n; i++)
+	size += slen[i] + 12;
+    key = (xmlChar *) xmlMalloc(size);
+    if (key == NULL)
+	return(NULL);
+    cur = key;
+    for (i = 0; i < n; i++) {
+	cur += snprintf((char *) cur, 12, "%d:", slen[i]);
+	memcpy(cur, search[i], slen[i]);
+	cur += slen[i];
+    }
+    *cur = 0;
+
+    matcher = (exsltStrMatcherPtr) xmlHashLookup(cache, key);
+    if (matcher == NULL) {
+	matcher = exsltStrMatcherCompile(search, slen, n);
+	if ((matcher != NULL) &&
+	    (xmlHashSize(cache) < EXSLT_STR_MATCHER_CACHE_MAX) &&
+	    (xmlHashAddEntry(cache, key, matcher) == 0))
+	    *cached = 1;
+    } else {
+	*cached = 1;
+    }
+    xmlFree(key);
+    return(matcher);
+}
+
 /**
  * exsltStrReplaceFunction:
  * @ctxt: an XPath parser context
@@ -566,6 +1183,8 @@ exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     xmlChar **search, **replace;
     xmlNodeSetPtr search_set = NULL, replace_set = NULL;
     xmlBufferPtr buf;
+    exsltStrMatcherPtr matcher = NULL;
+    int *longest = NULL, cached = 0;
 
     if (nargs  != 3) {
         xmlXPathSetArityError(ctxt);
@@ -673,6 +1292,22 @@ exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     if (i_empty >= 0 && rlen[i_empty] == 0)
         i_empty = -1;
 
+    /* compile large search lists */
+
+    if (n >= EXSLT_STR_MATCHER_MIN) {
+        matcher = exsltStrGetMatcher(xsltXPathGetTransformContext(ctxt),
+                                     search, slen, n, &cached);
+        if (matcher == NULL) {
+            xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+            goto fail_buffer;
+        }
+        longest = exsltStrMatcherLongest(matcher, string, xmlStrlen(string));
+        if (longest == NULL) {
+            xmlXPathSetError(ctxt, XPATH_MEMORY_ERROR);
+            goto fail_buffer;
+        }
+    }
+
     /* replace operation */
 
     buf = xmlBufferCreate();
@@ -686,13 +1321,20 @@ exsltStrReplaceFunction (xmlXPathParserContextPtr ctxt, int nargs) {
     while (*src != 0) {
         int max_len = 0, i_match = 0;
 
-        for (i=0; i<n; ++i) {
-            if (*src == search[i][0] &&
-                slen[i] > max_len &&
-                xmlStrncmp(src, search[i], slen[i]) == 0)
-            {
-                i_match = i;
-                max_len = slen[i];
+        if (longest != NULL) {
+            i_match = longest[src - string];
+            if (i_match >= 0)
+                max_len = slen[i_match];
+        }
+        else {
+            for (i=0; i<n; ++i) {
+                if (*src == search[i][0] &&
+                    slen[i] > max_len &&
+                    xmlStrncmp(src, search[i], slen[i]) == 0)
+                {
+                    i_match = i;
+                    max_len = slen[i];
+                }
             }
         }
 
@@ -739,6 +1381,11 @@ fail_buffer_add:
     xmlBufferFree(buf);
 
 fail_buffer:
+    if (longest != NULL)
+        xmlFree(longest);
+    if (!cached)
+        exsltStrMatcherFree(matcher);
+
 fail_process_args:
     if (search_set != NULL) {
         for (i=0; i<n; ++i)
@@ -774,6 +1421,37 @@ fail_replace:
     return;
 }
 
+/**
+ * exsltStrInit:
+ * @ctxt: an XSLT transformation context
+ * @URI: the namespace URI for the extension
+ *
+ * Initializes the EXSLT - Strings module.
+ *
+ * Returns the cache of compiled str:replace() matchers
+ */
+static void *
+exsltStrInit (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+	      const xmlChar *URI ATTRIBUTE_UNUSED) {
+    return xmlHashCreate(1);
+}
+
+/**
+ * exsltStrShutdown:
+ * @ctxt: an XSLT transformation context
+ * @URI: the namespace URI for the extension
+ * @data: the module data to free up
+ *
+ * Shutdown the EXSLT - Strings module
+ */
+static void
+exsltStrShutdown (xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+		  const xmlChar *URI ATTRIBUTE_UNUSED,
+		  void *data) {
+    xmlHashFree((xmlHashTablePtr) data,
+		(xmlHashDeallocator) exsltStrMatcherFree);
+}
+
 /**
  * exsltStrRegister:
  *
@@ -782,6 +1460,8 @@ fail_replace:
 
 void
 exsltStrRegister (void) {
+    xsltRegisterExtModule (EXSLT_STRINGS_NAMESPACE,
+			   exsltStrInit, exsltStrShutdown);
     xsltRegisterExtModuleFunction ((const xmlChar *) "tokenize",
 				   EXSLT_STRINGS_NAMESPACE,
 				   exsltStrTokenizeFunction);
@@ -97,15 +97,15 @@ xsltFreeAttrVT(xsltAttrVTPtr avt) {
 
     if (avt == NULL) return;
 
+    /*
+    * The compiled expressions are owned by the principal stylesheet,
+    * see xsltXPathCompileShared(), only the strings are freed here.
+    */
     if (avt->strstart == 1) {
 	for (i = 0;i < avt->nb_seg; i += 2)
 	    if (avt->segments[i] != NULL)
 		xmlFree((xmlChar *) avt->segments[i]);
-	for (i = 1;i < avt->nb_seg; i += 2)
-	    xmlXPathFreeCompExpr((xmlXPathCompExprPtr) avt->segments[i]);
     } else {
-	for (i = 0;i < avt->nb_seg; i += 2)
-	    xmlXPathFreeCompExpr((xmlXPathCompExprPtr) avt->segments[i]);
 	for (i = 1;i < avt->nb_seg; i += 2)
 	    if (avt->segments[i] != NULL)
 		xmlFree((xmlChar *) avt->segments[i]);
@@ -273,7 +273,7 @@ xsltCompileAttr(xsltStylesheetPtr style, xmlAttrPtr attr) {
 	    } else {
 		xmlXPathCompExprPtr comp;
 
-		comp = xsltXPathCompile(style, expr);
+		comp = xsltXPathCompileShared(style, expr, 0, attr->parent);
 		if (comp == NULL) {
 		    xsltTransformError(NULL, style, attr->parent,
 			 "Attribute '%s': Failed to compile the expression "
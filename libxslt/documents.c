@@ -10,12 +10,16 @@
 #include "libxslt.h"
 
 #include <string.h>
+#include <stddef.h>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/tree.h>
 #include <libxml/hash.h>
 #include <libxml/parser.h>
 #include <libxml/parserInternals.h>
+#include <libxml/xpathInternals.h>
+#include <libxml/uri.h>
+#include <libxml/threads.h>
 #include "xslt.h"
 #include "xsltInternals.h"
 #include "xsltutils.h"
@@ -125,6 +129,813 @@ xsltSetLoaderFunc(xsltDocLoaderFunc f) {
         xsltDocDefaultLoader = f;
 }
 
+/**
+ * xsltParseInputFile:
+ * @style:  the stylesheet the document is parsed for
+ * @filename:  the file name or URL of the input document
+ * @encoding:  the document encoding, or NULL
+ * @options:  parsing options, a set of xmlParserOption
+ *
+ * Parse an input document to be transformed by @style. The document
+ * gets its own sub-dictionary of the stylesheet one, so the element and
+ * attribute names it shares with the stylesheet are interned only once
+ * and the transformations of @style can compare them by pointer when
+ * matching templates. The document can still be used concurrently by
+ * several transformations and with other stylesheets.
+ *
+ * Returns the new document or NULL in case of error
+ */
+xmlDocPtr
+xsltParseInputFile(xsltStylesheetPtr style, const char *filename,
+                   const char *encoding, int options)
+{
+    xmlParserCtxtPtr pctxt;
+    xmlDictPtr dict;
+    xmlDocPtr doc;
+
+    if (filename == NULL)
+        return(NULL);
+    if ((style == NULL) || (style->dict == NULL) ||
+        (options & XML_PARSE_NODICT))
+        return(xmlReadFile(filename, encoding, options));
+
+    pctxt = xmlNewParserCtxt();
+    if (pctxt == NULL)
+        return(NULL);
+    dict = xmlDictCreateSub(style->dict);
+    if (dict == NULL) {
+        xmlFreeParserCtxt(pctxt);
+        return(NULL);
+    }
+    if (pctxt->dict != NULL)
+        xmlDictFree(pctxt->dict);
+    pctxt->dict = dict;
+#ifdef WITH_XSLT_DEBUG
+    xsltGenericDebug(xsltGenericDebugContext,
+                     "Using stylesheet sub-dictionary for %s\n", filename);
+#endif
+
+    doc = xmlCtxtReadFile(pctxt, filename, encoding, options);
+    xmlFreeParserCtxt(pctxt);
+
+    return(doc);
+}
+
+/************************************************************************
+ *									*
+ *		Documents parsed ahead of their use			*
+ *									*
+ ************************************************************************/
+
+static int xsltDocumentThreads = 0;
+
+/**
+ * xsltSetDocumentThreads:
+ * @nbThreads:  the maximum number of threads, 0 to disable, a negative
+ *              value for one per processor
+ *
+ * Set how many threads transformations may use to parse the documents
+ * needed by document() ahead of their use, see
+ * xsltPrefetchStyleDocuments(). By default documents are parsed by the
+ * transformation thread when first needed. Threads are only used with
+ * the default document loader, the external entity loader and the
+ * input callbacks registered with libxml2 must then be thread-safe.
+ */
+void
+xsltSetDocumentThreads(int nbThreads) {
+    xsltDocumentThreads = nbThreads;
+}
+
+/**
+ * xsltGetDocumentThreads:
+ *
+ * Provides the number of threads used to parse documents ahead of
+ * their use, see xsltSetDocumentThreads()
+ *
+ * Returns 0 if documents are only parsed when needed, the maximum
+ *         number of threads otherwise, negative for one per processor
+ */
+int
+xsltGetDocumentThreads(void) {
+    return(xsltDocumentThreads);
+}
+
+#define XSLT_IS_NAME_CHAR(c)						\
+    ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+     (((c) >= '0') && ((c) <= '9')) || ((c) == '_') || ((c) == '-') ||	\
+     ((c) == '.') || ((c) >= 0x80))
+
+/**
+ * xsltAddDocumentArg:
+ * @style:  the principal stylesheet
+ * @arg:  the argument of a document() call
+ * @isVar:  whether @arg is a variable name or a string
+ * @inst:  the instruction holding the call
+ *
+ * Records a document() argument for xsltPrefetchStyleDocuments().
+ *
+ * Returns 0 in case of success, 1 if @arg can't be resolved and -1 in
+ *         case of error.
+ */
+static int
+xsltAddDocumentArg(xsltStylesheetPtr style, const xmlChar *arg, int isVar,
+		   xmlNodePtr inst) {
+    xmlChar *base, *URI;
+    const xmlChar *name, *prefix = NULL, *nsURI = NULL;
+    xmlNsPtr ns;
+    int ret = -1;
+
+    base = xmlNodeGetBase(inst->doc, inst);
+    if (isVar) {
+	if (style->docVars == NULL) {
+	    style->docVars = xmlHashCreate(0);
+	    if (style->docVars == NULL)
+		goto done;
+	}
+	name = xsltSplitQName(style->dict, arg, &prefix);
+	if (prefix != NULL) {
+	    ns = xmlSearchNs(inst->doc, inst, prefix);
+	    if (ns == NULL) {
+		ret = 1;
+		goto done;
+	    }
+	    nsURI = ns->href;
+	}
+	if ((xmlHashAddEntry3(style->docVars, name, nsURI, base,
+			      (void *) style) < 0) &&
+	    (xmlHashLookup3(style->docVars, name, nsURI, base) == NULL))
+	    goto done;
+    } else {
+	if (style->docURIs == NULL) {
+	    style->docURIs = xmlHashCreate(0);
+	    if (style->docURIs == NULL)
+		goto done;
+	}
+	URI = xmlBuildURI(arg, base);
+	if (URI == NULL) {
+	    ret = 1;
+	    goto done;
+	}
+	xmlHashAddEntry(style->docURIs, URI, (void *) style);
+	xmlFree(URI);
+    }
+    ret = 0;
+
+done:
+    if (base != NULL)
+	xmlFree(base);
+    return(ret);
+}
+
+/**
+ * xsltCollectDocumentURIs:
+ * @style:  the stylesheet
+ * @str:  an XPath expression of the stylesheet
+ * @inst:  the instruction holding the expression
+ *
+ * Records in the principal stylesheet the arguments of the document()
+ * calls of @str known before the transformation starts: string
+ * literals, resolved against the base URI of @inst, and variable
+ * references, resolved when the transformation starts if they are
+ * global variables with a string value. Only calls with a single
+ * argument are recorded.
+ *
+ * Returns the number of calls recorded or -1 in case of error
+ */
+int
+xsltCollectDocumentURIs(xsltStylesheetPtr style, const xmlChar *str,
+			xmlNodePtr inst) {
+    const xmlChar *cur, *arg, *end;
+    xmlChar *value;
+    xmlChar quote = 0;
+    int isVar, res, ret = 0;
+
+    if ((style == NULL) || (str == NULL) || (inst == NULL))
+	return(-1);
+    if (xmlStrstr(str, BAD_CAST "document") == NULL)
+	return(0);
+    while (style->parent != NULL)
+	style = style->parent;
+
+    for (cur = str; *cur != 0; cur++) {
+	if (quote != 0) {
+	    if (*cur == quote)
+		quote = 0;
+	    continue;
+	}
+	if ((*cur == '"') || (*cur == '\'')) {
+	    quote = *cur;
+	    continue;
+	}
+	if ((*cur != 'd') || (xmlStrncmp(cur, BAD_CAST "document", 8)) ||
+	    ((cur > str) && ((XSLT_IS_NAME_CHAR(cur[-1])) ||
+	                     (cur[-1] == ':') || (cur[-1] == '$'))))
+	    continue;
+	arg = cur + 8;
+	while (IS_BLANK_CH(*arg))
+	    arg++;
+	if (*arg != '(')
+	    continue;
+	arg++;
+	while (IS_BLANK_CH(*arg))
+	    arg++;
+
+	if ((*arg == '"') || (*arg == '\'')) {
+	    isVar = 0;
+	    end = arg + 1;
+	    while ((*end != 0) && (*end != *arg))
+		end++;
+	    if (*end == 0)
+		break;
+	    arg++;
+	} else if (*arg == '$') {
+	    isVar = 1;
+	    arg++;
+	    end = arg;
+	    while ((XSLT_IS_NAME_CHAR(*end)) || (*end == ':'))
+		end++;
+	} else {
+	    continue;
+	}
+	value = xmlStrndup(arg, end - arg);
+	if (value == NULL)
+	    return(-1);
+	cur = (isVar) ? end - 1 : end;
+	if (!isVar)
+	    end++;
+	while (IS_BLANK_CH(*end))
+	    end++;
+	if ((*end == ')') && ((!isVar) || (*value != 0))) {
+	    res = xsltAddDocumentArg(style, value, isVar, inst);
+	    if (res < 0) {
+		xmlFree(value);
+		return(-1);
+	    }
+	    if (res == 0)
+		ret++;
+	}
+	xmlFree(value);
+    }
+    return(ret);
+}
+
+/*
+ * The states of a document parsed in the background.
+ */
+#define XSLT_PREFETCH_WAITING	0	/* no thread started parsing it */
+#define XSLT_PREFETCH_PARSING	1	/* a worker thread is parsing it */
+#define XSLT_PREFETCH_DONE	2	/* parsed, or left to xsltLoadDocument */
+
+typedef struct _xsltDocPrefetchEntry xsltDocPrefetchEntry;
+typedef xsltDocPrefetchEntry *xsltDocPrefetchEntryPtr;
+struct _xsltDocPrefetchEntry {
+    xmlChar *URI;
+    xmlDocPtr doc;		/* the parsed document, until it is used */
+    int diagnostics;		/* the parser reported something */
+    int taken;			/* xsltLoadDocument() asked for it */
+    int state;			/* XSLT_PREFETCH_*, in the background */
+    xmlMutexPtr parsing;	/* held by the worker parsing it */
+};
+
+struct _xsltDocPrefetch {
+    xsltDocPrefetchPtr next;
+    xsltDocPrefetchEntryPtr entries;
+    int nbEntries;
+    int maxEntries;
+    int nbPending;		/* the entries not taken yet */
+    xmlHashTablePtr index;	/* the entry numbers, plus one, by URI */
+    xsltParallelTasksPtr tasks;	/* the parsing running in the background */
+    xmlMutexPtr lock;		/* protects the entries states in the
+				   background, NULL otherwise */
+    xmlDictPtr dict;		/* the parent of the documents dictionaries */
+    int options;		/* the parser options */
+};
+
+/**
+ * xsltNewDocPrefetch:
+ * @ctxt:  an XSLT transformation context
+ * @dict:  the dictionary the dictionaries of the documents derive from
+ *
+ * Create a new, empty, set of documents to parse for @ctxt, capturing
+ * the parser settings of the calling thread.
+ *
+ * Returns the new xsltDocPrefetchPtr or NULL in case of error
+ */
+static xsltDocPrefetchPtr
+xsltNewDocPrefetch(xsltTransformContextPtr ctxt, xmlDictPtr dict) {
+    xsltDocPrefetchPtr cur;
+    xmlParserCtxtPtr pctxt;
+
+    cur = (xsltDocPrefetchPtr) xmlMalloc(sizeof(xsltDocPrefetch));
+    if (cur == NULL) {
+	xsltTransformError(ctxt, NULL, NULL,
+		"xsltNewDocPrefetch : malloc failed\n");
+	return(NULL);
+    }
+    memset(cur, 0, sizeof(xsltDocPrefetch));
+    cur->dict = dict;
+    cur->options = ctxt->parserOptions;
+
+    /*
+    * libxml2 keeps the parser defaults per thread: those of the calling
+    * thread which change the tree are turned into options for the
+    * worker threads.
+    */
+    pctxt = xmlNewParserCtxt();
+    if (pctxt == NULL) {
+	xsltTransformError(ctxt, NULL, NULL,
+		"xsltNewDocPrefetch : malloc failed\n");
+	xmlFree(cur);
+	return(NULL);
+    }
+    if (pctxt->loadsubset & XML_DETECT_IDS)
+	cur->options |= XML_PARSE_DTDLOAD;
+    if (pctxt->loadsubset & XML_COMPLETE_ATTRS)
+	cur->options |= XML_PARSE_DTDATTR;
+    if (pctxt->replaceEntities)
+	cur->options |= XML_PARSE_NOENT;
+    if (pctxt->keepBlanks == 0)
+	cur->options |= XML_PARSE_NOBLANKS;
+    if (pctxt->validate)
+	cur->options |= XML_PARSE_DTDVALID;
+    xmlFreeParserCtxt(pctxt);
+    return(cur);
+}
+
+/**
+ * xsltFreeDocPrefetch:
+ * @prefetch:  a set of documents to parse
+ *
+ * Cancels the parsing of the documents of @prefetch not started yet,
+ * waits for the ones being parsed and frees @prefetch along with the
+ * documents which weren't used.
+ */
+static void
+xsltFreeDocPrefetch(xsltDocPrefetchPtr prefetch) {
+    int i;
+
+    if (prefetch->lock != NULL) {
+	xmlMutexLock(prefetch->lock);
+	for (i = 0; i < prefetch->nbEntries; i++)
+	    if (prefetch->entries[i].state == XSLT_PREFETCH_WAITING)
+		prefetch->entries[i].state = XSLT_PREFETCH_DONE;
+	xmlMutexUnlock(prefetch->lock);
+    }
+    if (prefetch->tasks != NULL)
+	xsltWaitParallel(prefetch->tasks);
+    for (i = 0; i < prefetch->nbEntries; i++) {
+	xmlFree(prefetch->entries[i].URI);
+	if (prefetch->entries[i].doc != NULL)
+	    xmlFreeDoc(prefetch->entries[i].doc);
+	if (prefetch->entries[i].parsing != NULL)
+	    xmlFreeMutex(prefetch->entries[i].parsing);
+    }
+    if (prefetch->lock != NULL)
+	xmlFreeMutex(prefetch->lock);
+    if (prefetch->entries != NULL)
+	xmlFree(prefetch->entries);
+    if (prefetch->index != NULL)
+	xmlHashFree(prefetch->index, NULL);
+    xmlFree(prefetch);
+}
+
+/**
+ * xsltDocPrefetchAllowed:
+ * @ctxt:  an XSLT transformation context
+ * @URI:  the URI of a document
+ *
+ * Checks the read rights of @ctxt on @URI like xsltCheckRead() does,
+ * but silently, the error being reported if the document is actually
+ * loaded.
+ *
+ * Returns 1 if @URI can be read, 0 otherwise
+ */
+static int
+xsltDocPrefetchAllowed(xsltTransformContextPtr ctxt, const xmlChar *URI) {
+    xsltSecurityCheck check;
+    xmlURIPtr uri;
+    int ret = 1;
+
+    if (ctxt->sec == NULL)
+	return(1);
+    uri = xmlParseURI((const char *) URI);
+    if (uri == NULL)
+	return(0);
+    if ((uri->scheme == NULL) ||
+	(xmlStrEqual(BAD_CAST uri->scheme, BAD_CAST "file"))) {
+	check = xsltGetSecurityPrefs(ctxt->sec, XSLT_SECPREF_READ_FILE);
+	if ((check != NULL) && (check(ctxt->sec, ctxt, uri->path) == 0))
+	    ret = 0;
+    } else {
+	check = xsltGetSecurityPrefs(ctxt->sec, XSLT_SECPREF_READ_NETWORK);
+	if ((check != NULL) && (check(ctxt->sec, ctxt, (const char *) URI) == 0))
+	    ret = 0;
+    }
+    xmlFreeURI(uri);
+    return(ret);
+}
+
+/**
+ * xsltDocPrefetchAdd:
+ * @ctxt:  an XSLT transformation context
+ * @prefetch:  the set of documents to parse
+ * @URI:  the URI of a document, possibly with a fragment identifier
+ *
+ * Adds the document at @URI to @prefetch unless it is already loaded
+ * or being parsed, or can't be read.
+ *
+ * Returns 1 if the document was added, 0 if not and -1 in case of error
+ */
+static int
+xsltDocPrefetchAdd(xsltTransformContextPtr ctxt, xsltDocPrefetchPtr prefetch,
+		   const xmlChar *URI) {
+    xsltDocPrefetchEntryPtr tmp;
+    xsltDocPrefetchPtr cur;
+    xsltDocumentPtr idoc;
+    xmlURIPtr uri;
+    xmlChar *docURI;
+
+    uri = xmlParseURI((const char *) URI);
+    if (uri == NULL)
+	return(0);
+    if (uri->fragment != NULL) {
+	xmlFree(uri->fragment);
+	uri->fragment = NULL;
+	docURI = xmlSaveUri(uri);
+    } else {
+	docURI = xmlStrdup(URI);
+    }
+    xmlFreeURI(uri);
+    if (docURI == NULL)
+	return(-1);
+
+    for (idoc = ctxt->docList; idoc != NULL; idoc = idoc->next) {
+	if ((idoc->doc != NULL) && (idoc->doc->URL != NULL) &&
+	    (xmlStrEqual(idoc->doc->URL, docURI)))
+	    goto skip;
+    }
+    for (cur = ctxt->prefetch; cur != NULL; cur = cur->next) {
+	if (xmlHashLookup(cur->index, docURI) != NULL)
+	    goto skip;
+    }
+    if (prefetch->index == NULL) {
+	prefetch->index = xmlHashCreate(0);
+	if (prefetch->index == NULL) {
+	    xmlFree(docURI);
+	    return(-1);
+	}
+    }
+    if (xmlHashLookup(prefetch->index, docURI) != NULL)
+	goto skip;
+    if (!xsltDocPrefetchAllowed(ctxt, docURI))
+	goto skip;
+
+    if (prefetch->nbEntries >= prefetch->maxEntries) {
+	int max = (prefetch->maxEntries == 0) ? 8 : 2 * prefetch->maxEntries;
+
+	tmp = (xsltDocPrefetchEntryPtr) xmlRealloc(prefetch->entries,
+		max * sizeof(xsltDocPrefetchEntry));
+	if (tmp == NULL) {
+	    xsltTransformError(ctxt, NULL, NULL,
+		    "xsltDocPrefetchAdd : realloc failed\n");
+	    xmlFree(docURI);
+	    return(-1);
+	}
+	prefetch->entries = tmp;
+	prefetch->maxEntries = max;
+    }
+    if (xmlHashAddEntry(prefetch->index, docURI,
+	    (void *) (ptrdiff_t) (prefetch->nbEntries + 1)) < 0) {
+	xmlFree(docURI);
+	return(-1);
+    }
+    tmp = &prefetch->entries[prefetch->nbEntries++];
+    memset(tmp, 0, sizeof(xsltDocPrefetchEntry));
+    tmp->URI = docURI;
+    prefetch->nbPending++;
+    return(1);
+
+skip:
+    xmlFree(docURI);
+    return(0);
+}
+
+/**
+ * xsltDocPrefetchError:
+ * @ctx:  the entry being parsed
+ * @msg:  the message
+ *
+ * Notes that the parser reported something while parsing an entry.
+ */
+static void
+xsltDocPrefetchError(void *ctx, const char *msg ATTRIBUTE_UNUSED, ...) {
+    ((xsltDocPrefetchEntryPtr) ctx)->diagnostics = 1;
+}
+
+static void
+xsltDocPrefetchStructuredError(void *ctx,
+			       XSLT_ERROR_CONST xmlError *error ATTRIBUTE_UNUSED) {
+    ((xsltDocPrefetchEntryPtr) ctx)->diagnostics = 1;
+}
+
+/**
+ * xsltDocPrefetchParse:
+ * @data:  the xsltDocPrefetch
+ * @index:  the entry to parse
+ *
+ * Parses one of the documents of a prefetch set, possibly from a
+ * worker thread. The document gets its own dictionary, derived from
+ * the set one which is only read. The messages of the parser are not
+ * reported but noted, such documents are parsed again by
+ * xsltLoadDocument() to report them in the right order. In the
+ * background, an entry already claimed by xsltTakePrefetchedDocument()
+ * is skipped.
+ */
+static void
+xsltDocPrefetchParse(void *data, int index) {
+    xsltDocPrefetchPtr prefetch = (xsltDocPrefetchPtr) data;
+    xsltDocPrefetchEntryPtr entry = &prefetch->entries[index];
+    xmlGenericErrorFunc oldError;
+    void *oldErrorCtxt;
+    xmlStructuredErrorFunc oldSerror;
+    void *oldSerrorCtxt;
+    xmlDictPtr dict;
+
+    if (prefetch->lock != NULL) {
+	xmlMutexLock(prefetch->lock);
+	if (entry->state != XSLT_PREFETCH_WAITING) {
+	    xmlMutexUnlock(prefetch->lock);
+	    return;
+	}
+	entry->state = XSLT_PREFETCH_PARSING;
+	xmlMutexLock(entry->parsing);
+	xmlMutexUnlock(prefetch->lock);
+    }
+
+    oldError = xmlGenericError;
+    oldErrorCtxt = xmlGenericErrorContext;
+    oldSerror = xmlStructuredError;
+    oldSerrorCtxt = xmlStructuredErrorContext;
+    dict = xmlDictCreateSub(prefetch->dict);
+    if (dict == NULL) {
+	entry->diagnostics = 1;
+	goto done;
+    }
+    xmlSetGenericErrorFunc(entry, xsltDocPrefetchError);
+    xmlSetStructuredErrorFunc(entry, xsltDocPrefetchStructuredError);
+
+    entry->doc = xsltDocDefaultLoaderFunc(entry->URI, dict, prefetch->options,
+					  NULL, XSLT_LOAD_DOCUMENT);
+
+    xmlSetGenericErrorFunc(oldErrorCtxt, oldError);
+    xmlSetStructuredErrorFunc(oldSerrorCtxt, oldSerror);
+    xmlDictFree(dict);
+
+done:
+    if (prefetch->lock != NULL) {
+	xmlMutexUnlock(entry->parsing);
+	xmlMutexLock(prefetch->lock);
+	entry->state = XSLT_PREFETCH_DONE;
+	xmlMutexUnlock(prefetch->lock);
+    }
+}
+
+typedef struct _xsltDocPrefetchScan xsltDocPrefetchScan;
+struct _xsltDocPrefetchScan {
+    xsltTransformContextPtr ctxt;
+    xsltDocPrefetchPtr prefetch;
+    int error;
+};
+
+static void
+xsltDocPrefetchScanURI(void *payload ATTRIBUTE_UNUSED, void *data,
+		       const xmlChar *URI) {
+    xsltDocPrefetchScan *scan = (xsltDocPrefetchScan *) data;
+
+    if ((scan->error == 0) &&
+	(xsltDocPrefetchAdd(scan->ctxt, scan->prefetch, URI) < 0))
+	scan->error = 1;
+}
+
+static void
+xsltDocPrefetchScanVar(void *payload ATTRIBUTE_UNUSED, void *data,
+		       const xmlChar *name, const xmlChar *nsURI,
+		       const xmlChar *base) {
+    xsltDocPrefetchScan *scan = (xsltDocPrefetchScan *) data;
+    xsltStackElemPtr elem;
+    xmlChar *URI;
+
+    if ((scan->error != 0) || (scan->ctxt->globalVars == NULL))
+	return;
+    elem = (xsltStackElemPtr) xmlHashLookup2(scan->ctxt->globalVars,
+					     name, nsURI);
+    if ((elem == NULL) || (!elem->computed) || (elem->value == NULL) ||
+	(elem->value->type != XPATH_STRING) ||
+	(elem->value->stringval == NULL))
+	return;
+    URI = xmlBuildURI(elem->value->stringval, base);
+    if (URI == NULL)
+	return;
+    if (xsltDocPrefetchAdd(scan->ctxt, scan->prefetch, URI) < 0)
+	scan->error = 1;
+    xmlFree(URI);
+}
+
+/**
+ * xsltPrefetchStyleDocuments:
+ * @ctxt:  an XSLT transformation context
+ *
+ * Starts parsing in the background the documents the stylesheet of
+ * @ctxt passes to document() which are known at this point, see
+ * xsltCollectDocumentURIs(): this is meant to be called once the
+ * global variables are evaluated. The documents are only registered
+ * when document() actually asks for them, so the transformation is
+ * unchanged. Nothing is done unless xsltSetDocumentThreads() allows
+ * threads and the default document loader is used.
+ *
+ * Returns the number of documents being parsed or -1 in case of error
+ */
+int
+xsltPrefetchStyleDocuments(xsltTransformContextPtr ctxt) {
+    xsltDocPrefetchScan scan;
+    xsltDocPrefetchPtr prefetch;
+    xsltStylesheetPtr style;
+    int i;
+
+    if ((ctxt == NULL) || (ctxt->style == NULL))
+	return(-1);
+    if ((xsltDocumentThreads == 0) ||
+	(xsltDocDefaultLoader != xsltDocDefaultLoaderFunc))
+	return(0);
+    style = ctxt->style;
+    if ((style->docURIs == NULL) && (style->docVars == NULL))
+	return(0);
+
+    prefetch = xsltNewDocPrefetch(ctxt, style->dict);
+    if (prefetch == NULL)
+	return(-1);
+    scan.ctxt = ctxt;
+    scan.prefetch = prefetch;
+    scan.error = 0;
+    if (style->docURIs != NULL)
+	xmlHashScan(style->docURIs, xsltDocPrefetchScanURI, &scan);
+    if (style->docVars != NULL)
+	xmlHashScanFull(style->docVars, xsltDocPrefetchScanVar, &scan);
+    if ((scan.error) || (prefetch->nbEntries == 0))
+	goto done;
+
+    /*
+    * The transformation goes on: it waits for a document only when it
+    * needs it, see xsltTakePrefetchedDocument().
+    */
+    prefetch->lock = xmlNewMutex();
+    if (prefetch->lock == NULL)
+	goto done;
+    for (i = 0; i < prefetch->nbEntries; i++) {
+	prefetch->entries[i].parsing = xmlNewMutex();
+	if (prefetch->entries[i].parsing == NULL)
+	    goto done;
+    }
+    prefetch->tasks = xsltStartParallel(prefetch->nbEntries,
+	    (xsltDocumentThreads > 0) ? xsltDocumentThreads : 0,
+	    xsltDocPrefetchParse, prefetch);
+    if (prefetch->tasks == NULL)
+	goto done;
+#ifdef WITH_XSLT_DEBUG_DOCUMENTS
+    xsltGenericDebug(xsltGenericDebugContext,
+	"Prefetching %d documents\n", prefetch->nbEntries);
+#endif
+    prefetch->next = ctxt->prefetch;
+    ctxt->prefetch = prefetch;
+    return(prefetch->nbEntries);
+
+done:
+    xsltFreeDocPrefetch(prefetch);
+    return((scan.error) ? -1 : 0);
+}
+
+/**
+ * xsltPrefetchDocuments:
+ * @ctxt:  an XSLT transformation context
+ * @URIs:  the URIs of documents, possibly with fragment identifiers
+ * @nbURIs:  the number of entries in @URIs
+ *
+ * Parses concurrently the documents at @URIs which aren't loaded yet,
+ * and returns once they are parsed. The following xsltLoadDocument()
+ * calls for those URIs register the documents without parsing them,
+ * so the order of registration is still the order of the calls.
+ * Nothing is done unless xsltSetDocumentThreads() allows more than one
+ * thread, the default document loader is used and there is more than
+ * one document to parse.
+ *
+ * Returns the number of documents parsed or -1 in case of error
+ */
+int
+xsltPrefetchDocuments(xsltTransformContextPtr ctxt, const xmlChar **URIs,
+		      int nbURIs) {
+    xsltDocPrefetchPtr prefetch;
+    int i, nbThreads;
+
+    if ((ctxt == NULL) || (URIs == NULL) || (nbURIs < 0))
+	return(-1);
+    nbThreads = (xsltDocumentThreads > 0) ? xsltDocumentThreads :
+		xsltGetThreadCount();
+    if ((xsltDocumentThreads == 0) || (nbThreads < 2) || (nbURIs < 2) ||
+	(xsltDocDefaultLoader != xsltDocDefaultLoaderFunc))
+	return(0);
+
+    /*
+    * The transformation waits, so the documents dictionaries can
+    * derive from its own.
+    */
+    prefetch = xsltNewDocPrefetch(ctxt, ctxt->dict);
+    if (prefetch == NULL)
+	return(-1);
+    for (i = 0; i < nbURIs; i++) {
+	if ((URIs[i] != NULL) &&
+	    (xsltDocPrefetchAdd(ctxt, prefetch, URIs[i]) < 0)) {
+	    xsltFreeDocPrefetch(prefetch);
+	    return(-1);
+	}
+    }
+    if (prefetch->nbEntries < 2) {
+	xsltFreeDocPrefetch(prefetch);
+	return(0);
+    }
+
+#ifdef WITH_XSLT_DEBUG_DOCUMENTS
+    xsltGenericDebug(xsltGenericDebugContext,
+	"Parsing %d documents concurrently\n", prefetch->nbEntries);
+#endif
+    xsltRunParallel(prefetch->nbEntries, nbThreads, xsltDocPrefetchParse,
+		    prefetch);
+    prefetch->next = ctxt->prefetch;
+    ctxt->prefetch = prefetch;
+    return(prefetch->nbEntries);
+}
+
+/**
+ * xsltTakePrefetchedDocument:
+ * @ctxt:  an XSLT transformation context
+ * @URI:  the URI of a document
+ *
+ * Looks for @URI among the documents parsed ahead for @ctxt. If its
+ * parsing is running in the background, only that document is waited
+ * for; if it didn't start yet, it is left to the caller. The document
+ * is handed over to the caller, and a set is freed once all its
+ * documents are taken.
+ *
+ * Returns the document, or NULL if it wasn't parsed ahead or if it has
+ *         to be parsed again.
+ */
+static xmlDocPtr
+xsltTakePrefetchedDocument(xsltTransformContextPtr ctxt, const xmlChar *URI) {
+    xsltDocPrefetchPtr cur, prev = NULL;
+    xsltDocPrefetchEntryPtr entry;
+    xmlDocPtr doc;
+    ptrdiff_t i;
+
+    for (cur = ctxt->prefetch; cur != NULL; prev = cur, cur = cur->next) {
+	i = (ptrdiff_t) xmlHashLookup(cur->index, URI);
+	if (i == 0)
+	    continue;
+	entry = &cur->entries[i - 1];
+	if (cur->lock != NULL) {
+	    xmlMutexLock(cur->lock);
+	    if (entry->state == XSLT_PREFETCH_WAITING) {
+		/* cheaper to parse it here than to wait for a thread */
+		entry->state = XSLT_PREFETCH_DONE;
+		xmlMutexUnlock(cur->lock);
+	    } else if (entry->state == XSLT_PREFETCH_PARSING) {
+		xmlMutexUnlock(cur->lock);
+		xmlMutexLock(entry->parsing);
+		xmlMutexUnlock(entry->parsing);
+	    } else {
+		xmlMutexUnlock(cur->lock);
+	    }
+	}
+	doc = entry->doc;
+	entry->doc = NULL;
+	if ((doc != NULL) && (entry->diagnostics)) {
+	    xmlFreeDoc(doc);
+	    doc = NULL;
+	}
+	if (!entry->taken) {
+	    entry->taken = 1;
+	    cur->nbPending--;
+	}
+	if (cur->nbPending <= 0) {
+	    if (prev == NULL)
+		ctxt->prefetch = cur->next;
+	    else
+		prev->next = cur->next;
+	    xsltFreeDocPrefetch(cur);
+	}
+	return(doc);
+    }
+    return(NULL);
+}
+
 /************************************************************************
  *									*
  *			Module interfaces				*
@@ -235,6 +1046,7 @@ xsltFreeStyleDocuments(xsltStylesheetPtr style) {
 	    xsltRestoreDocumentNamespaces(nsMap, doc->doc);
 #endif
 	xsltFreeDocumentKeys(doc);
+	xsltFreeDocumentOrder(doc);
 	if (!doc->main)
 	    xmlFreeDoc(doc->doc);
         xmlFree(doc);
@@ -250,12 +1062,20 @@ xsltFreeStyleDocuments(xsltStylesheetPtr style) {
 void
 xsltFreeDocuments(xsltTransformContextPtr ctxt) {
     xsltDocumentPtr doc, cur;
+    xsltDocPrefetchPtr prefetch;
+
+    while (ctxt->prefetch != NULL) {
+	prefetch = ctxt->prefetch;
+	ctxt->prefetch = prefetch->next;
+	xsltFreeDocPrefetch(prefetch);
+    }
 
     cur = ctxt->docList;
     while (cur != NULL) {
 	doc = cur;
 	cur = cur->next;
 	xsltFreeDocumentKeys(doc);
+	xsltFreeDocumentOrder(doc);
 	if (!doc->main)
 	    xmlFreeDoc(doc->doc);
         xmlFree(doc);
@@ -265,6 +1085,7 @@ xsltFreeDocuments(xsltTransformContextPtr ctxt) {
 	doc = cur;
 	cur = cur->next;
 	xsltFreeDocumentKeys(doc);
+	xsltFreeDocumentOrder(doc);
 	if (!doc->main)
 	    xmlFreeDoc(doc->doc);
         xmlFree(doc);
@@ -315,8 +1136,12 @@ xsltLoadDocument(xsltTransformContextPtr ctxt, const xmlChar *URI) {
 	ret = ret->next;
     }
 
-    doc = xsltDocDefaultLoader(URI, ctxt->dict, ctxt->parserOptions,
-                               (void *) ctxt, XSLT_LOAD_DOCUMENT);
+    doc = NULL;
+    if (ctxt->prefetch != NULL)
+	doc = xsltTakePrefetchedDocument(ctxt, URI);
+    if (doc == NULL)
+	doc = xsltDocDefaultLoader(URI, ctxt->dict, ctxt->parserOptions,
+				   (void *) ctxt, XSLT_LOAD_DOCUMENT);
 
     if (doc == NULL)
 	return(NULL);
@@ -432,3 +1257,248 @@ xsltFindDocument (xsltTransformContextPtr ctxt, xmlDocPtr doc) {
     return(NULL);
 }
 
+
+/************************************************************************
+ *									*
+ *			Document order					*
+ *									*
+ ************************************************************************/
+
+/*
+ * The document order index of a document info: an open addressing hash
+ * table mapping every node of the tree, attributes included, to its
+ * rank in document order. Namespace nodes are not part of the tree and
+ * are ranked right after their owner element.
+ */
+typedef struct _xsltDocumentOrder xsltDocumentOrder;
+typedef xsltDocumentOrder *xsltDocumentOrderPtr;
+struct _xsltDocumentOrder {
+    int size;			/* the number of slots, a power of two */
+    int nbNodes;		/* the number of indexed nodes */
+    const void **nodes;		/* the node of each slot or NULL */
+    int *ranks;			/* the rank of each slot */
+};
+
+#define XSLT_ORDER_HASH(node, size)					\
+    ((int) ((((size_t) (node)) >> 4) * 2654435761u) & ((size) - 1))
+
+/**
+ * xsltDocumentOrderAdd:
+ * @order: a document order index
+ * @node: the next node in document order
+ *
+ * Records @node with the next rank.
+ */
+static void
+xsltDocumentOrderAdd(xsltDocumentOrderPtr order, const void *node) {
+    int i;
+
+    i = XSLT_ORDER_HASH(node, order->size);
+    while (order->nodes[i] != NULL)
+	i = (i + 1) & (order->size - 1);
+    order->nodes[i] = node;
+    order->ranks[i] = order->nbNodes++;
+}
+
+/**
+ * xsltDocumentOrderRank:
+ * @order: a document order index
+ * @node: a node
+ *
+ * Returns the rank of @node in document order or -1 if it is not indexed.
+ */
+static int
+xsltDocumentOrderRank(xsltDocumentOrderPtr order, const void *node) {
+    int i;
+
+    i = XSLT_ORDER_HASH(node, order->size);
+    while (order->nodes[i] != NULL) {
+	if (order->nodes[i] == node)
+	    return(order->ranks[i]);
+	i = (i + 1) & (order->size - 1);
+    }
+    return(-1);
+}
+
+/**
+ * xsltDocumentOrderWalk:
+ * @doc: a document
+ * @order: the index to fill, or NULL to only count the nodes
+ *
+ * Walks the tree in document order: a node, its attributes, then its
+ * children.
+ *
+ * Returns the number of nodes of the tree.
+ */
+static int
+xsltDocumentOrderWalk(xmlDocPtr doc, xsltDocumentOrderPtr order) {
+    xmlNodePtr cur = (xmlNodePtr) doc;
+    xmlAttrPtr attr;
+    int nb = 0;
+
+    while (cur != NULL) {
+	if (order != NULL)
+	    xsltDocumentOrderAdd(order, cur);
+	nb++;
+	if (cur->type == XML_ELEMENT_NODE) {
+	    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		if (order != NULL)
+		    xsltDocumentOrderAdd(order, attr);
+		nb++;
+	    }
+	}
+	if ((cur->children != NULL) &&
+	    ((cur->type == XML_ELEMENT_NODE) ||
+	     (cur->type == XML_DOCUMENT_NODE) ||
+	     (cur->type == XML_HTML_DOCUMENT_NODE))) {
+	    cur = cur->children;
+	    continue;
+	}
+	while ((cur != NULL) && (cur->next == NULL)) {
+	    cur = cur->parent;
+	    if (cur == (xmlNodePtr) doc)
+		cur = NULL;
+	}
+	if (cur != NULL)
+	    cur = cur->next;
+    }
+    return(nb);
+}
+
+/**
+ * xsltBuildDocumentOrder:
+ * @idoc: a document info
+ *
+ * Builds the document order index of @idoc if not already done. This is
+ * done automatically by xsltCmpDocumentOrder() on the first comparison
+ * involving nodes of a registered document. Nodes added to the tree
+ * afterwards are not indexed and are compared by walking the tree.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+int
+xsltBuildDocumentOrder(xsltDocumentPtr idoc) {
+    xsltDocumentOrderPtr order;
+    int nb;
+
+    if ((idoc == NULL) || (idoc->doc == NULL))
+	return(-1);
+    if (idoc->order != NULL)
+	return(0);
+
+    order = (xsltDocumentOrderPtr) xmlMalloc(sizeof(xsltDocumentOrder));
+    if (order == NULL)
+	return(-1);
+    memset(order, 0, sizeof(xsltDocumentOrder));
+    nb = xsltDocumentOrderWalk(idoc->doc, NULL);
+    /* keep the load factor under 3/4 */
+    order->size = 16;
+    while (order->size < nb + nb / 3 + 1)
+	order->size *= 2;
+    order->nodes = (const void **) xmlMalloc(order->size * sizeof(void *));
+    order->ranks = (int *) xmlMalloc(order->size * sizeof(int));
+    if ((order->nodes == NULL) || (order->ranks == NULL)) {
+	xsltGenericError(xsltGenericErrorContext,
+	    "xsltBuildDocumentOrder : malloc failed\n");
+	if (order->nodes != NULL)
+	    xmlFree(order->nodes);
+	if (order->ranks != NULL)
+	    xmlFree(order->ranks);
+	xmlFree(order);
+	return(-1);
+    }
+    memset(order->nodes, 0, order->size * sizeof(void *));
+    xsltDocumentOrderWalk(idoc->doc, order);
+    idoc->order = order;
+    return(0);
+}
+
+/**
+ * xsltFreeDocumentOrder:
+ * @idoc: a document info
+ *
+ * Frees the document order index of @idoc, if any.
+ */
+void
+xsltFreeDocumentOrder(xsltDocumentPtr idoc) {
+    xsltDocumentOrderPtr order;
+
+    if ((idoc == NULL) || (idoc->order == NULL))
+	return;
+    order = (xsltDocumentOrderPtr) idoc->order;
+    xmlFree(order->nodes);
+    xmlFree(order->ranks);
+    xmlFree(order);
+    idoc->order = NULL;
+}
+
+/**
+ * xsltCmpDocumentOrder:
+ * @ctxt: an XSLT transformation context
+ * @node1: the first node
+ * @node2: the second node
+ *
+ * Compares two nodes in document order using the order index of their
+ * document info, which is built on first use. Result Tree Fragments get
+ * a document info on demand. Nodes of documents not
+ * registered in @ctxt, of different documents, or added after the index
+ * was built, are compared with xmlXPathCmpNodes().
+ *
+ * Returns -2 in case of error, 1 if @node1 < @node2, 0 if @node1 == @node2,
+ *         -1 otherwise, like xmlXPathCmpNodes()
+ */
+int
+xsltCmpDocumentOrder(xsltTransformContextPtr ctxt, xmlNodePtr node1,
+		     xmlNodePtr node2) {
+    xmlNodePtr cur1 = node1, cur2 = node2;
+    xsltDocumentPtr idoc = NULL;
+    int rank1, rank2;
+
+    if ((node1 == NULL) || (node2 == NULL))
+	return(-2);
+    if (node1 == node2)
+	return(0);
+    if (cur1->type == XML_NAMESPACE_DECL)
+	cur1 = (xmlNodePtr) ((xmlNsPtr) node1)->next;
+    if (cur2->type == XML_NAMESPACE_DECL)
+	cur2 = (xmlNodePtr) ((xmlNsPtr) node2)->next;
+    if ((ctxt == NULL) || (cur1 == NULL) || (cur2 == NULL) ||
+	(cur1->type != XML_ELEMENT_NODE && node1 != cur1) ||
+	(cur2->type != XML_ELEMENT_NODE && node2 != cur2) ||
+	(cur1->doc == NULL) || (cur1->doc != cur2->doc))
+	goto fallback;
+
+    if (XSLT_IS_RES_TREE_FRAG(cur1->doc)) {
+	/*
+	* Like for keys, the document info of a Result Tree Fragment is
+	* created on demand and freed together with the fragment.
+	*/
+	if (cur1->doc->_private == NULL)
+	    cur1->doc->_private = xsltNewDocument(ctxt, cur1->doc);
+	idoc = (xsltDocumentPtr) cur1->doc->_private;
+    } else if ((ctxt->document != NULL) && (ctxt->document->doc == cur1->doc))
+	idoc = ctxt->document;
+    else
+	idoc = xsltFindDocument(ctxt, cur1->doc);
+    if ((idoc == NULL) || (idoc->doc != cur1->doc))
+	goto fallback;
+    if ((idoc->order == NULL) && (xsltBuildDocumentOrder(idoc) < 0))
+	goto fallback;
+
+    rank1 = xsltDocumentOrderRank((xsltDocumentOrderPtr) idoc->order, cur1);
+    rank2 = xsltDocumentOrderRank((xsltDocumentOrderPtr) idoc->order, cur2);
+    if ((rank1 < 0) || (rank2 < 0))
+	goto fallback;
+    /* a namespace node sorts between its element and the next node */
+    if (rank1 == rank2) {
+	if (node1 == cur1)
+	    return(1);
+	if (node2 == cur2)
+	    return(-1);
+	goto fallback;
+    }
+    return((rank1 < rank2) ? 1 : -1);
+
+fallback:
+    return(xmlXPathCmpNodes(node1, node2));
+}
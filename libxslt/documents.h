@@ -41,6 +41,18 @@ XSLTPUBFUN xsltDocumentPtr XSLTCALL
 XSLTPUBFUN void XSLTCALL
 		xsltFreeStyleDocuments	(xsltStylesheetPtr style);
 
+/*
+ * Document order
+ */
+XSLTPUBFUN int XSLTCALL
+		xsltBuildDocumentOrder	(xsltDocumentPtr idoc);
+XSLTPUBFUN void XSLTCALL
+		xsltFreeDocumentOrder	(xsltDocumentPtr idoc);
+XSLTPUBFUN int XSLTCALL
+		xsltCmpDocumentOrder	(xsltTransformContextPtr ctxt,
+					 xmlNodePtr node1,
+					 xmlNodePtr node2);
+
 /*
  * Hooks for document loading
  */
@@ -85,6 +97,30 @@ XSLTPUBFUN void XSLTCALL
 /* the loader may be needed by extension libraries so it is exported */
 XSLTPUBVAR xsltDocLoaderFunc xsltDocDefaultLoader;
 
+XSLTPUBFUN xmlDocPtr XSLTCALL
+		xsltParseInputFile		(xsltStylesheetPtr style,
+						 const char *filename,
+						 const char *encoding,
+						 int options);
+
+/*
+ * Documents parsed ahead of their use
+ */
+XSLTPUBFUN void XSLTCALL
+		xsltSetDocumentThreads		(int nbThreads);
+XSLTPUBFUN int XSLTCALL
+		xsltGetDocumentThreads		(void);
+XSLTPUBFUN int XSLTCALL
+		xsltCollectDocumentURIs		(xsltStylesheetPtr style,
+						 const xmlChar *str,
+						 xmlNodePtr inst);
+XSLTPUBFUN int XSLTCALL
+		xsltPrefetchStyleDocuments	(xsltTransformContextPtr ctxt);
+XSLTPUBFUN int XSLTCALL
+		xsltPrefetchDocuments		(xsltTransformContextPtr ctxt,
+						 const xmlChar **URIs,
+						 int nbURIs);
+
 #ifdef __cplusplus
 }
 #endif
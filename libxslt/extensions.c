@@ -14,6 +14,9 @@
 
 #include <string.h>
 #include <limits.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include <libxml/xmlmemory.h>
 #include <libxml/tree.h>
@@ -88,6 +91,58 @@ static xmlHashTablePtr xsltTopLevelsHash = NULL;
 static xmlHashTablePtr xsltModuleHash = NULL;
 static xmlMutexPtr xsltExtMutex = NULL;
 
+/*
+ * Read-only copies of the module registries used by the lookups.
+ * A snapshot is built under xsltExtMutex by the first lookup following
+ * a change of the registries and published with a single pointer
+ * store, lookups then read it without locking. Replaced snapshots may
+ * still be in use by concurrent lookups, so they are retired and freed
+ * once no thread reads them, see xsltExtReclaimSnapshots().
+ */
+typedef struct _xsltExtSnapshot xsltExtSnapshot;
+typedef xsltExtSnapshot *xsltExtSnapshotPtr;
+struct _xsltExtSnapshot {
+    xsltExtSnapshotPtr next;	/* list of replaced snapshots */
+    unsigned long generation;	/* the registry generation copied */
+    xmlHashTablePtr modules;
+    xmlHashTablePtr functions;
+    xmlHashTablePtr elements;
+    xmlHashTablePtr topLevels;
+};
+
+static xsltExtSnapshotPtr xsltExtCurrent = NULL;
+static xsltExtSnapshotPtr xsltExtRetired = NULL;
+static unsigned long xsltExtGeneration = 1;
+
+#if defined(__GNUC__) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7)))
+#define XSLT_EXT_ATOMICS
+#define XSLT_EXT_LOAD(p) __atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+#define XSLT_EXT_STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+#if defined(XSLT_EXT_ATOMICS) && defined(HAVE_PTHREAD_H)
+/*
+ * Each thread doing lookups owns a reader where it publishes the
+ * snapshot it reads, so the lookups only write to memory of their own
+ * thread. A reader is given back when its thread exits, and reused.
+ */
+#define XSLT_EXT_LOCK_FREE
+
+typedef struct _xsltExtReader xsltExtReader;
+typedef xsltExtReader *xsltExtReaderPtr;
+struct _xsltExtReader {
+    xsltExtReaderPtr next;	/* all the readers */
+    xsltExtSnapshotPtr snap;	/* the snapshot being read or NULL */
+    int used;			/* owned by a thread */
+    char pad[64];		/* keeps readers on distinct cache lines */
+};
+
+static xsltExtReaderPtr xsltExtReaders = NULL;
+static pthread_key_t xsltExtReaderKey;
+static int xsltExtReaderKeyValid = 0;
+#endif
+
 /************************************************************************
  *									*
  *			Type functions					*
@@ -290,6 +345,323 @@ xsltFreeExtElement(xsltExtElementPtr ext)
 }
 
 
+/************************************************************************
+ *									*
+ *		Lock-free snapshots of the registries			*
+ *									*
+ ************************************************************************/
+
+static void *
+xsltExtCopyEntry(void *payload, const xmlChar *name ATTRIBUTE_UNUSED)
+{
+    return(payload);
+}
+
+static void
+xsltExtFreeSnapshot(xsltExtSnapshotPtr snap)
+{
+    if (snap->modules != NULL)
+        xmlHashFree(snap->modules, NULL);
+    if (snap->functions != NULL)
+        xmlHashFree(snap->functions, NULL);
+    if (snap->elements != NULL)
+        xmlHashFree(snap->elements, NULL);
+    if (snap->topLevels != NULL)
+        xmlHashFree(snap->topLevels, NULL);
+    xmlFree(snap);
+}
+
+#ifdef XSLT_EXT_LOCK_FREE
+/**
+ * xsltExtReleaseReader:
+ * @data:  the reader of an exiting thread
+ *
+ * Gives back the reader of a thread.
+ */
+static void
+xsltExtReleaseReader(void *data)
+{
+    xsltExtReaderPtr reader = (xsltExtReaderPtr) data;
+
+    XSLT_EXT_STORE(reader->snap, NULL);
+    xmlMutexLock(xsltExtMutex);
+    reader->used = 0;
+    xmlMutexUnlock(xsltExtMutex);
+}
+
+/**
+ * xsltExtGetReader:
+ *
+ * Returns the reader of the calling thread, or NULL in case of memory
+ * allocation failure.
+ */
+static xsltExtReaderPtr
+xsltExtGetReader(void)
+{
+    xsltExtReaderPtr reader;
+
+    reader = (xsltExtReaderPtr) pthread_getspecific(xsltExtReaderKey);
+    if (reader != NULL)
+        return(reader);
+
+    xmlMutexLock(xsltExtMutex);
+    for (reader = xsltExtReaders; reader != NULL; reader = reader->next)
+        if (!reader->used)
+            break;
+    if (reader == NULL) {
+        reader = (xsltExtReaderPtr) xmlMalloc(sizeof(xsltExtReader));
+        if (reader != NULL) {
+            memset(reader, 0, sizeof(xsltExtReader));
+            reader->next = xsltExtReaders;
+            xsltExtReaders = reader;
+        }
+    }
+    if (reader != NULL) {
+        if (pthread_setspecific(xsltExtReaderKey, reader) == 0)
+            reader->used = 1;
+        else
+            reader = NULL;
+    }
+    xmlMutexUnlock(xsltExtMutex);
+    return(reader);
+}
+#endif /* XSLT_EXT_LOCK_FREE */
+
+/**
+ * xsltExtReclaimSnapshots:
+ *
+ * Frees the retired snapshots no thread reads anymore, the lookups
+ * starting from now can only get the published snapshot. Must be
+ * called with xsltExtMutex held.
+ */
+static void
+xsltExtReclaimSnapshots(void)
+{
+    xsltExtSnapshotPtr snap, *prev;
+#ifdef XSLT_EXT_LOCK_FREE
+    xsltExtReaderPtr reader;
+#endif
+
+    prev = &xsltExtRetired;
+    while (*prev != NULL) {
+        snap = *prev;
+#ifdef XSLT_EXT_LOCK_FREE
+        for (reader = xsltExtReaders; reader != NULL; reader = reader->next)
+            if (XSLT_EXT_LOAD(reader->snap) == snap)
+                break;
+        if (reader != NULL) {
+            prev = &snap->next;
+            continue;
+        }
+#endif
+        *prev = snap->next;
+        xsltExtFreeSnapshot(snap);
+    }
+}
+
+/**
+ * xsltExtInvalidateSnapshot:
+ *
+ * Retires the published snapshot after a change of the registries.
+ * Must be called with xsltExtMutex held.
+ */
+static void
+xsltExtInvalidateSnapshot(void)
+{
+    xsltExtSnapshotPtr snap = xsltExtCurrent;
+
+#ifdef XSLT_EXT_ATOMICS
+    __atomic_store_n(&xsltExtGeneration, xsltExtGeneration + 1,
+                     __ATOMIC_RELEASE);
+#else
+    xsltExtGeneration++;
+#endif
+    if (snap == NULL)
+        return;
+#ifdef XSLT_EXT_LOCK_FREE
+    XSLT_EXT_STORE(xsltExtCurrent, NULL);
+#else
+    xsltExtCurrent = NULL;
+#endif
+    snap->next = xsltExtRetired;
+    xsltExtRetired = snap;
+    xsltExtReclaimSnapshots();
+}
+
+/**
+ * xsltExtGetGeneration:
+ *
+ * Returns the current generation of the registries, which changes
+ * with every registration or unregistration.
+ */
+static unsigned long
+xsltExtGetGeneration(void)
+{
+#ifdef XSLT_EXT_ATOMICS
+    return(__atomic_load_n(&xsltExtGeneration, __ATOMIC_ACQUIRE));
+#else
+    unsigned long ret;
+
+    xmlMutexLock(xsltExtMutex);
+    ret = xsltExtGeneration;
+    xmlMutexUnlock(xsltExtMutex);
+    return(ret);
+#endif
+}
+
+/**
+ * xsltExtBuildSnapshot:
+ *
+ * Publishes a snapshot of the registries if there is none. Must be
+ * called with xsltExtMutex held.
+ *
+ * Returns the published snapshot or NULL in case of memory allocation
+ * failure.
+ */
+static xsltExtSnapshotPtr
+xsltExtBuildSnapshot(void)
+{
+    xsltExtSnapshotPtr snap = xsltExtCurrent;
+
+    if (snap != NULL)
+        return(snap);
+    snap = (xsltExtSnapshotPtr) xmlMalloc(sizeof(xsltExtSnapshot));
+    if (snap == NULL)
+        return(NULL);
+    memset(snap, 0, sizeof(xsltExtSnapshot));
+    snap->generation = xsltExtGeneration;
+    if (((xsltExtensionsHash != NULL) &&
+         ((snap->modules = xmlHashCopy(xsltExtensionsHash,
+                                       xsltExtCopyEntry)) == NULL)) ||
+        ((xsltFunctionsHash != NULL) &&
+         ((snap->functions = xmlHashCopy(xsltFunctionsHash,
+                                         xsltExtCopyEntry)) == NULL)) ||
+        ((xsltElementsHash != NULL) &&
+         ((snap->elements = xmlHashCopy(xsltElementsHash,
+                                        xsltExtCopyEntry)) == NULL)) ||
+        ((xsltTopLevelsHash != NULL) &&
+         ((snap->topLevels = xmlHashCopy(xsltTopLevelsHash,
+                                         xsltExtCopyEntry)) == NULL))) {
+        xsltExtFreeSnapshot(snap);
+        return(NULL);
+    }
+#ifdef XSLT_EXT_LOCK_FREE
+    XSLT_EXT_STORE(xsltExtCurrent, snap);
+#else
+    xsltExtCurrent = snap;
+#endif
+    return(snap);
+}
+
+/**
+ * xsltExtGetSnapshot:
+ *
+ * Starts a lookup, which must be ended by xsltExtReleaseSnapshot()
+ * whatever the result. The calling thread publishes the snapshot in
+ * its reader, and checks it is still the current one so that no
+ * change of the registries missed it. Without atomic operations or
+ * thread-specific data the lookup runs under xsltExtMutex instead.
+ *
+ * Returns the current snapshot of the registries, building it if
+ * needed, or NULL in case of memory allocation failure.
+ */
+static xsltExtSnapshotPtr
+xsltExtGetSnapshot(void)
+{
+    xsltExtSnapshotPtr snap;
+#ifdef XSLT_EXT_LOCK_FREE
+    xsltExtReaderPtr reader;
+
+    if (xsltExtReaderKeyValid) {
+        reader = xsltExtGetReader();
+        if (reader == NULL)
+            return(NULL);
+        while (1) {
+            snap = XSLT_EXT_LOAD(xsltExtCurrent);
+            if (snap == NULL)
+                break;
+            XSLT_EXT_STORE(reader->snap, snap);
+            if (XSLT_EXT_LOAD(xsltExtCurrent) == snap)
+                return(snap);
+        }
+
+        /* no change can retire the new snapshot before the reader has it */
+        xmlMutexLock(xsltExtMutex);
+        xsltExtReclaimSnapshots();
+        snap = xsltExtBuildSnapshot();
+        XSLT_EXT_STORE(reader->snap, snap);
+        xmlMutexUnlock(xsltExtMutex);
+        return(snap);
+    }
+#endif
+    xmlMutexLock(xsltExtMutex);
+    snap = xsltExtBuildSnapshot();
+    return(snap);
+}
+
+/**
+ * xsltExtReleaseSnapshot:
+ *
+ * Ends a lookup started by xsltExtGetSnapshot(), the snapshot it
+ * returned must not be used anymore.
+ */
+static void
+xsltExtReleaseSnapshot(void)
+{
+#ifdef XSLT_EXT_LOCK_FREE
+    xsltExtReaderPtr reader;
+
+    if (xsltExtReaderKeyValid) {
+        reader = (xsltExtReaderPtr) pthread_getspecific(xsltExtReaderKey);
+        if (reader != NULL)
+            __atomic_store_n(&reader->snap, NULL, __ATOMIC_RELEASE);
+        return;
+    }
+#endif
+    xmlMutexUnlock(xsltExtMutex);
+}
+
+/**
+ * xsltExtSnapshotModule:
+ * @URI:  the extension namespace URI
+ *
+ * Looks up a registered extension module without locking.
+ *
+ * Returns the module or NULL if not found.
+ */
+static xsltExtModulePtr
+xsltExtSnapshotModule(const xmlChar * URI)
+{
+    xsltExtSnapshotPtr snap = xsltExtGetSnapshot();
+    xsltExtModulePtr ret = NULL;
+
+    if ((snap != NULL) && (snap->modules != NULL))
+        ret = (xsltExtModulePtr) xmlHashLookup(snap->modules, URI);
+    xsltExtReleaseSnapshot();
+    return(ret);
+}
+
+/**
+ * xsltExtSnapshotElement:
+ * @name:  the element name
+ * @URI:  the element namespace URI
+ *
+ * Looks up a registered extension module element without locking.
+ *
+ * Returns the element or NULL if not found.
+ */
+static xsltExtElementPtr
+xsltExtSnapshotElement(const xmlChar * name, const xmlChar * URI)
+{
+    xsltExtSnapshotPtr snap = xsltExtGetSnapshot();
+    xsltExtElementPtr ret = NULL;
+
+    if ((snap != NULL) && (snap->elements != NULL))
+        ret = (xsltExtElementPtr) xmlHashLookup2(snap->elements, name, URI);
+    xsltExtReleaseSnapshot();
+    return(ret);
+}
+
 #ifdef WITH_MODULES
 typedef void (*exsltRegisterFunction) (void);
 
@@ -480,6 +852,10 @@ xsltFreeExts(xsltStylesheetPtr style)
 {
     if (style->nsDefs != NULL)
         xsltFreeExtDefList((xsltExtDefPtr) style->nsDefs);
+    if (style->extFunctions != NULL) {
+        xmlHashFree(style->extFunctions, NULL);
+        style->extFunctions = NULL;
+    }
 }
 
 /**
@@ -548,15 +924,10 @@ xsltRegisterExtPrefix(xsltStylesheetPtr style,
     if (xsltExtensionsHash != NULL) {
         xsltExtModulePtr module;
 
-        xmlMutexLock(xsltExtMutex);
-        module = xmlHashLookup(xsltExtensionsHash, URI);
-        xmlMutexUnlock(xsltExtMutex);
+        module = xsltExtSnapshotModule(URI);
         if (NULL == module) {
-            if (!xsltExtModuleRegisterDynamic(URI)) {
-                xmlMutexLock(xsltExtMutex);
-                module = xmlHashLookup(xsltExtensionsHash, URI);
-                xmlMutexUnlock(xsltExtMutex);
-            }
+            if (!xsltExtModuleRegisterDynamic(URI))
+                module = xsltExtSnapshotModule(URI);
         }
         if (module != NULL) {
             xsltStyleGetExtData(style, URI);
@@ -678,11 +1049,7 @@ xsltStyleInitializeStylesheetModule(xsltStylesheetPtr style,
 	return(NULL);
     }
 
-    xmlMutexLock(xsltExtMutex);
-
-    module = xmlHashLookup(xsltExtensionsHash, URI);
-
-    xmlMutexUnlock(xsltExtMutex);
+    module = xsltExtSnapshotModule(URI);
 
     if (module == NULL) {
 #ifdef WITH_XSLT_DEBUG_EXTENSIONS
@@ -877,11 +1244,7 @@ xsltGetExtData(xsltTransformContextPtr ctxt, const xmlChar * URI)
         void *extData;
         xsltExtModulePtr module;
 
-        xmlMutexLock(xsltExtMutex);
-
-        module = xmlHashLookup(xsltExtensionsHash, URI);
-
-        xmlMutexUnlock(xsltExtMutex);
+        module = xsltExtSnapshotModule(URI);
 
         if (module == NULL) {
 #ifdef WITH_XSLT_DEBUG_EXTENSIONS
@@ -1007,7 +1370,8 @@ xsltInitCtxtExt(xsltExtDataPtr styleData, xsltInitExtCtxt * ctxt,
  * xsltInitCtxtExts:
  * @ctxt: an XSLT transformation context
  *
- * Initialize the set of modules with registered stylesheet data
+ * Initialize the set of modules with registered stylesheet data which
+ * were not initialized yet for this transformation.
  *
  * Returns the number of modules initialized or -1 in case of error
  */
@@ -1043,6 +1407,49 @@ xsltInitCtxtExts(xsltTransformContextPtr ctxt)
     return (ctx.ret);
 }
 
+/**
+ * xsltInitCtxtExtByURI:
+ * @ctxt: an XSLT transformation context
+ * @URI:  the extension URI
+ *
+ * Initialize the module bound to @URI for this transformation if the
+ * stylesheet registered data for it and it was not initialized yet.
+ * Modules are no longer initialized when the transformation context is
+ * created, this is called when one of their functions or elements is
+ * first looked up.
+ *
+ * Returns 1 if the module got initialized, 0 if there was nothing to do
+ *         and -1 in case of error
+ */
+int
+xsltInitCtxtExtByURI(xsltTransformContextPtr ctxt, const xmlChar * URI)
+{
+    xsltStylesheetPtr style;
+    xsltExtDataPtr styleData;
+    xsltInitExtCtxt ctx;
+
+    if ((ctxt == NULL) || (URI == NULL))
+        return (-1);
+    if ((ctxt->extInfos != NULL) &&
+        (xmlHashLookup(ctxt->extInfos, URI) != NULL))
+        return (0);
+
+    style = ctxt->style;
+    while (style != NULL) {
+        if (style->extInfos != NULL) {
+            styleData = (xsltExtDataPtr) xmlHashLookup(style->extInfos, URI);
+            if (styleData != NULL) {
+                ctx.ctxt = ctxt;
+                ctx.ret = 0;
+                xsltInitCtxtExt(styleData, &ctx, URI);
+                return (ctx.ret);
+            }
+        }
+        style = xsltNextImport(style);
+    }
+    return (0);
+}
+
 /**
  * xsltShutdownCtxtExt:
  * @data:  the registered data for the module
@@ -1280,6 +1687,10 @@ xsltRegisterExtModuleFull(const xmlChar * URI,
         goto done;
     }
     ret = xmlHashAddEntry(xsltExtensionsHash, URI, (void *) module);
+    if (ret == 0)
+        xsltExtInvalidateSnapshot();
+    else
+        xsltFreeExtModule(module);
 
 done:
     xmlMutexUnlock(xsltExtMutex);
@@ -1327,6 +1738,8 @@ xsltUnregisterExtModule(const xmlChar * URI)
 
     ret = xmlHashRemoveEntry(xsltExtensionsHash, URI,
                              (xmlHashDeallocator) xsltFreeExtModule);
+    if (ret == 0)
+        xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 
@@ -1349,6 +1762,7 @@ xsltUnregisterAllExtModules(void)
     xmlHashFree(xsltExtensionsHash,
                 (xmlHashDeallocator) xsltFreeExtModule);
     xsltExtensionsHash = NULL;
+    xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 }
@@ -1387,6 +1801,9 @@ int
 xsltRegisterExtModuleFunction(const xmlChar * name, const xmlChar * URI,
                               xmlXPathFunction function)
 {
+    xmlXPathFunction cur;
+    int ret = 0;
+
     if ((name == NULL) || (URI == NULL) || (function == NULL))
         return (-1);
 
@@ -1397,12 +1814,18 @@ xsltRegisterExtModuleFunction(const xmlChar * name, const xmlChar * URI,
 
     xmlMutexLock(xsltExtMutex);
 
-    xmlHashUpdateEntry2(xsltFunctionsHash, name, URI,
-                        XML_CAST_FPTR(function), NULL);
+    /* registering the same function again changes nothing */
+    XML_CAST_FPTR(cur) = xmlHashLookup2(xsltFunctionsHash, name, URI);
+    if (cur != function) {
+        ret = xmlHashUpdateEntry2(xsltFunctionsHash, name, URI,
+                                  XML_CAST_FPTR(function), NULL);
+        if (ret == 0)
+            xsltExtInvalidateSnapshot();
+    }
 
     xmlMutexUnlock(xsltExtMutex);
 
-    return (0);
+    return (ret);
 }
 
 /**
@@ -1417,30 +1840,167 @@ xsltRegisterExtModuleFunction(const xmlChar * name, const xmlChar * URI,
 xmlXPathFunction
 xsltExtModuleFunctionLookup(const xmlChar * name, const xmlChar * URI)
 {
-    xmlXPathFunction ret;
+    xmlXPathFunction ret = NULL;
+    xsltExtSnapshotPtr snap;
 
     if ((xsltFunctionsHash == NULL) || (name == NULL) || (URI == NULL))
         return (NULL);
 
-    xmlMutexLock(xsltExtMutex);
-
-    XML_CAST_FPTR(ret) = xmlHashLookup2(xsltFunctionsHash, name, URI);
-
-    xmlMutexUnlock(xsltExtMutex);
+    snap = xsltExtGetSnapshot();
+    if ((snap != NULL) && (snap->functions != NULL))
+        XML_CAST_FPTR(ret) = xmlHashLookup2(snap->functions, name, URI);
+    xsltExtReleaseSnapshot();
 
     /* if lookup fails, attempt a dynamic load on supported platforms */
     if (NULL == ret) {
         if (!xsltExtModuleRegisterDynamic(URI)) {
-            xmlMutexLock(xsltExtMutex);
+            snap = xsltExtGetSnapshot();
+            if ((snap != NULL) && (snap->functions != NULL))
+                XML_CAST_FPTR(ret) =
+                    xmlHashLookup2(snap->functions, name, URI);
+            xsltExtReleaseSnapshot();
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * xsltStyleExtFunctionLookup:
+ * @style:  the principal stylesheet of the transformation
+ * @name:  the function name
+ * @URI:  the function namespace URI
+ *
+ * Looks up an extension module function, using the table built by
+ * xsltPreResolveExtFunctions() first as long as the registry didn't
+ * change since.
+ *
+ * Returns the function if found, NULL otherwise.
+ */
+xmlXPathFunction
+xsltStyleExtFunctionLookup(xsltStylesheetPtr style, const xmlChar * name,
+                           const xmlChar * URI)
+{
+    xmlXPathFunction ret = NULL;
+
+    if ((style != NULL) && (style->extFunctions != NULL) &&
+        (name != NULL) && (URI != NULL) &&
+        (xsltExtGetGeneration() == style->extGeneration)) {
+        XML_CAST_FPTR(ret) = xmlHashLookup2(style->extFunctions, name, URI);
+        if (ret != NULL)
+            return(ret);
+    }
+    return(xsltExtModuleFunctionLookup(name, URI));
+}
+
+typedef struct _xsltExtResolveCtxt xsltExtResolveCtxt;
+struct _xsltExtResolveCtxt {
+    xmlHashTablePtr URIs;
+    xmlHashTablePtr functions;
+};
 
-            XML_CAST_FPTR(ret) =
-                xmlHashLookup2(xsltFunctionsHash, name, URI);
+static void
+xsltExtCollectNamespaces(xmlHashTablePtr URIs, xmlDocPtr doc)
+{
+    xmlNodePtr cur;
+    xmlNsPtr ns;
 
-            xmlMutexUnlock(xsltExtMutex);
+    if (doc == NULL)
+        return;
+    cur = xmlDocGetRootElement(doc);
+    while (cur != NULL) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+                if (ns->href != NULL)
+                    xmlHashAddEntry(URIs, ns->href, (void *) ns);
+            }
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+        }
+        while (cur->next == NULL) {
+            cur = cur->parent;
+            if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+                return;
         }
+        cur = cur->next;
     }
+}
 
-    return ret;
+static void
+xsltExtResolveFunction(void *payload, void *data, const xmlChar * name,
+                       const xmlChar * URI,
+                       const xmlChar * name3 ATTRIBUTE_UNUSED)
+{
+    xsltExtResolveCtxt *ctxt = (xsltExtResolveCtxt *) data;
+
+    if ((URI != NULL) && (xmlHashLookup(ctxt->URIs, URI) != NULL))
+        xmlHashAddEntry2(ctxt->functions, name, URI, payload);
+}
+
+/**
+ * xsltPreResolveExtFunctions:
+ * @style:  the principal stylesheet
+ *
+ * Builds the table of the registered module functions whose namespace
+ * is declared in @style or the stylesheets it imports or includes, so
+ * that the transformations look them up without going through the
+ * global registry.
+ *
+ * Returns the number of functions resolved or -1 in case of error.
+ */
+int
+xsltPreResolveExtFunctions(xsltStylesheetPtr style)
+{
+    xsltExtSnapshotPtr snap;
+    xsltExtResolveCtxt ctxt;
+    xsltStylesheetPtr tmp;
+    xsltDocumentPtr include;
+    int ret;
+
+    if (style == NULL)
+        return (-1);
+    if (style->extFunctions != NULL) {
+        xmlHashFree(style->extFunctions, NULL);
+        style->extFunctions = NULL;
+    }
+    if (xsltFunctionsHash == NULL)
+        return (0);
+
+    ctxt.URIs = xmlHashCreate(10);
+    if (ctxt.URIs == NULL)
+        return (-1);
+    for (tmp = style; tmp != NULL; tmp = xsltNextImport(tmp)) {
+        xsltExtCollectNamespaces(ctxt.URIs, tmp->doc);
+        for (include = tmp->docList; include != NULL;
+             include = include->next)
+            xsltExtCollectNamespaces(ctxt.URIs, include->doc);
+    }
+    ctxt.functions = xmlHashCreate(10);
+    if (ctxt.functions == NULL) {
+        xmlHashFree(ctxt.URIs, NULL);
+        return (-1);
+    }
+
+    snap = xsltExtGetSnapshot();
+    if (snap == NULL) {
+        ret = -1;
+    } else {
+        if (snap->functions != NULL)
+            xmlHashScanFull(snap->functions, xsltExtResolveFunction, &ctxt);
+        ret = xmlHashSize(ctxt.functions);
+        if (ret > 0)
+            style->extGeneration = snap->generation;
+    }
+    xsltExtReleaseSnapshot();
+    xmlHashFree(ctxt.URIs, NULL);
+
+    if (ret > 0)
+        style->extFunctions = ctxt.functions;
+    else
+        xmlHashFree(ctxt.functions, NULL);
+    return (ret);
 }
 
 /**
@@ -1463,6 +2023,8 @@ xsltUnregisterExtModuleFunction(const xmlChar * name, const xmlChar * URI)
     xmlMutexLock(xsltExtMutex);
 
     ret = xmlHashRemoveEntry2(xsltFunctionsHash, name, URI, NULL);
+    if (ret == 0)
+        xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 
@@ -1481,6 +2043,7 @@ xsltUnregisterAllExtModuleFunction(void)
 
     xmlHashFree(xsltFunctionsHash, NULL);
     xsltFunctionsHash = NULL;
+    xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 }
@@ -1562,12 +2125,7 @@ xsltPreComputeExtModuleElement(xsltStylesheetPtr style, xmlNodePtr inst)
         (inst->type != XML_ELEMENT_NODE) || (inst->ns == NULL))
         return (NULL);
 
-    xmlMutexLock(xsltExtMutex);
-
-    ext = (xsltExtElementPtr)
-        xmlHashLookup2(xsltElementsHash, inst->name, inst->ns->href);
-
-    xmlMutexUnlock(xsltExtMutex);
+    ext = xsltExtSnapshotElement(inst->name, inst->ns->href);
 
     /*
     * EXT TODO: Now what?
@@ -1642,8 +2200,12 @@ xsltRegisterExtModuleElement(const xmlChar * name, const xmlChar * URI,
         goto done;
     }
 
-    xmlHashUpdateEntry2(xsltElementsHash, name, URI, (void *) ext,
-                        (xmlHashDeallocator) xsltFreeExtElement);
+    ret = xmlHashUpdateEntry2(xsltElementsHash, name, URI, (void *) ext,
+                              (xmlHashDeallocator) xsltFreeExtElement);
+    if (ret == 0)
+        xsltExtInvalidateSnapshot();
+    else
+        xsltFreeExtElement(ext);
 
 done:
     xmlMutexUnlock(xsltExtMutex);
@@ -1678,8 +2240,28 @@ xsltExtElementLookup(xsltTransformContextPtr ctxt,
         }
     }
 
+    /*
+     * The module owning @URI may register context-level elements
+     * when it gets initialized.
+     */
+    if ((ctxt != NULL) && (xsltInitCtxtExtByURI(ctxt, URI) > 0) &&
+        (ctxt->extElements != NULL)) {
+        XML_CAST_FPTR(ret) = xmlHashLookup2(ctxt->extElements, name, URI);
+        if (ret != NULL) {
+            return(ret);
+        }
+    }
+
     ret = xsltExtModuleElementLookup(name, URI);
 
+    /*
+     * Last resort: modules may register elements in namespaces other
+     * than their own, bring up the ones still pending.
+     */
+    if ((ret == NULL) && (ctxt != NULL) && (xsltInitCtxtExts(ctxt) > 0) &&
+        (ctxt->extElements != NULL))
+        XML_CAST_FPTR(ret) = xmlHashLookup2(ctxt->extElements, name, URI);
+
     return (ret);
 }
 
@@ -1700,25 +2282,15 @@ xsltExtModuleElementLookup(const xmlChar * name, const xmlChar * URI)
     if ((xsltElementsHash == NULL) || (name == NULL) || (URI == NULL))
         return (NULL);
 
-    xmlMutexLock(xsltExtMutex);
-
-    ext = (xsltExtElementPtr) xmlHashLookup2(xsltElementsHash, name, URI);
-
-    xmlMutexUnlock(xsltExtMutex);
+    ext = xsltExtSnapshotElement(name, URI);
 
     /*
      * if function lookup fails, attempt a dynamic load on
      * supported platforms
      */
     if (NULL == ext) {
-        if (!xsltExtModuleRegisterDynamic(URI)) {
-            xmlMutexLock(xsltExtMutex);
-
-            ext = (xsltExtElementPtr)
-	          xmlHashLookup2(xsltElementsHash, name, URI);
-
-            xmlMutexUnlock(xsltExtMutex);
-        }
+        if (!xsltExtModuleRegisterDynamic(URI))
+            ext = xsltExtSnapshotElement(name, URI);
     }
 
     if (ext == NULL)
@@ -1744,21 +2316,11 @@ xsltExtModuleElementPreComputeLookup(const xmlChar * name,
     if ((xsltElementsHash == NULL) || (name == NULL) || (URI == NULL))
         return (NULL);
 
-    xmlMutexLock(xsltExtMutex);
-
-    ext = (xsltExtElementPtr) xmlHashLookup2(xsltElementsHash, name, URI);
-
-    xmlMutexUnlock(xsltExtMutex);
+    ext = xsltExtSnapshotElement(name, URI);
 
     if (ext == NULL) {
-        if (!xsltExtModuleRegisterDynamic(URI)) {
-            xmlMutexLock(xsltExtMutex);
-
-            ext = (xsltExtElementPtr)
-	          xmlHashLookup2(xsltElementsHash, name, URI);
-
-            xmlMutexUnlock(xsltExtMutex);
-        }
+        if (!xsltExtModuleRegisterDynamic(URI))
+            ext = xsltExtSnapshotElement(name, URI);
     }
 
     if (ext == NULL)
@@ -1787,6 +2349,8 @@ xsltUnregisterExtModuleElement(const xmlChar * name, const xmlChar * URI)
 
     ret = xmlHashRemoveEntry2(xsltElementsHash, name, URI,
                               (xmlHashDeallocator) xsltFreeExtElement);
+    if (ret == 0)
+        xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 
@@ -1805,6 +2369,7 @@ xsltUnregisterAllExtModuleElement(void)
 
     xmlHashFree(xsltElementsHash, (xmlHashDeallocator) xsltFreeExtElement);
     xsltElementsHash = NULL;
+    xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 }
@@ -1823,6 +2388,9 @@ int
 xsltRegisterExtModuleTopLevel(const xmlChar * name, const xmlChar * URI,
                               xsltTopLevelFunction function)
 {
+    xsltTopLevelFunction cur;
+    int ret = 0;
+
     if ((name == NULL) || (URI == NULL) || (function == NULL))
         return (-1);
 
@@ -1833,12 +2401,18 @@ xsltRegisterExtModuleTopLevel(const xmlChar * name, const xmlChar * URI,
 
     xmlMutexLock(xsltExtMutex);
 
-    xmlHashUpdateEntry2(xsltTopLevelsHash, name, URI,
-                        XML_CAST_FPTR(function), NULL);
+    /* registering the same function again changes nothing */
+    XML_CAST_FPTR(cur) = xmlHashLookup2(xsltTopLevelsHash, name, URI);
+    if (cur != function) {
+        ret = xmlHashUpdateEntry2(xsltTopLevelsHash, name, URI,
+                                  XML_CAST_FPTR(function), NULL);
+        if (ret == 0)
+            xsltExtInvalidateSnapshot();
+    }
 
     xmlMutexUnlock(xsltExtMutex);
 
-    return (0);
+    return (ret);
 }
 
 /**
@@ -1853,25 +2427,25 @@ xsltRegisterExtModuleTopLevel(const xmlChar * name, const xmlChar * URI,
 xsltTopLevelFunction
 xsltExtModuleTopLevelLookup(const xmlChar * name, const xmlChar * URI)
 {
-    xsltTopLevelFunction ret;
+    xsltTopLevelFunction ret = NULL;
+    xsltExtSnapshotPtr snap;
 
     if ((xsltTopLevelsHash == NULL) || (name == NULL) || (URI == NULL))
         return (NULL);
 
-    xmlMutexLock(xsltExtMutex);
-
-    XML_CAST_FPTR(ret) = xmlHashLookup2(xsltTopLevelsHash, name, URI);
-
-    xmlMutexUnlock(xsltExtMutex);
+    snap = xsltExtGetSnapshot();
+    if ((snap != NULL) && (snap->topLevels != NULL))
+        XML_CAST_FPTR(ret) = xmlHashLookup2(snap->topLevels, name, URI);
+    xsltExtReleaseSnapshot();
 
     /* if lookup fails, attempt a dynamic load on supported platforms */
     if (NULL == ret) {
         if (!xsltExtModuleRegisterDynamic(URI)) {
-            xmlMutexLock(xsltExtMutex);
-
-            XML_CAST_FPTR(ret) = xmlHashLookup2(xsltTopLevelsHash, name, URI);
-
-            xmlMutexUnlock(xsltExtMutex);
+            snap = xsltExtGetSnapshot();
+            if ((snap != NULL) && (snap->topLevels != NULL))
+                XML_CAST_FPTR(ret) =
+                    xmlHashLookup2(snap->topLevels, name, URI);
+            xsltExtReleaseSnapshot();
         }
     }
 
@@ -1898,6 +2472,8 @@ xsltUnregisterExtModuleTopLevel(const xmlChar * name, const xmlChar * URI)
     xmlMutexLock(xsltExtMutex);
 
     ret = xmlHashRemoveEntry2(xsltTopLevelsHash, name, URI, NULL);
+    if (ret == 0)
+        xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 
@@ -1916,6 +2492,7 @@ xsltUnregisterAllExtModuleTopLevel(void)
 
     xmlHashFree(xsltTopLevelsHash, NULL);
     xsltTopLevelsHash = NULL;
+    xsltExtInvalidateSnapshot();
 
     xmlMutexUnlock(xsltExtMutex);
 }
@@ -2262,6 +2839,10 @@ xsltInitGlobals(void)
 {
     if (xsltExtMutex == NULL) {
         xsltExtMutex = xmlNewMutex();
+#ifdef XSLT_EXT_LOCK_FREE
+        if (pthread_key_create(&xsltExtReaderKey, xsltExtReleaseReader) == 0)
+            xsltExtReaderKeyValid = 1;
+#endif
     }
 }
 
@@ -2285,6 +2866,25 @@ xsltCleanupGlobals(void)
         xmlHashFree(xsltModuleHash, NULL);
         xsltModuleHash = NULL;
     }
+    /* all the snapshots were retired by the unregistrations */
+    while (xsltExtRetired != NULL) {
+        xsltExtSnapshotPtr snap = xsltExtRetired;
+
+        xsltExtRetired = snap->next;
+        xsltExtFreeSnapshot(snap);
+    }
+#ifdef XSLT_EXT_LOCK_FREE
+    if (xsltExtReaderKeyValid) {
+        pthread_key_delete(xsltExtReaderKey);
+        xsltExtReaderKeyValid = 0;
+    }
+    while (xsltExtReaders != NULL) {
+        xsltExtReaderPtr reader = xsltExtReaders;
+
+        xsltExtReaders = reader->next;
+        xmlFree(reader);
+    }
+#endif
     xmlMutexUnlock(xsltExtMutex);
 
     xmlFreeMutex(xsltExtMutex);
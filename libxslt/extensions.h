@@ -130,6 +130,13 @@ XSLTPUBFUN int XSLTCALL
 XSLTPUBFUN xmlXPathFunction XSLTCALL
 	xsltExtModuleFunctionLookup	(const xmlChar *name,
 					 const xmlChar *URI);
+XSLTPUBFUN xmlXPathFunction XSLTCALL
+	xsltStyleExtFunctionLookup	(xsltStylesheetPtr style,
+					 const xmlChar *name,
+					 const xmlChar *URI);
+XSLTPUBFUN int XSLTCALL
+		xsltPreResolveExtFunctions
+					(xsltStylesheetPtr style);
 XSLTPUBFUN int XSLTCALL
 		xsltUnregisterExtModuleFunction
 					(const xmlChar *name,
@@ -227,6 +234,9 @@ XSLTPUBFUN int XSLTCALL
 					 const xmlChar *URI);
 XSLTPUBFUN int XSLTCALL
 		xsltInitCtxtExts	(xsltTransformContextPtr ctxt);
+XSLTPUBFUN int XSLTCALL
+		xsltInitCtxtExtByURI	(xsltTransformContextPtr ctxt,
+					 const xmlChar *URI);
 XSLTPUBFUN void XSLTCALL
 		xsltFreeCtxtExts	(xsltTransformContextPtr ctxt);
 XSLTPUBFUN void XSLTCALL
@@ -83,8 +83,29 @@ xsltXPathFunctionLookup (xmlXPathContextPtr ctxt,
     */
     XML_CAST_FPTR(ret) = xmlHashLookup2(ctxt->funcHash, name, ns_uri);
 
-    if (ret == NULL)
-	ret = xsltExtModuleFunctionLookup(name, ns_uri);
+    if (ret == NULL) {
+	xsltTransformContextPtr tctxt = (xsltTransformContextPtr) ctxt->extra;
+
+	if (tctxt != NULL) {
+	    /*
+	     * Extension modules are initialized on first use, the one
+	     * owning this namespace may register context-level functions.
+	     */
+	    if (xsltInitCtxtExtByURI(tctxt, ns_uri) > 0)
+		XML_CAST_FPTR(ret) = xmlHashLookup2(ctxt->funcHash, name,
+		                                    ns_uri);
+	    if (ret == NULL)
+		ret = xsltStyleExtFunctionLookup(tctxt->style, name, ns_uri);
+	    /*
+	     * Modules like EXSLT func:function register functions in
+	     * other namespaces, bring up the ones still pending.
+	     */
+	    if ((ret == NULL) && (xsltInitCtxtExts(tctxt) > 0))
+		XML_CAST_FPTR(ret) = xmlHashLookup2(ctxt->funcHash, name,
+		                                    ns_uri);
+	} else
+	    ret = xsltExtModuleFunctionLookup(name, ns_uri);
+    }
 
 #ifdef WITH_XSLT_DEBUG_FUNCTION
     if (ret != NULL)
@@ -213,6 +234,84 @@ out_fragment:
     valuePush(ctxt, xmlXPathNewNodeSet(NULL));
 }
 
+/**
+ * xsltDocumentFunctionBase:
+ * @tctxt:  the XSLT transformation context
+ * @target:  the first node of the second argument of document(), or NULL
+ *
+ * Computes the base URI against which document() resolves its string
+ * arguments: the one of @target, or of the current instruction if
+ * there is none.
+ *
+ * Returns the base URI to free, or NULL
+ */
+static xmlChar *
+xsltDocumentFunctionBase(xsltTransformContextPtr tctxt, xmlNodePtr target)
+{
+    if ((target != NULL) && IS_XSLT_REAL_NODE(target)) {
+        if ((target->type == XML_ATTRIBUTE_NODE) ||
+            (target->type == XML_PI_NODE)) {
+            target = ((xmlAttrPtr) target)->parent;
+        }
+        return(xmlNodeGetBase(target->doc, target));
+    }
+    if ((tctxt != NULL) && (tctxt->inst != NULL))
+        return(xmlNodeGetBase(tctxt->inst->doc, tctxt->inst));
+    if ((tctxt != NULL) && (tctxt->style != NULL) &&
+        (tctxt->style->doc != NULL))
+        return(xmlNodeGetBase(tctxt->style->doc,
+                              (xmlNodePtr) tctxt->style->doc));
+    return(NULL);
+}
+
+/**
+ * xsltDocumentFunctionPrefetch:
+ * @ctxt:  the XPath Parser context
+ * @nodes:  the nodes holding the URIs
+ * @obj2:  the second argument of document(), or NULL
+ *
+ * Resolves the URIs of a node-set argument of document() and lets
+ * xsltPrefetchDocuments() parse the documents concurrently before
+ * they are loaded one after the other.
+ */
+static void
+xsltDocumentFunctionPrefetch(xmlXPathParserContextPtr ctxt,
+                             xmlNodeSetPtr nodes, xmlXPathObjectPtr obj2)
+{
+    xsltTransformContextPtr tctxt;
+    xmlNodePtr target = NULL;
+    xmlChar **URIs;
+    xmlChar *str, *base;
+    int i, nbURIs = 0;
+
+    tctxt = xsltXPathGetTransformContext(ctxt);
+    if (tctxt == NULL)
+        return;
+    URIs = (xmlChar **) xmlMalloc(nodes->nodeNr * sizeof(xmlChar *));
+    if (URIs == NULL)
+        return;
+    if ((obj2 != NULL) && (obj2->nodesetval != NULL) &&
+        (obj2->nodesetval->nodeNr > 0))
+        target = obj2->nodesetval->nodeTab[0];
+    for (i = 0; i < nodes->nodeNr; i++) {
+        str = xmlXPathCastNodeToString(nodes->nodeTab[i]);
+        if (str == NULL)
+            continue;
+        base = xsltDocumentFunctionBase(tctxt,
+                (obj2 != NULL) ? target : nodes->nodeTab[i]);
+        URIs[nbURIs] = xmlBuildURI(str, base);
+        if (URIs[nbURIs] != NULL)
+            nbURIs++;
+        if (base != NULL)
+            xmlFree(base);
+        xmlFree(str);
+    }
+    xsltPrefetchDocuments(tctxt, (const xmlChar **) URIs, nbURIs);
+    for (i = 0; i < nbURIs; i++)
+        xmlFree(URIs[i]);
+    xmlFree(URIs);
+}
+
 /**
  * xsltDocumentFunction:
  * @ctxt:  the XPath Parser context
@@ -260,6 +359,11 @@ xsltDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs)
         obj = valuePop(ctxt);
         ret = xmlXPathNewNodeSet(NULL);
 
+        if ((obj != NULL) && (obj->nodesetval != NULL) &&
+            (obj->nodesetval->nodeNr > 1) &&
+            (xsltGetDocumentThreads() != 0))
+            xsltDocumentFunctionPrefetch(ctxt, obj->nodesetval, obj2);
+
         if ((obj != NULL) && obj->nodesetval) {
             for (i = 0; i < obj->nodesetval->nodeNr; i++) {
                 valuePush(ctxt,
@@ -306,25 +410,11 @@ xsltDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs)
         xsltTransformContextPtr tctxt;
         tctxt = xsltXPathGetTransformContext(ctxt);
         if ((obj2 != NULL) && (obj2->nodesetval != NULL) &&
-            (obj2->nodesetval->nodeNr > 0) &&
-            IS_XSLT_REAL_NODE(obj2->nodesetval->nodeTab[0])) {
-            xmlNodePtr target;
-
-            target = obj2->nodesetval->nodeTab[0];
-            if ((target->type == XML_ATTRIBUTE_NODE) ||
-	        (target->type == XML_PI_NODE)) {
-                target = ((xmlAttrPtr) target)->parent;
-            }
-            base = xmlNodeGetBase(target->doc, target);
-        } else {
-            if ((tctxt != NULL) && (tctxt->inst != NULL)) {
-                base = xmlNodeGetBase(tctxt->inst->doc, tctxt->inst);
-            } else if ((tctxt != NULL) && (tctxt->style != NULL) &&
-                       (tctxt->style->doc != NULL)) {
-                base = xmlNodeGetBase(tctxt->style->doc,
-                                      (xmlNodePtr) tctxt->style->doc);
-            }
-        }
+            (obj2->nodesetval->nodeNr > 0))
+            base = xsltDocumentFunctionBase(tctxt,
+                                            obj2->nodesetval->nodeTab[0]);
+        else
+            base = xsltDocumentFunctionBase(tctxt, NULL);
         URI = xmlBuildURI(obj->stringval, base);
         if (base != NULL)
             xmlFree(base);
@@ -347,6 +437,87 @@ xsltDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs)
         xmlXPathFreeObject(obj2);
 }
 
+/**
+ * xsltKeyMergeNodeSets:
+ * @ctxt:  the XSLT transformation context
+ * @sets:  an array of node-sets in document order
+ * @nbSets:  the number of node-sets
+ *
+ * Merges node-sets which are each in document order and free of
+ * duplicates, as the per-value lists of a key table are, using a k-way
+ * merge over a heap of the list heads. Duplicates end up adjacent and are
+ * dropped, and the result is in document order without a separate sort.
+ *
+ * Returns the new node-set or NULL in case of error.
+ */
+static xmlNodeSetPtr
+xsltKeyMergeNodeSets(xsltTransformContextPtr ctxt, xmlNodeSetPtr *sets,
+		     int nbSets) {
+    xmlNodeSetPtr ret;
+    int *heap, *pos;
+    int i, nbHeap, parent, child, cur;
+    xmlNodePtr node, last = NULL;
+
+    ret = xmlXPathNodeSetCreate(NULL);
+    if ((ret == NULL) || (nbSets <= 0))
+	return(ret);
+    heap = (int *) xmlMalloc(2 * nbSets * sizeof(int));
+    if (heap == NULL) {
+	xmlXPathFreeNodeSet(ret);
+	return(NULL);
+    }
+    pos = heap + nbSets;
+
+/*
+* The heap holds set indexes, ordered on the next node of each set.
+*/
+#define XSLT_KEY_HEAD(h) (sets[heap[h]]->nodeTab[pos[heap[h]]])
+#define XSLT_KEY_BEFORE(a, b) (xsltCmpDocumentOrder(ctxt, XSLT_KEY_HEAD(a), \
+						    XSLT_KEY_HEAD(b)) > 0)
+
+    nbHeap = 0;
+    for (i = 0; i < nbSets; i++) {
+	pos[i] = 0;
+	heap[nbHeap] = i;
+	for (child = nbHeap++; child > 0; child = parent) {
+	    parent = (child - 1) / 2;
+	    if (!XSLT_KEY_BEFORE(child, parent))
+		break;
+	    cur = heap[child];
+	    heap[child] = heap[parent];
+	    heap[parent] = cur;
+	}
+    }
+
+    while (nbHeap > 0) {
+	node = XSLT_KEY_HEAD(0);
+	if (node != last) {
+	    xmlXPathNodeSetAddUnique(ret, node);
+	    last = node;
+	}
+	if (++pos[heap[0]] >= sets[heap[0]]->nodeNr)
+	    heap[0] = heap[--nbHeap];
+	for (parent = 0; ; parent = child) {
+	    child = 2 * parent + 1;
+	    if (child >= nbHeap)
+		break;
+	    if ((child + 1 < nbHeap) && XSLT_KEY_BEFORE(child + 1, child))
+		child++;
+	    if (!XSLT_KEY_BEFORE(child, parent))
+		break;
+	    cur = heap[child];
+	    heap[child] = heap[parent];
+	    heap[parent] = cur;
+	}
+    }
+
+#undef XSLT_KEY_BEFORE
+#undef XSLT_KEY_HEAD
+
+    xmlFree(heap);
+    return(ret);
+}
+
 /**
  * xsltKeyFunction:
  * @ctxt:  the XPath Parser context
@@ -358,6 +529,14 @@ xsltDocumentFunction(xmlXPathParserContextPtr ctxt, int nargs)
 void
 xsltKeyFunction(xmlXPathParserContextPtr ctxt, int nargs){
     xmlXPathObjectPtr obj1, obj2;
+    xmlNodeSetPtr nodelist = NULL;
+    xmlChar *key = NULL, *value;
+    const xmlChar *keyURI;
+    xsltTransformContextPtr tctxt;
+    xmlChar *qname, *prefix;
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    xmlNodePtr tmpNode = NULL;
+    xsltDocumentPtr oldDocInfo;
 
     if (nargs != 2) {
 	xsltTransformError(xsltXPathGetTransformContext(ctxt), NULL, NULL,
@@ -385,159 +564,170 @@ xsltKeyFunction(xmlXPathParserContextPtr ctxt, int nargs){
     */
     obj1 = valuePop(ctxt);
 
-    if ((obj2->type == XPATH_NODESET) || (obj2->type == XPATH_XSLT_TREE)) {
-	int i;
-	xmlXPathObjectPtr newobj, ret;
+    tctxt = xsltXPathGetTransformContext(ctxt);
 
-	ret = xmlXPathNewNodeSet(NULL);
+    oldDocInfo = tctxt->document;
 
-	if (obj2->nodesetval != NULL) {
-	    for (i = 0; i < obj2->nodesetval->nodeNr; i++) {
-		valuePush(ctxt, xmlXPathObjectCopy(obj1));
-		valuePush(ctxt,
-			  xmlXPathNewNodeSet(obj2->nodesetval->nodeTab[i]));
-		xmlXPathStringFunction(ctxt, 1);
-		xsltKeyFunction(ctxt, 2);
-		newobj = valuePop(ctxt);
-		ret->nodesetval = xmlXPathNodeSetMerge(ret->nodesetval,
-						       newobj->nodesetval);
-		xmlXPathFreeObject(newobj);
-	    }
-	}
-	valuePush(ctxt, ret);
+    if (xpctxt->node == NULL) {
+	xsltTransformError(tctxt, NULL, tctxt->inst,
+	    "Internal error in xsltKeyFunction(): "
+	    "The context node is not set on the XPath context.\n");
+	tctxt->state = XSLT_STATE_STOPPED;
+	goto error;
+    }
+    /*
+     * Get the associated namespace URI if qualified name
+     */
+    qname = obj1->stringval;
+    key = xmlSplitQName2(qname, &prefix);
+    if (key == NULL) {
+	key = xmlStrdup(obj1->stringval);
+	keyURI = NULL;
+	if (prefix != NULL)
+	    xmlFree(prefix);
     } else {
-	xmlNodeSetPtr nodelist = NULL;
-	xmlChar *key = NULL, *value;
-	const xmlChar *keyURI;
-	xsltTransformContextPtr tctxt;
-	xmlChar *qname, *prefix;
-	xmlXPathContextPtr xpctxt = ctxt->context;
-	xmlNodePtr tmpNode = NULL;
-	xsltDocumentPtr oldDocInfo;
-
-	tctxt = xsltXPathGetTransformContext(ctxt);
-
-	oldDocInfo = tctxt->document;
-
-	if (xpctxt->node == NULL) {
-	    xsltTransformError(tctxt, NULL, tctxt->inst,
-		"Internal error in xsltKeyFunction(): "
-		"The context node is not set on the XPath context.\n");
-	    tctxt->state = XSLT_STATE_STOPPED;
-	    goto error;
-	}
-	/*
-	 * Get the associated namespace URI if qualified name
-	 */
-	qname = obj1->stringval;
-	key = xmlSplitQName2(qname, &prefix);
-	if (key == NULL) {
-	    key = xmlStrdup(obj1->stringval);
-	    keyURI = NULL;
-	    if (prefix != NULL)
-		xmlFree(prefix);
-	} else {
-	    if (prefix != NULL) {
-		keyURI = xmlXPathNsLookup(xpctxt, prefix);
-		if (keyURI == NULL) {
-		    xsltTransformError(tctxt, NULL, tctxt->inst,
-			"key() : prefix %s is not bound\n", prefix);
-		    /*
-		    * TODO: Shouldn't we stop here?
-		    */
-		}
-		xmlFree(prefix);
-	    } else {
-		keyURI = NULL;
+	if (prefix != NULL) {
+	    keyURI = xmlXPathNsLookup(xpctxt, prefix);
+	    if (keyURI == NULL) {
+		xsltTransformError(tctxt, NULL, tctxt->inst,
+		    "key() : prefix %s is not bound\n", prefix);
+		/*
+		* TODO: Shouldn't we stop here?
+		*/
 	    }
+	    xmlFree(prefix);
+	} else {
+	    keyURI = NULL;
 	}
+    }
 
+    /*
+    * We need to ensure that ctxt->document is available for
+    * xsltGetKey().
+    * First find the relevant doc, which is the context node's
+    * owner doc; using context->doc is not safe, since
+    * the doc could have been acquired via the document() function,
+    * or the doc might be a Result Tree Fragment.
+    * FUTURE INFO: In XSLT 2.0 the key() function takes an additional
+    * argument indicating the doc to use.
+    */
+    if (xpctxt->node->type == XML_NAMESPACE_DECL) {
 	/*
-	 * Force conversion of first arg to string
-	 */
-	valuePush(ctxt, obj2);
-	xmlXPathStringFunction(ctxt, 1);
-	if ((ctxt->value == NULL) || (ctxt->value->type != XPATH_STRING)) {
-	    xsltTransformError(tctxt, NULL, tctxt->inst,
-		"key() : invalid arg expecting a string\n");
-	    ctxt->error = XPATH_INVALID_TYPE;
-	    goto error;
+	* REVISIT: This is a libxml hack! Check xpath.c for details.
+	* The XPath module sets the owner element of a ns-node on
+	* the ns->next field.
+	*/
+	if ((((xmlNsPtr) xpctxt->node)->next != NULL) &&
+	    (((xmlNsPtr) xpctxt->node)->next->type == XML_ELEMENT_NODE))
+	{
+	    tmpNode = (xmlNodePtr) ((xmlNsPtr) xpctxt->node)->next;
 	}
-	obj2 = valuePop(ctxt);
-	value = obj2->stringval;
+    } else
+	tmpNode = xpctxt->node;
 
-	/*
-	* We need to ensure that ctxt->document is available for
-	* xsltGetKey().
-	* First find the relevant doc, which is the context node's
-	* owner doc; using context->doc is not safe, since
-	* the doc could have been acquired via the document() function,
-	* or the doc might be a Result Tree Fragment.
-	* FUTURE INFO: In XSLT 2.0 the key() function takes an additional
-	* argument indicating the doc to use.
-	*/
-	if (xpctxt->node->type == XML_NAMESPACE_DECL) {
+    if ((tmpNode == NULL) || (tmpNode->doc == NULL)) {
+	xsltTransformError(tctxt, NULL, tctxt->inst,
+	    "Internal error in xsltKeyFunction(): "
+	    "Couldn't get the doc of the XPath context node.\n");
+	goto error;
+    }
+
+    if ((tctxt->document == NULL) ||
+	(tctxt->document->doc != tmpNode->doc))
+    {
+	if (tmpNode->doc->name && (tmpNode->doc->name[0] == ' ')) {
 	    /*
-	    * REVISIT: This is a libxml hack! Check xpath.c for details.
-	    * The XPath module sets the owner element of a ns-node on
-	    * the ns->next field.
+	    * This is a Result Tree Fragment.
 	    */
-	    if ((((xmlNsPtr) xpctxt->node)->next != NULL) &&
-		(((xmlNsPtr) xpctxt->node)->next->type == XML_ELEMENT_NODE))
-	    {
-		tmpNode = (xmlNodePtr) ((xmlNsPtr) xpctxt->node)->next;
+	    if (tmpNode->doc->_private == NULL) {
+		tmpNode->doc->_private = xsltNewDocument(tctxt, tmpNode->doc);
+		if (tmpNode->doc->_private == NULL)
+		    goto error;
 	    }
-	} else
-	    tmpNode = xpctxt->node;
-
-	if ((tmpNode == NULL) || (tmpNode->doc == NULL)) {
+	    tctxt->document = (xsltDocumentPtr) tmpNode->doc->_private;
+	} else {
+	    /*
+	    * May be the initial source doc or a doc acquired via the
+	    * document() function.
+	    */
+	    tctxt->document = xsltFindDocument(tctxt, tmpNode->doc);
+	}
+	if (tctxt->document == NULL) {
 	    xsltTransformError(tctxt, NULL, tctxt->inst,
 		"Internal error in xsltKeyFunction(): "
-		"Couldn't get the doc of the XPath context node.\n");
+		"Could not get the document info of a context doc.\n");
+	    tctxt->state = XSLT_STATE_STOPPED;
 	    goto error;
 	}
+    }
 
-	if ((tctxt->document == NULL) ||
-	    (tctxt->document->doc != tmpNode->doc))
-	{
-	    if (tmpNode->doc->name && (tmpNode->doc->name[0] == ' ')) {
-		/*
-		* This is a Result Tree Fragment.
-		*/
-		if (tmpNode->doc->_private == NULL) {
-		    tmpNode->doc->_private = xsltNewDocument(tctxt, tmpNode->doc);
-		    if (tmpNode->doc->_private == NULL)
-			goto error;
-		}
-		tctxt->document = (xsltDocumentPtr) tmpNode->doc->_private;
-	    } else {
-		/*
-		* May be the initial source doc or a doc acquired via the
-		* document() function.
-		*/
-		tctxt->document = xsltFindDocument(tctxt, tmpNode->doc);
-	    }
-	    if (tctxt->document == NULL) {
+    if ((obj2->type == XPATH_NODESET) || (obj2->type == XPATH_XSLT_TREE)) {
+	xmlNodeSetPtr *sets = NULL;
+	int i, nbSets = 0;
+
+	/*
+	* Look up the key for the string value of every node, then merge
+	* the resulting lists at once.
+	*/
+	if ((obj2->nodesetval != NULL) && (obj2->nodesetval->nodeNr > 0)) {
+	    sets = (xmlNodeSetPtr *) xmlMalloc(obj2->nodesetval->nodeNr *
+					       sizeof(xmlNodeSetPtr));
+	    if (sets == NULL) {
 		xsltTransformError(tctxt, NULL, tctxt->inst,
-		    "Internal error in xsltKeyFunction(): "
-		    "Could not get the document info of a context doc.\n");
-		tctxt->state = XSLT_STATE_STOPPED;
+		    "key() : out of memory\n");
+		ctxt->error = XPATH_MEMORY_ERROR;
 		goto error;
 	    }
+	    for (i = 0; i < obj2->nodesetval->nodeNr; i++) {
+		value = xmlXPathCastNodeToString(obj2->nodesetval->nodeTab[i]);
+		if (value == NULL)
+		    continue;
+		nodelist = xsltGetKey(tctxt, key, keyURI, value);
+		xmlFree(value);
+		if ((nodelist != NULL) && (nodelist->nodeNr > 0) &&
+		    ((nbSets == 0) || (sets[nbSets - 1] != nodelist)))
+		    sets[nbSets++] = nodelist;
+	    }
 	}
-	/*
-	* Get/compute the key value.
-	*/
-	nodelist = xsltGetKey(tctxt, key, keyURI, value);
-
-error:
 	tctxt->document = oldDocInfo;
-	valuePush(ctxt, xmlXPathWrapNodeSet(
-	    xmlXPathNodeSetMerge(NULL, nodelist)));
-	if (key != NULL)
-	    xmlFree(key);
+	if (nbSets == 1)
+	    valuePush(ctxt, xmlXPathWrapNodeSet(
+		xmlXPathNodeSetMerge(NULL, sets[0])));
+	else
+	    valuePush(ctxt, xmlXPathWrapNodeSet(
+		xsltKeyMergeNodeSets(tctxt, sets, nbSets)));
+	if (sets != NULL)
+	    xmlFree(sets);
+	goto done;
     }
 
+    /*
+     * Force conversion of first arg to string
+     */
+    valuePush(ctxt, obj2);
+    xmlXPathStringFunction(ctxt, 1);
+    if ((ctxt->value == NULL) || (ctxt->value->type != XPATH_STRING)) {
+	xsltTransformError(tctxt, NULL, tctxt->inst,
+	    "key() : invalid arg expecting a string\n");
+	ctxt->error = XPATH_INVALID_TYPE;
+	obj2 = NULL;
+	goto error;
+    }
+    obj2 = valuePop(ctxt);
+    value = obj2->stringval;
+
+    /*
+    * Get/compute the key value.
+    */
+    nodelist = xsltGetKey(tctxt, key, keyURI, value);
+
+error:
+    tctxt->document = oldDocInfo;
+    valuePush(ctxt, xmlXPathWrapNodeSet(
+	xmlXPathNodeSetMerge(NULL, nodelist)));
+done:
+    if (key != NULL)
+	xmlFree(key);
     if (obj1 != NULL)
 	xmlXPathFreeObject(obj1);
     if (obj2 != NULL)
@@ -558,7 +748,7 @@ xsltUnparsedEntityURIFunction(xmlXPathParserContextPtr ctxt, int nargs){
     xmlChar *str;
 
     if ((nargs != 1) || (ctxt->value == NULL)) {
-        xsltGenericError(xsltGenericErrorContext,
+        xsltTransformError(xsltXPathGetTransformContext(ctxt), NULL, NULL,
 		"unparsed-entity-uri() : expects one string arg\n");
 	ctxt->error = XPATH_INVALID_ARITY;
 	return;
@@ -687,7 +877,8 @@ xsltGenerateIdFunction(xmlXPathParserContextPtr ctxt, int nargs){
 	}
 	cur = nodelist->nodeTab[0];
 	for (i = 1;i < nodelist->nodeNr;i++) {
-	    ret = xmlXPathCmpNodes(cur, nodelist->nodeTab[i]);
+	    ret = xsltCmpDocumentOrder(xsltXPathGetTransformContext(ctxt),
+				       cur, nodelist->nodeTab[i]);
 	    if (ret == -1)
 	        cur = nodelist->nodeTab[i];
 	}
@@ -28,6 +28,7 @@
 #include "imports.h"
 #include "templates.h"
 #include "keys.h"
+#include "documents.h"
 
 #ifdef WITH_XSLT_DEBUG
 #define WITH_XSLT_DEBUG_KEYS
@@ -81,10 +82,10 @@ static void
 xsltFreeKeyDef(xsltKeyDefPtr keyd) {
     if (keyd == NULL)
 	return;
-    if (keyd->comp != NULL)
-	xmlXPathFreeCompExpr(keyd->comp);
-    if (keyd->usecomp != NULL)
-	xmlXPathFreeCompExpr(keyd->usecomp);
+    /*
+    * keyd->comp and keyd->usecomp are owned by the principal
+    * stylesheet, see xsltXPathCompileShared().
+    */
     if (keyd->name != NULL)
 	xmlFree(keyd->name);
     if (keyd->nameURI != NULL)
@@ -201,6 +202,43 @@ xsltFreeKeys(xsltStylesheetPtr style) {
 	xsltFreeKeyDefList((xsltKeyDefPtr) style->keys);
 }
 
+/**
+ * xsltPruneKeys:
+ * @style: an XSLT stylesheet
+ * @names:  the local names of the keys which can be used
+ *
+ * Removes the key definitions of @style whose local name is not in
+ * @names, so that they are not computed for the source documents.
+ *
+ * Returns the number of key definitions removed
+ */
+int
+xsltPruneKeys(xsltStylesheetPtr style, xmlHashTablePtr names) {
+    xsltKeyDefPtr cur, next, last = NULL;
+    int nbPruned = 0;
+
+    if ((style == NULL) || (names == NULL))
+	return(0);
+
+    for (cur = (xsltKeyDefPtr) style->keys; cur != NULL; cur = next) {
+	next = cur->next;
+	if (xmlHashLookup(names, cur->name) == NULL) {
+#ifdef WITH_XSLT_DEBUG_KEYS
+	    xsltGenericDebug(xsltGenericDebugContext,
+		"Pruned key %s\n", cur->name);
+#endif
+	    if (last == NULL)
+		style->keys = next;
+	    else
+		last->next = next;
+	    xsltFreeKeyDef(cur);
+	    nbPruned++;
+	} else
+	    last = cur;
+    }
+    return(nbPruned);
+}
+
 /**
  * skipString:
  * @cur: the current pointer
@@ -364,9 +402,9 @@ xsltAddKey(xsltStylesheetPtr style, const xmlChar *name,
     *   marks, could be sufficient.
     */
 #ifdef XML_XPATH_NOVAR
-    key->comp = xsltXPathCompileFlags(style, pattern, XML_XPATH_NOVAR);
+    key->comp = xsltXPathCompileShared(style, pattern, XML_XPATH_NOVAR, inst);
 #else
-    key->comp = xsltXPathCompile(style, pattern);
+    key->comp = xsltXPathCompileShared(style, pattern, 0, inst);
 #endif
     if (key->comp == NULL) {
 	xsltTransformError(NULL, style, inst,
@@ -375,9 +413,9 @@ xsltAddKey(xsltStylesheetPtr style, const xmlChar *name,
 	if (style != NULL) style->errors++;
     }
 #ifdef XML_XPATH_NOVAR
-    key->usecomp = xsltXPathCompileFlags(style, use, XML_XPATH_NOVAR);
+    key->usecomp = xsltXPathCompileShared(style, use, XML_XPATH_NOVAR, inst);
 #else
-    key->usecomp = xsltXPathCompile(style, use);
+    key->usecomp = xsltXPathCompileShared(style, use, 0, inst);
 #endif
     if (key->usecomp == NULL) {
 	xsltTransformError(NULL, style, inst,
@@ -599,6 +637,139 @@ fprintf(stderr, "xsltInitAllDocKeys: done\n");
     return(0);
 }
 
+/*
+ * The set of nodes of a document matched by at least one xsl:key. It is
+ * owned by the document info of the transformation, so computing keys
+ * never writes to the nodes of the input tree.
+ */
+typedef struct _xsltKeyedNodes xsltKeyedNodes;
+typedef xsltKeyedNodes *xsltKeyedNodesPtr;
+struct _xsltKeyedNodes {
+    int size;			/* the number of slots, a power of two */
+    int nbNodes;		/* the number of nodes in the set */
+    const void **nodes;		/* the node of each slot or NULL */
+};
+
+#define XSLT_KEYED_HASH(node, size)					\
+    ((int) ((((size_t) (node)) >> 4) * 2654435761u) & ((size) - 1))
+
+/**
+ * xsltAddKeyedNode:
+ * @idoc:  the document info
+ * @node:  a node matched by a key definition
+ *
+ * Records that @node is matched by a key in the document info.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+static int
+xsltAddKeyedNode(xsltDocumentPtr idoc, const void *node) {
+    xsltKeyedNodesPtr keyed = (xsltKeyedNodesPtr) idoc->keyed;
+    int i;
+
+    if (keyed == NULL) {
+	keyed = (xsltKeyedNodesPtr) xmlMalloc(sizeof(xsltKeyedNodes));
+	if (keyed == NULL)
+	    return(-1);
+	keyed->size = 64;
+	keyed->nbNodes = 0;
+	keyed->nodes = (const void **) xmlMalloc(keyed->size * sizeof(void *));
+	if (keyed->nodes == NULL) {
+	    xmlFree(keyed);
+	    return(-1);
+	}
+	memset(keyed->nodes, 0, keyed->size * sizeof(void *));
+	idoc->keyed = keyed;
+    } else if (4 * (keyed->nbNodes + 1) > 3 * keyed->size) {
+	const void **old = keyed->nodes;
+	int oldSize = keyed->size, j;
+
+	keyed->nodes = (const void **)
+	    xmlMalloc(2 * oldSize * sizeof(void *));
+	if (keyed->nodes == NULL) {
+	    keyed->nodes = old;
+	    return(-1);
+	}
+	keyed->size = 2 * oldSize;
+	memset(keyed->nodes, 0, keyed->size * sizeof(void *));
+	for (j = 0; j < oldSize; j++) {
+	    if (old[j] == NULL)
+		continue;
+	    i = XSLT_KEYED_HASH(old[j], keyed->size);
+	    while (keyed->nodes[i] != NULL)
+		i = (i + 1) & (keyed->size - 1);
+	    keyed->nodes[i] = old[j];
+	}
+	xmlFree((void *) old);
+    }
+
+    i = XSLT_KEYED_HASH(node, keyed->size);
+    while (keyed->nodes[i] != NULL) {
+	if (keyed->nodes[i] == node)
+	    return(0);
+	i = (i + 1) & (keyed->size - 1);
+    }
+    keyed->nodes[i] = node;
+    keyed->nbNodes++;
+    return(0);
+}
+
+/**
+ * xsltIsKeyedNode:
+ * @ctxt:  an XSLT transformation context
+ * @node:  a node
+ *
+ * Checks whether @node was matched by a key definition when the keys of
+ * its document were computed in this transformation.
+ *
+ * Returns 1 if the node is keyed, 0 otherwise.
+ */
+int
+xsltIsKeyedNode(xsltTransformContextPtr ctxt, xmlNodePtr node) {
+    xsltDocumentPtr idoc;
+    xsltKeyedNodesPtr keyed;
+    int i;
+
+    /*
+    * Namespace nodes are xmlNs structures without a document, and key
+    * patterns can't match them.
+    */
+    if ((ctxt == NULL) || (node == NULL) ||
+	(node->type == XML_NAMESPACE_DECL) || (node->doc == NULL))
+	return(0);
+    if ((ctxt->document != NULL) && (ctxt->document->doc == node->doc))
+	idoc = ctxt->document;
+    else if (XSLT_IS_RES_TREE_FRAG(node->doc))
+	idoc = (xsltDocumentPtr) node->doc->_private;
+    else
+	idoc = xsltFindDocument(ctxt, node->doc);
+    if ((idoc == NULL) || (idoc->keyed == NULL))
+	return(0);
+
+    keyed = (xsltKeyedNodesPtr) idoc->keyed;
+    i = XSLT_KEYED_HASH(node, keyed->size);
+    while (keyed->nodes[i] != NULL) {
+	if (keyed->nodes[i] == (const void *) node)
+	    return(1);
+	i = (i + 1) & (keyed->size - 1);
+    }
+    return(0);
+}
+
+/**
+ * xsltSortKeyList:
+ * @keylist:  the node-set of a key value
+ * @data:  the XSLT transformation context
+ * @name:  the key value
+ *
+ * Sorts the nodes of a key value in document order.
+ */
+static void
+xsltSortKeyList(xmlNodeSetPtr keylist, void *data,
+		const xmlChar *name ATTRIBUTE_UNUSED) {
+    xsltCtxtDocumentSortFunction((xsltTransformContextPtr) data, keylist);
+}
+
 /**
  * xsltInitCtxtKey:
  * @ctxt: an XSLT transformation context
@@ -618,6 +789,7 @@ xsltInitCtxtKey(xsltTransformContextPtr ctxt, xsltDocumentPtr idoc,
     xmlXPathObjectPtr matchRes = NULL, useRes = NULL;
     xmlChar *str = NULL;
     xsltKeyTablePtr table;
+    int tableShared = 0;
     xmlNodePtr oldInst, cur;
     xmlNodePtr oldContextNode;
     xsltDocumentPtr oldDocInfo;
@@ -744,6 +916,8 @@ fprintf(stderr, "xsltInitCtxtKey %s : %d\n", keyDef->name, ctxt->keyInitLevel);
 	    goto error;
         table->next = idoc->keys;
         idoc->keys = table;
+    } else {
+	tableShared = 1;
     }
 
     /*
@@ -829,14 +1003,11 @@ fprintf(stderr, "xsltInitCtxtKey %s : %d\n", keyDef->name, ctxt->keyInitLevel);
 		case XML_CDATA_SECTION_NODE:
 		case XML_PI_NODE:
 		case XML_COMMENT_NODE:
-		    cur->psvi = keyDef;
-		    break;
 		case XML_ATTRIBUTE_NODE:
-		    ((xmlAttrPtr) cur)->psvi = keyDef;
-		    break;
 		case XML_DOCUMENT_NODE:
 		case XML_HTML_DOCUMENT_NODE:
-		    ((xmlDocPtr) cur)->psvi = keyDef;
+		    if (xsltAddKeyedNode(idoc, cur) < 0)
+			goto error;
 		    break;
 		default:
 		    break;
@@ -852,6 +1023,14 @@ next_string:
 	}
     }
 
+    /*
+    * The nodes matched by a single key definition are added in document
+    * order. If another definition with the same name already filled the
+    * table, restore that order so key() can merge lists without sorting.
+    */
+    if (tableShared)
+	xmlHashScan(table->keys, (xmlHashScanner) xsltSortKeyList, ctxt);
+
 exit:
 error:
     ctxt->keyInitLevel--;
@@ -929,7 +1108,13 @@ fprintf(stderr, "xsltInitCtxtKeys on document: done\n");
  */
 void
 xsltFreeDocumentKeys(xsltDocumentPtr idoc) {
-    if (idoc != NULL)
+    if (idoc != NULL) {
         xsltFreeKeyTableList(idoc->keys);
+	if (idoc->keyed != NULL) {
+	    xmlFree(((xsltKeyedNodesPtr) idoc->keyed)->nodes);
+	    xmlFree(idoc->keyed);
+	    idoc->keyed = NULL;
+	}
+    }
 }
 
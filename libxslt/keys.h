@@ -42,8 +42,14 @@ XSLTPUBFUN void XSLTCALL
 					 xsltDocumentPtr doc);
 XSLTPUBFUN void XSLTCALL
 		xsltFreeKeys		(xsltStylesheetPtr style);
+XSLTPUBFUN int XSLTCALL
+		xsltPruneKeys		(xsltStylesheetPtr style,
+					 xmlHashTablePtr names);
 XSLTPUBFUN void XSLTCALL
 		xsltFreeDocumentKeys	(xsltDocumentPtr doc);
+XSLTPUBFUN int XSLTCALL
+		xsltIsKeyedNode		(xsltTransformContextPtr ctxt,
+					 xmlNodePtr node);
 
 #ifdef __cplusplus
 }
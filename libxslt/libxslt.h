@@ -27,6 +27,15 @@
 #endif
 #endif
 
+/*
+ * The structured error handlers get a const error since libxml2 2.12.
+ */
+#if LIBXML_VERSION >= 21200
+#define XSLT_ERROR_CONST const
+#else
+#define XSLT_ERROR_CONST
+#endif
+
 #if defined(_MSC_VER) || defined(__MINGW32__)
 #include <io.h>
 #include <direct.h>
@@ -112,6 +112,7 @@ struct _xsltCompMatch {
     xmlNsPtr *nsList;		/* the namespaces in scope */
     int nsNr;			/* the number of namespaces in scope */
     xsltStepOpPtr steps;        /* ops for computation */
+    xmlDictPtr dict;		/* dict holding element and attribute names */
 };
 
 typedef struct _xsltParserContext xsltParserContext;
@@ -186,7 +187,8 @@ xsltFreeCompMatch(xsltCompMatchPtr comp) {
 	xmlFree(comp->nsList);
     for (i = 0;i < comp->nbStep;i++) {
 	op = &comp->steps[i];
-	if (op->value != NULL)
+	if ((op->value != NULL) &&
+	    ((comp->dict == NULL) || (!xmlDictOwns(comp->dict, op->value))))
 	    xmlFree(op->value);
 	if (op->value2 != NULL)
 	    xmlFree(op->value2);
@@ -313,6 +315,24 @@ xsltCompMatchAdd(xsltParserContextPtr ctxt, xsltCompMatchPtr comp,
         comp->maxStep *= 2;
 	comp->steps = tmp;
     }
+    /*
+     * Intern element and attribute names in the stylesheet dictionary,
+     * input names parsed through it can then be compared by pointer.
+     * Runtime compilations must not grow the shared dictionary.
+     */
+    if (((op == XSLT_OP_ELEM) || (op == XSLT_OP_ATTR)) && (value != NULL) &&
+        (ctxt->ctxt == NULL) && (ctxt->style != NULL) &&
+        (ctxt->style->dict != NULL) &&
+        ((comp->dict == NULL) || (comp->dict == ctxt->style->dict))) {
+	const xmlChar *name;
+
+	name = xmlDictLookup(ctxt->style->dict, value, -1);
+	if (name != NULL) {
+	    xmlFree(value);
+	    value = (xmlChar *) name;
+	    comp->dict = ctxt->style->dict;
+	}
+    }
     comp->steps[comp->nbStep].op = op;
     comp->steps[comp->nbStep].value = value;
     comp->steps[comp->nbStep].value2 = value2;
@@ -623,6 +643,38 @@ xsltTestCompMatchDirect(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
     return(0);
 }
 
+/**
+ * xsltDocNamesShared:
+ * @ctxt:  a XSLT process context
+ * @doc:  a document being matched
+ *
+ * Check whether the names of @doc were parsed through a dictionary
+ * resolving into the stylesheet one, i.e. the transformation input
+ * parsed by xsltParseInputFile() or a document loaded by document().
+ * Equal names of such a document are then the same string, and are
+ * the same string as the pattern names too.
+ *
+ * Returns 1 if so, 0 otherwise
+ */
+static int
+xsltDocNamesShared(xsltTransformContextPtr ctxt, xmlDocPtr doc) {
+    if ((doc == NULL) || (doc->dict == NULL))
+	return(0);
+    if (doc->dict == ctxt->inputDict)
+	return(1);
+    return((doc->dict == ctxt->dict) && (!XSLT_IS_RES_TREE_FRAG(doc)));
+}
+
+/*
+ * XSLT_SAME_NAME:
+ *
+ * Compare two node names, by pointer only if they are known to be
+ * interned in the same dictionary.
+ */
+#define XSLT_SAME_NAME(shared, a, b)					\
+    (((a) == (b)) ||							\
+     ((!(shared)) && ((a)[0] == (b)[0]) && (xmlStrEqual((a), (b)))))
+
 /**
  * xsltTestPredicateMatch:
  * @ctxt: a XSLT process context
@@ -645,6 +697,7 @@ xsltTestPredicateMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
     int pos = 0, len = 0;
     int isRVT;
     int match;
+    int sharedNames;
 
     if (step->value == NULL)
         return(0);
@@ -656,6 +709,7 @@ xsltTestPredicateMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
         isRVT = 1;
     else
         isRVT = 0;
+    sharedNames = xsltDocNamesShared(ctxt, doc);
 
     /*
      * Recompute contextSize and proximityPosition.
@@ -689,8 +743,8 @@ xsltTestPredicateMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
                 if ((sibling->type == XML_ELEMENT_NODE) &&
                     (previous->name != NULL) &&
                     (sibling->name != NULL) &&
-                    (previous->name[0] == sibling->name[0]) &&
-                    (xmlStrEqual(previous->name, sibling->name)))
+                    (XSLT_SAME_NAME(sharedNames, previous->name,
+                                    sibling->name)))
                 {
                     if ((sel->value2 == NULL) ||
                         ((sibling->ns != NULL) &&
@@ -709,8 +763,8 @@ xsltTestPredicateMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
                     if ((sibling->type == XML_ELEMENT_NODE) &&
                         (previous->name != NULL) &&
                         (sibling->name != NULL) &&
-                        (previous->name[0] == sibling->name[0]) &&
-                        (xmlStrEqual(previous->name, sibling->name)))
+                        (XSLT_SAME_NAME(sharedNames, previous->name,
+                                        sibling->name)))
                     {
                         if ((sel->value2 == NULL) ||
                             ((sibling->ns != NULL) &&
@@ -756,8 +810,8 @@ xsltTestPredicateMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
                         pos = len;
                     } else if ((node->name != NULL) &&
                                (siblings->name != NULL) &&
-                        (node->name[0] == siblings->name[0]) &&
-                        (xmlStrEqual(node->name, siblings->name))) {
+                        (XSLT_SAME_NAME(sharedNames, node->name,
+                                        siblings->name))) {
                         if ((sel->value2 == NULL) ||
                             ((siblings->ns != NULL) &&
                              (xmlStrEqual(sel->value2, siblings->ns->href))))
@@ -917,6 +971,7 @@ xsltTestCompMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
     xmlNodePtr node = matchNode;
     xsltStepOpPtr step, sel = NULL;
     xsltStepStates states = {0, 0, NULL}; /* // may require backtrack */
+    int sharedNames;
 
     if ((comp == NULL) || (node == NULL) || (ctxt == NULL)) {
 	xsltTransformError(ctxt, NULL, node,
@@ -948,6 +1003,16 @@ xsltTestCompMatch(xsltTransformContextPtr ctxt, xsltCompMatchPtr comp,
 	    return(0);
     }
 
+    /*
+     * The pattern names and those of a document parsed through the
+     * stylesheet dictionary are interned in the same place, different
+     * pointers are then different names.
+     */
+    sharedNames = ((comp->dict != NULL) && (ctxt->style != NULL) &&
+                   (comp->dict == ctxt->style->dict) &&
+		   (node->type != XML_NAMESPACE_DECL) &&
+		   (xsltDocNamesShared(ctxt, node->doc)));
+
     i = 0;
 restart:
     for (;i < comp->nbStep;i++) {
@@ -972,10 +1037,14 @@ restart:
 		    goto rollback;
 		if (step->value == NULL)
 		    continue;
-		if (step->value[0] != node->name[0])
-		    goto rollback;
-		if (!xmlStrEqual(step->value, node->name))
-		    goto rollback;
+		if (step->value != node->name) {
+		    if (sharedNames)
+			goto rollback;
+		    if (step->value[0] != node->name[0])
+			goto rollback;
+		    if (!xmlStrEqual(step->value, node->name))
+			goto rollback;
+		}
 
 		/* Namespace test */
 		if (node->ns == NULL) {
@@ -991,7 +1060,9 @@ restart:
             case XSLT_OP_ATTR:
 		if (node->type != XML_ATTRIBUTE_NODE)
 		    goto rollback;
-		if (step->value != NULL) {
+		if ((step->value != NULL) && (step->value != node->name)) {
+		    if (sharedNames)
+			goto rollback;
 		    if (step->value[0] != node->name[0])
 			goto rollback;
 		    if (!xmlStrEqual(step->value, node->name))
@@ -2194,7 +2265,7 @@ xsltAddTemplate(xsltStylesheetPtr style, xsltTemplatePtr cur,
 	}
 	if (name != NULL) {
 	    if (style->templatesHash == NULL) {
-		style->templatesHash = xmlHashCreate(1024);
+		style->templatesHash = xmlHashCreateDict(1024, style->dict);
 		if (style->templatesHash == NULL) {
 		    xsltFreeCompMatch(pat);
 		    return(-1);
@@ -2397,37 +2468,23 @@ xsltGetTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		    list = curstyle->rootMatch;
 		else
 		    list = curstyle->elemMatch;
-		if (node->psvi != NULL) keyed = 1;
 		break;
-	    case XML_ATTRIBUTE_NODE: {
-	        xmlAttrPtr attr;
-
+	    case XML_ATTRIBUTE_NODE:
 		list = curstyle->attrMatch;
-		attr = (xmlAttrPtr) node;
-		if (attr->psvi != NULL) keyed = 1;
 		break;
-	    }
 	    case XML_PI_NODE:
 		list = curstyle->piMatch;
-		if (node->psvi != NULL) keyed = 1;
 		break;
 	    case XML_DOCUMENT_NODE:
-	    case XML_HTML_DOCUMENT_NODE: {
-	        xmlDocPtr doc;
-
+	    case XML_HTML_DOCUMENT_NODE:
 		list = curstyle->rootMatch;
-		doc = (xmlDocPtr) node;
-		if (doc->psvi != NULL) keyed = 1;
 		break;
-	    }
 	    case XML_TEXT_NODE:
 	    case XML_CDATA_SECTION_NODE:
 		list = curstyle->textMatch;
-		if (node->psvi != NULL) keyed = 1;
 		break;
 	    case XML_COMMENT_NODE:
 		list = curstyle->commentMatch;
-		if (node->psvi != NULL) keyed = 1;
 		break;
 	    case XML_ENTITY_REF_NODE:
 	    case XML_ENTITY_NODE:
@@ -2445,6 +2502,7 @@ xsltGetTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    default:
 		break;
 	}
+	keyed = xsltIsKeyedNode(ctxt, node);
 	while ((list != NULL) &&
 	       ((ret == NULL)  || (list->priority > priority))) {
 	    if (xsltTestCompMatch(ctxt, list, node,
@@ -2513,26 +2571,7 @@ keyed_match:
 	    if (xsltComputeAllKeys(ctxt, node) == -1)
 		goto error;
 
-	    switch (node->type) {
-		case XML_ELEMENT_NODE:
-		    if (node->psvi != NULL) keyed = 1;
-		    break;
-		case XML_ATTRIBUTE_NODE:
-		    if (((xmlAttrPtr) node)->psvi != NULL) keyed = 1;
-		    break;
-		case XML_TEXT_NODE:
-		case XML_CDATA_SECTION_NODE:
-		case XML_COMMENT_NODE:
-		case XML_PI_NODE:
-		    if (node->psvi != NULL) keyed = 1;
-		    break;
-		case XML_DOCUMENT_NODE:
-		case XML_HTML_DOCUMENT_NODE:
-		    if (((xmlDocPtr) node)->psvi != NULL) keyed = 1;
-		    break;
-		default:
-		    break;
-	    }
+	    keyed = xsltIsKeyedNode(ctxt, node);
 	    if (keyed)
 		goto keyed_match;
 	}
@@ -2549,6 +2588,128 @@ error:
     return(NULL);
 }
 
+/**
+ * xsltPruneCompMatchList:
+ * @list:  a list of compiled patterns
+ * @modes:  the modes which can be applied
+ * @nbPruned:  incremented for each pattern removed
+ *
+ * Frees the patterns of @list belonging to a mode which is not the
+ * default one and not in @modes.
+ *
+ * Returns the remaining list
+ */
+static xsltCompMatchPtr
+xsltPruneCompMatchList(xsltCompMatchPtr list, xmlHashTablePtr modes,
+		       int *nbPruned) {
+    xsltCompMatchPtr cur, next, *prev = &list;
+
+    for (cur = list; cur != NULL; cur = next) {
+	next = cur->next;
+	if ((cur->mode != NULL) &&
+	    (xmlHashLookup2(modes, cur->mode, cur->modeURI) == NULL)) {
+#ifdef WITH_XSLT_DEBUG_PATTERN
+	    xsltGenericDebug(xsltGenericDebugContext,
+			     "pruned pattern : '%s' mode '%s'\n",
+			     cur->pattern, cur->mode);
+#endif
+	    *prev = next;
+	    cur->next = NULL;
+	    xsltFreeCompMatch(cur);
+	    (*nbPruned)++;
+	} else
+	    prev = &cur->next;
+    }
+    return(list);
+}
+
+typedef struct _xsltPruneModesData xsltPruneModesData;
+struct _xsltPruneModesData {
+    xmlHashTablePtr modes;
+    const xmlChar **keys;	/* (name, mode, modeURI) of the lists to drop */
+    int nbKeys;
+    int maxKeys;
+};
+
+static void
+xsltPruneTemplatesScanner(void *payload ATTRIBUTE_UNUSED, void *data,
+			  const xmlChar *name, const xmlChar *mode,
+			  const xmlChar *modeURI) {
+    xsltPruneModesData *prune = (xsltPruneModesData *) data;
+    const xmlChar **tmp;
+
+    if ((mode == NULL) ||
+	(xmlHashLookup2(prune->modes, mode, modeURI) != NULL))
+	return;
+    if (prune->nbKeys >= prune->maxKeys) {
+	tmp = (const xmlChar **) xmlRealloc((void *) prune->keys,
+		(prune->maxKeys * 2 + 30) * sizeof(const xmlChar *));
+	if (tmp == NULL)
+	    return;
+	prune->keys = tmp;
+	prune->maxKeys = prune->maxKeys * 2 + 30;
+    }
+    prune->keys[prune->nbKeys++] = name;
+    prune->keys[prune->nbKeys++] = mode;
+    prune->keys[prune->nbKeys++] = modeURI;
+}
+
+/**
+ * xsltPruneTemplates:
+ * @style:  an XSLT stylesheet
+ * @modes:  the modes which can be applied, as (mode, modeURI) keys
+ *
+ * Removes from the lists searched by xsltGetTemplate() the template
+ * rules of @style in modes other than the default one which are not
+ * in @modes. The templates can still be called by name.
+ *
+ * Returns the number of patterns removed
+ */
+int
+xsltPruneTemplates(xsltStylesheetPtr style, xmlHashTablePtr modes) {
+    xsltPruneModesData prune;
+    xsltCompMatchPtr list;
+    int i, nbPruned = 0;
+
+    if ((style == NULL) || (modes == NULL))
+	return(0);
+
+    if (style->templatesHash != NULL) {
+	memset(&prune, 0, sizeof(prune));
+	prune.modes = modes;
+	xmlHashScanFull((xmlHashTablePtr) style->templatesHash,
+			xsltPruneTemplatesScanner, &prune);
+	for (i = 0;i < prune.nbKeys;i += 3) {
+	    list = (xsltCompMatchPtr) xmlHashLookup3(
+		(xmlHashTablePtr) style->templatesHash,
+		prune.keys[i], prune.keys[i + 1], prune.keys[i + 2]);
+	    xsltPruneCompMatchList(list, modes, &nbPruned);
+	    xmlHashRemoveEntry3((xmlHashTablePtr) style->templatesHash,
+		prune.keys[i], prune.keys[i + 1], prune.keys[i + 2], NULL);
+	}
+	if (prune.keys != NULL)
+	    xmlFree((void *) prune.keys);
+    }
+
+    style->rootMatch = xsltPruneCompMatchList(style->rootMatch, modes,
+					      &nbPruned);
+    style->keyMatch = xsltPruneCompMatchList(style->keyMatch, modes,
+					     &nbPruned);
+    style->elemMatch = xsltPruneCompMatchList(style->elemMatch, modes,
+					      &nbPruned);
+    style->attrMatch = xsltPruneCompMatchList(style->attrMatch, modes,
+					      &nbPruned);
+    style->parentMatch = xsltPruneCompMatchList(style->parentMatch, modes,
+						&nbPruned);
+    style->textMatch = xsltPruneCompMatchList(style->textMatch, modes,
+					      &nbPruned);
+    style->piMatch = xsltPruneCompMatchList(style->piMatch, modes,
+					    &nbPruned);
+    style->commentMatch = xsltPruneCompMatchList(style->commentMatch, modes,
+						 &nbPruned);
+    return(nbPruned);
+}
+
 /**
  * xsltCleanupTemplates:
  * @style: an XSLT stylesheet
@@ -65,6 +65,9 @@ XSLTPUBFUN void XSLTCALL
 		xsltFreeTemplateHashes	(xsltStylesheetPtr style);
 XSLTPUBFUN void XSLTCALL
 		xsltCleanupTemplates	(xsltStylesheetPtr style);
+XSLTPUBFUN int XSLTCALL
+		xsltPruneTemplates	(xsltStylesheetPtr style,
+					 xmlHashTablePtr modes);
 
 #if 0
 int		xsltMatchPattern	(xsltTransformContextPtr ctxt,
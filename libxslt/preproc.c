@@ -24,6 +24,7 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/valid.h>
+#include <libxml/parserInternals.h>
 #include <libxml/hash.h>
 #include <libxml/uri.h>
 #include <libxml/encoding.h>
@@ -211,6 +212,119 @@ xsltCheckParentElement(xsltStylesheetPtr style, xmlNodePtr inst,
  *									*
  ************************************************************************/
 
+/*
+ * The precomputed data of the XSLT instructions is carved out of large
+ * blocks owned by the stylesheet instead of being allocated one record
+ * at a time, and the lists of in-scope namespaces, which are the same
+ * for most instructions of a module, are shared.
+ */
+#define XSLT_PRECOMP_BLOCK_SIZE 16384
+#define XSLT_PRECOMP_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+
+typedef struct _xsltPreCompBlock xsltPreCompBlock;
+typedef xsltPreCompBlock *xsltPreCompBlockPtr;
+struct _xsltPreCompBlock {
+    xsltPreCompBlockPtr next;
+    size_t size;		/* usable bytes following the header */
+    size_t used;		/* bytes handed out */
+};
+
+#define XSLT_PRECOMP_BLOCK_HEADER XSLT_PRECOMP_ALIGN(sizeof(xsltPreCompBlock))
+
+struct _xsltPreCompArena {
+    xsltPreCompBlockPtr blocks;	/* the block in use comes first */
+    int nbBlocks;
+    size_t reserved;		/* bytes allocated for the blocks */
+    size_t used;		/* bytes handed out */
+    int nbPreComps;		/* number of precomputed instructions */
+    size_t preCompBytes;	/* bytes used by them */
+    xmlHashTablePtr nsLists;	/* the shared namespace lists */
+    int nbNsLists;		/* number of distinct namespace lists */
+    int nbNsListRefs;		/* number of instructions using them */
+    size_t nsListBytes;		/* bytes used by them */
+};
+
+/**
+ * xsltPreCompAlloc:
+ * @style:  the XSLT stylesheet
+ * @size:  the number of bytes needed
+ *
+ * Allocates zeroed memory for precomputed data from the blocks of
+ * @style. It is released by xsltFreeStylePreComps().
+ *
+ * Returns the memory or NULL in case of error
+ */
+static void *
+xsltPreCompAlloc(xsltStylesheetPtr style, size_t size) {
+    xsltPreCompArenaPtr arena = style->preCompArena;
+    xsltPreCompBlockPtr block;
+    void *ret;
+
+    if (arena == NULL) {
+	arena = (xsltPreCompArenaPtr) xmlMalloc(sizeof(xsltPreCompArena));
+	if (arena == NULL)
+	    return(NULL);
+	memset(arena, 0, sizeof(xsltPreCompArena));
+	style->preCompArena = arena;
+    }
+    size = XSLT_PRECOMP_ALIGN(size);
+    block = arena->blocks;
+    if ((block == NULL) || (block->size - block->used < size)) {
+	size_t blockSize;
+
+	blockSize = XSLT_PRECOMP_BLOCK_SIZE - XSLT_PRECOMP_BLOCK_HEADER;
+	if (size > blockSize)
+	    blockSize = size;
+	block = (xsltPreCompBlockPtr)
+	    xmlMalloc(XSLT_PRECOMP_BLOCK_HEADER + blockSize);
+	if (block == NULL)
+	    return(NULL);
+	block->size = blockSize;
+	block->used = 0;
+	if ((size > XSLT_PRECOMP_BLOCK_SIZE - XSLT_PRECOMP_BLOCK_HEADER) &&
+	    (arena->blocks != NULL)) {
+	    /* Keep filling the current block. */
+	    block->next = arena->blocks->next;
+	    arena->blocks->next = block;
+	} else {
+	    block->next = arena->blocks;
+	    arena->blocks = block;
+	}
+	arena->nbBlocks++;
+	arena->reserved += XSLT_PRECOMP_BLOCK_HEADER + blockSize;
+    }
+    ret = (char *) block + XSLT_PRECOMP_BLOCK_HEADER + block->used;
+    block->used += size;
+    arena->used += size;
+    memset(ret, 0, size);
+    return(ret);
+}
+
+/**
+ * xsltFreePreCompArena:
+ * @style:  the XSLT stylesheet
+ *
+ * Releases all the memory handed out by xsltPreCompAlloc() for @style.
+ */
+static void
+xsltFreePreCompArena(xsltStylesheetPtr style) {
+    xsltPreCompArenaPtr arena = style->preCompArena;
+    xsltPreCompBlockPtr block, next;
+
+    if (arena == NULL)
+	return;
+    if (arena->nsLists != NULL)
+	xmlHashFree(arena->nsLists, NULL);
+    block = arena->blocks;
+    while (block != NULL) {
+	next = block->next;
+	xmlFree(block);
+	block = next;
+    }
+    xmlFree(arena);
+    style->preCompArena = NULL;
+}
+
 /**
  * xsltNewStylePreComp:
  * @style:  the XSLT stylesheet
@@ -224,9 +338,7 @@ xsltCheckParentElement(xsltStylesheetPtr style, xmlNodePtr inst,
 static xsltStylePreCompPtr
 xsltNewStylePreComp(xsltStylesheetPtr style, xsltStyleType type) {
     xsltStylePreCompPtr cur;
-#ifdef XSLT_REFACTORED
     size_t size;
-#endif
 
     if (style == NULL)
         return(NULL);
@@ -290,28 +402,21 @@ xsltNewStylePreComp(xsltStylesheetPtr style, xsltStyleType type) {
     /*
     * Create the structure.
     */
-    cur = (xsltStylePreCompPtr) xmlMalloc(size);
-    if (cur == NULL) {
-	xsltTransformError(NULL, style, NULL,
-		"xsltNewStylePreComp : malloc failed\n");
-	style->errors++;
-	return(NULL);
-    }
-    memset(cur, 0, size);
-
 #else /* XSLT_REFACTORED */
     /*
     * Old behaviour.
     */
-    cur = (xsltStylePreCompPtr) xmlMalloc(sizeof(xsltStylePreComp));
+    size = sizeof(xsltStylePreComp);
+#endif /* XSLT_REFACTORED */
+    cur = (xsltStylePreCompPtr) xsltPreCompAlloc(style, size);
     if (cur == NULL) {
 	xsltTransformError(NULL, style, NULL,
 		"xsltNewStylePreComp : malloc failed\n");
 	style->errors++;
 	return(NULL);
     }
-    memset(cur, 0, sizeof(xsltStylePreComp));
-#endif /* XSLT_REFACTORED */
+    style->preCompArena->nbPreComps++;
+    style->preCompArena->preCompBytes += XSLT_PRECOMP_ALIGN(size);
 
     /*
     * URGENT TODO: Better to move this to spezialized factory functions.
@@ -371,6 +476,75 @@ xsltNewStylePreComp(xsltStylesheetPtr style, xsltStyleType type) {
     return(cur);
 }
 
+#ifndef XSLT_REFACTORED
+/**
+ * xsltPreCompNsList:
+ * @style:  the XSLT stylesheet
+ * @inst:  the instruction
+ * @nsNr:  where to store the number of namespaces
+ *
+ * Looks up the namespaces in scope of @inst, sharing the list with
+ * the other instructions of @style which have the same ones.
+ *
+ * Returns the NULL terminated list, owned by @style, or NULL if there
+ *         are no namespaces in scope or in case of error
+ */
+static xmlNsPtr *
+xsltPreCompNsList(xsltStylesheetPtr style, xmlNodePtr inst, int *nsNr) {
+    xsltPreCompArenaPtr arena;
+    xmlNsPtr *list, *ret = NULL;
+    xmlChar *key = NULL;
+    char buf[30];
+    size_t size;
+    int i, nr = 0;
+
+    *nsNr = 0;
+    list = xmlGetNsList(inst->doc, inst);
+    if (list == NULL)
+	return(NULL);
+    while (list[nr] != NULL)
+	nr++;
+    for (i = 0;i < nr;i++) {
+	snprintf(buf, sizeof(buf), "%p,", (void *) list[i]);
+	key = xmlStrcat(key, BAD_CAST buf);
+    }
+    if (key == NULL)
+	goto error;
+
+    arena = style->preCompArena;
+    if ((arena != NULL) && (arena->nsLists != NULL))
+	ret = (xmlNsPtr *) xmlHashLookup(arena->nsLists, key);
+    if (ret == NULL) {
+	size = (nr + 1) * sizeof(xmlNsPtr);
+	ret = (xmlNsPtr *) xsltPreCompAlloc(style, size);
+	if (ret == NULL)
+	    goto error;
+	memcpy(ret, list, size);
+	arena = style->preCompArena;
+	if (arena->nsLists == NULL)
+	    arena->nsLists = xmlHashCreate(16);
+	if (arena->nsLists != NULL)
+	    xmlHashAddEntry(arena->nsLists, key, ret);
+	arena->nbNsLists++;
+	arena->nsListBytes += XSLT_PRECOMP_ALIGN(size);
+    }
+    arena->nbNsListRefs++;
+    *nsNr = nr;
+    xmlFree(key);
+    xmlFree(list);
+    return(ret);
+
+error:
+    xsltTransformError(NULL, style, inst,
+	    "xsltPreCompNsList : malloc failed\n");
+    style->errors++;
+    if (key != NULL)
+	xmlFree(key);
+    xmlFree(list);
+    return(NULL);
+}
+#endif /* XSLT_REFACTORED */
+
 /**
  * xsltFreeStylePreComp:
  * @comp:  an XSLT Style precomputed block
@@ -394,8 +568,6 @@ xsltFreeStylePreComp(xsltStylePreCompPtr comp) {
 		xsltStyleItemSortPtr item = (xsltStyleItemSortPtr) comp;
 		if (item->locale != (xsltLocale)0)
 		    xsltFreeLocale(item->locale);
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
 	    }
             break;
         case XSLT_FUNC_TEXT:
@@ -408,17 +580,9 @@ xsltFreeStylePreComp(xsltStylePreCompPtr comp) {
             break;
         case XSLT_FUNC_PI:
 	    break;
-        case XSLT_FUNC_COPYOF: {
-		xsltStyleItemCopyOfPtr item = (xsltStyleItemCopyOfPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+        case XSLT_FUNC_COPYOF:
             break;
-        case XSLT_FUNC_VALUEOF: {
-		xsltStyleItemValueOfPtr item = (xsltStyleItemValueOfPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+        case XSLT_FUNC_VALUEOF:
             break;
         case XSLT_FUNC_NUMBER: {
                 xsltStyleItemNumberPtr item = (xsltStyleItemNumberPtr) comp;
@@ -432,57 +596,23 @@ xsltFreeStylePreComp(xsltStylePreCompPtr comp) {
             break;
         case XSLT_FUNC_CALLTEMPLATE:
             break;
-        case XSLT_FUNC_APPLYTEMPLATES: {
-		xsltStyleItemApplyTemplatesPtr item =
-		    (xsltStyleItemApplyTemplatesPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+        case XSLT_FUNC_APPLYTEMPLATES:
             break;
         case XSLT_FUNC_CHOOSE:
             break;
-        case XSLT_FUNC_IF: {
-		xsltStyleItemIfPtr item = (xsltStyleItemIfPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+        case XSLT_FUNC_IF:
             break;
-        case XSLT_FUNC_FOREACH: {
-		xsltStyleItemForEachPtr item =
-		    (xsltStyleItemForEachPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+        case XSLT_FUNC_FOREACH:
             break;
         case XSLT_FUNC_DOCUMENT:
             break;
-	case XSLT_FUNC_WITHPARAM: {
-		xsltStyleItemWithParamPtr item =
-		    (xsltStyleItemWithParamPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+	case XSLT_FUNC_WITHPARAM:
 	    break;
-	case XSLT_FUNC_PARAM: {
-		xsltStyleItemParamPtr item =
-		    (xsltStyleItemParamPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+	case XSLT_FUNC_PARAM:
 	    break;
-	case XSLT_FUNC_VARIABLE: {
-		xsltStyleItemVariablePtr item =
-		    (xsltStyleItemVariablePtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+	case XSLT_FUNC_VARIABLE:
 	    break;
-	case XSLT_FUNC_WHEN: {
-		xsltStyleItemWhenPtr item =
-		    (xsltStyleItemWhenPtr) comp;
-		if (item->comp != NULL)
-		    xmlXPathFreeCompExpr(item->comp);
-	    }
+	case XSLT_FUNC_WHEN:
 	    break;
 	case XSLT_FUNC_OTHERWISE:
 	case XSLT_FUNC_FALLBACK:
@@ -496,19 +626,28 @@ xsltFreeStylePreComp(xsltStylePreCompPtr comp) {
 	    break;
     }
 #else
+    /*
+    * comp->comp is owned by the principal stylesheet, see
+    * xsltXPathCompileShared().
+    */
     if (comp->locale != (xsltLocale)0)
 	xsltFreeLocale(comp->locale);
-    if (comp->comp != NULL)
-	xmlXPathFreeCompExpr(comp->comp);
     if (comp->numdata.countPat != NULL)
         xsltFreeCompMatchList(comp->numdata.countPat);
     if (comp->numdata.fromPat != NULL)
         xsltFreeCompMatchList(comp->numdata.fromPat);
-    if (comp->nsList != NULL)
-	xmlFree(comp->nsList);
 #endif
 
-    xmlFree(comp);
+    /*
+    * The records of xsltNewStylePreComp() and the namespace lists
+    * belong to the stylesheet, see xsltFreePreCompArena().
+    */
+#ifdef XSLT_REFACTORED
+    if ((comp->type == XSLT_FUNC_LITERAL_RESULT_ELEMENT) ||
+	(comp->type == XSLT_FUNC_UNKOWN_FORWARDS_COMPAT) ||
+	(comp->type == XSLT_FUNC_INCLUDE))
+	xmlFree(comp);
+#endif
 }
 
 
@@ -759,7 +898,7 @@ xsltSortComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	 */
 	comp->select = xmlDictLookup(style->dict, BAD_CAST ".", 1);
     }
-    comp->comp = xsltXPathCompile(style, comp->select);
+    comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
     if (comp->comp == NULL) {
 	xsltTransformError(NULL, style, inst,
 	     "xsltSortComp: could not compile select expression '%s'\n",
@@ -1158,6 +1297,164 @@ xsltProcessingInstructionComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 				 XSLT_NAMESPACE, &comp->has_name);
 }
 
+/**
+ * xsltCountVarRefs:
+ * @tree:  the root of a subtree of the stylesheet
+ * @name:  the name of a variable
+ *
+ * Counts the references to the variable @name in the attributes of
+ * @tree and its descendants. References to a prefixed variable with
+ * the same local name are counted as well, and expressions which
+ * might evaluate a computed string are counted as many references.
+ *
+ * Returns the number of references found
+ */
+static int
+xsltCountVarRefs(xmlNodePtr tree, const xmlChar *name) {
+    xmlNodePtr cur = tree, txt;
+    xmlAttrPtr attr;
+    const xmlChar *val, *start, *local;
+    int len = xmlStrlen(name);
+    int ret = 0;
+
+    while (cur != NULL) {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		for (txt = attr->children; txt != NULL; txt = txt->next) {
+		    if ((txt->type != XML_TEXT_NODE) ||
+			(txt->content == NULL))
+			continue;
+		    val = txt->content;
+		    if (xmlStrstr(val, BAD_CAST "evaluate") != NULL)
+			return(2);
+		    while ((val = xmlStrchr(val, '$')) != NULL) {
+			val++;
+			while (IS_BLANK_CH(*val))
+			    val++;
+			start = local = val;
+			while ((*val != 0) && (!IS_BLANK_CH(*val)) &&
+			       (xmlStrchr(BAD_CAST "$()[]{}/|,=!<>+*\"'@",
+					  *val) == NULL))
+			{
+			    if (*val == ':')
+				local = val + 1;
+			    val++;
+			}
+			if ((val - local == len) &&
+			    (xmlStrncmp(local, name, len) == 0))
+			    ret++;
+			else if (val == start)
+			    ret++;
+		    }
+		}
+	    }
+	    if (cur->children != NULL) {
+		cur = cur->children;
+		continue;
+	    }
+	}
+	while ((cur != tree) && (cur->next == NULL))
+	    cur = cur->parent;
+	if (cur == tree)
+	    break;
+	cur = cur->next;
+    }
+    return(ret);
+}
+
+/**
+ * xsltIsLastRVTUse:
+ * @style: an XSLT compiled stylesheet
+ * @inst:  the xslt copy-of node
+ * @select:  the select expression of @inst
+ *
+ * Checks whether @select is a plain reference to a local xsl:variable
+ * holding a result tree fragment, @inst is executed at most once per
+ * instantiation of that variable, and @inst is the only reference to
+ * the variable in its scope. In that case nothing can observe the
+ * fragment after @inst, so its nodes can be moved to the result tree
+ * instead of being copied.
+ *
+ * Returns 1 if the fragment can be moved, 0 otherwise
+ */
+static int
+xsltIsLastRVTUse(xsltStylesheetPtr style, xmlNodePtr inst,
+	         const xmlChar *select) {
+    xmlNodePtr cur, sib, decl = NULL;
+    xmlChar *name, *prop;
+    const xmlChar *start;
+    int ret = 0, refs = 0;
+
+    while (IS_BLANK_CH(*select))
+	select++;
+    if (*select != '$')
+	return(0);
+    select++;
+    start = select;
+    while ((*select != 0) && (!IS_BLANK_CH(*select)))
+	select++;
+    name = xmlStrndup(start, select - start);
+    if (name == NULL)
+	return(0);
+    while (IS_BLANK_CH(*select))
+	select++;
+    if ((*select != 0) || (xmlValidateNCName(name, 0) != 0))
+	goto done;
+
+    /*
+    * Find the declaration in scope, only going up through instructions
+    * which don't repeat their content.
+    */
+    cur = inst;
+    while (decl == NULL) {
+	for (sib = cur->prev; sib != NULL; sib = sib->prev) {
+	    if ((!IS_XSLT_ELEM(sib)) ||
+		((!IS_XSLT_NAME(sib, "variable")) &&
+		 (!IS_XSLT_NAME(sib, "param"))))
+		continue;
+	    prop = xmlGetNsProp(sib, BAD_CAST "name", NULL);
+	    if (prop != NULL) {
+		if (xmlStrEqual(prop, name))
+		    decl = sib;
+		xmlFree(prop);
+	    }
+	    if (decl != NULL)
+		break;
+	}
+	if (decl != NULL)
+	    break;
+	cur = cur->parent;
+	if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+	    goto done;
+	if (IS_XSLT_ELEM(cur)) {
+	    if ((!IS_XSLT_NAME(cur, "if")) &&
+		(!IS_XSLT_NAME(cur, "choose")) &&
+		(!IS_XSLT_NAME(cur, "when")) &&
+		(!IS_XSLT_NAME(cur, "otherwise")) &&
+		(!IS_XSLT_NAME(cur, "element")) &&
+		(!IS_XSLT_NAME(cur, "copy")))
+		goto done;
+	} else if (xsltCheckExtPrefix(style,
+		       (cur->ns != NULL) ? cur->ns->href : NULL)) {
+	    goto done;
+	}
+    }
+    if ((!IS_XSLT_NAME(decl, "variable")) || (decl->children == NULL) ||
+	(xmlHasNsProp(decl, BAD_CAST "select", NULL) != NULL))
+	goto done;
+
+    for (sib = decl->next; sib != NULL; sib = sib->next) {
+	refs += xsltCountVarRefs(sib, name);
+	if (refs > 1)
+	    goto done;
+    }
+    ret = (refs == 1);
+
+done:
+    xmlFree(name);
+    return(ret);
+}
+
 /**
  * xsltCopyOfComp:
  * @style: an XSLT compiled stylesheet
@@ -1195,13 +1492,15 @@ xsltCopyOfComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	if (style != NULL) style->errors++;
 	return;
     }
-    comp->comp = xsltXPathCompile(style, comp->select);
+    comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
     if (comp->comp == NULL) {
 	xsltTransformError(NULL, style, inst,
 	     "xsl:copy-of : could not compile select expression '%s'\n",
 	                 comp->select);
 	if (style != NULL) style->errors++;
+	return;
     }
+    comp->moveVar = xsltIsLastRVTUse(style, inst, comp->select);
 }
 
 /**
@@ -1255,7 +1554,7 @@ xsltValueOfComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	if (style != NULL) style->errors++;
 	return;
     }
-    comp->comp = xsltXPathCompile(style, comp->select);
+    comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
     if (comp->comp == NULL) {
 	xsltTransformError(NULL, style, inst,
 	     "xsl:value-of : could not compile select expression '%s'\n",
@@ -1373,7 +1672,7 @@ xsltWithParamComp(xsltStylesheetPtr style, xmlNodePtr inst) {
     comp->select = xsltGetCNsProp(style, inst, (const xmlChar *)"select",
 	                        XSLT_NAMESPACE);
     if (comp->select != NULL) {
-	comp->comp = xsltXPathCompile(style, comp->select);
+	comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
 	if (comp->comp == NULL) {
 	    xsltTransformError(NULL, style, inst,
 		 "XSLT-with-param: Failed to compile select "
@@ -1585,6 +1884,37 @@ xsltCallTemplateComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	comp->has_ns = 1;
 }
 
+/**
+ * xsltGetParallelProp:
+ * @style: an XSLT compiled stylesheet
+ * @inst:  an XSLT instruction
+ *
+ * Processes the libxslt:parallel extension attribute asking for the
+ * nodes selected by @inst to be processed by concurrent threads.
+ *
+ * Returns 1 if the attribute is "yes", 0 otherwise
+ */
+static int
+xsltGetParallelProp(xsltStylesheetPtr style, xmlNodePtr inst) {
+    xmlChar *prop;
+    int ret = 0;
+
+    prop = xmlGetNsProp(inst, (const xmlChar *)"parallel",
+	                XSLT_LIBXSLT_NAMESPACE);
+    if (prop == NULL)
+	return(0);
+    if (xmlStrEqual(prop, (const xmlChar *)"yes"))
+	ret = 1;
+    else if (!xmlStrEqual(prop, (const xmlChar *)"no")) {
+	xsltTransformError(NULL, style, inst,
+	    "xsl:%s: invalid value '%s' for libxslt:parallel, "
+	    "expecting 'yes' or 'no'\n", inst->name, prop);
+	style->warnings++;
+    }
+    xmlFree(prop);
+    return(ret);
+}
+
 /**
  * xsltApplyTemplatesComp:
  * @style: an XSLT compiled stylesheet
@@ -1626,7 +1956,7 @@ xsltApplyTemplatesComp(xsltStylesheetPtr style, xmlNodePtr inst) {
     comp->select = xsltGetCNsProp(style, inst, BAD_CAST "select",
 	XSLT_NAMESPACE);
     if (comp->select != NULL) {
-	comp->comp = xsltXPathCompile(style, comp->select);
+	comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
 	if (comp->comp == NULL) {
 	    xsltTransformError(NULL, style, inst,
 		"XSLT-apply-templates: could not compile select "
@@ -1634,6 +1964,7 @@ xsltApplyTemplatesComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	     style->errors++;
 	}
     }
+    comp->parallel = xsltGetParallelProp(style, inst);
     /* TODO: handle (or skip) the xsl:sort and xsl:with-param */
 }
 
@@ -1705,7 +2036,7 @@ xsltIfComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	if (style != NULL) style->errors++;
 	return;
     }
-    comp->comp = xsltXPathCompile(style, comp->test);
+    comp->comp = xsltXPathCompileShared(style, comp->test, 0, inst);
     if (comp->comp == NULL) {
 	xsltTransformError(NULL, style, inst,
 	     "xsl:if : could not compile test expression '%s'\n",
@@ -1751,7 +2082,7 @@ xsltWhenComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	if (style != NULL) style->errors++;
 	return;
     }
-    comp->comp = xsltXPathCompile(style, comp->test);
+    comp->comp = xsltXPathCompileShared(style, comp->test, 0, inst);
     if (comp->comp == NULL) {
 	xsltTransformError(NULL, style, inst,
 	     "xsl:when : could not compile test expression '%s'\n",
@@ -1797,7 +2128,7 @@ xsltForEachComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 		"xsl:for-each : select is missing\n");
 	if (style != NULL) style->errors++;
     } else {
-	comp->comp = xsltXPathCompile(style, comp->select);
+	comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
 	if (comp->comp == NULL) {
 	    xsltTransformError(NULL, style, inst,
      "xsl:for-each : could not compile select expression '%s'\n",
@@ -1805,6 +2136,7 @@ xsltForEachComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 	    if (style != NULL) style->errors++;
 	}
     }
+    comp->parallel = xsltGetParallelProp(style, inst);
     /* TODO: handle and skip the xsl:sort */
 }
 
@@ -1858,7 +2190,7 @@ xsltVariableComp(xsltStylesheetPtr style, xmlNodePtr inst) {
 #ifndef XSLT_REFACTORED
         xmlNodePtr cur;
 #endif
-	comp->comp = xsltXPathCompile(style, comp->select);
+	comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
 	if (comp->comp == NULL) {
 	    xsltTransformError(NULL, style, inst,
 		"XSLT-variable: Failed to compile the XPath expression '%s'.\n",
@@ -1930,7 +2262,7 @@ xsltParamComp(xsltStylesheetPtr style, xmlNodePtr inst) {
     comp->select = xsltGetCNsProp(style, inst, (const xmlChar *)"select",
 	                        XSLT_NAMESPACE);
     if (comp->select != NULL) {
-	comp->comp = xsltXPathCompile(style, comp->select);
+	comp->comp = xsltXPathCompileShared(style, comp->select, 0, inst);
 	if (comp->comp == NULL) {
 	    xsltTransformError(NULL, style, inst,
 		"XSLT-param: could not compile select expression '%s'.\n",
@@ -1974,6 +2306,84 @@ xsltFreeStylePreComps(xsltStylesheetPtr style) {
 	    xsltFreeStylePreComp((xsltStylePreCompPtr) cur);
 	cur = next;
     }
+    style->preComps = NULL;
+    xsltFreePreCompArena(style);
+}
+
+/**
+ * xsltDumpStylesheetMemory:
+ * @output:  the FILE * for the output
+ * @style:  the XSLT stylesheet
+ *
+ * Reports by category the memory used by the compiled form of the
+ * principal stylesheet of @style and of all its imports.
+ */
+void
+xsltDumpStylesheetMemory(FILE *output, xsltStylesheetPtr style) {
+    xsltStylesheetPtr cur, top;
+    xsltPreCompArenaPtr arena;
+    xsltElemPreCompPtr comp;
+    xsltTemplatePtr templ;
+    int nbStyles = 0, nbBlocks = 0, nbPreComps = 0, nbExtPreComps = 0;
+    int nbNsLists = 0, nbNsListRefs = 0, nbTemplates = 0;
+    size_t reserved = 0, used = 0, preCompBytes = 0, nsListBytes = 0;
+    size_t templBytes = 0;
+
+    if ((output == NULL) || (style == NULL))
+	return;
+
+    top = style;
+    while (top->parent != NULL)
+	top = top->parent;
+
+    cur = top;
+    while (cur != NULL) {
+	nbStyles++;
+	arena = cur->preCompArena;
+	if (arena != NULL) {
+	    nbBlocks += arena->nbBlocks;
+	    reserved += arena->reserved;
+	    used += arena->used;
+	    nbPreComps += arena->nbPreComps;
+	    preCompBytes += arena->preCompBytes;
+	    nbNsLists += arena->nbNsLists;
+	    nbNsListRefs += arena->nbNsListRefs;
+	    nsListBytes += arena->nsListBytes;
+	}
+	for (comp = cur->preComps; comp != NULL; comp = comp->next)
+	    if (comp->type == XSLT_FUNC_EXTENSION)
+		nbExtPreComps++;
+	for (templ = cur->templates; templ != NULL; templ = templ->next) {
+	    nbTemplates++;
+	    templBytes += sizeof(xsltTemplate) +
+			  templ->inheritedNsNr * sizeof(xmlNsPtr);
+	}
+	cur = xsltNextImport(cur);
+    }
+
+    fprintf(output, "Compiled stylesheet memory:\n");
+    fprintf(output, "  stylesheets:              %d\n", nbStyles);
+    fprintf(output,
+	    "  precomputed data:         %lu bytes used of %lu in %d blocks\n",
+	    (unsigned long) used, (unsigned long) reserved, nbBlocks);
+    fprintf(output, "    instructions:           %d, %lu bytes\n",
+	    nbPreComps, (unsigned long) preCompBytes);
+    fprintf(output,
+	    "    namespace lists:        %d shared by %d instructions, "
+	    "%lu bytes\n",
+	    nbNsLists, nbNsListRefs, (unsigned long) nsListBytes);
+    fprintf(output, "  extension instructions:   %d\n", nbExtPreComps);
+    fprintf(output, "  templates:                %d, %lu bytes\n",
+	    nbTemplates, (unsigned long) templBytes);
+    fprintf(output, "  XPath expressions:        %d\n",
+	    (top->xpathComps != NULL) ? xmlHashSize(top->xpathComps) : 0);
+    fprintf(output, "  dictionary strings:       %d\n",
+	    (top->dict != NULL) ? (int) xmlDictSize(top->dict) : 0);
+    if (xsltGetPruneDefault())
+	fprintf(output,
+		"  pruned:                   %d template rules, "
+		"%d global variables, %d keys\n",
+		top->prunedTemplates, top->prunedVariables, top->prunedKeys);
 }
 
 #ifdef XSLT_REFACTORED
@@ -2354,16 +2764,8 @@ xsltStylePreCompute(xsltStylesheetPtr style, xmlNodePtr inst) {
 	* A ns-list is build for every XSLT item in the
 	* node-tree. This is needed for XPath expressions.
 	*/
-	if (cur != NULL) {
-	    int i = 0;
-
-	    cur->nsList = xmlGetNsList(inst->doc, inst);
-            if (cur->nsList != NULL) {
-		while (cur->nsList[i] != NULL)
-		    i++;
-	    }
-	    cur->nsNr = i;
-	}
+	if (cur != NULL)
+	    cur->nsList = xsltPreCompNsList(style, inst, &cur->nsNr);
     } else {
 	inst->psvi =
 	    (void *) xsltPreComputeExtModuleElement(style, inst);
@@ -34,6 +34,9 @@ XSLTPUBFUN void XSLTCALL
 					 xmlNodePtr inst);
 XSLTPUBFUN void XSLTCALL
 		xsltFreeStylePreComps	(xsltStylesheetPtr style);
+XSLTPUBFUN void XSLTCALL
+		xsltDumpStylesheetMemory(FILE *output,
+					 xsltStylesheetPtr style);
 
 #ifdef __cplusplus
 }
@@ -197,6 +197,8 @@ xsltEvalTemplateString(xsltTransformContextPtr ctxt,
 	               xmlNodePtr inst)
 {
     xmlNodePtr oldInsert, insert = NULL;
+    const xmlChar *oldLastText;
+    unsigned int oldLastTSize, oldLastTUse;
     xmlChar *ret;
 
     if ((ctxt == NULL) || (contextNode == NULL) || (inst == NULL) ||
@@ -220,6 +222,9 @@ xsltEvalTemplateString(xsltTransformContextPtr ctxt,
 	return(NULL);
     }
     oldInsert = ctxt->insert;
+    oldLastText = ctxt->lasttext;
+    oldLastTSize = ctxt->lasttsize;
+    oldLastTUse = ctxt->lasttuse;
     ctxt->insert = insert;
     /*
     * OPTIMIZE TODO: if inst->children consists only of text-nodes.
@@ -227,6 +232,9 @@ xsltEvalTemplateString(xsltTransformContextPtr ctxt,
     xsltApplyOneTemplate(ctxt, contextNode, inst->children, NULL, NULL);
 
     ctxt->insert = oldInsert;
+    ctxt->lasttext = oldLastText;
+    ctxt->lasttsize = oldLastTSize;
+    ctxt->lasttuse = oldLastTUse;
 
     ret = xmlNodeGetContent(insert);
     if (insert != NULL)
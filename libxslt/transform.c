@@ -76,6 +76,19 @@ int xsltMaxVars = 15000;
 # define TRUE (!FALSE)
 #endif
 
+/*
+ * Text nodes of the result up to this size are stored in the output
+ * dictionary by xsltCopyTextString().
+ */
+#define XSLT_TEXT_INTERN_MAX 32
+
+/*
+ * Default limits of the tree fragment and variable caches, see
+ * xsltSetCtxtCacheLimits().
+ */
+#define XSLT_CACHE_MAX_RVT 40
+#define XSLT_CACHE_MAX_STACK_ITEMS 50
+
 #define IS_BLANK_NODE(n)						\
     (((n)->type == XML_TEXT_NODE) && (xsltIsBlank((n)->content)))
 
@@ -467,6 +480,77 @@ xsltGetXIncludeDefault(void) {
     return(xsltDoXIncludeDefault);
 }
 
+/************************************************************************
+ *									*
+ *			Parallel processing settings			*
+ *									*
+ ************************************************************************/
+
+static int xsltParallelThreads = -1;
+
+/**
+ * xsltSetParallelThreads:
+ * @nbThreads:  the maximum number of threads, negative for one per
+ *              processor
+ *
+ * Set the number of threads processing the nodes selected by the
+ * instructions flagged with libxslt:parallel="yes". With 0 or 1 such
+ * nodes are processed serially.
+ */
+void
+xsltSetParallelThreads(int nbThreads) {
+    xsltParallelThreads = nbThreads;
+}
+
+/**
+ * xsltGetParallelThreads:
+ *
+ * Provides the number of threads processing the nodes selected by the
+ * instructions flagged with libxslt:parallel="yes".
+ *
+ * Returns the number of threads, negative for one per processor
+ */
+int
+xsltGetParallelThreads(void) {
+    return(xsltParallelThreads);
+}
+
+/*
+ * Creating a context and starting a thread costs more than processing
+ * a few nodes, so each context gets at least that many nodes.
+ */
+#define XSLT_PARALLEL_CHUNK_SIZE 64
+
+static int xsltParallelChunkSize = XSLT_PARALLEL_CHUNK_SIZE;
+
+/**
+ * xsltSetParallelChunkSize:
+ * @nbNodes:  the minimum number of nodes, 0 for the default
+ *
+ * Set the minimum number of nodes processed by each of the threads of
+ * an instruction flagged with libxslt:parallel="yes". Fewer nodes are
+ * processed serially.
+ */
+void
+xsltSetParallelChunkSize(int nbNodes) {
+    if (nbNodes <= 0)
+	nbNodes = XSLT_PARALLEL_CHUNK_SIZE;
+    xsltParallelChunkSize = nbNodes;
+}
+
+/**
+ * xsltGetParallelChunkSize:
+ *
+ * Provides the minimum number of nodes processed by each of the
+ * threads of an instruction flagged with libxslt:parallel="yes".
+ *
+ * Returns the number of nodes
+ */
+int
+xsltGetParallelChunkSize(void) {
+    return(xsltParallelChunkSize);
+}
+
 unsigned long xsltDefaultTrace = (unsigned long) XSLT_TRACE_ALL;
 
 /**
@@ -508,6 +592,8 @@ xsltTransformCacheCreate(void)
 	return(NULL);
     }
     memset(ret, 0, sizeof(xsltTransformCache));
+    ret->maxRVT = XSLT_CACHE_MAX_RVT;
+    ret->maxStackItems = XSLT_CACHE_MAX_STACK_ITEMS;
     return(ret);
 }
 
@@ -529,6 +615,7 @@ xsltTransformCacheFree(xsltTransformCachePtr cache)
 		* Tree the document info.
 		*/
 		xsltFreeDocumentKeys((xsltDocumentPtr) tmp->_private);
+		xsltFreeDocumentOrder((xsltDocumentPtr) tmp->_private);
 		xmlFree(tmp->_private);
 	    }
 	    xmlFreeDoc(tmp);
@@ -552,6 +639,104 @@ xsltTransformCacheFree(xsltTransformCachePtr cache)
     xmlFree(cache);
 }
 
+/**
+ * xsltUnlinkInternalSubset:
+ * @doc:  the input document
+ *
+ * Avoid hitting the DTD when scanning nodes but keep it linked as
+ * doc->intSubset. Nothing is written if this was already done.
+ */
+static void
+xsltUnlinkInternalSubset(xmlDocPtr doc) {
+    xmlNodePtr cur;
+
+    if ((doc == NULL) || (doc->intSubset == NULL))
+	return;
+    cur = (xmlNodePtr) doc->intSubset;
+    if ((cur->prev == NULL) && (cur->next == NULL) &&
+        (doc->children != cur))
+	return;
+    if (cur->next != NULL)
+	cur->next->prev = cur->prev;
+    if (cur->prev != NULL)
+	cur->prev->next = cur->next;
+    if (doc->children == cur)
+	doc->children = cur->next;
+    if (doc->last == cur)
+	doc->last = cur->prev;
+    cur->prev = cur->next = NULL;
+}
+
+/**
+ * xsltOrderDocElems:
+ * @doc:  the input document
+ *
+ * Setup document element ordering for later efficiencies
+ * (bug 133289), unless the document was already ordered.
+ */
+static void
+xsltOrderDocElems(xmlDocPtr doc) {
+    xmlNodePtr root;
+
+    if (xslDebugStatus != XSLT_DEBUG_NONE)
+	return;
+    root = xmlDocGetRootElement(doc);
+    if ((root != NULL) && (((long) root->content) >= 0))
+	xmlXPathOrderDocElems(doc);
+}
+
+/**
+ * xsltPrepareSharedDocument:
+ * @doc:  the input document
+ *
+ * Performs once the modifications a transformation would otherwise
+ * make to the input document: the DTD is unlinked from the children
+ * list and the elements are numbered in document order. Once done,
+ * transformations only read @doc (key markers are kept in per-context
+ * tables), so it can be shared by transformations running in several
+ * threads at once. The exception are stylesheets using xsl:strip-space
+ * which still remove blank text nodes from the input.
+ *
+ * Returns 0 in case of success and -1 in case of error
+ */
+int
+xsltPrepareSharedDocument(xmlDocPtr doc) {
+    if (doc == NULL)
+	return(-1);
+    xsltUnlinkInternalSubset(doc);
+    xsltOrderDocElems(doc);
+    return(0);
+}
+
+/**
+ * xsltDictSharesStyle:
+ * @style:  the stylesheet
+ * @dict:  a document dictionary
+ *
+ * Check whether @dict is the dictionary of @style or one of its
+ * sub-dictionaries, i.e. whether the names it holds resolve to the
+ * strings of the stylesheet dictionary. The root element name of the
+ * stylesheet is used as a probe.
+ *
+ * Returns 1 if so, 0 otherwise
+ */
+static int
+xsltDictSharesStyle(xsltStylesheetPtr style, xmlDictPtr dict)
+{
+    xmlNodePtr root;
+
+    if ((style->dict == NULL) || (dict == NULL))
+	return(0);
+    if (dict == style->dict)
+	return(1);
+    if (style->doc == NULL)
+	return(0);
+    root = xmlDocGetRootElement(style->doc);
+    if ((root == NULL) || (xmlDictOwns(style->dict, root->name) != 1))
+	return(0);
+    return(xmlDictExists(dict, root->name, -1) == root->name);
+}
+
 /**
  * xsltNewTransformContext:
  * @style:  a parsed XSLT stylesheet
@@ -590,6 +775,14 @@ xsltNewTransformContext(xsltStylesheetPtr style, xmlDocPtr doc) {
     xsltGenericDebug(xsltGenericDebugContext,
 	     "Creating sub-dictionary from stylesheet for transformation\n");
 #endif
+    /*
+     * Names of an input parsed through the stylesheet dictionary, see
+     * xsltParseInputFile(), can be matched by pointer.
+     */
+    if ((doc != NULL) && (doc->dict != NULL) &&
+        (!XSLT_IS_RES_TREE_FRAG(doc)) &&
+        (xsltDictSharesStyle(style, doc->dict)))
+	cur->inputDict = doc->dict;
 
     /*
      * initialize the template stack
@@ -671,15 +864,10 @@ xsltNewTransformContext(xsltStylesheetPtr style, xmlDocPtr doc) {
     XSLT_REGISTER_FUNCTION_LOOKUP(cur);
     cur->xpathCtxt->nsHash = style->nsHash;
     /*
-     * Initialize the registered external modules
-     */
-    xsltInitCtxtExts(cur);
-    /*
-     * Setup document element ordering for later efficiencies
-     * (bug 133289)
+     * The registered external modules are initialized on first use,
+     * see xsltInitCtxtExtByURI()
      */
-    if (xslDebugStatus == XSLT_DEBUG_NONE)
-        xmlXPathOrderDocElems(doc);
+    xsltOrderDocElems(doc);
     /*
      * Must set parserOptions before calling xsltNewDocument
      * (bug 164530)
@@ -709,6 +897,95 @@ internal_err:
     return(NULL);
 }
 
+/**
+ * xsltSetCtxtCacheLimits:
+ * @ctxt:  an XSLT transformation context
+ * @maxRVT:  the max number of released tree fragments kept for reuse,
+ *           or -1 to keep the current limit
+ * @maxStackItems:  the max number of released variables/params kept
+ *                  for reuse, or -1 to keep the current limit
+ *
+ * Tunes the caches of @ctxt. Released tree fragments are emptied
+ * before being cached, so every cached item has the same small
+ * footprint and the limits are expressed in items. Items exceeding a
+ * lowered limit are freed immediately.
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+int
+xsltSetCtxtCacheLimits(xsltTransformContextPtr ctxt, int maxRVT,
+		       int maxStackItems)
+{
+    xsltTransformCachePtr cache;
+
+    if ((ctxt == NULL) || (ctxt->cache == NULL))
+	return(-1);
+    cache = ctxt->cache;
+    if (maxRVT >= 0) {
+	cache->maxRVT = maxRVT;
+	while (cache->nbRVT > maxRVT) {
+	    xmlDocPtr cur = cache->RVT;
+
+	    cache->RVT = (xmlDocPtr) cur->next;
+	    cache->nbRVT--;
+	    cache->freedRVTs++;
+	    xmlFreeDoc(cur);
+	}
+    }
+    if (maxStackItems >= 0) {
+	cache->maxStackItems = maxStackItems;
+	while (cache->nbStackItems > maxStackItems) {
+	    xsltStackElemPtr cur = cache->stackItems;
+
+	    cache->stackItems = cur->next;
+	    cache->nbStackItems--;
+	    cache->freedVars++;
+	    xmlFree(cur);
+	}
+    }
+    return(0);
+}
+
+/**
+ * xsltGetCtxtCacheStats:
+ * @ctxt:  an XSLT transformation context
+ * @newRVTs:  where to store the number of tree fragments allocated
+ * @reusedRVTs:  where to store the number of tree fragments reused
+ * @freedRVTs:  where to store the number of released tree fragments
+ *              freed because the cache was full
+ * @newVars:  where to store the number of variables/params allocated
+ * @reusedVars:  where to store the number of variables/params reused
+ * @freedVars:  where to store the number of released variables/params
+ *              freed because the cache was full
+ *
+ * Reports the use of the caches of @ctxt, any of the pointers can
+ * be NULL. The reuse ratio of tree fragments is
+ * reusedRVTs / (newRVTs + reusedRVTs).
+ *
+ * Returns 0 in case of success and -1 in case of error.
+ */
+int
+xsltGetCtxtCacheStats(xsltTransformContextPtr ctxt, int *newRVTs,
+		      int *reusedRVTs, int *freedRVTs, int *newVars,
+		      int *reusedVars, int *freedVars)
+{
+    if ((ctxt == NULL) || (ctxt->cache == NULL))
+	return(-1);
+    if (newRVTs != NULL)
+	*newRVTs = ctxt->cache->newRVTs;
+    if (reusedRVTs != NULL)
+	*reusedRVTs = ctxt->cache->reusedRVTs;
+    if (freedRVTs != NULL)
+	*freedRVTs = ctxt->cache->freedRVTs;
+    if (newVars != NULL)
+	*newVars = ctxt->cache->newVars;
+    if (reusedVars != NULL)
+	*reusedVars = ctxt->cache->reusedVars;
+    if (freedVars != NULL)
+	*freedVars = ctxt->cache->freedVars;
+    return(0);
+}
+
 /**
  * xsltFreeTransformContext:
  * @ctxt:  an XSLT parser context
@@ -746,6 +1023,8 @@ xsltFreeTransformContext(xsltTransformContextPtr ctxt) {
 	}
 	xmlFree(ctxt->extras);
     }
+    if (ctxt->templMemo != NULL)
+	xmlHashFree(ctxt->templMemo, NULL);
     xsltFreeGlobalVariables(ctxt);
     xsltFreeDocuments(ctxt);
     xsltFreeCtxtExts(ctxt);
@@ -815,7 +1094,7 @@ xsltAddTextString(xsltTransformContextPtr ctxt, xmlNodePtr target,
     if ((len <= 0) || (string == NULL) || (target == NULL))
         return(target);
 
-    if (ctxt->lasttext == target->content) {
+    if ((ctxt->lasttext != NULL) && (ctxt->lasttext == target->content)) {
 
 	if (ctxt->lasttuse + len >= ctxt->lasttsize) {
 	    xmlChar *newbuf;
@@ -837,11 +1116,37 @@ xsltAddTextString(xsltTransformContextPtr ctxt, xmlNodePtr target,
 	ctxt->lasttuse += len;
 	target->content[ctxt->lasttuse] = 0;
     } else {
-	xmlNodeAddContent(target, string);
-	ctxt->lasttext = target->content;
-	len = xmlStrlen(target->content);
-	ctxt->lasttsize = len;
-	ctxt->lasttuse = len;
+	xmlChar *newbuf;
+	int used, size;
+
+	/*
+	* The content is not the pending text buffer, e.g. it was
+	* interned or created elsewhere: turn it into a growable buffer
+	* so that following appends don't reallocate on every call.
+	*/
+	used = xmlStrlen(target->content);
+	size = (used + len + 100) * 2;
+	if ((target->content == NULL) ||
+	    (target->content == (xmlChar *) &(target->properties)) ||
+	    ((target->doc != NULL) && (target->doc->dict != NULL) &&
+	     (xmlDictOwns(target->doc->dict, target->content)))) {
+	    newbuf = (xmlChar *) xmlMalloc(size);
+	    if ((newbuf != NULL) && (used > 0))
+		memcpy(newbuf, target->content, used);
+	} else
+	    newbuf = (xmlChar *) xmlRealloc(target->content, size);
+	if (newbuf == NULL) {
+	    xsltTransformError(ctxt, NULL, target,
+	     "xsltCopyText: text allocation failed\n");
+	    ctxt->lasttext = NULL;
+	    return(NULL);
+	}
+	memcpy(&newbuf[used], string, len);
+	newbuf[used + len] = 0;
+	target->content = newbuf;
+	ctxt->lasttext = newbuf;
+	ctxt->lasttsize = size;
+	ctxt->lasttuse = used + len;
     }
     return(target);
 }
@@ -927,14 +1232,40 @@ xsltCopyTextString(xsltTransformContextPtr ctxt, xmlNodePtr target,
 	    (target->last->name == xmlStringText)) {
 	    return(xsltAddTextString(ctxt, target->last, string, len));
 	}
-	copy = xmlNewTextLen(string, len);
+	if ((len <= XSLT_TEXT_INTERN_MAX) && (target != NULL) &&
+	    (target->parent != NULL) &&
+	    (target->doc != NULL) && (target->doc->dict == ctxt->dict) &&
+	    (!XSLT_IS_RES_TREE_FRAG(target->doc)))
+	{
+	    /*
+	    * Small pieces of the final result are stored in the output
+	    * dictionary; they are moved to a buffer by
+	    * xsltAddTextString() if more text follows.
+	    */
+	    copy = xmlNewTextLen(NULL, 0);
+	    if (copy != NULL) {
+		copy->doc = target->doc;
+		copy->content = (xmlChar *) xmlDictLookup(ctxt->dict,
+		    string, len);
+		if (copy->content == NULL) {
+		    xmlFreeNode(copy);
+		    copy = NULL;
+		}
+	    }
+	} else
+	    copy = xmlNewTextLen(string, len);
     }
     if (copy != NULL && target != NULL)
 	copy = xsltAddChild(target, copy);
     if (copy != NULL) {
-	ctxt->lasttext = copy->content;
-	ctxt->lasttsize = len;
-	ctxt->lasttuse = len;
+	if ((copy->doc != NULL) && (copy->doc->dict != NULL) &&
+	    (xmlDictOwns(copy->doc->dict, copy->content))) {
+	    ctxt->lasttext = NULL;
+	} else {
+	    ctxt->lasttext = copy->content;
+	    ctxt->lasttsize = len;
+	    ctxt->lasttuse = len;
+	}
     } else {
 	xsltTransformError(ctxt, NULL, target,
 			 "xsltCopyTextString: text copy failed\n");
@@ -1581,6 +1912,142 @@ occupied:
     return(NULL);
 }
 
+/**
+ * xsltShareSubtree:
+ * @ctxt:  the XSLT transformation context
+ * @node:  an element of the input document being copied
+ * @copy:  its shallow copy in the result document
+ *
+ * Lets @copy stand for a copy of the children of @node instead of
+ * duplicating them, the serializer then writes them directly from the
+ * input document. This is only done for results which are serialized
+ * before the input is released, and only if serializing the input
+ * nodes gives the same output as serializing a copy: their namespaces
+ * must be in scope with the same prefixes, they must not hold
+ * redundant namespace declarations, CDATA sections or character
+ * data escaped differently in the two documents.
+ *
+ * The result tree is never navigated by the transformation; the
+ * exceptions are the copy of nodes already in the result, which
+ * xsltCopyTreeInternal() handles, and the temporary elements turned
+ * into strings by xsltEvalTemplateString(), which are not attached to
+ * the result document and never share.
+ *
+ * Returns 0 if the children are shared, -1 if they must be copied
+ */
+static int
+xsltShareSubtree(xsltTransformContextPtr ctxt, xmlNodePtr node,
+		 xmlNodePtr copy)
+{
+    xmlDocPtr res = copy->doc;
+    xmlNodePtr cur, root;
+    xmlNsPtr *nsList, *curns, ns, luNs;
+    xmlAttrPtr attr;
+    int checkAttrs, ret = 0;
+
+    if ((node->type != XML_ELEMENT_NODE) || (res != ctxt->shareResult) ||
+	(node->doc != ctxt->shareSource) || (node->children == NULL))
+	return(-1);
+
+    /*
+    * Temporary elements of the result document, like the ones holding
+    * the content of xsl:attribute or xsl:comment, are read back as
+    * strings and must hold real copies.
+    */
+    for (cur = copy->parent; cur != NULL; cur = cur->parent)
+	if (cur->type == XML_DOCUMENT_NODE)
+	    break;
+    if (cur != (xmlNodePtr) res)
+	return(-1);
+
+    /*
+    * The default output method might still switch to HTML.
+    */
+    root = xmlDocGetRootElement(res);
+    if ((root != NULL) && (root->ns == NULL) &&
+	(!xmlStrcasecmp(root->name, (const xmlChar *) "html")))
+	return(-1);
+
+    luNs = xmlSearchNs(res, copy, NULL);
+    if ((luNs != NULL) && (luNs->href != NULL) && (luNs->href[0] != 0)) {
+	ns = xmlSearchNs(node->doc, node, NULL);
+	if ((ns == NULL) || (!xmlStrEqual(ns->href, luNs->href)))
+	    return(-1);
+    }
+    nsList = xmlGetNsList(node->doc, node);
+    if (nsList != NULL) {
+	for (curns = nsList; *curns != NULL; curns++) {
+	    luNs = xmlSearchNs(res, copy, (*curns)->prefix);
+	    if ((luNs == NULL) || (!xmlStrEqual(luNs->href, (*curns)->href))) {
+		ret = -1;
+		break;
+	    }
+	}
+	xmlFree(nsList);
+	if (ret < 0)
+	    return(-1);
+    }
+
+    /*
+    * Non-ASCII characters in attributes are escaped depending on the
+    * encoding of the document.
+    */
+    checkAttrs = ((node->doc->encoding == NULL) != (res->encoding == NULL));
+    cur = node->children;
+    while (cur != NULL) {
+	switch (cur->type) {
+	    case XML_ELEMENT_NODE:
+		for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+		    luNs = xmlSearchNs(node->doc, cur->parent, ns->prefix);
+		    if ((luNs != NULL) && (xmlStrEqual(luNs->href, ns->href)))
+			return(-1);
+		}
+		if (checkAttrs) {
+		    for (attr = cur->properties; attr != NULL;
+			 attr = attr->next) {
+			xmlNodePtr txt;
+
+			for (txt = attr->children; txt != NULL;
+			     txt = txt->next) {
+			    const xmlChar *c = txt->content;
+
+			    if (c == NULL)
+				continue;
+			    while ((*c != 0) && (*c < 0x80))
+				c++;
+			    if (*c != 0)
+				return(-1);
+			}
+		    }
+		}
+		break;
+	    case XML_TEXT_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_PI_NODE:
+	    case XML_ENTITY_REF_NODE:
+		break;
+	    default:
+		return(-1);
+	}
+	if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+	    cur = cur->children;
+	    continue;
+	}
+	while ((cur->parent != node) && (cur->next == NULL))
+	    cur = cur->parent;
+	cur = cur->next;
+    }
+
+    copy->psvi = node;
+    for (cur = copy->parent;
+	 (cur != NULL) && (cur->type == XML_ELEMENT_NODE) &&
+	 (!XSLT_HAS_SHARED_NODES(cur));
+	 cur = cur->parent)
+	cur->psvi = (void *) res;
+    res->psvi = (void *) res;
+    return(0);
+}
+
 /**
  * xsltCopyTreeInternal:
  * @ctxt:  the XSLT transformation context
@@ -1607,6 +2074,7 @@ xsltCopyTreeInternal(xsltTransformContextPtr ctxt,
 		     xmlNodePtr insert, int isLRE, int topElemVisited)
 {
     xmlNodePtr copy;
+    int topElem = (topElemVisited == 0);
 
     if (node == NULL)
 	return(NULL);
@@ -1786,8 +2254,20 @@ xsltCopyTreeInternal(xsltTransformContextPtr ctxt,
 	* Copy the subtree.
 	*/
 	if (node->children != NULL) {
+	    if ((topElem) && (!isLRE) && (ctxt->shareResult != NULL) &&
+		(xsltShareSubtree(ctxt, node, copy) == 0))
+		return(copy);
 	    xsltCopyTreeList(ctxt, invocNode,
 		node->children, copy, isLRE, topElemVisited);
+	} else if ((node->doc != NULL) &&
+		   (XSLT_DOC_HAS_SHARED_NODES(node->doc)) &&
+		   (XSLT_SHARED_SOURCE(node) != NULL)) {
+	    /*
+	    * Copying a result element sharing the children of an
+	    * input element.
+	    */
+	    xsltCopyTreeList(ctxt, invocNode,
+		XSLT_SHARED_SOURCE(node)->children, copy, isLRE, 1);
 	}
     } else {
 	xsltTransformError(ctxt, NULL, invocNode,
@@ -1796,71 +2276,300 @@ xsltCopyTreeInternal(xsltTransformContextPtr ctxt,
     return(copy);
 }
 
+#define XSLT_MOVE_MAX_NS 16
+
 /**
- * xsltCopyTree:
- * @ctxt:  the XSLT transformation context
- * @node:  the element node in the source tree
- * @insert:  the parent in the result tree
- * @literal:  indicates if @node is a Literal Result Element
- *
- * Make a copy of the full tree under the element node @node
- * and insert it as last child of @insert
- * For literal result element, some of the namespaces may not be copied
- * over according to section 7.1.
- * TODO: Why is this a public function?
+ * xsltMoveNsMap:
+ * @ns:  a namespace referenced in a moved subtree
+ * @from:  the namespaces to replace
+ * @to:  their replacements
+ * @nb:  the number of replacements
  *
- * Returns a pointer to the new tree, or NULL in case of error
+ * Returns the namespace to use for @ns after the move
  */
-xmlNodePtr
-xsltCopyTree(xsltTransformContextPtr ctxt, xmlNodePtr node,
-	     xmlNodePtr insert, int literal)
-{
-    return(xsltCopyTreeInternal(ctxt, node, node, insert, literal, 0));
+static xmlNsPtr
+xsltMoveNsMap(xmlNsPtr ns, xmlNsPtr *from, xmlNsPtr *to, int nb) {
+    int i;
 
+    for (i = 0; i < nb; i++) {
+	if (from[i] == ns)
+	    return(to[i]);
+    }
+    return(ns);
 }
 
-/************************************************************************
- *									*
- *		Error/fallback processing				*
- *									*
- ************************************************************************/
-
 /**
- * xsltApplyFallbacks:
- * @ctxt:  a XSLT process context
- * @node:  the node in the source tree.
- * @inst:  the node generating the error
- *
- * Process possible xsl:fallback nodes present under @inst
+ * xsltMoveNsInScope:
+ * @node:  an element of the subtree to be moved
+ * @top:  the root of that subtree
+ * @ns:  a namespace referenced by @node or one of its attributes
  *
- * Returns the number of xsl:fallback element found and processed
+ * Returns 1 if @ns is declared on @node or one of its ancestors up
+ * to @top, 0 otherwise
  */
 static int
-xsltApplyFallbacks(xsltTransformContextPtr ctxt, xmlNodePtr node,
-	           xmlNodePtr inst) {
-
-    xmlNodePtr child;
-    int ret = 0;
-
-    if ((ctxt == NULL) || (node == NULL) || (inst == NULL) ||
-	(inst->children == NULL))
-	return(0);
+xsltMoveNsInScope(xmlNodePtr node, xmlNodePtr top, xmlNsPtr ns) {
+    xmlNsPtr cur;
 
-    child = inst->children;
-    while (child != NULL) {
-        if ((IS_XSLT_ELEM(child)) &&
-            (xmlStrEqual(child->name, BAD_CAST "fallback"))) {
-#ifdef WITH_XSLT_DEBUG_PARSING
-	    xsltGenericDebug(xsltGenericDebugContext,
-			     "applying xsl:fallback\n");
-#endif
-	    ret++;
-	    xsltApplySequenceConstructor(ctxt, node, child->children,
-		NULL);
+    while (node != NULL) {
+	for (cur = node->nsDef; cur != NULL; cur = cur->next) {
+	    if (cur == ns)
+		return(1);
 	}
-	child = child->next;
+	if (node == top)
+	    break;
+	node = node->parent;
     }
-    return(ret);
+    return(0);
+}
+
+/**
+ * xsltMoveTree:
+ * @ctxt:  the XSLT transformation context
+ * @invocNode: responsible node in the stylesheet; used for error reports
+ * @node:  a top-level element of a result tree fragment
+ * @insert:  the parent in the result tree
+ *
+ * Relinks @node as last child of @insert instead of copying it. The
+ * fragment must not be used afterwards. Namespace declarations of
+ * @node already in scope at @insert are dropped, like
+ * xsltCopyTreeInternal() does.
+ *
+ * Returns 0 in case of success, -1 if @node must be copied instead
+ */
+static int
+xsltMoveTree(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
+	     xmlNodePtr node, xmlNodePtr insert)
+{
+    xmlNsPtr from[XSLT_MOVE_MAX_NS], to[XSLT_MOVE_MAX_NS];
+    xmlNsPtr ns, prev, next, xmlDeclNs = NULL;
+    xmlDocPtr frag = node->doc;
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+    int nb = 0, useXmlNs = 0;
+
+    /*
+    * Only move trees which reference namespaces declared inside of
+    * them or the XML namespace, and no entities.
+    */
+    cur = node;
+    while (cur != NULL) {
+	switch (cur->type) {
+	    case XML_ELEMENT_NODE:
+		if (cur->ns != NULL) {
+		    if (cur->ns == frag->oldNs)
+			useXmlNs = 1;
+		    else if (!xsltMoveNsInScope(cur, node, cur->ns))
+			return(-1);
+		}
+		for (attr = cur->properties; attr != NULL;
+		     attr = attr->next) {
+		    if (attr->ns == NULL)
+			continue;
+		    if (attr->ns == frag->oldNs)
+			useXmlNs = 1;
+		    else if (!xsltMoveNsInScope(cur, node, attr->ns))
+			return(-1);
+		    if ((attr->children != NULL) &&
+			((attr->children->type != XML_TEXT_NODE) ||
+			 (attr->children->next != NULL)))
+			return(-1);
+		}
+		break;
+	    case XML_TEXT_NODE:
+	    case XML_CDATA_SECTION_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_PI_NODE:
+		break;
+	    default:
+		return(-1);
+	}
+	if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+	    cur = cur->children;
+	    continue;
+	}
+	while ((cur != node) && (cur->next == NULL))
+	    cur = cur->parent;
+	if (cur == node)
+	    break;
+	cur = cur->next;
+    }
+
+    if (useXmlNs) {
+	xmlDeclNs = xmlSearchNs(insert->doc, insert, BAD_CAST "xml");
+	if (xmlDeclNs == NULL)
+	    return(-1);
+	from[nb] = frag->oldNs;
+	to[nb++] = xmlDeclNs;
+    }
+
+    xmlUnlinkNode(node);
+    xmlSetTreeDoc(node, insert->doc);
+    xsltAddChild(insert, node);
+
+    /*
+    * Drop the namespace declarations already in scope.
+    */
+    prev = NULL;
+    ns = node->nsDef;
+    while (ns != NULL) {
+	next = ns->next;
+	if (nb < XSLT_MOVE_MAX_NS) {
+	    xmlNsPtr luNs = xmlSearchNs(insert->doc, insert, ns->prefix);
+
+	    if ((luNs != NULL) && (xmlStrEqual(luNs->href, ns->href))) {
+		if (prev == NULL)
+		    node->nsDef = next;
+		else
+		    prev->next = next;
+		ns->next = NULL;
+		from[nb] = ns;
+		to[nb++] = luNs;
+		ns = next;
+		continue;
+	    }
+	}
+	prev = ns;
+	ns = next;
+    }
+    if (nb > 0) {
+	cur = node;
+	while (cur != NULL) {
+	    if (cur->type == XML_ELEMENT_NODE) {
+		if (cur->ns != NULL)
+		    cur->ns = xsltMoveNsMap(cur->ns, from, to, nb);
+		for (attr = cur->properties; attr != NULL;
+		     attr = attr->next) {
+		    if (attr->ns != NULL)
+			attr->ns = xsltMoveNsMap(attr->ns, from, to, nb);
+		}
+		if (cur->children != NULL) {
+		    cur = cur->children;
+		    continue;
+		}
+	    }
+	    while ((cur != node) && (cur->next == NULL))
+		cur = cur->parent;
+	    if (cur == node)
+		break;
+	    cur = cur->next;
+	}
+	while (nb > useXmlNs)
+	    xmlFreeNs(from[--nb]);
+    }
+
+    if ((node->ns == NULL) && (insert->type == XML_ELEMENT_NODE) &&
+	(insert->ns != NULL))
+    {
+	/*
+	* "Undeclare" the default namespace on @node with xmlns="".
+	*/
+	xsltGetSpecialNamespace(ctxt, invocNode, NULL, NULL, node);
+    }
+    return(0);
+}
+
+/**
+ * xsltMoveTreeList:
+ * @ctxt:  the XSLT transformation context
+ * @invocNode: responsible node in the stylesheet; used for error reports
+ * @frag:  a result tree fragment which is not used anymore
+ * @insert:  the parent in the result tree
+ *
+ * Appends the content of @frag to @insert, relinking the elements
+ * instead of copying them when possible.
+ */
+static void
+xsltMoveTreeList(xsltTransformContextPtr ctxt, xmlNodePtr invocNode,
+		 xmlDocPtr frag, xmlNodePtr insert)
+{
+    xmlNodePtr cur, next;
+
+    if ((insert->doc == NULL) || (frag->dict != insert->doc->dict) ||
+	(frag->psvi == XSLT_RVT_FUNC_RESULT))
+    {
+	xsltCopyTreeList(ctxt, invocNode, frag->children, insert, 0, 0);
+	return;
+    }
+    cur = frag->children;
+    while (cur != NULL) {
+	next = cur->next;
+	if ((cur->type != XML_ELEMENT_NODE) ||
+	    (xsltMoveTree(ctxt, invocNode, cur, insert) < 0))
+	    xsltCopyTreeInternal(ctxt, invocNode, cur, insert, 0, 0);
+	cur = next;
+    }
+    /*
+    * The text coalescing buffer might belong to a moved node.
+    */
+    ctxt->lasttext = NULL;
+}
+
+/**
+ * xsltCopyTree:
+ * @ctxt:  the XSLT transformation context
+ * @node:  the element node in the source tree
+ * @insert:  the parent in the result tree
+ * @literal:  indicates if @node is a Literal Result Element
+ *
+ * Make a copy of the full tree under the element node @node
+ * and insert it as last child of @insert
+ * For literal result element, some of the namespaces may not be copied
+ * over according to section 7.1.
+ * TODO: Why is this a public function?
+ *
+ * Returns a pointer to the new tree, or NULL in case of error
+ */
+xmlNodePtr
+xsltCopyTree(xsltTransformContextPtr ctxt, xmlNodePtr node,
+	     xmlNodePtr insert, int literal)
+{
+    return(xsltCopyTreeInternal(ctxt, node, node, insert, literal, 0));
+
+}
+
+/************************************************************************
+ *									*
+ *		Error/fallback processing				*
+ *									*
+ ************************************************************************/
+
+/**
+ * xsltApplyFallbacks:
+ * @ctxt:  a XSLT process context
+ * @node:  the node in the source tree.
+ * @inst:  the node generating the error
+ *
+ * Process possible xsl:fallback nodes present under @inst
+ *
+ * Returns the number of xsl:fallback element found and processed
+ */
+static int
+xsltApplyFallbacks(xsltTransformContextPtr ctxt, xmlNodePtr node,
+	           xmlNodePtr inst) {
+
+    xmlNodePtr child;
+    int ret = 0;
+
+    if ((ctxt == NULL) || (node == NULL) || (inst == NULL) ||
+	(inst->children == NULL))
+	return(0);
+
+    child = inst->children;
+    while (child != NULL) {
+        if ((IS_XSLT_ELEM(child)) &&
+            (xmlStrEqual(child->name, BAD_CAST "fallback"))) {
+#ifdef WITH_XSLT_DEBUG_PARSING
+	    xsltGenericDebug(xsltGenericDebugContext,
+			     "applying xsl:fallback\n");
+#endif
+	    ret++;
+	    xsltApplySequenceConstructor(ctxt, node, child->children,
+		NULL);
+	}
+	child = child->next;
+    }
+    return(ret);
 }
 
 /************************************************************************
@@ -2290,38 +2999,65 @@ xsltLocalVariablePush(xsltTransformContextPtr ctxt,
 
 /**
  * xsltReleaseLocalRVTs:
+ * @ctxt:  a XSLT process context
+ * @base:  the top of the local fragment list when the scope was entered
+ * @preserve:  whether fragments returned by extension instructions
+ *             must be kept
  *
- * Fragments which are results of extension instructions
- * are preserved; all other fragments are freed/cached.
+ * Drops the region of local result tree fragments registered since the
+ * scope identified by @base was entered. The region is detached from
+ * ctxt->localRVT at once. If @preserve is set, fragments which are
+ * results of extension instructions escape the scope and are promoted
+ * to the enclosing region; all other fragments are freed/cached.
  */
 static void
-xsltReleaseLocalRVTs(xsltTransformContextPtr ctxt, xmlDocPtr base)
+xsltReleaseLocalRVTs(xsltTransformContextPtr ctxt, xmlDocPtr base,
+		     int preserve)
 {
-    xmlDocPtr cur = ctxt->localRVT, tmp;
-
-    while ((cur != NULL) && (cur != base)) {
-	if (cur->psvi == (void *) ((long) 1)) {
-	    cur = (xmlDocPtr) cur->next;
-	} else {
-	    tmp = cur;
-	    cur = (xmlDocPtr) cur->next;
+    xmlDocPtr cur = ctxt->localRVT, next;
+    xmlDocPtr keep = NULL, keepLast = NULL;
+    int baseReleased = 0;
 
-	    if (tmp == ctxt->localRVT)
-		ctxt->localRVT = cur;
+    if ((cur == NULL) || (cur == base))
+	return;
 
+    ctxt->localRVT = base;
+    if (base != NULL)
+	base->prev = NULL;
+    do {
+	next = (xmlDocPtr) cur->next;
+	if ((preserve) && (cur->psvi == XSLT_RVT_FUNC_RESULT)) {
+	    cur->prev = (xmlNodePtr) keepLast;
+	    cur->next = NULL;
+	    if (keepLast != NULL)
+		keepLast->next = (xmlNodePtr) cur;
+	    else
+		keep = cur;
+	    keepLast = cur;
 	    /*
 	    * We need ctxt->localRVTBase for extension instructions
-	    * which return values (like EXSLT's function).
+	    * which return values (like EXSLT's function); it moves to
+	    * the next remaining fragment if released.
 	    */
-	    if (tmp == ctxt->localRVTBase)
+	    if (baseReleased) {
 		ctxt->localRVTBase = cur;
-
-	    if (tmp->prev)
-		tmp->prev->next = (xmlNodePtr) cur;
-	    if (cur)
-		cur->prev = tmp->prev;
-	    xsltReleaseRVT(ctxt, tmp);
+		baseReleased = 0;
+	    }
+	} else {
+	    if (cur == ctxt->localRVTBase)
+		baseReleased = 1;
+	    xsltReleaseRVT(ctxt, cur);
 	}
+	cur = next;
+    } while ((cur != NULL) && (cur != base));
+
+    if (baseReleased)
+	ctxt->localRVTBase = base;
+    if (keep != NULL) {
+	keepLast->next = (xmlNodePtr) base;
+	if (base != NULL)
+	    base->prev = (xmlNodePtr) keepLast;
+	ctxt->localRVT = keep;
     }
 }
 
@@ -2600,7 +3336,7 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
 		    * Cleanup temporary tree fragments.
 		    */
 		    if (oldLocalFragmentTop != ctxt->localRVT)
-			xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop);
+			xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop, 1);
 
 		    ctxt->insert = oldInsert;
 		} else if (info->type == XSLT_FUNC_VARIABLE) {
@@ -2690,7 +3426,7 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
 		    * Cleanup temporary tree fragments.
 		    */
 		    if (oldLocalFragmentTop != ctxt->localRVT)
-			xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop);
+			xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop, 1);
 
 		    ctxt->insert = oldInsert;
 		}
@@ -2736,7 +3472,7 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
                      */
                     ctxt->insert = insert;
                     if (!xsltApplyFallbacks(ctxt, contextNode, cur)) {
-                        xsltGenericError(xsltGenericErrorContext,
+                        xsltTransformError(ctxt, NULL, cur,
 			    "xsltApplySequenceConstructor: %s was not compiled\n",
 			    cur->name);
                     }
@@ -2759,7 +3495,7 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
 		* Cleanup temporary tree fragments.
 		*/
 		if (oldLocalFragmentTop != ctxt->localRVT)
-		    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop);
+		    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop, 1);
 
                 ctxt->insert = oldInsert;
 		ctxt->inst = oldCurInst;
@@ -2881,7 +3617,7 @@ xsltApplySequenceConstructor(xsltTransformContextPtr ctxt,
 		* Cleanup temporary tree fragments.
 		*/
 		if (oldLocalFragmentTop != ctxt->localRVT)
-		    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop);
+		    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop, 1);
 
 		ctxt->localRVTBase = oldLocalFragmentBase;
                 ctxt->insert = oldInsert;
@@ -3032,6 +3768,211 @@ error:
 #endif
 }
 
+/**
+ * xsltTemplMemoAddString:
+ * @buf:  the key being built
+ * @str:  a string or NULL
+ *
+ * Appends a length prefixed string to a memoization key.
+ */
+static void
+xsltTemplMemoAddString(xmlBufferPtr buf, const xmlChar *str) {
+    char num[20];
+    int len = (str != NULL) ? xmlStrlen(str) : -1;
+
+    snprintf(num, sizeof(num), "%d:", len);
+    xmlBufferCCat(buf, num);
+    if (len > 0)
+	xmlBufferAdd(buf, str, len);
+}
+
+/**
+ * xsltTemplMemoAddNode:
+ * @buf:  the key being built
+ * @node:  a node
+ *
+ * Appends the identity of @node to a memoization key. Nodes of
+ * temporary trees and XPath namespace nodes don't have a stable
+ * identity.
+ *
+ * Returns 0 in case of success, -1 if @node can't be part of a key
+ */
+static int
+xsltTemplMemoAddNode(xmlBufferPtr buf, xmlNodePtr node) {
+    char ptr[40];
+
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL) ||
+        ((node->doc != NULL) && (XSLT_IS_RES_TREE_FRAG(node->doc))))
+	return(-1);
+    snprintf(ptr, sizeof(ptr), "%p,", (void *) node);
+    xmlBufferCCat(buf, ptr);
+    return(0);
+}
+
+/**
+ * xsltTemplMemoKey:
+ * @ctxt:  a XSLT transformation context
+ * @contextNode:  the context node
+ * @templ:  a template declared with libxslt:memoize
+ *
+ * Computes the memoization key of a call of @templ from the context
+ * node and the values of the parameters, which must already be on the
+ * variable stack.
+ *
+ * Returns the key or NULL if this call can't be memoized
+ */
+static xmlChar *
+xsltTemplMemoKey(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
+	         xsltTemplatePtr templ) {
+    xmlBufferPtr buf;
+    xmlChar *str, *ret = NULL;
+    char ptr[40];
+    int i, j;
+
+    buf = xmlBufferCreate();
+    if (buf == NULL)
+	return(NULL);
+    snprintf(ptr, sizeof(ptr), "%p|", (void *) templ);
+    xmlBufferCCat(buf, ptr);
+    if (templ->memoize == XSLT_MEMOIZE_STRING) {
+	str = xmlXPathCastNodeToString(contextNode);
+	if (str == NULL)
+	    goto done;
+	xsltTemplMemoAddString(buf, str);
+	xmlFree(str);
+    } else if (xsltTemplMemoAddNode(buf, contextNode) < 0) {
+	goto done;
+    }
+
+    for (i = ctxt->varsBase; i < ctxt->varsNr; i++) {
+	xsltStackElemPtr param = ctxt->varsTab[i];
+	xmlXPathObjectPtr val;
+
+	if ((param == NULL) || (param->value == NULL))
+	    goto done;
+	val = param->value;
+	xmlBufferCCat(buf, "|");
+	xsltTemplMemoAddString(buf, param->name);
+	xsltTemplMemoAddString(buf, param->nameURI);
+	switch (val->type) {
+	    case XPATH_NODESET:
+		xmlBufferCCat(buf, "N");
+		if (val->nodesetval == NULL)
+		    break;
+		for (j = 0; j < val->nodesetval->nodeNr; j++) {
+		    if (xsltTemplMemoAddNode(buf,
+			    val->nodesetval->nodeTab[j]) < 0)
+			goto done;
+		}
+		break;
+	    case XPATH_BOOLEAN:
+	    case XPATH_NUMBER:
+	    case XPATH_STRING:
+		snprintf(ptr, sizeof(ptr), "%d", (int) val->type);
+		xmlBufferCCat(buf, ptr);
+		str = xmlXPathCastToString(val);
+		if (str == NULL)
+		    goto done;
+		xsltTemplMemoAddString(buf, str);
+		xmlFree(str);
+		break;
+	    default:
+		/*
+		* Result tree fragments are compared by identity only
+		* while they are freed and reallocated all the time.
+		*/
+		goto done;
+	}
+    }
+    ret = xmlStrndup(xmlBufferContent(buf), xmlBufferLength(buf));
+done:
+    xmlBufferFree(buf);
+    return(ret);
+}
+
+/**
+ * xsltTemplMemoAttrState:
+ * @elem:  an element of the result tree
+ *
+ * Serializes the attributes and namespace declarations of @elem, used
+ * to detect templates setting attributes on their parent.
+ *
+ * Returns the state or NULL if @elem has no attributes
+ */
+static xmlChar *
+xsltTemplMemoAttrState(xmlNodePtr elem) {
+    xmlBufferPtr buf;
+    xmlAttrPtr attr;
+    xmlNsPtr ns;
+    xmlChar *ret, *value;
+
+    if ((elem->properties == NULL) && (elem->nsDef == NULL))
+	return(NULL);
+    buf = xmlBufferCreate();
+    if (buf == NULL)
+	return(NULL);
+    for (attr = elem->properties; attr != NULL; attr = attr->next) {
+	xsltTemplMemoAddString(buf, attr->name);
+	xsltTemplMemoAddString(buf,
+	    (attr->ns != NULL) ? attr->ns->href : NULL);
+	value = xmlNodeListGetString(attr->doc, attr->children, 1);
+	xsltTemplMemoAddString(buf, value);
+	if (value != NULL)
+	    xmlFree(value);
+    }
+    for (ns = elem->nsDef; ns != NULL; ns = ns->next) {
+	xsltTemplMemoAddString(buf, ns->prefix);
+	xsltTemplMemoAddString(buf, ns->href);
+    }
+    ret = xmlStrndup(xmlBufferContent(buf), xmlBufferLength(buf));
+    xmlBufferFree(buf);
+    return(ret);
+}
+
+/**
+ * xsltTemplMemoStore:
+ * @ctxt:  a XSLT transformation context
+ * @templ:  the memoized template
+ * @key:  the memoization key of the call
+ * @last:  the last child of the insertion point before the call
+ * @textLen:  the length of @last if it is a text node, -1 otherwise
+ *
+ * Saves a copy of the nodes a call of @templ appended to the result
+ * tree, text merged into a preceding text node included.
+ */
+static void
+xsltTemplMemoStore(xsltTransformContextPtr ctxt, xsltTemplatePtr templ,
+	           const xmlChar *key, xmlNodePtr last, int textLen) {
+    xmlNodePtr insert = ctxt->insert, first, text;
+    xmlDocPtr frag;
+    int len;
+
+    if (ctxt->templMemo == NULL) {
+	ctxt->templMemo = xmlHashCreate(0);
+	if (ctxt->templMemo == NULL)
+	    return;
+    }
+    frag = xsltCreateRVT(ctxt);
+    if (frag == NULL)
+	return;
+    if (textLen >= 0) {
+	len = xmlStrlen(last->content);
+	if (len > textLen) {
+	    text = xmlNewDocTextLen(frag, last->content + textLen,
+		                    len - textLen);
+	    if (text != NULL) {
+		text->name = last->name;
+		xmlAddChild((xmlNodePtr) frag, text);
+	    }
+	}
+    }
+    first = (last != NULL) ? last->next : insert->children;
+    if (first != NULL)
+	xsltCopyTreeList(ctxt, templ->elem, first, (xmlNodePtr) frag, 0, 0);
+    xsltRegisterPersistRVT(ctxt, frag);
+    xmlHashAddEntry(ctxt->templMemo, key, frag);
+}
+
 /*
 * xsltApplyXSLTTemplate:
 * @ctxt:  a XSLT transformation context
@@ -3060,6 +4001,9 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
     xmlNodePtr cur;
     xsltStackElemPtr tmpParam = NULL;
     xmlDocPtr oldUserFragmentTop, oldLocalFragmentTop;
+    xmlChar *memoKey = NULL, *memoAttrs = NULL;
+    xmlNodePtr memoLast = NULL, memoInsert = NULL;
+    int memoTextLen = -1, memoCheckAttrs = 0;
 
 #ifdef XSLT_REFACTORED
     xsltStyleItemParamPtr iparam;
@@ -3210,11 +4154,70 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
 	}
 	cur = cur->next;
     } while (cur != NULL);
+
+    /*
+    * Templates declared with libxslt:memoize: reuse the output of a
+    * previous call with the same context node and parameters.
+    */
+    if ((templ->memoize != XSLT_MEMOIZE_NONE) && (ctxt->insert != NULL))
+	memoKey = xsltTemplMemoKey(ctxt, contextNode, templ);
+    if (memoKey != NULL) {
+	xmlDocPtr frag = NULL;
+
+	if (ctxt->templMemo != NULL)
+	    frag = (xmlDocPtr) xmlHashLookup(ctxt->templMemo, memoKey);
+	if (frag != NULL) {
+	    if (ctxt->profile)
+		templ->memoHits++;
+	    if (frag->children != NULL)
+		xsltCopyTreeList(ctxt, templ->elem, frag->children,
+		    ctxt->insert, 0, 0);
+	    xmlFree(memoKey);
+	    memoKey = NULL;
+	    goto memo_done;
+	}
+	if (ctxt->profile)
+	    templ->memoMisses++;
+	memoInsert = ctxt->insert;
+	memoLast = memoInsert->last;
+	if ((memoLast != NULL) && (memoLast->type == XML_TEXT_NODE))
+	    memoTextLen = xmlStrlen(memoLast->content);
+	/*
+	* Attributes can only be added to an element without children.
+	*/
+	if ((memoInsert->type == XML_ELEMENT_NODE) &&
+	    (memoInsert->children == NULL))
+	{
+	    memoCheckAttrs = 1;
+	    memoAttrs = xsltTemplMemoAttrState(memoInsert);
+	}
+    }
+
     /*
     * Process the sequence constructor.
     */
     xsltApplySequenceConstructor(ctxt, contextNode, list, templ);
 
+    if (memoKey != NULL) {
+	int store = ((ctxt->state == XSLT_STATE_OK) &&
+		     (ctxt->insert == memoInsert));
+
+	if ((store) && (memoCheckAttrs)) {
+	    xmlChar *attrs = xsltTemplMemoAttrState(memoInsert);
+
+	    store = xmlStrEqual(attrs, memoAttrs);
+	    if (attrs != NULL)
+		xmlFree(attrs);
+	}
+	if (store)
+	    xsltTemplMemoStore(ctxt, templ, memoKey, memoLast, memoTextLen);
+	if (memoAttrs != NULL)
+	    xmlFree(memoAttrs);
+	xmlFree(memoKey);
+    }
+
+memo_done:
+
     /*
     * Remove remaining xsl:param and xsl:with-param items from
     * the stack. Don't free xsl:with-param items.
@@ -3230,23 +4233,7 @@ xsltApplyXSLTTemplate(xsltTransformContextPtr ctxt,
     * just for the case xsltExtensionInstructionResultFinalize()
     * was not called by the extension author.
     */
-    if (oldLocalFragmentTop != ctxt->localRVT) {
-	xmlDocPtr curdoc = ctxt->localRVT, tmp;
-
-	do {
-	    tmp = curdoc;
-	    curdoc = (xmlDocPtr) curdoc->next;
-	    /* Need to housekeep localRVTBase */
-	    if (tmp == ctxt->localRVTBase)
-	        ctxt->localRVTBase = curdoc;
-	    if (tmp->prev)
-		tmp->prev->next = (xmlNodePtr) curdoc;
-	    if (curdoc)
-		curdoc->prev = tmp->prev;
-	    xsltReleaseRVT(ctxt, tmp);
-	} while (curdoc != oldLocalFragmentTop);
-    }
-    ctxt->localRVT = oldLocalFragmentTop;
+    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop, 0);
 
     /*
     * Release user-created fragments stored in the scope
@@ -4488,8 +5475,18 @@ xsltCopyOf(xsltTransformContextPtr ctxt, xmlNodePtr node,
 		(list->nodeTab[0] != NULL) &&
 		(IS_XSLT_REAL_NODE(list->nodeTab[0])))
 	    {
-		xsltCopyTreeList(ctxt, inst,
-		    list->nodeTab[0]->children, ctxt->insert, 0, 0);
+		/*
+		* If this is the last use of a local variable, its
+		* fragment can be moved over.
+		*/
+		if ((comp->moveVar) &&
+		    (list->nodeTab[0]->type == XML_DOCUMENT_NODE) &&
+		    (XSLT_IS_RES_TREE_FRAG(list->nodeTab[0])))
+		    xsltMoveTreeList(ctxt, inst,
+			(xmlDocPtr) list->nodeTab[0], ctxt->insert);
+		else
+		    xsltCopyTreeList(ctxt, inst,
+			list->nodeTab[0]->children, ctxt->insert, 0, 0);
 	    }
 	} else {
 	    xmlChar *value = NULL;
@@ -4799,11 +5796,11 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 			withParams = param;
 		    }
 		} else {
-		    xsltGenericError(xsltGenericErrorContext,
+		    xsltTransformError(ctxt, NULL, cur,
 			"xsl:call-template: misplaced xsl:%s\n", cur->name);
 		}
 	    } else {
-		xsltGenericError(xsltGenericErrorContext,
+		xsltTransformError(ctxt, NULL, cur,
 		    "xsl:call-template: misplaced %s element\n", cur->name);
 	    }
 	    cur = cur->next;
@@ -4824,12 +5821,603 @@ xsltCallTemplate(xsltTransformContextPtr ctxt, xmlNodePtr node,
 #endif
 }
 
-/**
- * xsltApplyTemplates:
- * @ctxt:  a XSLT transformation context
- * @node:  the 'current node' in the source tree
- * @inst:  the element node of an XSLT 'apply-templates' instruction
- * @castedComp:  the compiled instruction
+/************************************************************************
+ *									*
+ *		Parallel processing of the selected nodes		*
+ *									*
+ ************************************************************************/
+
+/*
+ * A range of the nodes selected by a libxslt:parallel instruction,
+ * processed by its own transformation context into its own document.
+ */
+typedef struct _xsltParallelChunk xsltParallelChunk;
+typedef xsltParallelChunk *xsltParallelChunkPtr;
+struct _xsltParallelChunk {
+    xsltTransformContextPtr ctxt;	/* the worker context */
+    xmlDocPtr output;			/* the document receiving the output */
+    xmlNodePtr insert;			/* stands for the insertion point */
+    int start;				/* the index of the first node */
+    int end;				/* the index after the last node */
+    int failed;				/* an error or a warning was raised */
+};
+
+typedef struct _xsltParallelJob xsltParallelJob;
+typedef xsltParallelJob *xsltParallelJobPtr;
+struct _xsltParallelJob {
+    xmlNodeSetPtr list;			/* the selected nodes */
+    xmlNsPtr *nsList;			/* the namespaces in scope of the
+					   insertion point */
+    int nsNr;				/* the number of such namespaces */
+    xmlNsPtr xmlNs;			/* the XML namespace of the output */
+    xmlNodePtr body;			/* the content of an xsl:for-each,
+					   NULL to apply the templates */
+    xsltStackElemPtr *vars;		/* the local variables in scope */
+    int varsNr;				/* the number of such variables */
+    xsltParallelChunkPtr chunks;
+    int nbChunks;
+};
+
+static void
+xsltParallelError(void *ctx, const char *msg ATTRIBUTE_UNUSED, ...) {
+    ((xsltParallelChunkPtr) ctx)->failed = 1;
+}
+
+static void
+xsltParallelStructuredError(void *ctx,
+			    XSLT_ERROR_CONST xmlError *error ATTRIBUTE_UNUSED) {
+    ((xsltParallelChunkPtr) ctx)->failed = 1;
+}
+
+/**
+ * xsltParallelCheckVariable:
+ * @elem:  a variable or a parameter
+ *
+ * Checks whether @elem can be read by concurrent contexts: its value
+ * must have been computed and must not hold tree fragments, which get
+ * annotated when used.
+ *
+ * Returns 1 if so, 0 if the value wasn't computed, -1 if it holds tree
+ *         fragments
+ */
+static int
+xsltParallelCheckVariable(xsltStackElemPtr elem) {
+    xmlNodePtr node;
+    int i;
+
+    if (elem->computed == 0)
+	return(0);
+    if ((elem->value == NULL) || (elem->value->nodesetval == NULL) ||
+	((elem->value->type != XPATH_NODESET) &&
+	 (elem->value->type != XPATH_XSLT_TREE)))
+	return(1);
+    for (i = 0; i < elem->value->nodesetval->nodeNr; i++) {
+	node = elem->value->nodesetval->nodeTab[i];
+	if (node->type == XML_NAMESPACE_DECL)
+	    node = (xmlNodePtr) ((xmlNsPtr) node)->next;
+	if ((node != NULL) && (XSLT_IS_RES_TREE_FRAG(node->doc)))
+	    return(-1);
+    }
+    return(1);
+}
+
+static void
+xsltParallelCheckGlobal(void *payload, void *data,
+			const xmlChar *name ATTRIBUTE_UNUSED) {
+    int *state = (int *) data;
+
+    if (*state > 0)
+	*state = xsltParallelCheckVariable((xsltStackElemPtr) payload);
+}
+
+/**
+ * xsltParallelChunkCount:
+ * @ctxt:  the XSLT transformation context
+ * @list:  the nodes selected by a libxslt:parallel instruction
+ *
+ * Decides whether @list can be processed by concurrent contexts: the
+ * templates of the stylesheet must be safe (see xsltIsParallelSafe()
+ * in xslt.c), the nodes must belong to the source document, the output
+ * must go to an element, and the global variables must be readable by
+ * concurrent contexts, see xsltParallelCheckVariable(). Each context
+ * gets at least xsltGetParallelChunkSize() nodes.
+ *
+ * Returns the number of contexts to use, or 0 to process the nodes
+ *         serially
+ */
+static int
+xsltParallelChunkCount(xsltTransformContextPtr ctxt, xmlNodeSetPtr list) {
+    xmlNodePtr cur;
+    int nbThreads, i;
+
+    nbThreads = xsltParallelThreads;
+    if (nbThreads < 0)
+	nbThreads = xsltGetThreadCount();
+    if (nbThreads > list->nodeNr / xsltParallelChunkSize)
+	nbThreads = list->nodeNr / xsltParallelChunkSize;
+    if ((nbThreads < 2) || (ctxt->parallelWorker) ||
+	(ctxt->style == NULL) || (ctxt->style->parallelSafe == 0) ||
+	(ctxt->profile) || (ctxt->debugStatus != XSLT_DEBUG_NONE) ||
+	(ctxt->initialContextDoc == NULL) || (ctxt->insert == NULL) ||
+	(ctxt->insert->type != XML_ELEMENT_NODE) ||
+	(ctxt->insert->doc == NULL))
+	return(0);
+    for (i = 0; i < list->nodeNr; i++) {
+	cur = list->nodeTab[i];
+	if ((cur->type == XML_NAMESPACE_DECL) ||
+	    (cur->doc != ctxt->initialContextDoc))
+	    return(0);
+    }
+    if (ctxt->parallelGlobals == 0) {
+	int state = 1;
+
+	if (ctxt->globalVars != NULL)
+	    xmlHashScan(ctxt->globalVars, xsltParallelCheckGlobal, &state);
+	if (state == 0)
+	    return(0);
+	ctxt->parallelGlobals = state;
+    }
+    if (ctxt->parallelGlobals < 0)
+	return(0);
+    return(nbThreads);
+}
+
+/**
+ * xsltParallelFreeJob:
+ * @job:  the parallel job
+ *
+ * Frees the worker contexts and the documents of @job.
+ */
+static void
+xsltParallelFreeJob(xsltParallelJobPtr job) {
+    xsltParallelChunkPtr chunk;
+    int i;
+
+    if (job->chunks != NULL) {
+	for (i = 0; i < job->nbChunks; i++) {
+	    chunk = &job->chunks[i];
+	    if (chunk->output != NULL)
+		xmlFreeDoc(chunk->output);
+	    if (chunk->ctxt != NULL) {
+		chunk->ctxt->globalVars = NULL;
+		xsltFreeTransformContext(chunk->ctxt);
+	    }
+	}
+	xmlFree(job->chunks);
+    }
+    if (job->nsList != NULL)
+	xmlFree(job->nsList);
+}
+
+/**
+ * xsltParallelInitJob:
+ * @ctxt:  the XSLT transformation context
+ * @job:  the parallel job
+ * @inst:  the libxslt:parallel instruction
+ * @nbChunks:  the number of worker contexts
+ *
+ * Creates the worker contexts of @job. They share the stylesheet, the
+ * global variables and the local variables in scope of @ctxt, and
+ * write to a copy of the insertion point which declares the same
+ * namespaces.
+ *
+ * Returns 0 in case of success, -1 in case of error
+ */
+static int
+xsltParallelInitJob(xsltTransformContextPtr ctxt, xsltParallelJobPtr job,
+		    xmlNodePtr inst, int nbChunks) {
+    xsltParallelChunkPtr chunk;
+    xsltTransformContextPtr wctxt;
+    xmlNsPtr ns;
+    int i, j;
+
+    job->nsList = xmlGetNsList(ctxt->insert->doc, ctxt->insert);
+    if (job->nsList != NULL)
+	while (job->nsList[job->nsNr] != NULL)
+	    job->nsNr++;
+    job->chunks = (xsltParallelChunkPtr)
+	xmlMalloc(nbChunks * sizeof(xsltParallelChunk));
+    if (job->chunks == NULL)
+	return(-1);
+    memset(job->chunks, 0, nbChunks * sizeof(xsltParallelChunk));
+    job->nbChunks = nbChunks;
+
+    for (i = 0; i < nbChunks; i++) {
+	chunk = &job->chunks[i];
+	chunk->start = (int) ((long) job->list->nodeNr * i / nbChunks);
+	chunk->end = (int) ((long) job->list->nodeNr * (i + 1) / nbChunks);
+
+	wctxt = xsltNewTransformContext(ctxt->style, ctxt->initialContextDoc);
+	if (wctxt == NULL)
+	    return(-1);
+	chunk->ctxt = wctxt;
+	wctxt->parallelWorker = 1;
+	wctxt->globalVars = ctxt->globalVars;
+	wctxt->initialContextDoc = ctxt->initialContextDoc;
+	wctxt->initialContextNode = ctxt->initialContextNode;
+	wctxt->type = ctxt->type;
+	wctxt->mode = ctxt->mode;
+	wctxt->modeURI = ctxt->modeURI;
+	wctxt->nbKeys = ctxt->nbKeys;
+	wctxt->parserOptions = ctxt->parserOptions;
+	wctxt->sec = ctxt->sec;
+	wctxt->xinclude = ctxt->xinclude;
+	wctxt->outputFile = ctxt->outputFile;
+	wctxt->_private = ctxt->_private;
+	wctxt->inst = inst;
+	wctxt->currentTemplateRule = ctxt->currentTemplateRule;
+	wctxt->nodeList = job->list;
+	wctxt->maxTemplateDepth = ctxt->maxTemplateDepth - ctxt->templNr;
+	wctxt->maxTemplateVars =
+	    ctxt->maxTemplateVars - ctxt->varsNr + job->varsNr;
+	wctxt->error = xsltParallelError;
+	if (job->varsNr > 0) {
+	    /*
+	    * The variables are only referenced: the worker never pops
+	    * them since they are below the level of the body.
+	    */
+	    if (job->varsNr > wctxt->varsMax) {
+		xsltStackElemPtr *tmp;
+
+		tmp = (xsltStackElemPtr *) xmlRealloc(wctxt->varsTab,
+		    job->varsNr * sizeof(wctxt->varsTab[0]));
+		if (tmp == NULL)
+		    return(-1);
+		wctxt->varsTab = tmp;
+		wctxt->varsMax = job->varsNr;
+	    }
+	    memcpy(wctxt->varsTab, job->vars,
+		   job->varsNr * sizeof(wctxt->varsTab[0]));
+	    wctxt->varsNr = job->varsNr;
+	    wctxt->vars = wctxt->varsTab[wctxt->varsNr - 1];
+	}
+	wctxt->errctx = chunk;
+
+	chunk->output = xmlNewDoc(NULL);
+	if (chunk->output == NULL)
+	    return(-1);
+	chunk->output->dict = wctxt->dict;
+	xmlDictReference(wctxt->dict);
+	chunk->output->charset = XML_CHAR_ENCODING_UTF8;
+	if (XSLT_IS_RES_TREE_FRAG(ctxt->insert->doc))
+	    chunk->output->name = (char *)
+		xmlStrdup(BAD_CAST " fake node libxslt");
+	chunk->insert = xmlNewDocNode(chunk->output, NULL,
+				      ctxt->insert->name, NULL);
+	if (chunk->insert == NULL)
+	    return(-1);
+	xmlAddChild((xmlNodePtr) chunk->output, chunk->insert);
+	for (j = 0; j < job->nsNr; j++) {
+	    ns = xmlNewNs(chunk->insert, job->nsList[j]->href,
+			  job->nsList[j]->prefix);
+	    if (ns == NULL)
+		return(-1);
+	    if (job->nsList[j] == ctxt->insert->ns)
+		chunk->insert->ns = ns;
+	}
+	wctxt->output = chunk->output;
+	wctxt->insert = chunk->insert;
+    }
+    return(0);
+}
+
+/**
+ * xsltParallelProcessChunk:
+ * @data:  the parallel job
+ * @index:  the index of the chunk
+ *
+ * Applies the templates or instantiates the content of the
+ * xsl:for-each for the nodes of a chunk, possibly from a worker
+ * thread. The messages are not reported but noted, the nodes are then
+ * processed again serially to report them in order.
+ */
+static void
+xsltParallelProcessChunk(void *data, int index) {
+    xsltParallelJobPtr job = (xsltParallelJobPtr) data;
+    xsltParallelChunkPtr chunk = &job->chunks[index];
+    xsltTransformContextPtr ctxt = chunk->ctxt;
+    xmlXPathContextPtr xpctxt = ctxt->xpathCtxt;
+    xmlGenericErrorFunc oldError = xmlGenericError;
+    void *oldErrorCtxt = xmlGenericErrorContext;
+    xmlStructuredErrorFunc oldSerror = xmlStructuredError;
+    void *oldSerrorCtxt = xmlStructuredErrorContext;
+    xmlNodePtr cur;
+    int i;
+
+    xmlSetGenericErrorFunc(chunk, xsltParallelError);
+    xmlSetStructuredErrorFunc(chunk, xsltParallelStructuredError);
+
+    xpctxt->contextSize = job->list->nodeNr;
+    for (i = chunk->start; i < chunk->end; i++) {
+	cur = job->list->nodeTab[i];
+	ctxt->node = cur;
+	xpctxt->doc = cur->doc;
+	xpctxt->proximityPosition = i + 1;
+	if (job->body != NULL)
+	    xsltApplySequenceConstructor(ctxt, cur, job->body, NULL);
+	else
+	    xsltProcessOneNode(ctxt, cur, NULL);
+	if (ctxt->state != XSLT_STATE_OK)
+	    break;
+    }
+    if (ctxt->state != XSLT_STATE_OK)
+	chunk->failed = 1;
+
+    xmlSetGenericErrorFunc(oldErrorCtxt, oldError);
+    xmlSetStructuredErrorFunc(oldSerrorCtxt, oldSerror);
+}
+
+/**
+ * xsltParallelCheckChunk:
+ * @job:  the parallel job
+ * @chunk:  a processed chunk
+ *
+ * Checks that the output of @chunk is made of nodes which can be moved
+ * to the insertion point as they are. Attributes and namespace
+ * declarations added to the insertion point depend on what precedes,
+ * so they are left to the serial processing.
+ *
+ * Returns 0 if so, -1 otherwise
+ */
+static int
+xsltParallelCheckChunk(xsltParallelJobPtr job, xsltParallelChunkPtr chunk) {
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+    xmlNsPtr ns;
+    int nsNr = 0;
+
+    if ((chunk->failed) || (chunk->insert->properties != NULL))
+	return(-1);
+    for (ns = chunk->insert->nsDef; ns != NULL; ns = ns->next)
+	nsNr++;
+    if (nsNr != job->nsNr)
+	return(-1);
+
+    cur = chunk->insert->children;
+    while (cur != NULL) {
+	switch (cur->type) {
+	    case XML_ELEMENT_NODE:
+		for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		    xmlNodePtr txt;
+
+		    for (txt = attr->children; txt != NULL; txt = txt->next)
+			if (txt->type != XML_TEXT_NODE)
+			    return(-1);
+		}
+		break;
+	    case XML_TEXT_NODE:
+	    case XML_CDATA_SECTION_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_PI_NODE:
+		break;
+	    default:
+		return(-1);
+	}
+	if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+	    cur = cur->children;
+	    continue;
+	}
+	while ((cur->next == NULL) && (cur->parent != chunk->insert))
+	    cur = cur->parent;
+	cur = cur->next;
+    }
+    return(0);
+}
+
+/**
+ * xsltParallelAdoptString:
+ * @from:  the dictionary of the chunk
+ * @to:  the dictionary of the output or NULL
+ * @str:  a name or content of a node moved to the output
+ *
+ * Makes sure @str doesn't come from the dictionary of the chunk.
+ */
+static void
+xsltParallelAdoptString(xmlDictPtr from, xmlDictPtr to, const xmlChar **str) {
+    if ((*str == NULL) || (xmlDictOwns(from, *str) != 1))
+	return;
+    if (to == NULL)
+	*str = xmlStrdup(*str);
+    else if (xmlDictOwns(to, *str) != 1)
+	*str = xmlDictLookup(to, *str, -1);
+}
+
+/**
+ * xsltParallelAdoptNs:
+ * @ctxt:  the XSLT transformation context
+ * @job:  the parallel job
+ * @chunk:  the chunk
+ * @ns:  a namespace referenced by the output of @chunk
+ *
+ * Returns the namespace of the output standing for @ns
+ */
+static xmlNsPtr
+xsltParallelAdoptNs(xsltTransformContextPtr ctxt, xsltParallelJobPtr job,
+		    xsltParallelChunkPtr chunk, xmlNsPtr ns) {
+    xmlNsPtr def;
+    int i;
+
+    if (ns == NULL)
+	return(NULL);
+    for (def = chunk->insert->nsDef, i = 0; def != NULL;
+	 def = def->next, i++)
+	if (def == ns)
+	    return(job->nsList[i]);
+    if (ns == chunk->output->oldNs) {
+	if (job->xmlNs == NULL)
+	    job->xmlNs = xmlSearchNs(ctxt->insert->doc, ctxt->insert,
+				     BAD_CAST "xml");
+	return(job->xmlNs);
+    }
+    return(ns);
+}
+
+/**
+ * xsltParallelAdoptTree:
+ * @ctxt:  the XSLT transformation context
+ * @job:  the parallel job
+ * @chunk:  the chunk
+ * @tree:  a node of the output of @chunk
+ *
+ * Moves @tree to the document of the insertion point of @ctxt: the
+ * nodes are updated in place instead of being copied.
+ */
+static void
+xsltParallelAdoptTree(xsltTransformContextPtr ctxt, xsltParallelJobPtr job,
+		      xsltParallelChunkPtr chunk, xmlNodePtr tree) {
+    xmlDocPtr doc = ctxt->insert->doc;
+    xmlDictPtr from = chunk->output->dict, to = doc->dict;
+    xmlNodePtr cur, txt;
+    xmlAttrPtr attr;
+
+    cur = tree;
+    while (cur != NULL) {
+	cur->doc = doc;
+	switch (cur->type) {
+	    case XML_ELEMENT_NODE:
+		xsltParallelAdoptString(from, to, &cur->name);
+		cur->ns = xsltParallelAdoptNs(ctxt, job, chunk, cur->ns);
+		for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		    attr->doc = doc;
+		    xsltParallelAdoptString(from, to, &attr->name);
+		    attr->ns = xsltParallelAdoptNs(ctxt, job, chunk, attr->ns);
+		    for (txt = attr->children; txt != NULL; txt = txt->next) {
+			txt->doc = doc;
+			xsltParallelAdoptString(from, to,
+			    (const xmlChar **) &txt->content);
+		    }
+		}
+		break;
+	    case XML_PI_NODE:
+		xsltParallelAdoptString(from, to, &cur->name);
+		/* no break on purpose */
+	    default:
+		xsltParallelAdoptString(from, to,
+		    (const xmlChar **) &cur->content);
+		break;
+	}
+	if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+	    cur = cur->children;
+	    continue;
+	}
+	if (cur == tree)
+	    break;
+	while ((cur->next == NULL) && (cur->parent != tree))
+	    cur = cur->parent;
+	if (cur->next == NULL)
+	    break;
+	cur = cur->next;
+    }
+}
+
+/**
+ * xsltParallelMergeChunk:
+ * @ctxt:  the XSLT transformation context
+ * @job:  the parallel job
+ * @chunk:  a processed chunk
+ *
+ * Appends the output of @chunk to the insertion point of @ctxt,
+ * merging text like xsltCopyTextString() does.
+ */
+static void
+xsltParallelMergeChunk(xsltTransformContextPtr ctxt, xsltParallelJobPtr job,
+		       xsltParallelChunkPtr chunk) {
+    xmlNodePtr insert = ctxt->insert, child, last;
+
+    while ((child = chunk->insert->children) != NULL) {
+	xmlUnlinkNode(child);
+	xsltParallelAdoptTree(ctxt, job, chunk, child);
+	last = insert->last;
+	if ((last != NULL) && (last->type == XML_CDATA_SECTION_NODE) &&
+	    ((child->type == XML_CDATA_SECTION_NODE) ||
+	     ((child->type == XML_TEXT_NODE) &&
+	      (child->name == xmlStringTextNoenc)))) {
+	    xmlNodeAddContent(last, child->content);
+	    xmlFreeNode(child);
+	    continue;
+	}
+	xmlAddChild(insert, child);
+    }
+}
+
+/**
+ * xsltProcessParallel:
+ * @ctxt:  the XSLT transformation context
+ * @list:  the nodes selected by a libxslt:parallel instruction
+ * @inst:  the xsl:apply-templates or xsl:for-each instruction
+ * @body:  the content of the xsl:for-each following the xsl:sort,
+ *         NULL for xsl:apply-templates
+ *
+ * Applies the templates to the nodes of @list, or instantiates @body
+ * for each of them, with concurrent contexts, each of them processing
+ * a range of the nodes into its own document. The outputs are then
+ * moved in order to the insertion point. If any context raised an
+ * error or a warning, or produced output which can't be moved as is,
+ * everything is discarded and the caller processes the nodes serially.
+ *
+ * Returns 0 if the nodes were processed, -1 otherwise
+ */
+static int
+xsltProcessParallel(xsltTransformContextPtr ctxt, xmlNodeSetPtr list,
+		    xmlNodePtr inst, xmlNodePtr body) {
+    xsltParallelJob job;
+    xsltStackElemPtr elem;
+    int nbChunks, i, ret = -1;
+
+    nbChunks = xsltParallelChunkCount(ctxt, list);
+    if (nbChunks < 2)
+	return(-1);
+    memset(&job, 0, sizeof(job));
+    job.list = list;
+    if (body != NULL) {
+	/*
+	* The content of an xsl:for-each sees the local variables of the
+	* template, the workers read them as they are.
+	*/
+	for (i = ctxt->varsBase; i < ctxt->varsNr; i++) {
+	    for (elem = ctxt->varsTab[i]; elem != NULL; elem = elem->next)
+		if (xsltParallelCheckVariable(elem) <= 0)
+		    return(-1);
+	}
+	job.body = body;
+	job.vars = &ctxt->varsTab[ctxt->varsBase];
+	job.varsNr = ctxt->varsNr - ctxt->varsBase;
+    }
+    if (xsltParallelInitJob(ctxt, &job, inst, nbChunks) < 0)
+	goto done;
+
+    xsltRunParallel(nbChunks, nbChunks, xsltParallelProcessChunk, &job);
+
+    for (i = 0; i < nbChunks; i++)
+	if (xsltParallelCheckChunk(&job, &job.chunks[i]) < 0)
+	    goto done;
+    for (i = 0; i < nbChunks; i++)
+	xsltParallelMergeChunk(ctxt, &job, &job.chunks[i]);
+    ctxt->lasttext = NULL;
+    ret = 0;
+
+done:
+#ifdef WITH_XSLT_DEBUG_PROCESS
+    if (body != NULL) {
+	XSLT_TRACE(ctxt,XSLT_TRACE_FOR_EACH,xsltGenericDebug(xsltGenericDebugContext,
+	    "xsltForEach: %d nodes processed by %d contexts%s\n",
+	    list->nodeNr, nbChunks, (ret < 0) ? ", processing them again" : ""));
+    } else {
+	XSLT_TRACE(ctxt,XSLT_TRACE_APPLY_TEMPLATES,xsltGenericDebug(xsltGenericDebugContext,
+	    "xsltApplyTemplates: %d nodes processed by %d contexts%s\n",
+	    list->nodeNr, nbChunks, (ret < 0) ? ", processing them again" : ""));
+    }
+#endif
+    xsltParallelFreeJob(&job);
+    return(ret);
+}
+
+/**
+ * xsltApplyTemplates:
+ * @ctxt:  a XSLT transformation context
+ * @node:  the 'current node' in the source tree
+ * @inst:  the element node of an XSLT 'apply-templates' instruction
+ * @castedComp:  the compiled instruction
  *
  * Processes the XSLT 'apply-templates' instruction on the current node.
  */
@@ -5153,6 +6741,15 @@ xsltApplyTemplates(xsltTransformContextPtr ctxt, xmlNodePtr node,
 	    cur = cur->next;
 	}
     }
+    /*
+    * With libxslt:parallel="yes", ranges of the nodes are processed by
+    * concurrent contexts when possible.
+    */
+    if ((comp->parallel) && (withParams == NULL) &&
+	(ctxt->state != XSLT_STATE_STOPPED) &&
+	(xsltProcessParallel(ctxt, list, inst, NULL) == 0))
+	goto exit;
+
     xpctxt->contextSize = list->nodeNr;
     /*
     * Apply templates for all selected source nodes.
@@ -5406,7 +7003,7 @@ xsltIf(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 	* "select" expression.
 	*/
 	if (oldLocalFragmentTop != ctxt->localRVT)
-	    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop);
+	    xsltReleaseLocalRVTs(ctxt, oldLocalFragmentTop, 1);
     }
 
 #ifdef WITH_XSLT_DEBUG_PROCESS
@@ -5613,6 +7210,10 @@ xsltForEach(xsltTransformContextPtr ctxt, xmlNodePtr contextNode,
 	}
 	xsltDoSortFunction(ctxt, sorts, nbsorts);
     }
+    if ((comp->parallel) && (curInst != NULL) &&
+	(ctxt->state != XSLT_STATE_STOPPED) &&
+	(xsltProcessParallel(ctxt, list, inst, curInst) == 0))
+	goto exit;
     xpctxt->contextSize = list->nodeNr;
     /*
     * Instantiate the sequence constructor for each selected node.
@@ -5836,16 +7437,20 @@ xsltCountKeys(xsltTransformContextPtr ctxt)
  * @output:  the targetted output
  * @profile:  profile FILE * output or NULL
  * @user:  user provided parameter
+ * @share:  the result will be serialized with xsltSaveResultTo() and
+ *          freed before @doc is modified or freed
  *
  * Apply the stylesheet to the document
  * NOTE: This may lead to a non-wellformed output XML wise !
+ * NOTE: If @share is set, the result may share subtrees with @doc.
  *
  * Returns the result document or NULL in case of error
  */
 static xmlDocPtr
 xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
                             const char **params, const char *output,
-                            FILE * profile, xsltTransformContextPtr userCtxt)
+                            FILE * profile, xsltTransformContextPtr userCtxt,
+                            int share)
 {
     xmlDocPtr res = NULL;
     xsltTransformContextPtr ctxt = NULL;
@@ -5869,31 +7474,8 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
 			 "Stylesheet was not fully internalized !\n");
 #endif
     }
-    if (doc->intSubset != NULL) {
-	/*
-	 * Avoid hitting the DTD when scanning nodes
-	 * but keep it linked as doc->intSubset
-	 */
-	xmlNodePtr cur = (xmlNodePtr) doc->intSubset;
-	if (cur->next != NULL)
-	    cur->next->prev = cur->prev;
-	if (cur->prev != NULL)
-	    cur->prev->next = cur->next;
-	if (doc->children == cur)
-	    doc->children = cur->next;
-	if (doc->last == cur)
-	    doc->last = cur->prev;
-	cur->prev = cur->next = NULL;
-    }
-
-    /*
-     * Check for XPath document order availability
-     */
-    root = xmlDocGetRootElement(doc);
-    if (root != NULL) {
-	if (((long) root->content) >= 0 && (xslDebugStatus == XSLT_DEBUG_NONE))
-	    xmlXPathOrderDocElems(doc);
-    }
+    xsltUnlinkInternalSubset(doc);
+    xsltOrderDocElems(doc);
 
     if (userCtxt != NULL)
 	ctxt = userCtxt;
@@ -6042,11 +7624,34 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
 
     xsltEvalGlobalVariables(ctxt);
 
+    /*
+    * The documents the stylesheet loads are known by now.
+    */
+    if (xsltGetDocumentThreads() != 0)
+	xsltPrefetchStyleDocuments(ctxt);
+
     ctxt->node = (xmlNodePtr) doc;
     ctxt->output = res;
     ctxt->insert = (xmlNodePtr) res;
     ctxt->varsBase = ctxt->varsNr - 1;
 
+    /*
+    * Copies of input subtrees can be shared if the result is going to
+    * be serialized right away with the plain XML output method.
+    */
+    if ((share) && (res->type == XML_DOCUMENT_NODE) &&
+        (doc->type == XML_DOCUMENT_NODE) &&
+        ((method == NULL) ||
+         (xmlStrEqual(method, (const xmlChar *) "xml"))) &&
+        (style->methodURI == NULL) && (style->cdataSection == NULL) &&
+        (xmlIsXHTML(doctypeSystem, doctypePublic) <= 0) &&
+        ((doc->intSubset == NULL) ||
+         (xmlIsXHTML(doc->intSubset->SystemID,
+                     doc->intSubset->ExternalID) <= 0))) {
+        ctxt->shareSource = doc;
+        ctxt->shareResult = res;
+    }
+
     ctxt->xpathCtxt->contextSize = 1;
     ctxt->xpathCtxt->proximityPosition = 1;
     ctxt->xpathCtxt->node = NULL; /* TODO: Set the context node here? */
@@ -6054,6 +7659,8 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
     * Start processing the source tree -----------------------------------
     */
     xsltProcessOneNode(ctxt, ctxt->node, NULL);
+    ctxt->shareSource = NULL;
+    ctxt->shareResult = NULL;
     /*
     * Remove all remaining vars from the stack.
     */
@@ -6207,8 +7814,10 @@ xsltApplyStylesheetInternal(xsltStylesheetPtr style, xmlDocPtr doc,
 
 #ifdef XSLT_DEBUG_PROFILE_CACHE
     printf("# Cache:\n");
-    printf("# Reused tree fragments: %d\n", ctxt->cache->dbgReusedRVTs);
-    printf("# Reused variables     : %d\n", ctxt->cache->dbgReusedVars);
+    printf("# Reused tree fragments: %d / %d\n", ctxt->cache->reusedRVTs,
+	   ctxt->cache->reusedRVTs + ctxt->cache->newRVTs);
+    printf("# Reused variables     : %d / %d\n", ctxt->cache->reusedVars,
+	   ctxt->cache->reusedVars + ctxt->cache->newVars);
 #endif
 
     if ((ctxt != NULL) && (userCtxt == NULL))
@@ -6222,8 +7831,10 @@ error:
 
 #ifdef XSLT_DEBUG_PROFILE_CACHE
     printf("# Cache:\n");
-    printf("# Reused tree fragments: %d\n", ctxt->cache->dbgReusedRVTs);
-    printf("# Reused variables     : %d\n", ctxt->cache->dbgReusedVars);
+    printf("# Reused tree fragments: %d / %d\n", ctxt->cache->reusedRVTs,
+	   ctxt->cache->reusedRVTs + ctxt->cache->newRVTs);
+    printf("# Reused variables     : %d / %d\n", ctxt->cache->reusedVars,
+	   ctxt->cache->reusedVars + ctxt->cache->newVars);
 #endif
 
     if ((ctxt != NULL) && (userCtxt == NULL))
@@ -6246,7 +7857,8 @@ xmlDocPtr
 xsltApplyStylesheet(xsltStylesheetPtr style, xmlDocPtr doc,
                     const char **params)
 {
-    return (xsltApplyStylesheetInternal(style, doc, params, NULL, NULL, NULL));
+    return (xsltApplyStylesheetInternal(style, doc, params, NULL, NULL, NULL,
+	                                0));
 }
 
 /**
@@ -6267,7 +7879,8 @@ xsltProfileStylesheet(xsltStylesheetPtr style, xmlDocPtr doc,
 {
     xmlDocPtr res;
 
-    res = xsltApplyStylesheetInternal(style, doc, params, NULL, output, NULL);
+    res = xsltApplyStylesheetInternal(style, doc, params, NULL, output, NULL,
+	                              0);
     return (res);
 }
 
@@ -6293,10 +7906,133 @@ xsltApplyStylesheetUser(xsltStylesheetPtr style, xmlDocPtr doc,
     xmlDocPtr res;
 
     res = xsltApplyStylesheetInternal(style, doc, params, output,
-	                              profile, userCtxt);
+	                              profile, userCtxt, 0);
     return (res);
 }
 
+/**
+ * xsltResultCacheUsable:
+ * @style:  a parsed XSLT stylesheet
+ * @IObuf:  the output buffer or NULL
+ *
+ * Checks that the serialization of a result can be replayed from the
+ * bytes stored in a result cache: those are encoded as the stylesheet
+ * asks, which is only what gets written to an output buffer without
+ * encoder if that encoding is UTF-8.
+ *
+ * Returns 1 if the result can be cached, 0 otherwise
+ */
+static int
+xsltResultCacheUsable(xsltStylesheetPtr style, xmlOutputBufferPtr IObuf) {
+    const xmlChar *encoding;
+
+    if ((style->methodURI != NULL) &&
+	((style->method == NULL) ||
+	 (!xmlStrEqual(style->method, (const xmlChar *) "xhtml"))))
+	return(0);
+    if (IObuf == NULL)
+	return(1);
+    if (IObuf->encoder != NULL)
+	return(0);
+    XSLT_GET_IMPORT_PTR(encoding, style, encoding)
+    if ((encoding == NULL) ||
+        (xmlStrcasecmp(encoding, BAD_CAST "UTF-8") == 0) ||
+        (xmlStrcasecmp(encoding, BAD_CAST "UTF8") == 0))
+	return(1);
+    return(0);
+}
+
+/**
+ * xsltWriteCachedResult:
+ * @output:  the URL/filename of the generated resource
+ * @IObuf:  an output buffer or NULL
+ * @content:  the serialized result
+ * @len:  the length of @content
+ *
+ * Writes a serialized result the way xsltRunStylesheetUser() would.
+ *
+ * Returns the number of bytes written or -1 in case of error
+ */
+static int
+xsltWriteCachedResult(const char *output, xmlOutputBufferPtr IObuf,
+	              const xmlChar *content, int len) {
+    xmlOutputBufferPtr buf;
+    int base;
+
+    if (len == 0)
+	return(0);
+    if (IObuf != NULL) {
+	base = IObuf->written;
+	xmlOutputBufferWrite(IObuf, len, (const char *) content);
+	xmlOutputBufferFlush(IObuf);
+	return(IObuf->written - base);
+    }
+    buf = xmlOutputBufferCreateFilename(output, NULL, 0);
+    if (buf == NULL)
+	return(-1);
+    xmlOutputBufferWrite(buf, len, (const char *) content);
+    return(xmlOutputBufferClose(buf));
+}
+
+/**
+ * xsltRunStylesheetCached:
+ * @cache:  the result cache
+ * @key:  the cache key of the transformation
+ * @style:  a parsed XSLT stylesheet
+ * @doc:  a parsed XML document
+ * @params:  a NULL terminated array of parameters names/values tuples
+ * @output:  the URL/filename ot the generated resource if available
+ * @IObuf:  an output buffer or NULL
+ * @userCtxt:  user provided transform context
+ *
+ * Implements xsltRunStylesheetUser() on top of a result cache: the
+ * stored result is written if available, otherwise the transformation
+ * is run and its result stored.
+ *
+ * Returns the number of bytes written or -1 in case of error
+ */
+static int
+xsltRunStylesheetCached(xsltResultCachePtr cache, const xmlChar *key,
+	                xsltStylesheetPtr style, xmlDocPtr doc,
+			const char **params, const char *output,
+			xmlOutputBufferPtr IObuf,
+			xsltTransformContextPtr userCtxt)
+{
+    xsltTransformContextPtr ctxt = NULL;
+    xmlChar *content = NULL;
+    xmlDocPtr tmp;
+    int len = 0, ret = -1;
+
+    if (xsltResultCacheLookup(cache, key, &content, &len) != 1) {
+	ctxt = (userCtxt != NULL) ? userCtxt :
+	                            xsltNewTransformContext(style, doc);
+	if (ctxt == NULL)
+	    return(-1);
+	tmp = xsltApplyStylesheetInternal(style, doc, params, output, NULL,
+	                                  ctxt, 1);
+	if (tmp == NULL) {
+	    xsltTransformError(NULL, NULL, (xmlNodePtr) doc,
+			     "xsltRunStylesheet : run failed\n");
+	    goto done;
+	}
+	if (xsltSaveResultToString(&content, &len, tmp, style) < 0) {
+	    xmlFreeDoc(tmp);
+	    goto done;
+	}
+	xmlFreeDoc(tmp);
+	if (ctxt->state == XSLT_STATE_OK)
+	    xsltResultCacheStore(cache, key, ctxt, content, len);
+    }
+    ret = xsltWriteCachedResult(output, IObuf, content, len);
+
+done:
+    if (content != NULL)
+	xmlFree(content);
+    if ((ctxt != NULL) && (ctxt != userCtxt))
+	xsltFreeTransformContext(ctxt);
+    return(ret);
+}
+
 /**
  * xsltRunStylesheetUser:
  * @style:  a parsed XSLT stylesheet
@@ -6310,6 +8046,9 @@ xsltApplyStylesheetUser(xsltStylesheetPtr style, xmlDocPtr doc,
  *
  * Apply the stylesheet to the document and generate the output according
  * to @output @SAX and @IObuf. It's an error to specify both @SAX and @IObuf.
+ * If a result cache was set with xsltSetResultCache() and no profiling
+ * is requested, a result previously obtained for the same stylesheet,
+ * input and parameters is written instead of running the transformation.
  *
  * NOTE: This may lead to a non-wellformed output XML wise !
  * NOTE: This may also result in multiple files being generated
@@ -6329,6 +8068,7 @@ xsltRunStylesheetUser(xsltStylesheetPtr style, xmlDocPtr doc,
                   xmlSAXHandlerPtr SAX, xmlOutputBufferPtr IObuf,
 		  FILE * profile, xsltTransformContextPtr userCtxt)
 {
+    xsltResultCachePtr cache;
     xmlDocPtr tmp;
     int ret;
 
@@ -6343,8 +8083,26 @@ xsltRunStylesheetUser(xsltStylesheetPtr style, xmlDocPtr doc,
 	return (-1);
     }
 
+    cache = xsltGetResultCache();
+    if ((cache != NULL) && (profile == NULL) &&
+        (xsltResultCacheUsable(style, IObuf))) {
+	xmlChar *key;
+
+	/*
+	 * Hash the document as the transformation will see it
+	 */
+	xsltPrepareSharedDocument(doc);
+	key = xsltResultCacheKey(cache, style, doc, params);
+	if (key != NULL) {
+	    ret = xsltRunStylesheetCached(cache, key, style, doc, params,
+		                          output, IObuf, userCtxt);
+	    xmlFree(key);
+	    return(ret);
+	}
+    }
+
     tmp = xsltApplyStylesheetInternal(style, doc, params, output, profile,
-	                              userCtxt);
+	                              userCtxt, 1);
     if (tmp == NULL) {
 	xsltTransformError(NULL, NULL, (xmlNodePtr) doc,
                          "xsltRunStylesheet : run failed\n");
@@ -6393,6 +8151,292 @@ xsltRunStylesheet(xsltStylesheetPtr style, xmlDocPtr doc,
 		                 NULL, NULL));
 }
 
+typedef struct _xsltParallelApply xsltParallelApply;
+typedef xsltParallelApply *xsltParallelApplyPtr;
+struct _xsltParallelApply {
+    xmlDocPtr doc;		/* the shared input document */
+    xsltTransformJobPtr jobs;
+};
+
+/**
+ * xsltStyleStripsSpace:
+ * @style:  a parsed XSLT stylesheet
+ *
+ * Returns 1 if @style or one of its imports uses xsl:strip-space,
+ *         0 otherwise
+ */
+static int
+xsltStyleStripsSpace(xsltStylesheetPtr style) {
+    while (style != NULL) {
+	if (style->stripSpaces != NULL)
+	    return(1);
+	style = xsltNextImport(style);
+    }
+    return(0);
+}
+
+/**
+ * xsltRunTransformJob:
+ * @data:  the xsltParallelApply
+ * @index:  the job to run
+ *
+ * Runs one of the jobs of xsltApplyStylesheetsParallel().
+ */
+static void
+xsltRunTransformJob(void *data, int index) {
+    xsltParallelApplyPtr apply = (xsltParallelApplyPtr) data;
+    xsltTransformJobPtr job = &apply->jobs[index];
+    xmlDocPtr input = apply->doc;
+    xmlDocPtr res;
+
+    job->result = NULL;
+    job->status = -1;
+    if (job->style == NULL)
+	return;
+
+    /*
+     * Space stripping removes nodes from the input, such transformations
+     * get their own copy of the document.
+     */
+    if (xsltStyleStripsSpace(job->style)) {
+	input = xmlCopyDoc(apply->doc, 1);
+	if (input == NULL) {
+	    xsltTransformError(NULL, job->style, (xmlNodePtr) apply->doc,
+		"xsltApplyStylesheetsParallel : failed to copy the input\n");
+	    return;
+	}
+    }
+
+    res = xsltApplyStylesheetInternal(job->style, input, job->params,
+	                              NULL, NULL, NULL, 0);
+    if (res != NULL) {
+	if (job->output == NULL) {
+	    job->result = res;
+	    job->status = 0;
+	} else {
+	    if (xsltSaveResultTo(job->output, res, job->style) >= 0)
+		job->status = 0;
+	    xmlFreeDoc(res);
+	}
+    }
+    if (input != apply->doc)
+	xmlFreeDoc(input);
+}
+
+/**
+ * xsltApplyStylesheetsParallel:
+ * @doc:  a parsed XML document
+ * @jobs:  an array of transformations to run on @doc
+ * @nbJobs:  the number of entries in @jobs
+ * @nbThreads:  the maximum number of threads, 0 for one per processor
+ *
+ * Applies the stylesheet of each job to @doc, running the
+ * transformations concurrently and returning once all of them are
+ * done. The input is parsed once and shared read-only between the
+ * threads, see xsltPrepareSharedDocument(). The result of a job is
+ * serialized to its output buffer if one is given (the buffer is not
+ * closed), otherwise it is stored in the job result and must be freed
+ * by the caller. The stylesheets must not be modified while the jobs
+ * run but a stylesheet can be used by several jobs.
+ *
+ * Returns 0 if all the transformations succeeded, -1 otherwise, the
+ *         status field of each job telling which ones failed.
+ */
+int
+xsltApplyStylesheetsParallel(xmlDocPtr doc, xsltTransformJobPtr jobs,
+	                     int nbJobs, int nbThreads)
+{
+    xsltParallelApply apply;
+    int i, ret = 0;
+
+    if ((doc == NULL) || (jobs == NULL) || (nbJobs < 0))
+	return(-1);
+
+    /*
+     * Everything touching globals or the input is done upfront
+     * from the calling thread.
+     */
+    xmlInitParser();
+    xsltInitGlobals();
+    xsltPrepareSharedDocument(doc);
+
+    apply.doc = doc;
+    apply.jobs = jobs;
+    if (xsltRunParallel(nbJobs, nbThreads, xsltRunTransformJob, &apply) < 0)
+	return(-1);
+    for (i = 0; i < nbJobs; i++) {
+	if (jobs[i].status != 0)
+	    ret = -1;
+    }
+    return(ret);
+}
+
+/**
+ * xsltNewPipeline:
+ *
+ * Create a new, empty, stylesheet pipeline
+ *
+ * Returns the newly allocated xsltPipelinePtr or NULL in case of error
+ */
+xsltPipelinePtr
+xsltNewPipeline(void) {
+    xsltPipelinePtr cur;
+
+    cur = (xsltPipelinePtr) xmlMalloc(sizeof(xsltPipeline));
+    if (cur == NULL) {
+	xsltTransformError(NULL, NULL, NULL,
+		"xsltNewPipeline : malloc failed\n");
+	return(NULL);
+    }
+    memset(cur, 0, sizeof(xsltPipeline));
+    return(cur);
+}
+
+/**
+ * xsltFreePipeline:
+ * @pipe:  a stylesheet pipeline
+ *
+ * Free up the memory allocated by @pipe, the stylesheets of the stages
+ * are not freed.
+ */
+void
+xsltFreePipeline(xsltPipelinePtr pipe) {
+    if (pipe == NULL)
+	return;
+    if (pipe->stages != NULL)
+	xmlFree(pipe->stages);
+    xmlFree(pipe);
+}
+
+/**
+ * xsltPipelineAddStage:
+ * @pipe:  a stylesheet pipeline
+ * @style:  the stylesheet of the new stage
+ * @params:  a NULL terminated array of parameters names/values tuples
+ *
+ * Appends a stage applying @style to the result of the previous stage.
+ * @style and @params are not copied and must stay valid as long as
+ * the pipeline is used.
+ *
+ * Returns the number of the new stage or -1 in case of error
+ */
+int
+xsltPipelineAddStage(xsltPipelinePtr pipe, xsltStylesheetPtr style,
+	             const char **params) {
+    xsltPipelineStagePtr cur;
+
+    if ((pipe == NULL) || (style == NULL))
+	return(-1);
+    if (pipe->nbStages >= pipe->maxStages) {
+	int max = (pipe->maxStages > 0) ? pipe->maxStages * 2 : 4;
+
+	cur = (xsltPipelineStagePtr) xmlRealloc(pipe->stages,
+		max * sizeof(xsltPipelineStage));
+	if (cur == NULL) {
+	    xsltTransformError(NULL, style, NULL,
+		    "xsltPipelineAddStage : realloc failed\n");
+	    return(-1);
+	}
+	pipe->stages = cur;
+	pipe->maxStages = max;
+    }
+    cur = &pipe->stages[pipe->nbStages];
+    cur->style = style;
+    cur->params = params;
+    cur->time = 0;
+    return(pipe->nbStages++);
+}
+
+/**
+ * xsltPipelineApply:
+ * @pipe:  a stylesheet pipeline
+ * @doc:  a parsed XML document
+ *
+ * Applies the stages of @pipe in turn, the result tree of a stage being
+ * directly the input of the next one: there is no serialization nor
+ * parsing in between and each intermediate result is freed as soon as
+ * the following stage is done with it. @doc itself is left to the
+ * caller. The time spent in each stage is recorded in the stage.
+ * A stage stopped by an error or by xsl:message terminate="yes" makes
+ * the whole pipeline fail.
+ *
+ * Returns the result of the last stage, to be serialized using its
+ * stylesheet, or NULL in case of error
+ */
+xmlDocPtr
+xsltPipelineApply(xsltPipelinePtr pipe, xmlDocPtr doc) {
+    xsltTransformContextPtr ctxt;
+    xmlDocPtr cur, res = NULL;
+    long start;
+    int i;
+
+    if ((pipe == NULL) || (doc == NULL))
+	return(NULL);
+    if (pipe->nbStages == 0) {
+	xsltTransformError(NULL, NULL, (xmlNodePtr) doc,
+		"xsltPipelineApply : the pipeline has no stage\n");
+	return(NULL);
+    }
+    for (i = 0; i < pipe->nbStages; i++)
+	pipe->stages[i].time = 0;
+
+    cur = doc;
+    for (i = 0; i < pipe->nbStages; i++) {
+	start = xsltTimestamp();
+	ctxt = xsltNewTransformContext(pipe->stages[i].style, cur);
+	if (ctxt != NULL) {
+	    res = xsltApplyStylesheetInternal(pipe->stages[i].style, cur,
+		    pipe->stages[i].params, NULL, NULL, ctxt, 0);
+	    /* a stage stopped by an error or xsl:message doesn't go on */
+	    if ((res != NULL) && (ctxt->state != XSLT_STATE_OK)) {
+		xmlFreeDoc(res);
+		res = NULL;
+	    }
+	    xsltFreeTransformContext(ctxt);
+	} else
+	    res = NULL;
+	pipe->stages[i].time = xsltTimestamp() - start;
+	if (cur != doc)
+	    xmlFreeDoc(cur);
+	if (res == NULL) {
+	    xsltTransformError(NULL, pipe->stages[i].style,
+		    (xmlNodePtr) doc,
+		    "xsltPipelineApply : stage %d failed\n", i);
+	    return(NULL);
+	}
+	cur = res;
+    }
+    return(res);
+}
+
+/**
+ * xsltSavePipelineTimings:
+ * @pipe:  a stylesheet pipeline
+ * @output:  a FILE * for saving the information
+ *
+ * Save the time spent in each stage by the last xsltPipelineApply()
+ */
+void
+xsltSavePipelineTimings(xsltPipelinePtr pipe, FILE *output) {
+    long total = 0;
+    int i;
+
+    if ((pipe == NULL) || (output == NULL))
+	return;
+    fprintf(output, "%6s %-40s %10s\n", "stage", "stylesheet", "Time");
+    for (i = 0; i < pipe->nbStages; i++) {
+	xsltStylesheetPtr style = pipe->stages[i].style;
+	const char *name = "";
+
+	if ((style->doc != NULL) && (style->doc->URL != NULL))
+	    name = (const char *) style->doc->URL;
+	fprintf(output, "%5d  %-40s %10ld\n", i, name,
+		pipe->stages[i].time);
+	total += pipe->stages[i].time;
+    }
+    fprintf(output, "\n%5s  %-40s %10ld\n", "", "Total", total);
+}
+
 /**
  * xsltRegisterAllElement:
  * @ctxt:  the XPath context
@@ -29,6 +29,18 @@ XSLTPUBFUN void XSLTCALL
 XSLTPUBFUN int XSLTCALL
 		xsltGetXIncludeDefault	(void);
 
+/**
+ * Threads used by the libxslt:parallel instructions.
+ */
+XSLTPUBFUN void XSLTCALL
+		xsltSetParallelThreads	(int nbThreads);
+XSLTPUBFUN int XSLTCALL
+		xsltGetParallelThreads	(void);
+XSLTPUBFUN void XSLTCALL
+		xsltSetParallelChunkSize(int nbNodes);
+XSLTPUBFUN int XSLTCALL
+		xsltGetParallelChunkSize(void);
+
 /**
  * Export context to users.
  */
@@ -39,6 +51,22 @@ XSLTPUBFUN xsltTransformContextPtr XSLTCALL
 XSLTPUBFUN void XSLTCALL
 		xsltFreeTransformContext(xsltTransformContextPtr ctxt);
 
+XSLTPUBFUN int XSLTCALL
+		xsltSetCtxtCacheLimits	(xsltTransformContextPtr ctxt,
+					 int maxRVT,
+					 int maxStackItems);
+XSLTPUBFUN int XSLTCALL
+		xsltGetCtxtCacheStats	(xsltTransformContextPtr ctxt,
+					 int *newRVTs,
+					 int *reusedRVTs,
+					 int *freedRVTs,
+					 int *newVars,
+					 int *reusedVars,
+					 int *freedVars);
+
+XSLTPUBFUN int XSLTCALL
+		xsltPrepareSharedDocument(xmlDocPtr doc);
+
 XSLTPUBFUN xmlDocPtr XSLTCALL
 		xsltApplyStylesheetUser	(xsltStylesheetPtr style,
 					 xmlDocPtr doc,
@@ -50,6 +78,64 @@ XSLTPUBFUN void XSLTCALL
                 xsltProcessOneNode      (xsltTransformContextPtr ctxt,
                                          xmlNodePtr node,
                                          xsltStackElemPtr params);
+
+/**
+ * xsltTransformJob:
+ *
+ * One of the transformations run by xsltApplyStylesheetsParallel().
+ */
+typedef struct _xsltTransformJob xsltTransformJob;
+typedef xsltTransformJob *xsltTransformJobPtr;
+struct _xsltTransformJob {
+    xsltStylesheetPtr style;	/* the stylesheet to apply */
+    const char **params;	/* NULL terminated name/value pairs or NULL */
+    xmlOutputBufferPtr output;	/* where to serialize the result or NULL */
+    xmlDocPtr result;		/* the result tree if output is NULL */
+    int status;			/* 0 on success, -1 on failure */
+};
+
+XSLTPUBFUN int XSLTCALL
+		xsltApplyStylesheetsParallel(xmlDocPtr doc,
+					 xsltTransformJobPtr jobs,
+					 int nbJobs,
+					 int nbThreads);
+
+/**
+ * xsltPipeline:
+ *
+ * A chain of stylesheets, each one applied to the result of the previous.
+ */
+typedef struct _xsltPipelineStage xsltPipelineStage;
+typedef xsltPipelineStage *xsltPipelineStagePtr;
+struct _xsltPipelineStage {
+    xsltStylesheetPtr style;	/* the stylesheet of the stage */
+    const char **params;	/* NULL terminated name/value pairs or NULL */
+    long time;			/* time spent in the last run in
+				   XSLT_TIMESTAMP_TICS_PER_SEC units */
+};
+
+typedef struct _xsltPipeline xsltPipeline;
+typedef xsltPipeline *xsltPipelinePtr;
+struct _xsltPipeline {
+    int nbStages;		/* number of stages */
+    int maxStages;		/* size of the stages array */
+    xsltPipelineStagePtr stages;/* the stages in order */
+};
+
+XSLTPUBFUN xsltPipelinePtr XSLTCALL
+		xsltNewPipeline		(void);
+XSLTPUBFUN void XSLTCALL
+		xsltFreePipeline	(xsltPipelinePtr pipe);
+XSLTPUBFUN int XSLTCALL
+		xsltPipelineAddStage	(xsltPipelinePtr pipe,
+					 xsltStylesheetPtr style,
+					 const char **params);
+XSLTPUBFUN xmlDocPtr XSLTCALL
+		xsltPipelineApply	(xsltPipelinePtr pipe,
+					 xmlDocPtr doc);
+XSLTPUBFUN void XSLTCALL
+		xsltSavePipelineTimings	(xsltPipelinePtr pipe,
+					 FILE *output);
 /**
  * Private Interfaces.
  */
@@ -31,6 +31,7 @@
 #include "imports.h"
 #include "preproc.h"
 #include "keys.h"
+#include "documents.h"
 
 #ifdef WITH_XSLT_DEBUG
  #define WITH_XSLT_DEBUG_VARIABLE
@@ -45,6 +46,7 @@ const xmlChar *xsltComputingGlobalVarMarker =
 
 #define XSLT_VAR_GLOBAL 1<<0
 #define XSLT_VAR_IN_SELECT 1<<1
+#define XSLT_VAR_UNUSED 1<<2
 #define XSLT_TCTXT_VARIABLE(c) ((xsltStackElemPtr) (c)->contextVariable)
 
 /************************************************************************
@@ -84,15 +86,14 @@ xsltCreateRVT(xsltTransformContextPtr ctxt)
 	container->prev = NULL;
 	if (ctxt->cache->nbRVT > 0)
 	    ctxt->cache->nbRVT--;
-#ifdef XSLT_DEBUG_PROFILE_CACHE
-	ctxt->cache->dbgReusedRVTs++;
-#endif
+	ctxt->cache->reusedRVTs++;
 	return(container);
     }
 
     container = xmlNewDoc(NULL);
     if (container == NULL)
 	return(NULL);
+    ctxt->cache->newRVTs++;
     container->dict = ctxt->dict;
     xmlDictReference(container->dict);
     XSLT_MARK_RES_TREE_FRAG(container);
@@ -220,7 +221,7 @@ xsltExtensionInstructionResultFinalize(xsltTransformContextPtr ctxt)
     */
     cur = ctxt->localRVTBase;
     do {
-	cur->psvi = NULL;
+	cur->psvi = XSLT_RVT_LOCAL;
 	cur = (xmlDocPtr) cur->next;
     } while (cur != NULL);
     return(0);
@@ -298,7 +299,7 @@ xsltExtensionInstructionResultRegister(xsltTransformContextPtr ctxt,
 	    *  global variable or a doc acquired via the
 	    *  document() function?
 	    */
-	    doc->psvi = (void *) ((long) 1);
+	    doc->psvi = XSLT_RVT_FUNC_RESULT;
 	}
     }
 
@@ -321,13 +322,14 @@ xsltReleaseRVT(xsltTransformContextPtr ctxt, xmlDocPtr RVT)
     if (RVT == NULL)
 	return;
 
-    if (ctxt && (ctxt->cache->nbRVT < 40)) {
+    if (ctxt && (ctxt->cache->nbRVT < ctxt->cache->maxRVT)) {
 	/*
 	* Store the Result Tree Fragment.
 	* Free the document info.
 	*/
 	if (RVT->_private != NULL) {
 	    xsltFreeDocumentKeys((xsltDocumentPtr) RVT->_private);
+	    xsltFreeDocumentOrder((xsltDocumentPtr) RVT->_private);
 	    xmlFree(RVT->_private);
 	    RVT->_private = NULL;
 	}
@@ -352,23 +354,23 @@ xsltReleaseRVT(xsltTransformContextPtr ctxt, xmlDocPtr RVT)
 	/*
 	* Reset the reference counter.
 	*/
-	RVT->psvi = 0;
+	RVT->psvi = XSLT_RVT_LOCAL;
 
 	RVT->next = (xmlNodePtr) ctxt->cache->RVT;
 	ctxt->cache->RVT = RVT;
 
 	ctxt->cache->nbRVT++;
-
-#ifdef XSLT_DEBUG_PROFILE_CACHE
-	ctxt->cache->dbgCachedRVTs++;
-#endif
+	ctxt->cache->cachedRVTs++;
 	return;
     }
     /*
     * Free it.
     */
+    if (ctxt != NULL)
+	ctxt->cache->freedRVTs++;
     if (RVT->_private != NULL) {
 	xsltFreeDocumentKeys((xsltDocumentPtr) RVT->_private);
+	xsltFreeDocumentOrder((xsltDocumentPtr) RVT->_private);
 	xmlFree(RVT->_private);
     }
     xmlFreeDoc(RVT);
@@ -421,6 +423,7 @@ xsltFreeRVTs(xsltTransformContextPtr ctxt)
         next = (xmlDocPtr) cur->next;
 	if (cur->_private != NULL) {
 	    xsltFreeDocumentKeys(cur->_private);
+	    xsltFreeDocumentOrder(cur->_private);
 	    xmlFree(cur->_private);
 	}
 	xmlFreeDoc(cur);
@@ -435,6 +438,7 @@ xsltFreeRVTs(xsltTransformContextPtr ctxt)
         next = (xmlDocPtr) cur->next;
 	if (cur->_private != NULL) {
 	    xsltFreeDocumentKeys(cur->_private);
+	    xsltFreeDocumentOrder(cur->_private);
 	    xmlFree(cur->_private);
 	}
 	xmlFreeDoc(cur);
@@ -449,6 +453,7 @@ xsltFreeRVTs(xsltTransformContextPtr ctxt)
         next = (xmlDocPtr) cur->next;
 	if (cur->_private != NULL) {
 	    xsltFreeDocumentKeys(cur->_private);
+	    xsltFreeDocumentOrder(cur->_private);
 	    xmlFree(cur->_private);
 	}
 	xmlFreeDoc(cur);
@@ -482,9 +487,7 @@ xsltNewStackElem(xsltTransformContextPtr ctxt)
 	ctxt->cache->stackItems = ret->next;
 	ret->next = NULL;
 	ctxt->cache->nbStackItems--;
-#ifdef XSLT_DEBUG_PROFILE_CACHE
-	ctxt->cache->dbgReusedVars++;
-#endif
+	ctxt->cache->reusedVars++;
 	return(ret);
     }
     ret = (xsltStackElemPtr) xmlMalloc(sizeof(xsltStackElem));
@@ -493,6 +496,8 @@ xsltNewStackElem(xsltTransformContextPtr ctxt)
 		"xsltNewStackElem : malloc failed\n");
 	return(NULL);
     }
+    if (ctxt != NULL)
+	ctxt->cache->newVars++;
     memset(ret, 0, sizeof(xsltStackElem));
     ret->context = ctxt;
     return(ret);
@@ -523,6 +528,7 @@ xsltCopyStackElem(xsltStackElemPtr elem) {
     cur->select = elem->select;
     cur->tree = elem->tree;
     cur->comp = elem->comp;
+    cur->flags = elem->flags & (XSLT_VAR_UNUSED);
     return(cur);
 }
 
@@ -549,7 +555,7 @@ xsltFreeStackElem(xsltStackElemPtr elem) {
 	    elem->fragment = (xmlDocPtr) cur->next;
 
 	    if (elem->context &&
-		(cur->psvi == (void *) ((long) 1)))
+		(cur->psvi == XSLT_RVT_FUNC_RESULT))
 	    {
 		/*
 		* This fragment is a result of an extension instruction
@@ -575,7 +581,8 @@ xsltFreeStackElem(xsltStackElemPtr elem) {
     /*
     * Cache or free the variable structure.
     */
-    if (elem->context && (elem->context->cache->nbStackItems < 50)) {
+    if (elem->context && (elem->context->cache->nbStackItems <
+	                  elem->context->cache->maxStackItems)) {
 	/*
 	* Store the item in the cache.
 	*/
@@ -585,11 +592,11 @@ xsltFreeStackElem(xsltStackElemPtr elem) {
 	elem->next = ctxt->cache->stackItems;
 	ctxt->cache->stackItems = elem;
 	ctxt->cache->nbStackItems++;
-#ifdef XSLT_DEBUG_PROFILE_CACHE
-	ctxt->cache->dbgCachedVars++;
-#endif
+	ctxt->cache->cachedVars++;
 	return;
     }
+    if (elem->context != NULL)
+	elem->context->cache->freedVars++;
     xmlFree(elem);
 }
 
@@ -942,6 +949,8 @@ xsltEvalVariable(xsltTransformContextPtr ctxt, xsltStackElemPtr variable,
 		xmlDocPtr container;
 		xmlNodePtr oldInsert;
 		xmlDocPtr  oldOutput;
+		const xmlChar *oldLastText;
+		unsigned int oldLastTSize, oldLastTUse;
 		xsltStackElemPtr oldVar = ctxt->contextVariable;
 
 		/*
@@ -966,6 +975,13 @@ xsltEvalVariable(xsltTransformContextPtr ctxt, xsltStackElemPtr variable,
 
 		oldOutput = ctxt->output;
 		oldInsert = ctxt->insert;
+		/*
+		* Keep the pending text of the current insertion point, so
+		* that text following the variable is still appended in place.
+		*/
+		oldLastText = ctxt->lasttext;
+		oldLastTSize = ctxt->lasttsize;
+		oldLastTUse = ctxt->lasttuse;
 
 		ctxt->output = container;
 		ctxt->insert = (xmlNodePtr) container;
@@ -980,6 +996,9 @@ xsltEvalVariable(xsltTransformContextPtr ctxt, xsltStackElemPtr variable,
 		ctxt->contextVariable = oldVar;
 		ctxt->insert = oldInsert;
 		ctxt->output = oldOutput;
+		ctxt->lasttext = oldLastText;
+		ctxt->lasttsize = oldLastTSize;
+		ctxt->lasttuse = oldLastTUse;
 
 		result = xmlXPathNewValueTree((xmlNodePtr) container);
 	    }
@@ -1166,6 +1185,8 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 	    xmlDocPtr container;
 	    xmlNodePtr oldInsert;
 	    xmlDocPtr  oldOutput, oldXPDoc;
+	    const xmlChar *oldLastText;
+	    unsigned int oldLastTSize, oldLastTUse;
 	    /*
 	    * Generate a result tree fragment.
 	    */
@@ -1180,6 +1201,9 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 
 	    oldOutput = ctxt->output;
 	    oldInsert = ctxt->insert;
+	    oldLastText = ctxt->lasttext;
+	    oldLastTSize = ctxt->lasttsize;
+	    oldLastTUse = ctxt->lasttuse;
 
 	    oldXPDoc = ctxt->xpathCtxt->doc;
 
@@ -1196,6 +1220,9 @@ xsltEvalGlobalVariable(xsltStackElemPtr elem, xsltTransformContextPtr ctxt)
 
 	    ctxt->insert = oldInsert;
 	    ctxt->output = oldOutput;
+	    ctxt->lasttext = oldLastText;
+	    ctxt->lasttsize = oldLastTSize;
+	    ctxt->lasttuse = oldLastTUse;
 
 	    result = xmlXPathNewValueTree((xmlNodePtr) container);
 	    if (result == NULL) {
@@ -1224,6 +1251,23 @@ error:
     return(result);
 }
 
+/**
+ * xsltEvalUsedGlobalVariable:
+ * @elem:  the global variable or parameter
+ * @ctxt:  the XSLT transformation context
+ *
+ * Evaluates @elem unless xsltPruneGlobalVariables() found it is not
+ * referenced by the stylesheet, in which case it is only evaluated
+ * if it is looked up.
+ */
+static void
+xsltEvalUsedGlobalVariable(xsltStackElemPtr elem,
+			   xsltTransformContextPtr ctxt) {
+    if (elem->flags & XSLT_VAR_UNUSED)
+	return;
+    xsltEvalGlobalVariable(elem, ctxt);
+}
+
 /**
  * xsltEvalGlobalVariables:
  * @ctxt:  the XSLT transformation context
@@ -1299,7 +1343,7 @@ xsltEvalGlobalVariables(xsltTransformContextPtr ctxt) {
      * This part does the actual evaluation
      */
     xmlHashScan(ctxt->globalVars,
-	        (xmlHashScanner) xsltEvalGlobalVariable, ctxt);
+	        (xmlHashScanner) xsltEvalUsedGlobalVariable, ctxt);
 
     return(0);
 }
@@ -2102,6 +2146,141 @@ xsltParseGlobalParam(xsltStylesheetPtr style, xmlNodePtr cur) {
 	NULL);
 }
 
+/**
+ * xsltHasPrefixedCall:
+ * @str:  an XPath expression or attribute value template
+ *
+ * Checks whether @str calls a function with a prefixed name, that is
+ * an extension function.
+ *
+ * Returns 1 if so, 0 otherwise
+ */
+static int
+xsltHasPrefixedCall(const xmlChar *str) {
+    const xmlChar *cur;
+    xmlChar quote = 0;
+
+    for (cur = str; *cur != 0; cur++) {
+	if (quote != 0) {
+	    if (*cur == quote)
+		quote = 0;
+	    continue;
+	}
+	if ((*cur == '"') || (*cur == '\'')) {
+	    quote = *cur;
+	    continue;
+	}
+	if (*cur != ':')
+	    continue;
+	if (cur[1] == ':') {
+	    cur++;
+	    continue;
+	}
+	cur++;
+	while ((IS_LETTER(*cur)) || (IS_DIGIT(*cur)) || (*cur == '_') ||
+	       (*cur == '-') || (*cur == '.') || (*cur >= 0x80))
+	    cur++;
+	while (IS_BLANK_CH(*cur))
+	    cur++;
+	if (*cur == '(')
+	    return(1);
+	if (*cur == 0)
+	    break;
+    }
+    return(0);
+}
+
+/**
+ * xsltGlobalHasSideEffects:
+ * @elem:  a global variable or parameter
+ *
+ * Checks whether evaluating @elem could be observed other than through
+ * its value: messages, secondary documents, extension elements or
+ * functions, or templates called from its content.
+ *
+ * Returns 1 if so, 0 otherwise
+ */
+static int
+xsltGlobalHasSideEffects(xsltStackElemPtr elem) {
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+    xmlChar *value;
+    int ret;
+
+    if ((elem->select != NULL) && (xsltHasPrefixedCall(elem->select)))
+	return(1);
+    cur = elem->tree;
+    while (cur != NULL) {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    if (IS_XSLT_ELEM(cur)) {
+		if ((IS_XSLT_NAME(cur, "message")) ||
+		    (IS_XSLT_NAME(cur, "document")) ||
+		    (IS_XSLT_NAME(cur, "call-template")) ||
+		    (IS_XSLT_NAME(cur, "apply-templates")) ||
+		    (IS_XSLT_NAME(cur, "apply-imports")))
+		    return(1);
+	    } else if (cur->psvi != NULL) {
+		/* an extension element */
+		return(1);
+	    }
+	    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		value = xmlNodeListGetString(cur->doc, attr->children, 1);
+		if (value == NULL)
+		    continue;
+		ret = xsltHasPrefixedCall(value);
+		xmlFree(value);
+		if (ret)
+		    return(1);
+	    }
+	    if (cur->children != NULL) {
+		cur = cur->children;
+		continue;
+	    }
+	}
+	while ((cur->next == NULL) && (cur->parent != NULL) &&
+	       (cur->parent != elem->comp->inst))
+	    cur = cur->parent;
+	cur = cur->next;
+    }
+    return(0);
+}
+
+/**
+ * xsltPruneGlobalVariables:
+ * @style:  the XSLT stylesheet
+ * @names:  the local names of the variables which can be referenced
+ *
+ * Excludes from the evaluation at the start of the transformations the
+ * global variables and parameters of @style whose local name is not in
+ * @names and whose evaluation has no other effect than computing the
+ * value. They are still evaluated if looked up, for example from an
+ * extension.
+ *
+ * Returns the number of variables and parameters excluded
+ */
+int
+xsltPruneGlobalVariables(xsltStylesheetPtr style, xmlHashTablePtr names) {
+    xsltStackElemPtr cur;
+    int nbPruned = 0;
+
+    if ((style == NULL) || (names == NULL))
+	return(0);
+
+    for (cur = style->variables; cur != NULL; cur = cur->next) {
+	if ((cur->comp != NULL) && (cur->comp->inst != NULL) &&
+	    (xmlHashLookup(names, cur->name) == NULL) &&
+	    (xsltGlobalHasSideEffects(cur) == 0)) {
+#ifdef WITH_XSLT_DEBUG_VARIABLE
+	    xsltGenericDebug(xsltGenericDebugContext,
+			     "Pruned global variable %s\n", cur->name);
+#endif
+	    cur->flags |= XSLT_VAR_UNUSED;
+	    nbPruned++;
+	}
+    }
+    return(nbPruned);
+}
+
 /**
  * xsltParseStylesheetVariable:
  * @ctxt:  the XSLT transformation context
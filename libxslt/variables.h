@@ -61,6 +61,9 @@ XSLTPUBFUN void XSLTCALL
 XSLTPUBFUN void XSLTCALL
 		xsltParseGlobalParam		(xsltStylesheetPtr style,
 						 xmlNodePtr cur);
+XSLTPUBFUN int XSLTCALL
+		xsltPruneGlobalVariables	(xsltStylesheetPtr style,
+						 xmlHashTablePtr names);
 XSLTPUBFUN void XSLTCALL
 		xsltParseStylesheetVariable	(xsltTransformContextPtr ctxt,
 						 xmlNodePtr cur);
@@ -1006,6 +1006,17 @@ xsltFreeStylesheet(xsltStylesheetPtr style)
         xsltFreeAVTList(style->attVTs);
     if (style->imports != NULL)
         xsltFreeStylesheetList(style->imports);
+    /*
+    * The compiled expressions are shared by the imports, free them
+    * once those are gone.
+    */
+    if (style->xpathComps != NULL)
+	xmlHashFree(style->xpathComps,
+	            (xmlHashDeallocator) xmlXPathFreeCompExpr);
+    if (style->docURIs != NULL)
+	xmlHashFree(style->docURIs, NULL);
+    if (style->docVars != NULL)
+	xmlHashFree(style->docVars, NULL);
 
 #ifdef XSLT_REFACTORED
     /*
@@ -5133,6 +5144,39 @@ error:
     }
 }
 
+/**
+ * xsltParseTemplateMemoize:
+ * @style:  the XSLT stylesheet
+ * @templ:  the compiled template
+ * @node:  the "template" element
+ *
+ * Processes the libxslt:memoize extension attribute declaring that the
+ * output of the template only depends on its parameters and on either
+ * the identity ("node") or the string value ("string") of the context
+ * node, so that it can be reused across calls.
+ */
+static void
+xsltParseTemplateMemoize(xsltStylesheetPtr style, xsltTemplatePtr templ,
+	                 xmlNodePtr node) {
+    xmlChar *prop;
+
+    prop = xmlGetNsProp(node, (const xmlChar *)"memoize",
+	                XSLT_LIBXSLT_NAMESPACE);
+    if (prop == NULL)
+	return;
+    if (xmlStrEqual(prop, (const xmlChar *)"node"))
+	templ->memoize = XSLT_MEMOIZE_NODE;
+    else if (xmlStrEqual(prop, (const xmlChar *)"string"))
+	templ->memoize = XSLT_MEMOIZE_STRING;
+    else if (!xmlStrEqual(prop, (const xmlChar *)"no")) {
+	xsltTransformError(NULL, style, node,
+	    "xsl:template: invalid value '%s' for libxslt:memoize, "
+	    "expecting 'node', 'string' or 'no'\n", prop);
+	if (style != NULL) style->warnings++;
+    }
+    xmlFree(prop);
+}
+
 #ifdef XSLT_REFACTORED
 /**
  * xsltParseXSLTTemplate:
@@ -5288,6 +5332,7 @@ xsltParseXSLTTemplate(xsltCompilerCtxtPtr cctxt, xmlNodePtr templNode) {
 	*/
     }
 
+    xsltParseTemplateMemoize(cctxt->style, templ, templNode);
     templ->elem = templNode;
     templ->content = templNode->children;
     xsltAddTemplate(cctxt->style, templ, templ->mode, templ->modeURI);
@@ -5411,6 +5456,7 @@ xsltParseStylesheetTemplate(xsltStylesheetPtr style, xmlNodePtr template) {
      * parse the content and register the pattern
      */
     xsltParseTemplateContent(style, template);
+    xsltParseTemplateMemoize(style, ret, template);
     ret->elem = template;
     ret->content = template->children;
     xsltAddTemplate(style, ret, ret->mode, ret->modeURI);
@@ -6644,6 +6690,482 @@ xsltParseStylesheetImportedDoc(xmlDocPtr doc,
     return(retStyle);
 }
 
+/************************************************************************
+ *									*
+ *		Pruning of the unused parts of a stylesheet		*
+ *									*
+ ************************************************************************/
+
+static int xsltDoPruneDefault = 0;
+
+/**
+ * xsltSetPruneDefault:
+ * @prune: whether to prune the stylesheets
+ *
+ * Set whether the stylesheets parsed by xsltParseStylesheetDoc() should
+ * drop the template rules of the modes never applied, the keys never
+ * used, and exclude the global variables never referenced from the
+ * evaluation at the start of the transformations.
+ * This assumes the transformations start in the default mode and that
+ * extensions don't use keys or variables by name.
+ */
+void
+xsltSetPruneDefault(int prune) {
+    xsltDoPruneDefault = (prune != 0);
+}
+
+/**
+ * xsltGetPruneDefault:
+ *
+ * Provides the default state for the pruning of stylesheets
+ *
+ * Returns 0 if the stylesheets are kept whole, 1 otherwise
+ */
+int
+xsltGetPruneDefault(void) {
+    return(xsltDoPruneDefault);
+}
+
+typedef struct _xsltPruneData xsltPruneData;
+typedef xsltPruneData *xsltPruneDataPtr;
+struct _xsltPruneData {
+    xmlHashTablePtr modes;	/* the modes used by xsl:apply-templates */
+    xmlHashTablePtr varNames;	/* the local names following a '$' */
+    xmlHashTablePtr keyNames;	/* the local names passed to key() */
+    int allModes;		/* a mode couldn't be resolved */
+    int allKeys;		/* key() is called with a computed name */
+    int dynamic;		/* expressions are built at run time */
+};
+
+#define XSLT_IS_QNAME_CHAR(c)						\
+    ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+     (((c) >= '0') && ((c) <= '9')) || ((c) == '_') || ((c) == '-') ||	\
+     ((c) == '.') || ((c) == ':') || ((c) >= 0x80))
+
+/**
+ * xsltPruneAddName:
+ * @table:  the set of names
+ * @start:  the start of a QName
+ * @end:  the end of the QName
+ *
+ * Adds the local part of the QName to @table.
+ */
+static void
+xsltPruneAddName(xmlHashTablePtr table, const xmlChar *start,
+		 const xmlChar *end) {
+    const xmlChar *cur;
+    xmlChar *name;
+
+    for (cur = start; cur < end; cur++)
+	if (*cur == ':')
+	    start = cur + 1;
+    if (start >= end)
+	return;
+    name = xmlStrndup(start, end - start);
+    if (name == NULL)
+	return;
+    xmlHashAddEntry(table, name, (void *) table);
+    xmlFree(name);
+}
+
+/**
+ * xsltPruneScanValue:
+ * @data:  the pruning data
+ * @str:  an attribute value of the stylesheet
+ *
+ * Records the variable references and the key() calls found in @str.
+ * String literals are not skipped, which can only keep more.
+ */
+static void
+xsltPruneScanValue(xsltPruneDataPtr data, const xmlChar *str) {
+    const xmlChar *cur, *start;
+    xmlChar quote;
+
+    for (cur = str; *cur != 0; cur++) {
+	if (*cur == '$') {
+	    start = cur + 1;
+	    while (IS_BLANK_CH(*start))
+		start++;
+	    cur = start;
+	    while (XSLT_IS_QNAME_CHAR(*cur))
+		cur++;
+	    xsltPruneAddName(data->varNames, start, cur);
+	    cur--;
+	} else if ((*cur == 'k') && (cur[1] == 'e') && (cur[2] == 'y') &&
+		   ((cur == str) || (!XSLT_IS_QNAME_CHAR(cur[-1])))) {
+	    cur += 3;
+	    while (IS_BLANK_CH(*cur))
+		cur++;
+	    if (*cur != '(') {
+		cur--;
+		continue;
+	    }
+	    cur++;
+	    while (IS_BLANK_CH(*cur))
+		cur++;
+	    if ((*cur != '"') && (*cur != '\'')) {
+		data->allKeys = 1;
+		cur--;
+		continue;
+	    }
+	    quote = *cur++;
+	    start = cur;
+	    while ((*cur != 0) && (*cur != quote))
+		cur++;
+	    xsltPruneAddName(data->keyNames, start, cur);
+	    if (*cur == 0)
+		break;
+	}
+    }
+}
+
+/**
+ * xsltPruneScanDoc:
+ * @data:  the pruning data
+ * @doc:  a stylesheet module
+ *
+ * Records what the instructions and attribute values of @doc use.
+ */
+static void
+xsltPruneScanDoc(xsltPruneDataPtr data, xmlDocPtr doc) {
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+    xmlNsPtr ns;
+    xmlChar *value;
+
+    cur = xmlDocGetRootElement(doc);
+    while (cur != NULL) {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+		if ((xmlStrEqual(ns->href,
+			BAD_CAST "http://exslt.org/dynamic")) ||
+		    (xmlStrEqual(ns->href, BAD_CAST "http://icl.com/saxon")))
+		    data->dynamic = 1;
+	    }
+	    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		value = xmlNodeListGetString(doc, attr->children, 1);
+		if (value == NULL)
+		    continue;
+		xsltPruneScanValue(data, value);
+		xmlFree(value);
+	    }
+	    if ((IS_XSLT_ELEM(cur)) && (IS_XSLT_NAME(cur, "apply-templates"))) {
+#ifdef XSLT_REFACTORED
+		xsltStyleItemApplyTemplatesPtr comp =
+		    (xsltStyleItemApplyTemplatesPtr) cur->psvi;
+#else
+		xsltStylePreCompPtr comp = (xsltStylePreCompPtr) cur->psvi;
+#endif
+		if (comp == NULL) {
+		    if (xmlHasProp(cur, BAD_CAST "mode") != NULL)
+			data->allModes = 1;
+		} else if (comp->mode != NULL) {
+		    xmlHashAddEntry2(data->modes, comp->mode, comp->modeURI,
+				     (void *) data->modes);
+		}
+	    }
+	    if (cur->children != NULL) {
+		cur = cur->children;
+		continue;
+	    }
+	}
+	while ((cur->next == NULL) && (cur->parent != NULL) &&
+	       (cur->parent->type != XML_DOCUMENT_NODE))
+	    cur = cur->parent;
+	cur = cur->next;
+    }
+}
+
+/**
+ * xsltPruneStylesheet:
+ * @style:  the principal XSLT stylesheet
+ *
+ * Finds out which modes, keys and global variables the stylesheet and
+ * its imports can use, and prunes the others, see xsltSetPruneDefault().
+ */
+static void
+xsltPruneStylesheet(xsltStylesheetPtr style) {
+    xsltPruneData data;
+    xsltStylesheetPtr cur;
+    xsltDocumentPtr incl;
+
+    memset(&data, 0, sizeof(data));
+    data.modes = xmlHashCreate(0);
+    data.varNames = xmlHashCreate(0);
+    data.keyNames = xmlHashCreate(0);
+    if ((data.modes == NULL) || (data.varNames == NULL) ||
+	(data.keyNames == NULL))
+	goto done;
+
+    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+	if (cur->doc != NULL)
+	    xsltPruneScanDoc(&data, cur->doc);
+	for (incl = cur->docList; incl != NULL; incl = incl->next)
+	    if (incl->doc != NULL)
+		xsltPruneScanDoc(&data, incl->doc);
+    }
+
+    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+	if (data.allModes == 0)
+	    style->prunedTemplates += xsltPruneTemplates(cur, data.modes);
+	if (data.dynamic == 0) {
+	    style->prunedVariables +=
+		xsltPruneGlobalVariables(cur, data.varNames);
+	    if (data.allKeys == 0)
+		style->prunedKeys += xsltPruneKeys(cur, data.keyNames);
+	}
+    }
+#ifdef WITH_XSLT_DEBUG_PARSING
+    xsltGenericDebug(xsltGenericDebugContext,
+	"pruned %d template rules, %d global variables, %d keys\n",
+	style->prunedTemplates, style->prunedVariables, style->prunedKeys);
+#endif
+
+done:
+    if (data.modes != NULL)
+	xmlHashFree(data.modes, NULL);
+    if (data.varNames != NULL)
+	xmlHashFree(data.varNames, NULL);
+    if (data.keyNames != NULL)
+	xmlHashFree(data.keyNames, NULL);
+}
+
+/************************************************************************
+ *									*
+ *		Checks of the side effects of the templates		*
+ *									*
+ ************************************************************************/
+
+/*
+ * What the templates are checked for: processing by concurrent
+ * transformation contexts, see xsltIsParallelSafe(), or caching of
+ * the results, see xsltIsDeterministic().
+ */
+#define XSLT_CHECK_PARALLEL	1
+#define XSLT_CHECK_CACHE	2
+
+/*
+ * The namespaces of the extension functions which only depend on their
+ * arguments and have no side effects, math:random() excepted.
+ */
+static const char *xsltPureFunctionNs[] = {
+    "http://exslt.org/common",
+    "http://exslt.org/math",
+    "http://exslt.org/sets",
+    "http://exslt.org/strings",
+    NULL
+};
+
+/**
+ * xsltCheckSideEffectsValue:
+ * @node:  the element holding the value
+ * @str:  an attribute value of the stylesheet
+ * @check:  XSLT_CHECK_PARALLEL or XSLT_CHECK_CACHE
+ *
+ * Looks for calls of extension functions which are not known to be
+ * free of side effects in @str, and of document() for the parallel
+ * processing or generate-id() for the caching. String literals are not
+ * skipped, which can only reject more.
+ *
+ * Returns 0 if none is found, -1 otherwise
+ */
+static int
+xsltCheckSideEffectsValue(xmlNodePtr node, const xmlChar *str, int check) {
+    const xmlChar *cur, *start, *end, *colon;
+    xmlChar *prefix;
+    xmlNsPtr ns;
+    int i;
+
+    cur = str;
+    while (*cur != 0) {
+	if (!XSLT_IS_QNAME_CHAR(*cur)) {
+	    cur++;
+	    continue;
+	}
+	start = cur;
+	while (XSLT_IS_QNAME_CHAR(*cur))
+	    cur++;
+	end = cur;
+	while (IS_BLANK_CH(*cur))
+	    cur++;
+	if (*cur != '(')
+	    continue;
+	/*
+	* Skip an axis, node tests are handled like functions.
+	*/
+	colon = NULL;
+	for (i = 0; start + i < end; i++) {
+	    if (start[i] != ':')
+		continue;
+	    if ((start + i + 1 < end) && (start[i + 1] == ':')) {
+		start += i + 2;
+		i = -1;
+		colon = NULL;
+	    } else if (colon == NULL)
+		colon = start + i;
+	}
+	if (colon == NULL) {
+	    if ((check == XSLT_CHECK_PARALLEL) && (end - start == 8) &&
+		(!xmlStrncmp(start, BAD_CAST "document", 8)))
+		return(-1);
+	    if ((check == XSLT_CHECK_CACHE) && (end - start == 11) &&
+		(!xmlStrncmp(start, BAD_CAST "generate-id", 11)))
+		return(-1);
+	    continue;
+	}
+	prefix = xmlStrndup(start, colon - start);
+	if (prefix == NULL)
+	    return(-1);
+	ns = xmlSearchNs(node->doc, node, prefix);
+	xmlFree(prefix);
+	if (ns == NULL)
+	    return(-1);
+	for (i = 0; xsltPureFunctionNs[i] != NULL; i++)
+	    if (xmlStrEqual(ns->href, BAD_CAST xsltPureFunctionNs[i]))
+		break;
+	if (xsltPureFunctionNs[i] == NULL)
+	    return(-1);
+	if ((end - colon - 1 == 6) &&
+	    (!xmlStrncmp(colon + 1, BAD_CAST "random", 6)))
+	    return(-1);
+    }
+    return(0);
+}
+
+/**
+ * xsltCheckSideEffectsDoc:
+ * @doc:  a stylesheet module
+ * @check:  XSLT_CHECK_PARALLEL or XSLT_CHECK_CACHE
+ *
+ * Checks that the instructions of @doc have no side effects: there is
+ * no xsl:message, xsl:document or extension element, and the
+ * expressions don't call unknown extension functions, see
+ * xsltCheckSideEffectsValue(). For the parallel processing, the global
+ * variables and parameters are skipped since they are computed by the
+ * main context, and there must be no xsl:number, which isn't
+ * reentrant.
+ *
+ * Returns 0 if so, -1 otherwise
+ */
+static int
+xsltCheckSideEffectsDoc(xmlDocPtr doc, int check) {
+    xmlNodePtr root, cur;
+    xmlAttrPtr attr;
+    xmlChar *value;
+    int ret;
+
+    root = xmlDocGetRootElement(doc);
+    cur = root;
+    while (cur != NULL) {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    if (IS_XSLT_ELEM(cur)) {
+		if ((check == XSLT_CHECK_PARALLEL) && (cur->parent == root) &&
+		    ((IS_XSLT_NAME(cur, "variable")) ||
+		     (IS_XSLT_NAME(cur, "param"))))
+		    goto skip_children;
+		if ((IS_XSLT_NAME(cur, "message")) ||
+		    (IS_XSLT_NAME(cur, "document")))
+		    return(-1);
+		/*
+		* xsl:number keeps its state in the compiled instruction
+		* and in the static data of numbers.c.
+		*/
+		if ((check == XSLT_CHECK_PARALLEL) &&
+		    (IS_XSLT_NAME(cur, "number")))
+		    return(-1);
+	    } else if ((cur->ns != NULL) && (cur->psvi != NULL)) {
+		return(-1);
+	    }
+	    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+		if ((attr->children != NULL) &&
+		    (attr->children->next == NULL) &&
+		    (attr->children->type == XML_TEXT_NODE)) {
+		    if (xsltCheckSideEffectsValue(cur,
+			    attr->children->content, check) < 0)
+			return(-1);
+		    continue;
+		}
+		value = xmlNodeListGetString(doc, attr->children, 1);
+		if (value == NULL)
+		    continue;
+		ret = xsltCheckSideEffectsValue(cur, value, check);
+		xmlFree(value);
+		if (ret < 0)
+		    return(-1);
+	    }
+	    if (cur->children != NULL) {
+		cur = cur->children;
+		continue;
+	    }
+	}
+skip_children:
+	while ((cur->next == NULL) && (cur->parent != NULL) &&
+	       (cur->parent->type != XML_DOCUMENT_NODE))
+	    cur = cur->parent;
+	cur = cur->next;
+    }
+    return(0);
+}
+
+/**
+ * xsltCheckSideEffects:
+ * @style:  the principal XSLT stylesheet
+ * @check:  XSLT_CHECK_PARALLEL or XSLT_CHECK_CACHE
+ *
+ * Applies xsltCheckSideEffectsDoc() to the modules of the stylesheet
+ * and its imports.
+ *
+ * Returns 0 if none has side effects, -1 otherwise
+ */
+static int
+xsltCheckSideEffects(xsltStylesheetPtr style, int check) {
+    xsltStylesheetPtr cur;
+    xsltDocumentPtr incl;
+
+    for (cur = style; cur != NULL; cur = xsltNextImport(cur)) {
+	if ((cur->doc != NULL) &&
+	    (xsltCheckSideEffectsDoc(cur->doc, check) < 0))
+	    return(-1);
+	for (incl = cur->docList; incl != NULL; incl = incl->next)
+	    if ((incl->doc != NULL) &&
+		(xsltCheckSideEffectsDoc(incl->doc, check) < 0))
+		return(-1);
+    }
+    return(0);
+}
+
+/**
+ * xsltIsParallelSafe:
+ * @style:  the principal XSLT stylesheet
+ *
+ * Finds out whether the templates of the stylesheet and its imports
+ * can be applied by concurrent transformation contexts, see
+ * xsltCheckSideEffectsDoc().
+ *
+ * Returns 1 if so, 0 otherwise
+ */
+static int
+xsltIsParallelSafe(xsltStylesheetPtr style) {
+    return(xsltCheckSideEffects(style, XSLT_CHECK_PARALLEL) == 0);
+}
+
+/**
+ * xsltIsDeterministic:
+ * @style:  the principal XSLT stylesheet
+ *
+ * Finds out whether the result of the stylesheet only depends on the
+ * input, the parameters and the documents it loads, so that it can be
+ * stored in a result cache: its templates and global variables must
+ * have no side effects, and must not call generate-id() or extension
+ * functions like date:date-time() or math:random().
+ *
+ * Returns 1 if so, 0 otherwise
+ */
+static int
+xsltIsDeterministic(xsltStylesheetPtr style) {
+    return(xsltCheckSideEffects(style, XSLT_CHECK_CACHE) == 0);
+}
+
 /**
  * xsltParseStylesheetDoc:
  * @doc:  and xmlDoc parsed XML
@@ -6668,6 +7190,11 @@ xsltParseStylesheetDoc(xmlDocPtr doc) {
 	return(NULL);
 
     xsltResolveStylesheetAttributeSet(ret);
+    xsltPreResolveExtFunctions(ret);
+    if (xsltDoPruneDefault)
+	xsltPruneStylesheet(ret);
+    ret->parallelSafe = xsltIsParallelSafe(ret);
+    ret->deterministic = xsltIsDeterministic(ret);
 #ifdef XSLT_REFACTORED
     /*
     * Free the compilation context.
@@ -57,6 +57,52 @@ extern "C" {
     ((n != NULL) && ((n)->type == XML_DOCUMENT_NODE) && \
      ((n)->name != NULL) && ((n)->name[0] == ' '))
 
+/**
+ * XSLT_RVT_LOCAL:
+ *
+ * state (psvi field) of a result tree fragment owned by the region
+ * of the scope which registered it
+ */
+#define XSLT_RVT_LOCAL ((void *) 0)
+
+/**
+ * XSLT_RVT_FUNC_RESULT:
+ *
+ * state (psvi field) of a result tree fragment returned by an extension
+ * instruction (e.g. EXSLT's function); it escapes the region of the
+ * scope which created it
+ */
+#define XSLT_RVT_FUNC_RESULT ((void *) ((long) 1))
+
+/**
+ * XSLT_HAS_SHARED_NODES:
+ *
+ * internal macro to test if a node of a result document has
+ * descendants sharing their content with the input document
+ */
+#define XSLT_HAS_SHARED_NODES(n) \
+    ((n)->psvi == (void *) (n)->doc)
+
+/**
+ * XSLT_DOC_HAS_SHARED_NODES:
+ *
+ * internal macro to test if a result document has nodes sharing
+ * their content with the input document
+ */
+#define XSLT_DOC_HAS_SHARED_NODES(d) \
+    ((d)->psvi == (void *) (d))
+
+/**
+ * XSLT_SHARED_SOURCE:
+ *
+ * internal macro to get the input node whose children stand for the
+ * children of a result element, or NULL. Only valid in a document
+ * for which XSLT_DOC_HAS_SHARED_NODES() is true.
+ */
+#define XSLT_SHARED_SOURCE(n) \
+    ((((n)->type == XML_ELEMENT_NODE) && \
+      ((n)->psvi != (void *) (n)->doc)) ? (xmlNodePtr) (n)->psvi : NULL)
+
 /**
  * XSLT_REFACTORED_KEYCOMP:
  *
@@ -264,6 +310,18 @@ struct _xsltRuntimeExtra {
  */
 #define	XSLT_RUNTIME_EXTRA(ctxt, nr, typ) (ctxt)->extras[(nr)].val.typ
 
+/**
+ * xsltMemoizeType:
+ *
+ * What the output of a template declared with libxslt:memoize is
+ * assumed to depend on, besides the template parameters.
+ */
+typedef enum {
+    XSLT_MEMOIZE_NONE = 0,	/* not memoized */
+    XSLT_MEMOIZE_NODE,		/* the identity of the context node */
+    XSLT_MEMOIZE_STRING		/* the string value of the context node */
+} xsltMemoizeType;
+
 /**
  * xsltTemplate:
  *
@@ -299,6 +357,10 @@ struct _xsltTemplate {
     int              templMax;		/* Size of the templtes stack */
     xsltTemplatePtr *templCalledTab;	/* templates called */
     int             *templCountTab;  /* .. and how often */
+
+    int memoize;        /* libxslt:memoize, a xsltMemoizeType */
+    int memoHits;       /* profiling: calls served from the memo */
+    int memoMisses;     /* profiling: calls which were memoized */
 };
 
 /**
@@ -341,6 +403,8 @@ struct _xsltDocument {
     struct _xsltDocument *includes; /* subsidiary includes */
     int preproc;		/* pre-processing already done */
     int nbKeysComputed;
+    void *order;		/* document order index, built on demand */
+    void *keyed;		/* the set of nodes matched by keys */
 };
 
 /**
@@ -499,6 +563,15 @@ struct _xsltElemPreComp {
 typedef struct _xsltStylePreComp xsltStylePreComp;
 typedef xsltStylePreComp *xsltStylePreCompPtr;
 
+/**
+ * xsltPreCompArena:
+ *
+ * Opaque storage of the precomputed data of a stylesheet, see
+ * xsltStylePreCompute().
+ */
+typedef struct _xsltPreCompArena xsltPreCompArena;
+typedef xsltPreCompArena *xsltPreCompArenaPtr;
+
 #ifdef XSLT_REFACTORED
 
 /*
@@ -758,6 +831,7 @@ struct _xsltStyleItemApplyTemplates {
     const xmlChar *modeURI;	/* apply-templates */
     const xmlChar *select;	/* sort, copy-of, value-of, apply-templates */
     xmlXPathCompExprPtr comp;	/* a precompiled XPath expression */
+    int parallel;		/* libxslt:parallel */
     /* TODO: with-params */
 };
 
@@ -829,9 +903,17 @@ struct _xsltStyleItemIf {
  * <xsl:copy-of
  *  select = expression />
  */
-typedef xsltStyleBasicExpressionItem xsltStyleItemCopyOf;
+typedef struct _xsltStyleItemCopyOf xsltStyleItemCopyOf;
 typedef xsltStyleItemCopyOf *xsltStyleItemCopyOfPtr;
 
+struct _xsltStyleItemCopyOf {
+    XSLT_ITEM_COMMON_FIELDS
+
+    const xmlChar *select;
+    xmlXPathCompExprPtr comp;
+    int moveVar; /* the select is the last use of a local fragment */
+};
+
 /**
  * xsltStyleItemValueOf:
  *
@@ -905,9 +987,17 @@ typedef xsltStyleItemFallback *xsltStyleItemFallbackPtr;
  *   <!-- Content: (xsl:sort*, template) -->
  * </xsl:for-each>
  */
-typedef xsltStyleBasicExpressionItem xsltStyleItemForEach;
+typedef struct _xsltStyleItemForEach xsltStyleItemForEach;
 typedef xsltStyleItemForEach *xsltStyleItemForEachPtr;
 
+struct _xsltStyleItemForEach {
+    XSLT_ITEM_COMMON_FIELDS
+
+    const xmlChar *select;
+    xmlXPathCompExprPtr comp;
+    int parallel;		/* libxslt:parallel */
+};
+
 /**
  * xsltStyleItemMessage:
  *
@@ -1416,6 +1506,10 @@ struct _xsltStylePreComp {
     xmlXPathCompExprPtr comp;	/* a precompiled XPath expression */
     xmlNsPtr *nsList;		/* the namespaces in scope */
     int nsNr;			/* the number of namespaces in scope */
+
+    int      moveVar;		/* copy-of: last use of a local fragment */
+
+    int      parallel;		/* libxslt:parallel */
 };
 
 #endif /* XSLT_REFACTORED */
@@ -1641,6 +1735,42 @@ struct _xsltStylesheet {
     int forwards_compatible;
 
     xmlHashTablePtr namedTemplates; /* hash table of named templates */
+
+    xmlHashTablePtr extFunctions; /* module functions of the namespaces
+				     used, see xsltPreResolveExtFunctions */
+    unsigned long extGeneration; /* registry generation of extFunctions */
+
+    xmlHashTablePtr xpathComps; /* compiled XPath expressions shared by
+				   the principal stylesheet and its imports,
+				   see xsltXPathCompileShared */
+    xsltPreCompArenaPtr preCompArena; /* storage of the precomputed data */
+
+    /*
+     * What xsltSetPruneDefault() pruned from the stylesheet and its imports.
+     */
+    int prunedTemplates;	/* template rules of modes never applied */
+    int prunedVariables;	/* global variables never referenced */
+    int prunedKeys;		/* keys never used */
+
+    /*
+     * The arguments of the document() calls known before a
+     * transformation starts, see xsltCollectDocumentURIs().
+     */
+    xmlHashTablePtr docURIs;	/* the URIs of string literals */
+    xmlHashTablePtr docVars;	/* the (name, namespace, base) of the
+				   variables passed to document() */
+
+    /*
+     * Whether the templates can run on concurrent transformation
+     * contexts, see the libxslt:parallel extension attribute.
+     */
+    int parallelSafe;
+
+    /*
+     * Whether the result only depends on the input, the parameters and
+     * the documents loaded, see xsltResultCacheKey().
+     */
+    int deterministic;
 };
 
 typedef struct _xsltTransformCache xsltTransformCache;
@@ -1650,14 +1780,28 @@ struct _xsltTransformCache {
     int nbRVT;
     xsltStackElemPtr stackItems;
     int nbStackItems;
-#ifdef XSLT_DEBUG_PROFILE_CACHE
-    int dbgCachedRVTs;
-    int dbgReusedRVTs;
-    int dbgCachedVars;
-    int dbgReusedVars;
-#endif
+    int maxRVT;			/* max number of cached tree fragments */
+    int maxStackItems;		/* max number of cached variables */
+    /* statistics, see xsltGetCtxtCacheStats() */
+    int newRVTs;
+    int reusedRVTs;
+    int cachedRVTs;
+    int freedRVTs;
+    int newVars;
+    int reusedVars;
+    int cachedVars;
+    int freedVars;
 };
 
+/**
+ * xsltDocPrefetch:
+ *
+ * Opaque set of documents parsed ahead of their use by document(),
+ * see xsltPrefetchStyleDocuments().
+ */
+typedef struct _xsltDocPrefetch xsltDocPrefetch;
+typedef xsltDocPrefetch *xsltDocPrefetchPtr;
+
 /*
  * The in-memory structure corresponding to an XSLT Transformation.
  */
@@ -1788,6 +1932,16 @@ struct _xsltTransformContext {
     int funcLevel;      /* Needed to catch recursive functions issues */
     int maxTemplateDepth;
     int maxTemplateVars;
+    xmlHashTablePtr templMemo; /* fragments of libxslt:memoize templates */
+    xmlDocPtr shareSource; /* input whose subtrees the result may share */
+    xmlDocPtr shareResult; /* the result sharing them, see xsltCopyOf */
+    xmlDictPtr inputDict; /* input dictionary resolving through the
+			     stylesheet one, see xsltParseInputFile */
+    xsltDocPrefetchPtr prefetch; /* documents parsed ahead of their use */
+    int parallelWorker; /* processes a part of a libxslt:parallel
+			   instruction for another context */
+    int parallelGlobals; /* 1 if the global variables can be shared with
+			    such contexts, -1 if not, 0 if not checked */
 };
 
 /**
@@ -1863,6 +2017,10 @@ XSLTPUBFUN void XSLTCALL
 						 xmlNodePtr cur);
 XSLTPUBFUN xsltStylesheetPtr XSLTCALL
 			xsltParseStylesheetDoc	(xmlDocPtr doc);
+XSLTPUBFUN void XSLTCALL
+			xsltSetPruneDefault	(int prune);
+XSLTPUBFUN int XSLTCALL
+			xsltGetPruneDefault	(void);
 XSLTPUBFUN xsltStylesheetPtr XSLTCALL
 			xsltParseStylesheetImportedDoc(xmlDocPtr doc,
 						xsltStylesheetPtr style);
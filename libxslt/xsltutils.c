@@ -26,6 +26,12 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
@@ -36,11 +42,15 @@
 #include <libxml/HTMLtree.h>
 #include <libxml/xmlerror.h>
 #include <libxml/xmlIO.h>
+#include <libxml/threads.h>
+#include <libxml/xmlsave.h>
+#include <libxml/uri.h>
 #include "xsltutils.h"
 #include "templates.h"
 #include "xsltInternals.h"
 #include "imports.h"
 #include "transform.h"
+#include "documents.h"
 
 /* gettimeofday on Windows ??? */
 #if defined(_WIN32) && !defined(__CYGWIN__)
@@ -51,6 +61,23 @@
 #endif /* _MS_VER */
 #endif /* WIN32 */
 
+#ifndef HAVE_STAT
+#  ifdef HAVE__STAT
+#    ifndef _MSC_VER
+#      define stat(x,y) _stat(x,y)
+#    endif
+#    define HAVE_STAT
+#  endif
+#endif
+
+#ifdef LIBXML_THREAD_ENABLED
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#elif defined(_WIN32) && !defined(__CYGWIN__)
+#include <windows.h>
+#endif
+#endif
+
 /************************************************************************
  *									*
  *			Convenience function				*
@@ -925,30 +952,67 @@ xsltGetQNameURI2(xsltStylesheetPtr style, xmlNodePtr node,
  * @list:  the node set
  *
  * reorder the current node list @list accordingly to the document order
- * This function is slow, obsolete and should not be used anymore.
+ * This function is obsolete, xsltCtxtDocumentSortFunction() uses the
+ * document order index of the transformation.
  */
 void
 xsltDocumentSortFunction(xmlNodeSetPtr list) {
-    int i, j;
-    int len, tst;
-    xmlNodePtr node;
+    xsltCtxtDocumentSortFunction(NULL, list);
+}
+
+/**
+ * xsltCtxtDocumentSortFunction:
+ * @ctxt:  an XSLT transformation context or NULL
+ * @list:  the node set
+ *
+ * Reorders @list in document order with a merge sort comparing the
+ * nodes with xsltCmpDocumentOrder(), which uses the document order
+ * index of the documents of @ctxt. Without a context the nodes are
+ * compared with xmlXPathCmpNodes().
+ */
+void
+xsltCtxtDocumentSortFunction(xsltTransformContextPtr ctxt,
+			     xmlNodeSetPtr list) {
+    xmlNodePtr *tmp, *from, *to, *swap;
+    int len, width, lo, mid, hi, i, j, k;
 
     if (list == NULL)
 	return;
     len = list->nodeNr;
     if (len <= 1)
 	return;
-    /* TODO: sort is really not optimized, does it needs to ? */
-    for (i = 0;i < len -1;i++) {
-	for (j = i + 1; j < len; j++) {
-	    tst = xmlXPathCmpNodes(list->nodeTab[i], list->nodeTab[j]);
-	    if (tst == -1) {
-		node = list->nodeTab[i];
-		list->nodeTab[i] = list->nodeTab[j];
-		list->nodeTab[j] = node;
+    tmp = (xmlNodePtr *) xmlMalloc(len * sizeof(xmlNodePtr));
+    if (tmp == NULL) {
+	xmlXPathNodeSetSort(list);
+	return;
+    }
+    from = list->nodeTab;
+    to = tmp;
+    for (width = 1; width < len; width *= 2) {
+	for (lo = 0; lo < len; lo += 2 * width) {
+	    mid = (lo + width < len) ? lo + width : len;
+	    hi = (mid + width < len) ? mid + width : len;
+	    i = lo;
+	    j = mid;
+	    k = lo;
+	    while ((i < mid) && (j < hi)) {
+		if (xsltCmpDocumentOrder(ctxt, from[j], from[i]) == 1)
+		    to[k++] = from[j++];
+		else
+		    to[k++] = from[i++];
 	    }
+	    while (i < mid)
+		to[k++] = from[i++];
+	    while (j < hi)
+		to[k++] = from[j++];
 	}
+	swap = from;
+	from = to;
+	to = swap;
     }
+    if (from != list->nodeTab)
+	memcpy(list->nodeTab, from, len * sizeof(xmlNodePtr));
+    xmlFree(tmp);
 }
 
 /**
@@ -1434,6 +1498,120 @@ xsltSetCtxtParseOptions(xsltTransformContextPtr ctxt, int options)
  *									*
  ************************************************************************/
 
+/**
+ * xsltSaveIndent:
+ * @buf:  an output buffer
+ * @level:  the indentation level
+ *
+ * Writes the indentation used by the libxml2 serializer at @level.
+ */
+static void
+xsltSaveIndent(xmlOutputBufferPtr buf, int level) {
+    int size = xmlStrlen((const xmlChar *) xmlTreeIndentString);
+    int max;
+
+    if (size <= 0)
+	return;
+    max = 60 / size;
+    if (level > max)
+	level = max;
+    while (level-- > 0)
+	xmlOutputBufferWrite(buf, size, xmlTreeIndentString);
+}
+
+/**
+ * xsltSaveSharedNode:
+ * @buf:  an output buffer
+ * @doc:  the result document
+ * @cur:  the node to save
+ * @level:  the indentation level
+ * @format:  whether to indent
+ * @encoding:  the output encoding or NULL
+ *
+ * Same as xmlNodeDumpOutput() for result documents sharing subtrees
+ * with the input document: elements with shared descendants are
+ * written here, the children of a shared element are written from
+ * the input node it stands for.
+ */
+static void
+xsltSaveSharedNode(xmlOutputBufferPtr buf, xmlDocPtr doc, xmlNodePtr cur,
+		   int level, int format, const char *encoding) {
+    xmlNodePtr child, children, last;
+    xmlDocPtr childDoc;
+    xmlBufferPtr tag;
+    int len;
+
+    if ((cur->type != XML_ELEMENT_NODE) || (cur->psvi == NULL)) {
+	xmlNodeDumpOutput(buf, doc, cur, level, format, encoding);
+	return;
+    }
+    if (XSLT_HAS_SHARED_NODES(cur)) {
+	children = cur->children;
+	childDoc = doc;
+    } else {
+	children = XSLT_SHARED_SOURCE(cur)->children;
+	childDoc = children->doc;
+    }
+
+    /*
+    * Let libxml2 write the start tag of the element without children.
+    */
+    tag = xmlBufferCreate();
+    if (tag == NULL)
+	return;
+    child = cur->children;
+    last = cur->last;
+    cur->children = NULL;
+    cur->last = NULL;
+    xmlNodeDump(tag, doc, cur, 0, 0);
+    cur->children = child;
+    cur->last = last;
+    len = xmlBufferLength(tag);
+    if (len >= 2)
+	xmlOutputBufferWrite(buf, len - 2,
+	                     (const char *) xmlBufferContent(tag));
+    xmlBufferFree(tag);
+    xmlOutputBufferWrite(buf, 1, ">");
+
+    if (format == 1) {
+	for (child = children; child != NULL; child = child->next) {
+	    if ((child->type == XML_TEXT_NODE) ||
+		(child->type == XML_CDATA_SECTION_NODE) ||
+		(child->type == XML_ENTITY_REF_NODE)) {
+		format = 0;
+		break;
+	    }
+	}
+    }
+    if (format == 1)
+	xmlOutputBufferWrite(buf, 1, "\n");
+    for (child = children; child != NULL; child = child->next) {
+	if ((format == 1) && (xmlIndentTreeOutput) &&
+	    ((child->type == XML_ELEMENT_NODE) ||
+	     (child->type == XML_COMMENT_NODE) ||
+	     (child->type == XML_PI_NODE)))
+	    xsltSaveIndent(buf, level + 1);
+	if (childDoc == doc)
+	    xsltSaveSharedNode(buf, doc, child, level + 1, format, encoding);
+	else
+	    xmlNodeDumpOutput(buf, childDoc, child, level + 1, format,
+	                      encoding);
+	if ((format == 1) && (child->type != XML_XINCLUDE_START) &&
+	    (child->type != XML_XINCLUDE_END))
+	    xmlOutputBufferWrite(buf, 1, "\n");
+    }
+    if ((format == 1) && (xmlIndentTreeOutput))
+	xsltSaveIndent(buf, level);
+
+    xmlOutputBufferWrite(buf, 2, "</");
+    if ((cur->ns != NULL) && (cur->ns->prefix != NULL)) {
+	xmlOutputBufferWriteString(buf, (const char *) cur->ns->prefix);
+	xmlOutputBufferWrite(buf, 1, ":");
+    }
+    xmlOutputBufferWriteString(buf, (const char *) cur->name);
+    xmlOutputBufferWrite(buf, 1, ">");
+}
+
 /**
  * xsltSaveResultTo:
  * @buf:  an output buffer
@@ -1583,8 +1761,12 @@ xsltSaveResultTo(xmlOutputBufferPtr buf, xmlDocPtr result,
 	    xmlNodePtr child = result->children;
 
 	    while (child != NULL) {
-		xmlNodeDumpOutput(buf, result, child, 0, (indent == 1),
-			          (const char *) encoding);
+		if (XSLT_DOC_HAS_SHARED_NODES(result))
+		    xsltSaveSharedNode(buf, result, child, 0, (indent == 1),
+				       (const char *) encoding);
+		else
+		    xmlNodeDumpOutput(buf, result, child, 0, (indent == 1),
+				      (const char *) encoding);
 		if (indent && ((child->type == XML_DTD_NODE) ||
 		    ((child->type == XML_COMMENT_NODE) &&
 		     (child->next != NULL))))
@@ -2047,6 +2229,21 @@ xsltSaveProfiling(xsltTransformContextPtr ctxt, FILE *output) {
     }
     fprintf(output, "\n%30s%26s %6d %6ld\n", "Total", "", total, totalt);
 
+    /* print memoization statistics */
+    for (i = 0, k = 0; i < nb; i++) {
+        templ1 = templates[i];
+        if (templ1->memoize == XSLT_MEMOIZE_NONE)
+            continue;
+        if (k++ == 0)
+            fprintf(output, "\n%6s%20s%20s%10s  Hits Misses\n",
+                    "number", "match", "name", "mode");
+        fprintf(output, "%5d %20s%20s%10s %6d %6d\n", i,
+                (templ1->match != NULL) ? (char *) templ1->match : "",
+                (templ1->name != NULL) ? (char *) templ1->name : "",
+                (templ1->mode != NULL) ? (char *) templ1->mode : "",
+                templ1->memoHits, templ1->memoMisses);
+    }
+
 
     /* print call graph */
 
@@ -2257,6 +2454,13 @@ xsltGetProfileInformation(xsltTransformContextPtr ctxt)
 
         sprintf(buf, "%ld", templates[i]->time / templates[i]->nbCalls);
         xmlSetProp(child, BAD_CAST "average", BAD_CAST buf);
+
+        if (templates[i]->memoize != XSLT_MEMOIZE_NONE) {
+            sprintf(buf, "%d", templates[i]->memoHits);
+            xmlSetProp(child, BAD_CAST "memoHits", BAD_CAST buf);
+            sprintf(buf, "%d", templates[i]->memoMisses);
+            xmlSetProp(child, BAD_CAST "memoMisses", BAD_CAST buf);
+        }
     };
 
     xmlFree(templates);
@@ -2264,6 +2468,1140 @@ xsltGetProfileInformation(xsltTransformContextPtr ctxt)
     return ret;
 }
 
+/************************************************************************
+ *									*
+ *			Transformation result cache			*
+ *									*
+ ************************************************************************/
+
+#define XSLT_RESULT_CACHE_MAGIC "XSLTRC3\n"
+#define XSLT_RESULT_CACHE_GEN "generation"
+
+/*
+ * A file read by document() during a cached transformation, the
+ * cached result is only valid as long as the file is unchanged.
+ */
+typedef struct _xsltResultCacheDep xsltResultCacheDep;
+typedef xsltResultCacheDep *xsltResultCacheDepPtr;
+struct _xsltResultCacheDep {
+    xmlChar *path;
+    long mtime;
+    long size;
+};
+
+typedef struct _xsltResultCacheEntry xsltResultCacheEntry;
+typedef xsltResultCacheEntry *xsltResultCacheEntryPtr;
+struct _xsltResultCacheEntry {
+    xmlChar *content;		/* the serialized result */
+    int len;
+    int nbDeps;
+    xsltResultCacheDepPtr deps;
+};
+
+struct _xsltResultCache {
+    xmlChar *directory;		/* the storage directory or NULL */
+    xmlHashTablePtr entries;	/* in memory storage */
+    xmlMutexPtr lock;
+    long hits;
+    long misses;
+    long stores;
+};
+
+static xsltResultCachePtr xsltDefaultResultCache = NULL;
+
+/*
+ * The key is the SHA-256 digest of the stylesheets, input and
+ * parameters in hexadecimal, it also names the entry of a directory
+ * cache. The data is hashed as it is serialized and isn't kept.
+ */
+#define XSLT_RESULT_CACHE_KEY_LEN 64
+
+typedef struct _xsltResultCacheHash xsltResultCacheHash;
+typedef xsltResultCacheHash *xsltResultCacheHashPtr;
+struct _xsltResultCacheHash {
+    unsigned long h[8];
+    unsigned long len;		/* the number of bytes hashed, modulo 2^32 */
+    unsigned long lenHigh;	/* the upper bits of the count */
+    unsigned char block[64];
+    int used;			/* the bytes pending in block */
+};
+
+static const unsigned long xsltSha256K[64] = {
+    0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
+    0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+    0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
+    0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+    0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+    0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+    0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
+    0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+    0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
+    0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+    0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
+    0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+    0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
+    0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+    0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+    0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+#define XSLT_ROTR32(x, n) \
+    ((((x) >> (n)) | ((x) << (32 - (n)))) & 0xFFFFFFFFUL)
+
+static void
+xsltResultCacheHashInit(xsltResultCacheHashPtr hash) {
+    hash->h[0] = 0x6a09e667UL;
+    hash->h[1] = 0xbb67ae85UL;
+    hash->h[2] = 0x3c6ef372UL;
+    hash->h[3] = 0xa54ff53aUL;
+    hash->h[4] = 0x510e527fUL;
+    hash->h[5] = 0x9b05688cUL;
+    hash->h[6] = 0x1f83d9abUL;
+    hash->h[7] = 0x5be0cd19UL;
+    hash->len = 0;
+    hash->lenHigh = 0;
+    hash->used = 0;
+}
+
+/*
+ * Processes the 64 bytes of hash->block
+ */
+static void
+xsltResultCacheHashBlock(xsltResultCacheHashPtr hash) {
+    unsigned long w[64], v[8], s0, s1, t1, t2;
+    const unsigned char *p = hash->block;
+    int i;
+
+    for (i = 0; i < 16; i++, p += 4)
+	w[i] = ((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16) |
+	       ((unsigned long) p[2] << 8) | (unsigned long) p[3];
+    for (i = 16; i < 64; i++) {
+	s0 = XSLT_ROTR32(w[i - 15], 7) ^ XSLT_ROTR32(w[i - 15], 18) ^
+	     (w[i - 15] >> 3);
+	s1 = XSLT_ROTR32(w[i - 2], 17) ^ XSLT_ROTR32(w[i - 2], 19) ^
+	     (w[i - 2] >> 10);
+	w[i] = (w[i - 16] + s0 + w[i - 7] + s1) & 0xFFFFFFFFUL;
+    }
+    for (i = 0; i < 8; i++)
+	v[i] = hash->h[i];
+    for (i = 0; i < 64; i++) {
+	s1 = XSLT_ROTR32(v[4], 6) ^ XSLT_ROTR32(v[4], 11) ^
+	     XSLT_ROTR32(v[4], 25);
+	t1 = (v[7] + s1 + ((v[4] & v[5]) ^ (~v[4] & v[6])) +
+	      xsltSha256K[i] + w[i]) & 0xFFFFFFFFUL;
+	s0 = XSLT_ROTR32(v[0], 2) ^ XSLT_ROTR32(v[0], 13) ^
+	     XSLT_ROTR32(v[0], 22);
+	t2 = (s0 + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]))) &
+	     0xFFFFFFFFUL;
+	v[7] = v[6];
+	v[6] = v[5];
+	v[5] = v[4];
+	v[4] = (v[3] + t1) & 0xFFFFFFFFUL;
+	v[3] = v[2];
+	v[2] = v[1];
+	v[1] = v[0];
+	v[0] = (t1 + t2) & 0xFFFFFFFFUL;
+    }
+    for (i = 0; i < 8; i++)
+	hash->h[i] = (hash->h[i] + v[i]) & 0xFFFFFFFFUL;
+}
+
+static int
+xsltResultCacheHashUpdate(void *context, const char *buffer, int len) {
+    xsltResultCacheHashPtr hash = (xsltResultCacheHashPtr) context;
+    int i;
+
+    if (len <= 0)
+	return(0);
+    hash->len = (hash->len + len) & 0xFFFFFFFFUL;
+    if (hash->len < (unsigned long) len)
+	hash->lenHigh++;
+    for (i = 0; i < len; i++) {
+	hash->block[hash->used++] = (unsigned char) buffer[i];
+	if (hash->used == 64) {
+	    xsltResultCacheHashBlock(hash);
+	    hash->used = 0;
+	}
+    }
+    return(len);
+}
+
+/*
+ * Pads the data and writes the digest to @out in hexadecimal
+ */
+static void
+xsltResultCacheHashFinal(xsltResultCacheHashPtr hash, char *out) {
+    unsigned long high = (hash->lenHigh << 3) | (hash->len >> 29);
+    unsigned long low = (hash->len << 3) & 0xFFFFFFFFUL;
+    int i;
+
+    hash->block[hash->used++] = 0x80;
+    if (hash->used > 56) {
+	memset(hash->block + hash->used, 0, 64 - hash->used);
+	xsltResultCacheHashBlock(hash);
+	hash->used = 0;
+    }
+    memset(hash->block + hash->used, 0, 56 - hash->used);
+    for (i = 0; i < 4; i++) {
+	hash->block[56 + i] = (unsigned char) (high >> (24 - 8 * i));
+	hash->block[60 + i] = (unsigned char) (low >> (24 - 8 * i));
+    }
+    xsltResultCacheHashBlock(hash);
+    for (i = 0; i < 8; i++)
+	snprintf(out + 8 * i, 9, "%08lx", hash->h[i]);
+}
+
+/*
+ * Strings are hashed with their length so that consecutive fields
+ * can't be confused.
+ */
+static void
+xsltResultCacheHashString(xsltResultCacheHashPtr hash, const xmlChar *str) {
+    char num[20];
+    int len = (str != NULL) ? xmlStrlen(str) : -1;
+
+    snprintf(num, sizeof(num), "%d:", len);
+    xsltResultCacheHashUpdate(hash, num, strlen(num));
+    if (len > 0)
+	xsltResultCacheHashUpdate(hash, (const char *) str, len);
+}
+
+static int
+xsltResultCacheHashClose(void *context ATTRIBUTE_UNUSED) {
+    return(0);
+}
+
+/*
+ * Hashes the serialization of @doc
+ */
+static int
+xsltResultCacheHashDoc(xsltResultCacheHashPtr hash, xmlDocPtr doc) {
+    xmlSaveCtxtPtr save;
+
+    xsltResultCacheHashString(hash, (doc != NULL) ? doc->URL : NULL);
+    if (doc == NULL)
+	return(0);
+    save = xmlSaveToIO(xsltResultCacheHashUpdate, xsltResultCacheHashClose,
+	               hash, NULL, 0);
+    if (save == NULL)
+	return(-1);
+    if (xmlSaveDoc(save, doc) < 0) {
+	xmlSaveClose(save);
+	return(-1);
+    }
+    return(xmlSaveClose(save) < 0 ? -1 : 0);
+}
+
+/*
+ * Hashes @style with its includes and imports. Returns 1 if the
+ * stylesheet produces secondary documents, in which case the results
+ * can't be cached, 0 if OK and -1 in case of error.
+ */
+static int
+xsltResultCacheHashStyle(xsltResultCacheHashPtr hash,
+	                 xsltStylesheetPtr style) {
+    xsltElemPreCompPtr comp;
+    xsltDocumentPtr incl;
+    int ret;
+
+    for (; style != NULL; style = style->next) {
+	for (comp = style->preComps; comp != NULL; comp = comp->next) {
+	    if (comp->type == XSLT_FUNC_DOCUMENT)
+		return(1);
+	}
+	if (xsltResultCacheHashDoc(hash, style->doc) < 0)
+	    return(-1);
+	for (incl = style->docList; incl != NULL; incl = incl->next) {
+	    if (xsltResultCacheHashDoc(hash, incl->doc) < 0)
+		return(-1);
+	}
+	ret = xsltResultCacheHashStyle(hash, style->imports);
+	if (ret != 0)
+	    return(ret);
+    }
+    return(0);
+}
+
+/*
+ * Returns the local path of @URL or NULL if it isn't a local file
+ */
+static char *
+xsltResultCachePath(const xmlChar *URL) {
+    if (URL == NULL)
+	return(NULL);
+    if (!xmlStrncasecmp(URL, BAD_CAST "file://localhost/", 17))
+	URL += 16;
+    else if (!xmlStrncasecmp(URL, BAD_CAST "file:///", 8))
+	URL += 7;
+    else if (xmlStrstr(URL, BAD_CAST "://") != NULL)
+	return(NULL);
+    return(xmlURIUnescapeString((const char *) URL, 0, NULL));
+}
+
+/*
+ * Fills @dep with the state of @path, returns 0 or -1 if the file
+ * can't be checked.
+ */
+static int
+xsltResultCacheStat(const char *path, xsltResultCacheDepPtr dep) {
+#ifdef HAVE_STAT
+    struct stat info;
+
+    if (stat(path, &info) != 0)
+	return(-1);
+    dep->mtime = (long) info.st_mtime;
+    dep->size = (long) info.st_size;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/*
+ * Returns 1 if none of the files the entry depends on changed
+ */
+static int
+xsltResultCacheDepsValid(xsltResultCacheEntryPtr entry) {
+    xsltResultCacheDep cur;
+    int i;
+
+    for (i = 0; i < entry->nbDeps; i++) {
+	if (xsltResultCacheStat((const char *) entry->deps[i].path, &cur) < 0)
+	    return(0);
+	if ((cur.mtime != entry->deps[i].mtime) ||
+	    (cur.size != entry->deps[i].size))
+	    return(0);
+    }
+    return(1);
+}
+
+static void
+xsltFreeResultCacheEntry(void *payload,
+	                 xmlChar *name ATTRIBUTE_UNUSED) {
+    xsltResultCacheEntryPtr entry = (xsltResultCacheEntryPtr) payload;
+    int i;
+
+    if (entry == NULL)
+	return;
+    if (entry->content != NULL)
+	xmlFree(entry->content);
+    for (i = 0; i < entry->nbDeps; i++)
+	xmlFree(entry->deps[i].path);
+    if (entry->deps != NULL)
+	xmlFree(entry->deps);
+    xmlFree(entry);
+}
+
+/*
+ * Returns the allocated name of the file holding @key, or of the
+ * generation file if @key is NULL
+ */
+static char *
+xsltResultCacheFile(xsltResultCachePtr cache, const xmlChar *key) {
+    xmlChar *ret;
+
+    int i;
+
+    if (key != NULL) {
+	for (i = 0; i < XSLT_RESULT_CACHE_KEY_LEN; i++) {
+	    if (((key[i] < '0') || (key[i] > '9')) &&
+	        ((key[i] < 'a') || (key[i] > 'f')))
+		return(NULL);
+	}
+	if (key[i] != 0)
+	    return(NULL);
+    }
+    ret = xmlStrdup(cache->directory);
+    ret = xmlStrcat(ret, BAD_CAST "/");
+    if (key == NULL)
+	return((char *) xmlStrcat(ret, BAD_CAST XSLT_RESULT_CACHE_GEN));
+    ret = xmlStrcat(ret, key);
+    return((char *) xmlStrcat(ret, BAD_CAST ".xrc"));
+}
+
+/*
+ * Returns the generation of a directory cache, bumped on clear
+ */
+static long
+xsltResultCacheGeneration(xsltResultCachePtr cache) {
+    char *name;
+    FILE *f;
+    long gen = 0;
+
+    name = xsltResultCacheFile(cache, NULL);
+    if (name == NULL)
+	return(0);
+    f = fopen(name, "r");
+    if (f != NULL) {
+	if (fscanf(f, "%ld", &gen) != 1)
+	    gen = 0;
+	fclose(f);
+    }
+    xmlFree(name);
+    return(gen);
+}
+
+/*
+ * Reads the entry for @key from a cache file, returns NULL if missing,
+ * invalid or stored for another key
+ */
+static xsltResultCacheEntryPtr
+xsltResultCacheReadFile(const char *name, const xmlChar *key) {
+    xsltResultCacheEntryPtr entry = NULL;
+    char magic[sizeof(XSLT_RESULT_CACHE_MAGIC)];
+    char buf[XSLT_RESULT_CACHE_KEY_LEN + 1];
+    FILE *f;
+    int i, len;
+
+    f = fopen(name, "rb");
+    if (f == NULL)
+	return(NULL);
+    if ((fread(magic, 1, sizeof(magic) - 1, f) != sizeof(magic) - 1) ||
+        (memcmp(magic, XSLT_RESULT_CACHE_MAGIC, sizeof(magic) - 1)))
+	goto error;
+    if ((fread(buf, 1, sizeof(buf), f) != sizeof(buf)) ||
+        (memcmp(buf, key, XSLT_RESULT_CACHE_KEY_LEN)) ||
+	(buf[XSLT_RESULT_CACHE_KEY_LEN] != '\n'))
+	goto error;
+    entry = (xsltResultCacheEntryPtr) xmlMalloc(sizeof(*entry));
+    if (entry == NULL)
+	goto error;
+    memset(entry, 0, sizeof(*entry));
+    if ((fscanf(f, "%d\n", &entry->nbDeps) != 1) || (entry->nbDeps < 0) ||
+        (entry->nbDeps > 100000)) {
+	entry->nbDeps = 0;
+	goto error;
+    }
+    if (entry->nbDeps > 0) {
+	entry->deps = (xsltResultCacheDepPtr)
+	    xmlMalloc(entry->nbDeps * sizeof(xsltResultCacheDep));
+	if (entry->deps == NULL) {
+	    entry->nbDeps = 0;
+	    goto error;
+	}
+	memset(entry->deps, 0, entry->nbDeps * sizeof(xsltResultCacheDep));
+    }
+    for (i = 0; i < entry->nbDeps; i++) {
+	if ((fscanf(f, "%ld %ld %d ", &entry->deps[i].mtime,
+	            &entry->deps[i].size, &len) != 3) ||
+	    (len <= 0) || (len > 100000))
+	    goto error;
+	entry->deps[i].path = (xmlChar *) xmlMalloc(len + 1);
+	if (entry->deps[i].path == NULL)
+	    goto error;
+	if (fread(entry->deps[i].path, 1, len, f) != (size_t) len)
+	    goto error;
+	entry->deps[i].path[len] = 0;
+    }
+    if ((fscanf(f, "\n%d\n", &entry->len) != 1) || (entry->len < 0))
+	goto error;
+    entry->content = (xmlChar *) xmlMalloc(entry->len + 1);
+    if (entry->content == NULL)
+	goto error;
+    if (fread(entry->content, 1, entry->len, f) != (size_t) entry->len)
+	goto error;
+    entry->content[entry->len] = 0;
+    fclose(f);
+    return(entry);
+
+error:
+    xsltFreeResultCacheEntry(entry, NULL);
+    fclose(f);
+    return(NULL);
+}
+
+/*
+ * Writes the entry for @key to a cache file, going through a temporary
+ * file so that readers never see a partial entry
+ */
+static int
+xsltResultCacheWriteFile(const char *name, const xmlChar *key,
+	                 xsltResultCacheEntryPtr entry) {
+    xmlChar *tmp;
+    FILE *f;
+    int i, ret = -1;
+
+    tmp = xmlStrdup(BAD_CAST name);
+    tmp = xmlStrcat(tmp, BAD_CAST ".tmp");
+    if (tmp == NULL)
+	return(-1);
+    f = fopen((const char *) tmp, "wb");
+    if (f == NULL)
+	goto done;
+    fputs(XSLT_RESULT_CACHE_MAGIC, f);
+    fprintf(f, "%s\n%d\n", (const char *) key, entry->nbDeps);
+    for (i = 0; i < entry->nbDeps; i++)
+	fprintf(f, "%ld %ld %d %s\n", entry->deps[i].mtime,
+		entry->deps[i].size, xmlStrlen(entry->deps[i].path),
+		(const char *) entry->deps[i].path);
+    fprintf(f, "%d\n", entry->len);
+    if (entry->len > 0)
+	fwrite(entry->content, 1, entry->len, f);
+    if ((ferror(f)) || (fclose(f) != 0)) {
+	remove((const char *) tmp);
+	goto done;
+    }
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    remove(name);
+#endif
+    if (rename((const char *) tmp, name) != 0) {
+	remove((const char *) tmp);
+	goto done;
+    }
+    ret = 0;
+done:
+    xmlFree(tmp);
+    return(ret);
+}
+
+/**
+ * xsltNewResultCache:
+ * @directory:  a directory to store the results in, or NULL
+ *
+ * Create a cache of transformation results. The results are kept in
+ * memory, or in @directory if given so that they can be shared between
+ * processes. See xsltSetResultCache() and xsltRunStylesheetUser().
+ *
+ * Returns the new cache or NULL in case of error
+ */
+xsltResultCachePtr
+xsltNewResultCache(const char *directory) {
+    xsltResultCachePtr cache;
+
+    cache = (xsltResultCachePtr) xmlMalloc(sizeof(xsltResultCache));
+    if (cache == NULL) {
+	xsltTransformError(NULL, NULL, NULL,
+		"xsltNewResultCache : malloc failed\n");
+	return(NULL);
+    }
+    memset(cache, 0, sizeof(xsltResultCache));
+    if (directory != NULL) {
+	cache->directory = xmlStrdup(BAD_CAST directory);
+	if (cache->directory == NULL)
+	    goto error;
+    } else {
+	cache->entries = xmlHashCreate(0);
+	if (cache->entries == NULL)
+	    goto error;
+    }
+    cache->lock = xmlNewMutex();
+    if (cache->lock == NULL)
+	goto error;
+    return(cache);
+
+error:
+    xsltTransformError(NULL, NULL, NULL,
+	    "xsltNewResultCache : allocation failed\n");
+    xsltFreeResultCache(cache);
+    return(NULL);
+}
+
+/**
+ * xsltFreeResultCache:
+ * @cache:  a result cache
+ *
+ * Free up the memory used by @cache, the files of a directory cache
+ * are kept.
+ */
+void
+xsltFreeResultCache(xsltResultCachePtr cache) {
+    if (cache == NULL)
+	return;
+    if (xsltDefaultResultCache == cache)
+	xsltDefaultResultCache = NULL;
+    if (cache->entries != NULL)
+	xmlHashFree(cache->entries,
+		    (xmlHashDeallocator) xsltFreeResultCacheEntry);
+    if (cache->directory != NULL)
+	xmlFree(cache->directory);
+    if (cache->lock != NULL)
+	xmlFreeMutex(cache->lock);
+    xmlFree(cache);
+}
+
+/**
+ * xsltResultCacheClear:
+ * @cache:  a result cache
+ *
+ * Invalidates all the entries of @cache. For a directory cache the
+ * generation number mixed in the keys is incremented, making the
+ * existing files unreachable.
+ *
+ * Returns 0 in case of success and -1 in case of error
+ */
+int
+xsltResultCacheClear(xsltResultCachePtr cache) {
+    int ret = 0;
+
+    if (cache == NULL)
+	return(-1);
+    xmlMutexLock(cache->lock);
+    if (cache->entries != NULL) {
+	xmlHashFree(cache->entries,
+		    (xmlHashDeallocator) xsltFreeResultCacheEntry);
+	cache->entries = xmlHashCreate(0);
+	if (cache->entries == NULL)
+	    ret = -1;
+    } else {
+	char *name = xsltResultCacheFile(cache, NULL);
+	long gen = xsltResultCacheGeneration(cache);
+	FILE *f;
+
+	ret = -1;
+	if (name != NULL) {
+	    f = fopen(name, "w");
+	    if (f != NULL) {
+		fprintf(f, "%ld\n", gen + 1);
+		if (fclose(f) == 0)
+		    ret = 0;
+	    }
+	    xmlFree(name);
+	}
+    }
+    xmlMutexUnlock(cache->lock);
+    return(ret);
+}
+
+/**
+ * xsltResultCacheGetStats:
+ * @cache:  a result cache
+ * @hits:  where to store the number of lookups that found a result
+ * @misses:  where to store the number of lookups that didn't
+ * @stores:  where to store the number of results added
+ *
+ * Reports the use of @cache since its creation, any of the
+ * pointers can be NULL.
+ */
+void
+xsltResultCacheGetStats(xsltResultCachePtr cache, long *hits,
+	                long *misses, long *stores) {
+    if (cache == NULL)
+	return;
+    xmlMutexLock(cache->lock);
+    if (hits != NULL)
+	*hits = cache->hits;
+    if (misses != NULL)
+	*misses = cache->misses;
+    if (stores != NULL)
+	*stores = cache->stores;
+    xmlMutexUnlock(cache->lock);
+}
+
+/**
+ * xsltSetResultCache:
+ * @cache:  a result cache or NULL
+ *
+ * Sets the cache used by xsltRunStylesheetUser() and
+ * xsltRunStylesheet(), NULL disables caching (the default).
+ *
+ * Returns the previous cache
+ */
+xsltResultCachePtr
+xsltSetResultCache(xsltResultCachePtr cache) {
+    xsltResultCachePtr ret = xsltDefaultResultCache;
+
+    xsltDefaultResultCache = cache;
+    return(ret);
+}
+
+/**
+ * xsltGetResultCache:
+ *
+ * Returns the cache used by xsltRunStylesheetUser() or NULL
+ */
+xsltResultCachePtr
+xsltGetResultCache(void) {
+    return(xsltDefaultResultCache);
+}
+
+/**
+ * xsltResultCacheKey:
+ * @cache:  a result cache
+ * @style:  a parsed XSLT stylesheet
+ * @doc:  a parsed XML document
+ * @params:  a NULL terminated array of parameters names/values tuples
+ *
+ * Computes the cache key of the transformation of @doc by @style: the
+ * SHA-256 digest of the serialized stylesheet modules, input and
+ * parameters, in hexadecimal.
+ *
+ * Stylesheets whose result doesn't only depend on those and on the
+ * documents they load aren't cached: the ones calling generate-id(),
+ * extension functions like date:date-time() or math:random(), or with
+ * side effects like xsl:message which a cached result wouldn't
+ * reproduce.
+ *
+ * Returns the allocated key or NULL if the transformation can't be
+ *         cached or in case of error
+ */
+xmlChar *
+xsltResultCacheKey(xsltResultCachePtr cache, xsltStylesheetPtr style,
+	           xmlDocPtr doc, const char **params) {
+    xsltResultCacheHash hash;
+    char key[XSLT_RESULT_CACHE_KEY_LEN + 1];
+    int i;
+
+    if ((cache == NULL) || (style == NULL) || (doc == NULL) ||
+        (!style->deterministic))
+	return(NULL);
+    xsltResultCacheHashInit(&hash);
+    if (cache->directory != NULL) {
+	snprintf(key, sizeof(key), "%ld",
+		 xsltResultCacheGeneration(cache));
+	xsltResultCacheHashString(&hash, BAD_CAST key);
+    }
+    if (xsltResultCacheHashStyle(&hash, style) != 0)
+	return(NULL);
+    if (xsltResultCacheHashDoc(&hash, doc) < 0)
+	return(NULL);
+    if (params != NULL) {
+	for (i = 0; params[i] != NULL; i++)
+	    xsltResultCacheHashString(&hash, BAD_CAST params[i]);
+    }
+    xsltResultCacheHashFinal(&hash, key);
+    return(xmlStrdup(BAD_CAST key));
+}
+
+/**
+ * xsltResultCacheLookup:
+ * @cache:  a result cache
+ * @key:  a key computed by xsltResultCacheKey()
+ * @content:  where to store the allocated serialized result
+ * @len:  where to store its length
+ *
+ * Looks up a result stored for @key, entries depending
+ * on a file which changed since they were stored are dropped.
+ *
+ * Returns 1 if found, 0 if not and -1 in case of error
+ */
+int
+xsltResultCacheLookup(xsltResultCachePtr cache, const xmlChar *key,
+	              xmlChar **content, int *len) {
+    xsltResultCacheEntryPtr entry;
+    int ret = 0;
+
+    if ((cache == NULL) || (key == NULL) || (content == NULL) ||
+        (len == NULL))
+	return(-1);
+    *content = NULL;
+    *len = 0;
+    if (cache->directory != NULL) {
+	char *name = xsltResultCacheFile(cache, key);
+
+	if (name == NULL)
+	    return(-1);
+	entry = xsltResultCacheReadFile(name, key);
+	if ((entry != NULL) && (xsltResultCacheDepsValid(entry))) {
+	    *content = entry->content;
+	    *len = entry->len;
+	    entry->content = NULL;
+	    ret = 1;
+	}
+	xsltFreeResultCacheEntry(entry, NULL);
+	xmlFree(name);
+	xmlMutexLock(cache->lock);
+    } else {
+	xmlMutexLock(cache->lock);
+	entry = (xsltResultCacheEntryPtr) xmlHashLookup(cache->entries, key);
+	if (entry != NULL) {
+	    if (xsltResultCacheDepsValid(entry)) {
+		*content = xmlStrndup(entry->content, entry->len);
+		if (*content == NULL)
+		    ret = -1;
+		else {
+		    *len = entry->len;
+		    ret = 1;
+		}
+	    } else {
+		xmlHashRemoveEntry(cache->entries, key,
+			(xmlHashDeallocator) xsltFreeResultCacheEntry);
+	    }
+	}
+    }
+    if (ret == 1)
+	cache->hits++;
+    else
+	cache->misses++;
+    xmlMutexUnlock(cache->lock);
+    return(ret);
+}
+
+/**
+ * xsltResultCacheStore:
+ * @cache:  a result cache
+ * @key:  a key computed by xsltResultCacheKey()
+ * @ctxt:  the context of the transformation which produced the result
+ * @content:  the serialized result
+ * @len:  the length of @content
+ *
+ * Adds a result to @cache. The documents loaded by the transformation
+ * are recorded so that the entry is dropped once one of them changes,
+ * results depending on non local resources aren't stored.
+ *
+ * Returns 1 if stored, 0 if the result can't be cached and -1 in case
+ *         of error
+ */
+int
+xsltResultCacheStore(xsltResultCachePtr cache, const xmlChar *key,
+	             xsltTransformContextPtr ctxt, const xmlChar *content,
+		     int len) {
+    xsltResultCacheEntryPtr entry;
+    xsltDocumentPtr cur;
+    int nbDeps = 0, ret = -1;
+
+    if ((cache == NULL) || (key == NULL) || (ctxt == NULL) || (len < 0) ||
+        ((content == NULL) && (len > 0)))
+	return(-1);
+
+    entry = (xsltResultCacheEntryPtr) xmlMalloc(sizeof(*entry));
+    if (entry == NULL)
+	return(-1);
+    memset(entry, 0, sizeof(*entry));
+    /*
+     * The input itself is part of the key
+     */
+    for (cur = ctxt->docList; cur != NULL; cur = cur->next) {
+	if (!cur->main)
+	    nbDeps++;
+    }
+    if (nbDeps > 0) {
+	entry->deps = (xsltResultCacheDepPtr)
+	    xmlMalloc(nbDeps * sizeof(xsltResultCacheDep));
+	if (entry->deps == NULL)
+	    goto done;
+    }
+    for (cur = ctxt->docList; cur != NULL; cur = cur->next) {
+	xsltResultCacheDepPtr dep;
+	char *path;
+
+	if (cur->main)
+	    continue;
+	dep = &entry->deps[entry->nbDeps];
+	path = xsltResultCachePath((cur->doc != NULL) ? cur->doc->URL : NULL);
+	if (path == NULL) {
+	    ret = 0;
+	    goto done;
+	}
+	if (xsltResultCacheStat(path, dep) < 0) {
+	    xmlFree(path);
+	    ret = 0;
+	    goto done;
+	}
+	dep->path = BAD_CAST path;
+	entry->nbDeps++;
+    }
+    entry->content = xmlStrndup((content != NULL) ? content : BAD_CAST "",
+	                        len);
+    if (entry->content == NULL)
+	goto done;
+    entry->len = len;
+
+    if (cache->directory != NULL) {
+	char *name = xsltResultCacheFile(cache, key);
+
+	if (name == NULL)
+	    goto done;
+	ret = (xsltResultCacheWriteFile(name, key, entry) < 0) ? -1 : 1;
+	xmlFree(name);
+	xmlMutexLock(cache->lock);
+    } else {
+	xmlMutexLock(cache->lock);
+	if (xmlHashUpdateEntry(cache->entries, key, entry,
+		(xmlHashDeallocator) xsltFreeResultCacheEntry) == 0) {
+	    entry = NULL;
+	    ret = 1;
+	}
+    }
+    if (ret == 1)
+	cache->stores++;
+    xmlMutexUnlock(cache->lock);
+
+done:
+    xsltFreeResultCacheEntry(entry, NULL);
+    return(ret);
+}
+
+/************************************************************************
+ *									*
+ *			Running tasks in parallel			*
+ *									*
+ ************************************************************************/
+
+#if defined(LIBXML_THREAD_ENABLED) && \
+    (defined(HAVE_PTHREAD_H) || (defined(_WIN32) && !defined(__CYGWIN__)))
+#define XSLT_PARALLEL_ENABLED
+#endif
+
+struct _xsltParallelTasks {
+    xsltParallelFunc func;
+    void *data;
+    int nbTasks;
+    int next;			/* the next task to hand out */
+#ifdef XSLT_PARALLEL_ENABLED
+    xmlMutexPtr lock;
+#ifdef HAVE_PTHREAD_H
+    pthread_t *tids;
+#else
+    HANDLE *tids;
+#endif
+    int nbStarted;		/* the number of threads started */
+#endif
+};
+
+#ifdef XSLT_PARALLEL_ENABLED
+/**
+ * xsltParallelWorker:
+ * @tasks:  the tasks to run
+ *
+ * Runs tasks until none is left.
+ */
+static void
+xsltParallelWorker(xsltParallelTasksPtr tasks) {
+    int i;
+
+    while (1) {
+	xmlMutexLock(tasks->lock);
+	i = tasks->next;
+	if (i < tasks->nbTasks)
+	    tasks->next++;
+	xmlMutexUnlock(tasks->lock);
+	if (i >= tasks->nbTasks)
+	    break;
+	tasks->func(tasks->data, i);
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *
+xsltParallelThread(void *arg) {
+    xsltParallelWorker((xsltParallelTasksPtr) arg);
+    return(NULL);
+}
+#else
+static DWORD WINAPI
+xsltParallelThread(LPVOID arg) {
+    xsltParallelWorker((xsltParallelTasksPtr) arg);
+    return(0);
+}
+#endif
+
+/**
+ * xsltParallelStartThreads:
+ * @tasks:  the tasks to run
+ * @nbThreads:  the number of threads to start
+ *
+ * Starts up to @nbThreads threads running @tasks. The lock must have
+ * been created.
+ *
+ * Returns the number of threads started
+ */
+static int
+xsltParallelStartThreads(xsltParallelTasksPtr tasks, int nbThreads) {
+    int i;
+
+    tasks->nbStarted = 0;
+    if (nbThreads <= 0)
+	return(0);
+    tasks->tids = xmlMalloc(nbThreads * sizeof(tasks->tids[0]));
+    if (tasks->tids == NULL)
+	return(0);
+    for (i = 0; i < nbThreads; i++) {
+#ifdef HAVE_PTHREAD_H
+	if (pthread_create(&tasks->tids[i], NULL, xsltParallelThread,
+			   tasks) != 0)
+	    break;
+#else
+	tasks->tids[i] = CreateThread(NULL, 0, xsltParallelThread, tasks,
+				      0, NULL);
+	if (tasks->tids[i] == NULL)
+	    break;
+#endif
+	tasks->nbStarted++;
+    }
+    return(tasks->nbStarted);
+}
+
+/**
+ * xsltParallelJoinThreads:
+ * @tasks:  the tasks being run
+ *
+ * Waits for the threads started by xsltParallelStartThreads().
+ */
+static void
+xsltParallelJoinThreads(xsltParallelTasksPtr tasks) {
+    int i;
+
+    for (i = 0; i < tasks->nbStarted; i++) {
+#ifdef HAVE_PTHREAD_H
+	pthread_join(tasks->tids[i], NULL);
+#else
+	WaitForSingleObject(tasks->tids[i], INFINITE);
+	CloseHandle(tasks->tids[i]);
+#endif
+    }
+    if (tasks->tids != NULL)
+	xmlFree(tasks->tids);
+    tasks->tids = NULL;
+    tasks->nbStarted = 0;
+}
+#endif /* XSLT_PARALLEL_ENABLED */
+
+/**
+ * xsltGetThreadCount:
+ *
+ * Returns the number of threads used when no explicit count is
+ * given to xsltRunParallel(): the number of online processors, or 1
+ * if tasks can't be run in parallel.
+ */
+int
+xsltGetThreadCount(void) {
+#ifdef XSLT_PARALLEL_ENABLED
+#ifdef HAVE_PTHREAD_H
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > 0)
+	return((n > 64) ? 64 : (int) n);
+#endif
+#else
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    if (info.dwNumberOfProcessors > 0)
+	return((info.dwNumberOfProcessors > 64) ? 64 :
+	       (int) info.dwNumberOfProcessors);
+#endif
+#endif /* XSLT_PARALLEL_ENABLED */
+    return(1);
+}
+
+/**
+ * xsltRunParallel:
+ * @nbTasks:  the number of tasks
+ * @nbThreads:  the maximum number of threads, 0 for xsltGetThreadCount()
+ * @func:  the function running a task
+ * @data:  user data passed to @func
+ *
+ * Calls @func once for each task index in [0, @nbTasks[ spreading the
+ * calls over up to @nbThreads threads, the calling thread being one of
+ * them, and returns once all the tasks are done. If threads can't be
+ * created the remaining tasks are run by the calling thread, so all
+ * tasks are always run. libxml2 must have been initialized with
+ * xmlInitParser() beforehand.
+ *
+ * Returns the number of threads used, or -1 in case of error
+ */
+int
+xsltRunParallel(int nbTasks, int nbThreads, xsltParallelFunc func,
+	        void *data) {
+#ifdef XSLT_PARALLEL_ENABLED
+    xsltParallelTasks tasks;
+    int nbStarted;
+#endif
+    int i;
+
+    if ((nbTasks < 0) || (func == NULL))
+	return(-1);
+    if (nbThreads <= 0)
+	nbThreads = xsltGetThreadCount();
+    if (nbThreads > nbTasks)
+	nbThreads = nbTasks;
+
+#ifdef XSLT_PARALLEL_ENABLED
+    if (nbThreads > 1) {
+	memset(&tasks, 0, sizeof(tasks));
+	tasks.func = func;
+	tasks.data = data;
+	tasks.nbTasks = nbTasks;
+	tasks.lock = xmlNewMutex();
+	if (tasks.lock == NULL)
+	    goto serial;
+	xsltParallelStartThreads(&tasks, nbThreads - 1);
+	xsltParallelWorker(&tasks);
+	nbStarted = tasks.nbStarted;
+	xsltParallelJoinThreads(&tasks);
+	xmlFreeMutex(tasks.lock);
+	return(nbStarted + 1);
+    }
+serial:
+#endif /* XSLT_PARALLEL_ENABLED */
+    for (i = 0; i < nbTasks; i++)
+	func(data, i);
+    return(1);
+}
+
+/**
+ * xsltStartParallel:
+ * @nbTasks:  the number of tasks
+ * @nbThreads:  the maximum number of threads, 0 for xsltGetThreadCount()
+ * @func:  the function running a task
+ * @data:  user data passed to @func
+ *
+ * Like xsltRunParallel() but returns as soon as the threads are
+ * started, the calling thread being free to do something else until
+ * it calls xsltWaitParallel(). Nothing is run if no thread can be
+ * created. libxml2 must have been initialized with xmlInitParser()
+ * beforehand.
+ *
+ * Returns the handle to give to xsltWaitParallel(), or NULL if the
+ *         tasks can't be run in the background.
+ */
+xsltParallelTasksPtr
+xsltStartParallel(int nbTasks, int nbThreads, xsltParallelFunc func,
+		  void *data) {
+#ifdef XSLT_PARALLEL_ENABLED
+    xsltParallelTasksPtr tasks;
+
+    if ((nbTasks <= 0) || (func == NULL))
+	return(NULL);
+    if (nbThreads <= 0)
+	nbThreads = xsltGetThreadCount();
+    if (nbThreads > nbTasks)
+	nbThreads = nbTasks;
+
+    tasks = (xsltParallelTasksPtr) xmlMalloc(sizeof(xsltParallelTasks));
+    if (tasks == NULL)
+	return(NULL);
+    memset(tasks, 0, sizeof(xsltParallelTasks));
+    tasks->func = func;
+    tasks->data = data;
+    tasks->nbTasks = nbTasks;
+    tasks->lock = xmlNewMutex();
+    if (tasks->lock == NULL) {
+	xmlFree(tasks);
+	return(NULL);
+    }
+    if (xsltParallelStartThreads(tasks, nbThreads) == 0) {
+	xsltParallelJoinThreads(tasks);
+	xmlFreeMutex(tasks->lock);
+	xmlFree(tasks);
+	return(NULL);
+    }
+    return(tasks);
+#else
+    return(NULL);
+#endif /* XSLT_PARALLEL_ENABLED */
+}
+
+/**
+ * xsltWaitParallel:
+ * @tasks:  the handle returned by xsltStartParallel()
+ *
+ * Runs the tasks not handed out yet from the calling thread, waits
+ * for all the tasks to be done and frees @tasks.
+ */
+void
+xsltWaitParallel(xsltParallelTasksPtr tasks) {
+    if (tasks == NULL)
+	return;
+#ifdef XSLT_PARALLEL_ENABLED
+    xsltParallelWorker(tasks);
+    xsltParallelJoinThreads(tasks);
+    xmlFreeMutex(tasks->lock);
+#endif
+    xmlFree(tasks);
+}
+
 /************************************************************************
  *									*
  *		Hooks for libxml2 XPath					*
@@ -2351,6 +3689,168 @@ xsltXPathCompile(xsltStylesheetPtr style, const xmlChar *str) {
     return(xsltXPathCompileFlags(style, str, 0));
 }
 
+#define XSLT_IS_PREFIX_CHAR(c)						\
+    ((((c) >= 'a') && ((c) <= 'z')) || (((c) >= 'A') && ((c) <= 'Z')) || \
+     (((c) >= '0') && ((c) <= '9')) || ((c) == '_') || ((c) == '-') ||	\
+     ((c) == '.') || ((c) >= 0x80))
+
+/**
+ * xsltXPathPrefixKey:
+ * @str:  the XPath expression
+ * @inst:  the instruction the expression was found on, or NULL
+ * @key:  where to store the namespace key
+ *
+ * Builds the part of the sharing key which depends on the namespace
+ * context of @inst: the "prefix=URI;" bindings of every prefix used
+ * in @str. Unprefixed expressions get a NULL key as they compile to
+ * the same thing everywhere.
+ *
+ * Returns 0 in case of success, 1 if @str uses prefixes but @inst is
+ *         NULL, and -1 in case of error.
+ */
+static int
+xsltXPathPrefixKey(const xmlChar *str, xmlNodePtr inst, xmlChar **key) {
+    const xmlChar *cur, *start;
+    xmlChar quote = 0;
+    xmlChar *prefix;
+    xmlNsPtr ns;
+
+    *key = NULL;
+    for (cur = str; *cur != 0; cur++) {
+	if (quote != 0) {
+	    if (*cur == quote)
+		quote = 0;
+	    continue;
+	}
+	if ((*cur == '"') || (*cur == '\'')) {
+	    quote = *cur;
+	    continue;
+	}
+	if (*cur != ':')
+	    continue;
+	if (cur[1] == ':') {
+	    /* an axis specifier */
+	    cur++;
+	    continue;
+	}
+	start = cur;
+	while ((start > str) && (XSLT_IS_PREFIX_CHAR(start[-1])))
+	    start--;
+	if (start == cur)
+	    continue;
+	if (inst == NULL) {
+	    if (*key != NULL) {
+		xmlFree(*key);
+		*key = NULL;
+	    }
+	    return(1);
+	}
+	prefix = xmlStrndup(start, cur - start);
+	if (prefix == NULL)
+	    goto error;
+	ns = xmlSearchNs(inst->doc, inst, prefix);
+	*key = xmlStrcat(*key, prefix);
+	*key = xmlStrcat(*key, BAD_CAST "=");
+	if (ns != NULL)
+	    *key = xmlStrcat(*key, ns->href);
+	*key = xmlStrcat(*key, BAD_CAST ";");
+	xmlFree(prefix);
+	if (*key == NULL)
+	    goto error;
+    }
+    return(0);
+
+error:
+    if (*key != NULL) {
+	xmlFree(*key);
+	*key = NULL;
+    }
+    return(-1);
+}
+
+/**
+ * xsltXPathCompileShared:
+ * @style: the stylesheet
+ * @str:  the XPath expression
+ * @flags: extra compilation flags to pass down to libxml2 XPath
+ * @inst:  the instruction holding the expression, used for its
+ *         namespace context
+ *
+ * Compile an XPath expression, reusing an earlier compilation of the
+ * same expression with the same @flags and the same prefix bindings
+ * anywhere in the principal stylesheet and its imports. The bindings
+ * are part of the key since libxml2 caches the resolution of prefixed
+ * function calls in the compiled expression.
+ *
+ * Returns the xmlXPathCompExprPtr resulting from the compilation or NULL.
+ *         The object is owned by the principal stylesheet and freed
+ *         with it, the caller must not free it.
+ */
+xmlXPathCompExprPtr
+xsltXPathCompileShared(xsltStylesheetPtr style, const xmlChar *str,
+                       int flags, xmlNodePtr inst) {
+    xsltStylesheetPtr top;
+    xmlXPathCompExprPtr ret;
+    xmlChar *nsKey = NULL;
+    char flagsKey[20];
+    char uniqueKey[30];
+    int res;
+
+    if ((style == NULL) || (str == NULL))
+	return(NULL);
+    top = style;
+    while (top->parent != NULL)
+	top = top->parent;
+
+    if (inst != NULL)
+	xsltCollectDocumentURIs(top, str, inst);
+    res = xsltXPathPrefixKey(str, inst, &nsKey);
+    if (res < 0)
+	return(NULL);
+    snprintf(flagsKey, sizeof(flagsKey), "%d", flags);
+
+    if ((res == 0) && (top->xpathComps != NULL)) {
+	ret = (xmlXPathCompExprPtr) xmlHashLookup3(top->xpathComps,
+	    str, BAD_CAST flagsKey, nsKey);
+	if (ret != NULL)
+	    goto done;
+    }
+
+    ret = xsltXPathCompileFlags(style, str, flags);
+    if (ret == NULL)
+	goto done;
+
+    if (top->xpathComps == NULL) {
+	top->xpathComps = xmlHashCreate(64);
+	if (top->xpathComps == NULL)
+	    goto error;
+    }
+    if (res != 0) {
+	/*
+	* The prefixes can't be resolved here, so don't share the
+	* expression but still give it an entry to be freed with
+	* the stylesheet.
+	*/
+	snprintf(uniqueKey, sizeof(uniqueKey), "#%p", (void *) ret);
+	nsKey = xmlStrdup(BAD_CAST uniqueKey);
+	if (nsKey == NULL)
+	    goto error;
+    }
+    if (xmlHashAddEntry3(top->xpathComps, str, BAD_CAST flagsKey, nsKey,
+                         ret) < 0)
+	goto error;
+
+done:
+    if (nsKey != NULL)
+	xmlFree(nsKey);
+    return(ret);
+
+error:
+    xmlXPathFreeCompExpr(ret);
+    ret = NULL;
+    goto done;
+}
+
 /************************************************************************
  *									*
  *		Hooks for the debugger					*
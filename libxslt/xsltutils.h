@@ -176,6 +176,9 @@ XSLTPUBFUN int XSLTCALL
 
 XSLTPUBFUN void XSLTCALL
 		xsltDocumentSortFunction	(xmlNodeSetPtr list);
+XSLTPUBFUN void XSLTCALL
+		xsltCtxtDocumentSortFunction	(xsltTransformContextPtr ctxt,
+						 xmlNodeSetPtr list);
 XSLTPUBFUN void XSLTCALL
 		xsltSetSortFunc			(xsltSortFunc handler);
 XSLTPUBFUN void XSLTCALL
@@ -246,6 +249,11 @@ XSLTPUBFUN xmlXPathCompExprPtr XSLTCALL
 		xsltXPathCompileFlags		(xsltStylesheetPtr style,
 						 const xmlChar *str,
 						 int flags);
+XSLTPUBFUN xmlXPathCompExprPtr XSLTCALL
+		xsltXPathCompileShared		(xsltStylesheetPtr style,
+						 const xmlChar *str,
+						 int flags,
+						 xmlNodePtr inst);
 
 /*
  * Profiling.
@@ -268,6 +276,76 @@ XSLTPUBFUN void XSLTCALL
  */
 #define XSLT_TIMESTAMP_TICS_PER_SEC 100000l
 
+/*
+ * Transformation result cache.
+ */
+typedef struct _xsltResultCache xsltResultCache;
+typedef xsltResultCache *xsltResultCachePtr;
+
+XSLTPUBFUN xsltResultCachePtr XSLTCALL
+		xsltNewResultCache		(const char *directory);
+XSLTPUBFUN void XSLTCALL
+		xsltFreeResultCache		(xsltResultCachePtr cache);
+XSLTPUBFUN int XSLTCALL
+		xsltResultCacheClear		(xsltResultCachePtr cache);
+XSLTPUBFUN void XSLTCALL
+		xsltResultCacheGetStats		(xsltResultCachePtr cache,
+						 long *hits,
+						 long *misses,
+						 long *stores);
+XSLTPUBFUN xsltResultCachePtr XSLTCALL
+		xsltSetResultCache		(xsltResultCachePtr cache);
+XSLTPUBFUN xsltResultCachePtr XSLTCALL
+		xsltGetResultCache		(void);
+XSLTPUBFUN xmlChar * XSLTCALL
+		xsltResultCacheKey		(xsltResultCachePtr cache,
+						 xsltStylesheetPtr style,
+						 xmlDocPtr doc,
+						 const char **params);
+XSLTPUBFUN int XSLTCALL
+		xsltResultCacheLookup		(xsltResultCachePtr cache,
+						 const xmlChar *key,
+						 xmlChar **content,
+						 int *len);
+XSLTPUBFUN int XSLTCALL
+		xsltResultCacheStore		(xsltResultCachePtr cache,
+						 const xmlChar *key,
+						 xsltTransformContextPtr ctxt,
+						 const xmlChar *content,
+						 int len);
+
+/*
+ * Running tasks in parallel.
+ */
+
+/**
+ * xsltParallelFunc:
+ * @data:  the user data given to xsltRunParallel()
+ * @index:  the number of the task to run
+ *
+ * Signature of the function running one of the tasks
+ * dispatched by xsltRunParallel() or xsltStartParallel().
+ */
+typedef void (*xsltParallelFunc) (void *data, int index);
+
+typedef struct _xsltParallelTasks xsltParallelTasks;
+typedef xsltParallelTasks *xsltParallelTasksPtr;
+
+XSLTPUBFUN int XSLTCALL
+		xsltGetThreadCount		(void);
+XSLTPUBFUN int XSLTCALL
+		xsltRunParallel			(int nbTasks,
+						 int nbThreads,
+						 xsltParallelFunc func,
+						 void *data);
+XSLTPUBFUN xsltParallelTasksPtr XSLTCALL
+		xsltStartParallel		(int nbTasks,
+						 int nbThreads,
+						 xsltParallelFunc func,
+						 void *data);
+XSLTPUBFUN void XSLTCALL
+		xsltWaitParallel		(xsltParallelTasksPtr tasks);
+
 /*
  * Hooks for the debugger.
  */
@@ -0,0 +1,18 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<xsl:output method="text"/>
+
+<!-- with -\-prefetch the documents of a node-set are parsed concurrently,
+     they must come in the same order with the same messages -->
+<xsl:template match="/">
+  <xsl:for-each select="document(files/file)">
+    <xsl:value-of select="concat(position(), ' ', name(*), ' ',
+                                 count(//*), '&#10;')"/>
+  </xsl:for-each>
+  <xsl:for-each select="document(files/file[position() > 3])">
+    <xsl:value-of select="concat(position(), ' ', name(*), '&#10;')"/>
+  </xsl:for-each>
+</xsl:template>
+
+</xsl:stylesheet>
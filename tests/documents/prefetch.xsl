@@ -0,0 +1,24 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:saxon="http://icl.com/saxon"
+    exclude-result-prefixes="saxon">
+
+<xsl:output method="text"/>
+
+<!-- with -\-prefetch those documents are parsed when the transformation
+     starts, which must not change the trees nor the messages -->
+<xsl:variable name="data" select="'prefetch-data.xml'"/>
+
+<xsl:template match="/">
+  <xsl:for-each select="document($data)/doc/item">
+    <xsl:value-of select="concat(saxon:line-number(), ' ', @kind, ': ', .,
+                                 '&#10;')"/>
+  </xsl:for-each>
+  <xsl:value-of select="count(document('menu.xml')/menu/menuitem)"/>
+  <xsl:text>&#10;</xsl:text>
+  <xsl:if test="not(document('prefetch-missing.xml'))">
+    <xsl:text>missing&#10;</xsl:text>
+  </xsl:if>
+</xsl:template>
+
+</xsl:stylesheet>
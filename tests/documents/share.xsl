@@ -0,0 +1,24 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:p="urn:other">
+
+<!-- Copies of input subtrees written with -o may be serialized
+     directly from the input document -->
+<xsl:output method="xml" indent="yes"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:copy-of select="doc/plain"/>
+    <xsl:copy-of select="doc/*[local-name() = 'ns']"/>
+    <default xmlns="urn:default">
+      <xsl:copy-of select="doc/plain"/>
+      <xsl:copy-of select="doc/deep"/>
+    </default>
+    <xsl:copy-of select="doc/redundant"/>
+    <xsl:copy-of select="doc/cdata"/>
+    <xsl:copy-of select="doc/accent"/>
+    <mixed>text<xsl:copy-of select="doc/deep"/></mixed>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
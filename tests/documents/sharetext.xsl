@@ -0,0 +1,22 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- Copies of input subtrees made to compute the text of attributes,
+     comments, processing instructions and messages are never shared -->
+<xsl:output method="xml" indent="yes"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:attribute name="plain">
+      <xsl:copy-of select="doc/plain"/>
+    </xsl:attribute>
+    <xsl:comment><xsl:copy-of select="doc/deep"/></xsl:comment>
+    <xsl:processing-instruction name="deep">
+      <xsl:copy-of select="doc/deep"/>
+    </xsl:processing-instruction>
+    <xsl:message><xsl:copy-of select="doc/plain"/></xsl:message>
+    <xsl:copy-of select="doc/deep"/>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,19 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+  xmlns:func="http://exslt.org/functions" xmlns:exsl="http://exslt.org/common"
+  xmlns:f="urn:f" extension-element-prefixes="func">
+<func:function name="f:x">
+  <xsl:param name="n"/>
+  <xsl:variable name="v"><a><xsl:value-of select="$n"/></a><b/></xsl:variable>
+  <func:result select="exsl:node-set($v)/a"/>
+</func:function>
+<func:function name="f:r">
+  <func:result><r>res</r></func:result>
+</func:function>
+<xsl:variable name="g" select="f:x(7)"/>
+<xsl:variable name="g2" select="f:r()"/>
+<xsl:template match="/">
+  <out><xsl:call-template name="t"/><xsl:copy-of select="$g"/><xsl:copy-of select="$g2"/>
+  <xsl:for-each select="//*"><xsl:variable name="l" select="f:x(position())"/><xsl:copy-of select="$l"/><xsl:copy-of select="$g"/></xsl:for-each></out>
+</xsl:template>
+<xsl:template name="t"><xsl:param name="p" select="f:x(9)"/><xsl:copy-of select="$p"/><xsl:copy-of select="$g"/></xsl:template>
+</xsl:stylesheet>
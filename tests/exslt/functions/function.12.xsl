@@ -0,0 +1,28 @@
+<?xml version="1.0"?>
+
+<!--
+  The same expression, with its prefix bound to different namespaces,
+  must call a different function each time.
+-->
+<xsl:stylesheet xmlns:xsl="http://www.w3.org/1999/XSL/Transform" version="1.0"
+  xmlns:func="http://exslt.org/functions" extension-element-prefixes="func"
+  xmlns:a="urn:a" xmlns:b="urn:b">
+
+<func:function name="a:f">
+  <func:result select="'a'"/>
+</func:function>
+
+<func:function name="b:f">
+  <func:result select="'b'"/>
+</func:function>
+
+<xsl:template match="/">
+  <out>
+    <first xmlns:p="urn:a"><xsl:value-of select="p:f()"/></first>
+    <second xmlns:p="urn:b"><xsl:value-of select="p:f()"/></second>
+    <third xmlns:p="urn:a" attr="{p:f()}"/>
+    <fourth xmlns:p="urn:b" attr="{p:f()}"/>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,20 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:str="http://exslt.org/strings"
+    exclude-result-prefixes="str">
+
+<xsl:template match="/">
+	<xsl:variable name="from" select="doc/entities/e/@from"/>
+	<xsl:variable name="to" select="doc/entities/e/@to"/>
+<out>;
+<xsl:for-each select="doc/text">
+	str:replace('<xsl:value-of select="."/>', $from, $to)
+	<xsl:value-of select="str:replace(., $from, $to)"/>;
+</xsl:for-each>
+	str:replace('x--y', $from, 'z')
+	<xsl:value-of select="str:replace('x--y', $from, 'z')"/>;
+</out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,26 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:str="http://exslt.org/strings"
+    exclude-result-prefixes="str">
+
+<xsl:template match="/">
+<out>;
+  str:tokenize('a&#xE9;b&#xE8;c&#xE9;&#xE9;d', '&#xE9;')
+  <xsl:copy-of select="str:tokenize('a&#xE9;b&#xE8;c&#xE9;&#xE9;d', '&#xE9;')"/>;
+
+  str:tokenize('&#xE9;t&#xE9;, hiver;,printemps', ',;&#x2014;')
+  <xsl:copy-of select="str:tokenize('&#xE9;t&#xE9;, hiver;,printemps', ',;&#x2014;')"/>;
+
+  str:tokenize('one&#x2014;two&#x2014;&#x2014;three&#x2014;', '&#x2014;')
+  <xsl:copy-of select="str:tokenize('one&#x2014;two&#x2014;&#x2014;three&#x2014;', '&#x2014;')"/>;
+
+  str:tokenize('d&#xE9;j&#xE0;', '')
+  <xsl:copy-of select="str:tokenize('d&#xE9;j&#xE0;', '')"/>;
+
+  str:split('aXbxcXXd', 'x')
+  <xsl:copy-of select="str:split('aXbxcXXd', 'x')"/>;
+</out>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,34 @@
+<?xml version='1.0'?>
+<xsl:stylesheet xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+		xmlns:libxslt="http://xmlsoft.org/XSLT/"
+		xmlns:func="http://exslt.org/functions"
+		xmlns:dyn="http://exslt.org/dynamic"
+		xmlns:str="http://exslt.org/strings"
+		xmlns:my="http://example.org/my"
+		extension-element-prefixes="libxslt func dyn str"
+		exclude-result-prefixes="my"
+                version='1.0'>
+<!--
+  Run on several inputs with one compiled stylesheet: the test module
+  reports an error if it is initialized twice for a transformation or
+  shut down without being initialized, the modules being initialized
+  on first use.
+-->
+<xsl:output method="xml" indent="no"/>
+
+<func:function name="my:label">
+  <xsl:param name="s"/>
+  <func:result select="str:replace($s, '-', ' ')"/>
+</func:function>
+
+<xsl:template match="/">
+  <out>
+    <libxslt:test/>
+    <xsl:value-of select="libxslt:test('ignored')"/>
+    <xsl:for-each select="doc/item">
+      <item label="{my:label(@name)}"
+            value="{dyn:evaluate(@expr)}"/>
+    </xsl:for-each>
+  </out>
+</xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,55 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+                xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+                xmlns:exsl="http://exslt.org/common"
+                exclude-result-prefixes="exsl">
+  <xsl:output method="text"/>
+
+  <xsl:variable name="rtf">
+    <r id="r1"><s id="s1" z="3"/></r>
+    <r id="r2"/>
+  </xsl:variable>
+
+  <xsl:template name="check">
+    <xsl:param name="label"/>
+    <xsl:param name="set"/>
+    <xsl:param name="first"/>
+    <xsl:value-of select="$label"/>
+    <xsl:text>: </xsl:text>
+    <xsl:value-of select="generate-id($set) = generate-id($first)"/>
+    <xsl:text>&#10;</xsl:text>
+  </xsl:template>
+
+  <xsl:template match="/">
+    <xsl:call-template name="check">
+      <xsl:with-param name="label">elements</xsl:with-param>
+      <xsl:with-param name="set" select="//b[@id='b3'] | //b[@id='b1']"/>
+      <xsl:with-param name="first" select="//b[@id='b1']"/>
+    </xsl:call-template>
+    <xsl:call-template name="check">
+      <xsl:with-param name="label">attribute before child</xsl:with-param>
+      <xsl:with-param name="set" select="//b[@id='b1'] | //a/@x"/>
+      <xsl:with-param name="first" select="//a/@x"/>
+    </xsl:call-template>
+    <xsl:call-template name="check">
+      <xsl:with-param name="label">text and pi</xsl:with-param>
+      <xsl:with-param name="set" select="//processing-instruction() | //a/text()"/>
+      <xsl:with-param name="first" select="//a/text()"/>
+    </xsl:call-template>
+    <xsl:call-template name="check">
+      <xsl:with-param name="label">comment</xsl:with-param>
+      <xsl:with-param name="set" select="//b[@id='b3'] | //comment()"/>
+      <xsl:with-param name="first" select="//comment()"/>
+    </xsl:call-template>
+    <xsl:call-template name="check">
+      <xsl:with-param name="label">namespace</xsl:with-param>
+      <xsl:with-param name="set" select="/doc/@* | /doc/a[1] | /doc/namespace::p"/>
+      <xsl:with-param name="first" select="/doc/namespace::p"/>
+    </xsl:call-template>
+    <xsl:call-template name="check">
+      <xsl:with-param name="label">result tree fragment</xsl:with-param>
+      <xsl:with-param name="set" select="exsl:node-set($rtf)//*[@id='r2'] | exsl:node-set($rtf)//@z"/>
+      <xsl:with-param name="first" select="exsl:node-set($rtf)//@z"/>
+    </xsl:call-template>
+  </xsl:template>
+</xsl:stylesheet>
@@ -0,0 +1,25 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- Templates applied to namespace nodes with keys defined -->
+<xsl:output method="xml" indent="no"/>
+
+<xsl:key name="item" match="item" use="@id"/>
+
+<xsl:template match="/">
+  <r>
+    <xsl:value-of select="count(key('item', 'x'))"/>
+    <xsl:apply-templates select="//namespace::*"/>
+    <xsl:apply-templates select="//item/namespace::*" mode="name"/>
+  </r>
+</xsl:template>
+
+<xsl:template match="node()" mode="name">
+  <xsl:value-of select="name()"/>
+</xsl:template>
+
+<xsl:template match="*" mode="name">
+  <element/>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,48 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    exclude-result-prefixes="libxslt">
+
+<xsl:output method="xml" indent="no"/>
+
+<xsl:key name="def" match="def" use="@id"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:for-each select="doc/item">
+      <entry>
+        <xsl:apply-templates select="key('def', @ref)" mode="attr"/>
+        <xsl:apply-templates select="key('def', @ref)" mode="render">
+          <xsl:with-param name="sep" select="concat('#', position() mod 2)"/>
+        </xsl:apply-templates>
+        <xsl:text>;</xsl:text>
+        <xsl:call-template name="label">
+          <xsl:with-param name="s" select="string(@ref)"/>
+        </xsl:call-template>
+      </entry>
+    </xsl:for-each>
+  </out>
+</xsl:template>
+
+<!-- memoized on the context node and the $sep parameter -->
+<xsl:template match="def" mode="render" libxslt:memoize="node">
+  <xsl:param name="sep"/>
+  <xsl:value-of select="name"/>
+  <xsl:value-of select="$sep"/>
+  <v><xsl:value-of select="value"/></v>
+</xsl:template>
+
+<!-- memoized on the string value of the context node, output merges
+     with the preceding text node -->
+<xsl:template name="label" libxslt:memoize="string">
+  <xsl:param name="s"/>
+  <xsl:text>label-</xsl:text>
+  <xsl:value-of select="$s"/>
+</xsl:template>
+
+<!-- adds attributes to the parent element: never replayed -->
+<xsl:template match="def" mode="attr" libxslt:memoize="node">
+  <xsl:attribute name="id"><xsl:value-of select="@id"/></xsl:attribute>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,18 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    exclude-result-prefixes="libxslt">
+
+<xsl:output method="xml" indent="no"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:apply-templates select="doc/item" libxslt:parallel="yes"/>
+  </out>
+</xsl:template>
+
+<xsl:template match="item">
+  <i><xsl:value-of select="unparsed-entity-uri()"/></i>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,68 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    xmlns:str="http://exslt.org/strings"
+    exclude-result-prefixes="libxslt str">
+
+<xsl:output method="xml" indent="no"/>
+
+<xsl:key name="group" match="item" use="@group"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:call-template name="rows">
+      <xsl:with-param name="prefix" select="'row'"/>
+    </xsl:call-template>
+    <!-- the local variables are read by all the contexts -->
+    <xsl:variable name="first" select="doc/item[1]"/>
+    <xsl:variable name="label" select="concat('of ', $first/@group)"/>
+    <xsl:for-each select="doc/item" libxslt:parallel="yes">
+      <same>
+        <xsl:value-of select="concat(@group = $first/@group, ' ', $label)"/>
+      </same>
+    </xsl:for-each>
+    <!-- the tree fragment can't be shared, processed serially -->
+    <xsl:variable name="sep">
+      <sep/>
+    </xsl:variable>
+    <xsl:for-each select="doc/item" libxslt:parallel="yes">
+      <xsl:if test="position() != 1">
+        <xsl:copy-of select="$sep"/>
+      </xsl:if>
+      <xsl:value-of select="@group"/>
+    </xsl:for-each>
+  </out>
+</xsl:template>
+
+<xsl:template name="rows">
+  <xsl:param name="prefix"/>
+  <xsl:variable name="count" select="count(doc/item)"/>
+  <xsl:for-each select="doc/item" libxslt:parallel="yes">
+    <xsl:sort select="@group"/>
+    <xsl:sort select="string-length(.)" data-type="number" order="descending"/>
+    <xsl:variable name="words" select="str:tokenize(., ' ')"/>
+    <xsl:element name="{$prefix}">
+      <xsl:attribute name="pos">
+        <xsl:value-of select="concat(position(), '/', $count)"/>
+      </xsl:attribute>
+      <xsl:attribute name="same">
+        <xsl:value-of select="count(key('group', current()/@group))"/>
+      </xsl:attribute>
+      <xsl:call-template name="words">
+        <xsl:with-param name="words" select="$words"/>
+      </xsl:call-template>
+    </xsl:element>
+    <xsl:text>&#10;</xsl:text>
+  </xsl:for-each>
+</xsl:template>
+
+<xsl:template name="words">
+  <xsl:param name="words"/>
+  <xsl:for-each select="$words">
+    <xsl:value-of select="translate(., 'abcdefghijklmnopqrstuvwxyz',
+                                    'ABCDEFGHIJKLMNOPQRSTUVWXYZ')"/>
+    <xsl:if test="position() != last()">-</xsl:if>
+  </xsl:for-each>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,24 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    exclude-result-prefixes="libxslt">
+
+<xsl:output method="xml" indent="no"/>
+
+<!-- each context keeps its own memo of the calls -->
+<xsl:template match="/">
+  <out>
+    <xsl:for-each select="doc/item" libxslt:parallel="yes">
+      <xsl:apply-templates select="@group" mode="label"/>
+      <xsl:text>&#10;</xsl:text>
+    </xsl:for-each>
+  </out>
+</xsl:template>
+
+<xsl:template match="@group" mode="label" libxslt:memoize="string">
+  <group name="{.}">
+    <xsl:value-of select="count(/doc/item[@group = current()])"/>
+  </group>
+</xsl:template>
+
+</xsl:stylesheet>
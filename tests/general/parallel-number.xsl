@@ -0,0 +1,19 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    exclude-result-prefixes="libxslt">
+
+<xsl:output method="xml" indent="no"/>
+
+<!-- xsl:number isn't reentrant, the items are processed serially -->
+<xsl:template match="/">
+  <out>
+    <xsl:apply-templates select="doc/item" libxslt:parallel="yes"/>
+  </out>
+</xsl:template>
+
+<xsl:template match="item">
+  <i n="{@group}"><xsl:number format="i "/><xsl:number level="multiple" count="doc|item" format="A.1"/></i>
+</xsl:template>
+
+</xsl:stylesheet>
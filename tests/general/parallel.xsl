@@ -0,0 +1,52 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:libxslt="http://xmlsoft.org/XSLT/namespace"
+    xmlns:str="http://exslt.org/strings"
+    xmlns:r="urn:parallel:result"
+    exclude-result-prefixes="libxslt str">
+
+<xsl:output method="xml" indent="no" cdata-section-elements="groups"/>
+
+<xsl:key name="group" match="item" use="@group"/>
+
+<xsl:variable name="count" select="count(//item)"/>
+
+<xsl:template match="/">
+  <r:out>
+    <xsl:apply-templates select="doc/item" libxslt:parallel="yes"/>
+    <groups>
+      <xsl:apply-templates select="doc/item" mode="group"
+                           libxslt:parallel="yes"/>
+    </groups>
+    <sizes>
+      <xsl:apply-templates select="doc/item" mode="size"
+                           libxslt:parallel="yes"/>
+    </sizes>
+  </r:out>
+</xsl:template>
+
+<xsl:template match="item">
+  <r:item pos="{position()}" of="{last()}" total="{$count}"
+          same="{count(key('group', @group))}" xml:lang="en">
+    <xsl:for-each select="str:tokenize(., ' ')">
+      <word><xsl:value-of select="."/></word>
+    </xsl:for-each>
+  </r:item>
+</xsl:template>
+
+<xsl:template match="item" mode="group">
+  <xsl:value-of select="@group"/>
+</xsl:template>
+
+<!-- the first item adds an attribute to the parent -->
+<xsl:template match="item" mode="size">
+  <xsl:if test="position() = 1">
+    <xsl:attribute name="first">
+      <xsl:value-of select="."/>
+    </xsl:attribute>
+  </xsl:if>
+  <xsl:value-of select="string-length(.)"/>
+  <xsl:text> </xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
@@ -0,0 +1,53 @@
+<xsl:stylesheet version="1.0"
+    xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+    xmlns:a="urn:a">
+
+<xsl:output method="xml" indent="no"/>
+
+<xsl:template match="/">
+  <out>
+    <!-- moved: only use of the variable -->
+    <xsl:variable name="simple">
+      <x>text</x>tail<y z="1"/>
+    </xsl:variable>
+    <xsl:copy-of select="$simple"/>
+
+    <!-- moved under an element with a default namespace -->
+    <wrap xmlns="urn:default">
+      <xsl:variable name="nons">
+        <xsl:element name="plain"><xsl:attribute name="xml:lang">en</xsl:attribute>none</xsl:element>
+        <a:q a:attr="v"><a:r/></a:q>
+      </xsl:variable>
+      <xsl:if test="true()">
+        <xsl:copy-of select=" $nons "/>
+      </xsl:if>
+    </wrap>
+
+    <!-- copied: the variable is used twice -->
+    <xsl:variable name="twice">
+      <t/>
+    </xsl:variable>
+    <xsl:copy-of select="$twice"/>
+    <xsl:copy-of select="$twice"/>
+
+    <!-- copied: the instruction is repeated -->
+    <xsl:variable name="loop">
+      <l/>
+    </xsl:variable>
+    <xsl:for-each select="doc/item">
+      <xsl:copy-of select="$loop"/>
+    </xsl:for-each>
+
+    <!-- moved once per iteration -->
+    <xsl:for-each select="doc/item">
+      <xsl:variable name="item">
+        <i><xsl:value-of select="."/></i>
+      </xsl:variable>
+      <xsl:text>[</xsl:text>
+      <xsl:copy-of select="$item"/>
+      <xsl:text>]</xsl:text>
+    </xsl:for-each>
+  </out>
+</xsl:template>
+
+</xsl:stylesheet>
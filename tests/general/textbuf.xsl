@@ -0,0 +1,35 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+
+<!-- Text written before and after variables, attribute values and
+     disabled escaping must end up in the right text nodes -->
+<xsl:output method="xml"/>
+
+<xsl:template match="/">
+  <out>
+    <xsl:for-each select="doc/item">
+      <xsl:value-of select="@id"/>
+      <xsl:variable name="v">[<xsl:value-of select="."/>]</xsl:variable>
+      <xsl:text>=</xsl:text>
+      <xsl:value-of select="$v"/>
+      <xsl:text>;</xsl:text>
+    </xsl:for-each>
+    <line>
+      <xsl:attribute name="n"><xsl:value-of select="count(doc/item)"/></xsl:attribute>
+      <xsl:text>short</xsl:text>
+      <xsl:value-of select="doc/item[1]"/>
+      <xsl:call-template name="t">
+        <xsl:with-param name="p">param <xsl:value-of select="doc/item[2]"/></xsl:with-param>
+      </xsl:call-template>
+      <xsl:text disable-output-escaping="yes">&lt;raw/&gt;</xsl:text>
+      <xsl:text>&lt;escaped&gt;</xsl:text>
+      <xsl:text>a text node longer than the dictionary limit for result text</xsl:text>
+    </line>
+  </out>
+</xsl:template>
+
+<xsl:template name="t">
+  <xsl:param name="p"/>
+  <xsl:text>(</xsl:text><xsl:value-of select="$p"/><xsl:text>)</xsl:text>
+</xsl:template>
+
+</xsl:stylesheet>
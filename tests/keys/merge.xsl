@@ -0,0 +1,33 @@
+<?xml version="1.0"?>
+<xsl:stylesheet version="1.0"
+                xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+  <xsl:output method="text"/>
+
+  <!-- two definitions for the same key name -->
+  <xsl:key name="cat" match="note" use="@tag"/>
+  <xsl:key name="cat" match="item" use="@cat"/>
+  <xsl:key name="tok" match="item" use="substring-before(concat(@cat, ' '), ' ')"/>
+
+  <xsl:template match="/">
+    <xsl:text>cat(wanted):</xsl:text>
+    <xsl:for-each select="key('cat', doc/wanted)">
+      <xsl:text> </xsl:text>
+      <xsl:value-of select="@id"/>
+    </xsl:for-each>
+    <xsl:text>&#10;count:</xsl:text>
+    <xsl:value-of select="count(key('cat', doc/wanted))"/>
+    <xsl:text>&#10;cat(a):</xsl:text>
+    <xsl:for-each select="key('cat', 'a')">
+      <xsl:text> </xsl:text>
+      <xsl:value-of select="@id"/>
+    </xsl:for-each>
+    <xsl:text>&#10;tok(wanted[2]|wanted[1]):</xsl:text>
+    <xsl:for-each select="key('tok', doc/wanted[2] | doc/wanted[1])">
+      <xsl:text> </xsl:text>
+      <xsl:value-of select="@id"/>
+    </xsl:for-each>
+    <xsl:text>&#10;tok(none):</xsl:text>
+    <xsl:value-of select="count(key('tok', doc/nothing))"/>
+    <xsl:text>&#10;</xsl:text>
+  </xsl:template>
+</xsl:stylesheet>
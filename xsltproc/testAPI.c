@@ -0,0 +1,880 @@
+/**
+ * testAPI.c: testing of the library interfaces not exercised by xsltproc
+ *
+ * See Copyright for the status of this software.
+ */
+
+#include "config.h"
+#include "libexslt/exslt.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include <libxml/xmlversion.h>
+#include <libxml/parser.h>
+#include <libxml/xmlIO.h>
+#include <libxml/xpath.h>
+#include <libxslt/xslt.h>
+#include <libxslt/xsltInternals.h>
+#include <libxslt/transform.h>
+#include <libxslt/xsltutils.h>
+#include <libxslt/extensions.h>
+#include <libxslt/variables.h>
+
+static int errors = 0;
+
+#define TEST_FAIL(msg) do {						\
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, msg);		\
+    errors++;								\
+} while (0)
+
+static xsltStylesheetPtr
+parseStyle(const char *str) {
+    xmlDocPtr doc;
+    xsltStylesheetPtr style;
+
+    doc = xmlReadMemory(str, strlen(str), "testAPI.xsl", NULL, 0);
+    if (doc == NULL) {
+        fprintf(stderr, "Failed to parse stylesheet\n");
+        exit(1);
+    }
+    style = xsltParseStylesheetDoc(doc);
+    if (style == NULL) {
+        fprintf(stderr, "Failed to compile stylesheet\n");
+        exit(1);
+    }
+    return(style);
+}
+
+static xmlDocPtr
+parseDoc(const char *str) {
+    xmlDocPtr doc;
+
+    doc = xmlReadMemory(str, strlen(str), "testAPI.xml", NULL, 0);
+    if (doc == NULL) {
+        fprintf(stderr, "Failed to parse input\n");
+        exit(1);
+    }
+    return(doc);
+}
+
+static void
+writeFile(const char *name, const char *content) {
+    FILE *f;
+
+    f = fopen(name, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to write %s\n", name);
+        exit(1);
+    }
+    fputs(content, f);
+    fclose(f);
+}
+
+/************************************************************************
+ *									*
+ *			Transformation result cache			*
+ *									*
+ ************************************************************************/
+
+#define CACHE_DEP "testAPI.dep.xml"
+#define CACHE_DIR "testAPI.cache"
+
+const char *cacheStyle = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:param name='p' select='0'/>\
+<xsl:template match='/'>\
+<xsl:value-of select='concat(doc, $p, document(\"" CACHE_DEP "\")/dep)'/>\
+</xsl:template>\
+</xsl:stylesheet>";
+
+const char *cacheUncachable[] = {
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:template match='/'><xsl:value-of select='generate-id()'/></xsl:template>\
+</xsl:stylesheet>",
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:template match='/'><xsl:message>run</xsl:message></xsl:template>\
+</xsl:stylesheet>",
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform' \
+xmlns:date='http://exslt.org/dates-and-times'>\
+<xsl:variable name='now' select='date:date-time()'/>\
+<xsl:template match='/'><xsl:value-of select='$now'/></xsl:template>\
+</xsl:stylesheet>",
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform' \
+xmlns:math='http://exslt.org/math'>\
+<xsl:template match='/'><xsl:value-of select='math:random()'/></xsl:template>\
+</xsl:stylesheet>",
+NULL
+};
+
+/*
+ * Runs @style through the result cache and checks the output
+ */
+static void
+cacheRun(xsltStylesheetPtr style, xmlDocPtr doc, const char **params,
+         const char *expect) {
+    xmlOutputBufferPtr buf;
+    const xmlChar *content;
+    int len;
+
+    buf = xmlAllocOutputBuffer(NULL);
+    if (buf == NULL) {
+        fprintf(stderr, "Failed to create output buffer\n");
+        exit(1);
+    }
+    if (xsltRunStylesheetUser(style, doc, params, NULL, NULL, buf,
+                              NULL, NULL) < 0)
+        TEST_FAIL("result cache run failed");
+#ifdef LIBXML2_NEW_BUFFER
+    content = xmlOutputBufferGetContent(buf);
+    len = xmlOutputBufferGetSize(buf);
+#else
+    content = buf->buffer->content;
+    len = buf->buffer->use;
+#endif
+    if ((len != (int) strlen(expect)) ||
+        (memcmp(content, expect, len) != 0))
+        TEST_FAIL("unexpected result cache output");
+    xmlOutputBufferClose(buf);
+}
+
+static void
+cacheCheckStats(xsltResultCachePtr cache, long hits, long misses) {
+    long curHits = -1, curMisses = -1;
+
+    xsltResultCacheGetStats(cache, &curHits, &curMisses, NULL);
+    if ((curHits != hits) || (curMisses != misses)) {
+        fprintf(stderr, "result cache: %ld hits, %ld misses, "
+                "expecting %ld and %ld\n", curHits, curMisses, hits, misses);
+        TEST_FAIL("unexpected result cache statistics");
+    }
+}
+
+static void
+testResultCache(const char *directory) {
+    xsltResultCachePtr cache;
+    xsltStylesheetPtr style;
+    xmlDocPtr doc, other;
+    xmlChar *key, *content;
+    const char *params[3] = { "p", "1", NULL };
+    int i, len;
+
+    writeFile(CACHE_DEP, "<dep>a</dep>");
+    cache = xsltNewResultCache(directory);
+    if (cache == NULL) {
+        fprintf(stderr, "Failed to create result cache\n");
+        exit(1);
+    }
+    /* forget the results of previous runs */
+    if ((directory != NULL) && (xsltResultCacheClear(cache) != 0))
+        TEST_FAIL("failed to clear the result cache");
+    xsltSetResultCache(cache);
+    style = parseStyle(cacheStyle);
+    doc = parseDoc("<doc>x</doc>");
+    other = parseDoc("<doc>y</doc>");
+
+    /* miss then hit */
+    cacheRun(style, doc, NULL, "x0a");
+    cacheCheckStats(cache, 0, 1);
+    cacheRun(style, doc, NULL, "x0a");
+    cacheCheckStats(cache, 1, 1);
+
+    /* the input and the parameters are part of the key */
+    cacheRun(style, other, NULL, "y0a");
+    cacheRun(style, doc, params, "x1a");
+    cacheCheckStats(cache, 1, 3);
+    cacheRun(style, doc, params, "x1a");
+    cacheCheckStats(cache, 2, 3);
+
+    /* a change of a loaded document drops the entries */
+    writeFile(CACHE_DEP, "<dep>bb</dep>");
+    cacheRun(style, doc, NULL, "x0bb");
+    cacheCheckStats(cache, 2, 4);
+    cacheRun(style, doc, NULL, "x0bb");
+    cacheCheckStats(cache, 3, 4);
+
+    /* clearing drops everything */
+    if (xsltResultCacheClear(cache) != 0)
+        TEST_FAIL("failed to clear the result cache");
+    cacheRun(style, doc, NULL, "x0bb");
+    cacheCheckStats(cache, 3, 5);
+
+    /* the key is a digest, whatever the size of the input */
+    key = xsltResultCacheKey(cache, style, doc, NULL);
+    if (key == NULL) {
+        TEST_FAIL("no result cache key");
+    } else {
+        if (xmlStrlen(key) != 64)
+            TEST_FAIL("result cache key isn't a SHA-256 digest");
+        if (xsltResultCacheLookup(cache, key, &content, &len) != 1)
+            TEST_FAIL("result cache lookup failed");
+        else
+            xmlFree(content);
+        key[0] = (key[0] == '0') ? '1' : '0';
+        if (xsltResultCacheLookup(cache, key, &content, &len) != 0)
+            TEST_FAIL("result cache lookup matched another key");
+        xmlFree(key);
+    }
+
+    /* stylesheets whose output may vary aren't cached */
+    for (i = 0; cacheUncachable[i] != NULL; i++) {
+        xsltStylesheetPtr cur = parseStyle(cacheUncachable[i]);
+
+        key = xsltResultCacheKey(cache, cur, doc, NULL);
+        if (key != NULL) {
+            fprintf(stderr, "stylesheet %d\n", i);
+            TEST_FAIL("result cache key for a nondeterministic stylesheet");
+            xmlFree(key);
+        }
+        xsltFreeStylesheet(cur);
+    }
+
+    xsltSetResultCache(NULL);
+    xsltFreeResultCache(cache);
+    xsltFreeStylesheet(style);
+    xmlFreeDoc(doc);
+    xmlFreeDoc(other);
+    remove(CACHE_DEP);
+}
+
+/************************************************************************
+ *									*
+ *			Stylesheet pruning				*
+ *									*
+ ************************************************************************/
+
+#define PRUNE_NS "http://xmlsoft.org/XSLT/testAPI"
+
+const char *pruneStyle = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:key name='used' match='item' use='@id'/>\
+<xsl:key name='unused' match='item' use='.'/>\
+<xsl:variable name='used' select='1'/>\
+<xsl:variable name='unused' select='2'/>\
+<xsl:variable name='called'><xsl:call-template name='t'/></xsl:variable>\
+<xsl:param name='p' select='0'/>\
+<xsl:template match='/'>\
+<xsl:value-of select='concat($used, key(\"used\", \"b\"), $p)'/>\
+<xsl:apply-templates select='doc' mode='used'/>\
+</xsl:template>\
+<xsl:template match='doc' mode='used'>U</xsl:template>\
+<xsl:template match='doc' mode='unused'>N</xsl:template>\
+<xsl:template match='item' mode='unused'>N</xsl:template>\
+<xsl:template name='t'>T</xsl:template>\
+</xsl:stylesheet>";
+
+/* a pruned variable looked up by an extension */
+const char *pruneLookup = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform' \
+xmlns:test='" PRUNE_NS "'>\
+<xsl:output method='text'/>\
+<xsl:variable name='unused' select='2'/>\
+<xsl:template match='/'><xsl:value-of select='test:lookup(\"unused\")'/>\
+</xsl:template>\
+</xsl:stylesheet>";
+
+/* key() with a computed name keeps all the keys */
+const char *pruneComputedKey = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:key name='used' match='item' use='@id'/>\
+<xsl:key name='unused' match='item' use='.'/>\
+<xsl:variable name='unused' select='2'/>\
+<xsl:template match='/'>\
+<xsl:value-of select='key(concat(\"us\", \"ed\"), \"b\")'/>\
+</xsl:template>\
+<xsl:template match='doc' mode='unused'>N</xsl:template>\
+</xsl:stylesheet>";
+
+/* expressions built at run time keep all the variables and keys */
+const char *pruneDynamic = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform' \
+xmlns:dyn='http://exslt.org/dynamic' extension-element-prefixes='dyn'>\
+<xsl:output method='text'/>\
+<xsl:key name='unused' match='item' use='@id'/>\
+<xsl:variable name='unused' select='2'/>\
+<xsl:template match='/'>\
+<xsl:value-of select='dyn:evaluate(concat(\"$un\", \"used\"))'/>\
+<xsl:value-of select='dyn:evaluate(\"key(&apos;unused&apos;, &apos;a&apos;)\")'/>\
+</xsl:template>\
+<xsl:template match='doc' mode='unused'>N</xsl:template>\
+</xsl:stylesheet>";
+
+/*
+ * test:lookup(name): the value of the variable @name
+ */
+static void
+pruneLookupFunction(xmlXPathParserContextPtr ctxt, int nargs) {
+    xmlXPathObjectPtr value;
+    xmlChar *name;
+
+    if (nargs != 1) {
+        xmlXPathSetArityError(ctxt);
+        return;
+    }
+    name = xmlXPathPopString(ctxt);
+    value = xsltVariableLookup(xsltXPathGetTransformContext(ctxt), name,
+                               NULL);
+    xmlFree(name);
+    if (value == NULL) {
+        xmlXPathSetError(ctxt, XPATH_UNDEF_VARIABLE_ERROR);
+        return;
+    }
+    valuePush(ctxt, value);
+}
+
+/*
+ * Applies @style to @doc and checks the output
+ */
+static void
+pruneRun(xsltStylesheetPtr style, xmlDocPtr doc, const char **params,
+         const char *expect) {
+    xmlDocPtr res;
+    xmlChar *content = NULL;
+    int len = 0;
+
+    res = xsltApplyStylesheet(style, doc, params);
+    if (res == NULL) {
+        TEST_FAIL("pruned stylesheet failed");
+        return;
+    }
+    xsltSaveResultToString(&content, &len, res, style);
+    if ((content == NULL) || (len != (int) strlen(expect)) ||
+        (memcmp(content, expect, len) != 0)) {
+        fprintf(stderr, "got \"%s\", expecting \"%s\"\n",
+                content ? (const char *) content : "", expect);
+        TEST_FAIL("unexpected pruned stylesheet output");
+    }
+    if (content != NULL)
+        xmlFree(content);
+    xmlFreeDoc(res);
+}
+
+static void
+pruneCheck(xsltStylesheetPtr style, int templates, int variables, int keys) {
+    if ((style->prunedTemplates != templates) ||
+        (style->prunedVariables != variables) ||
+        (style->prunedKeys != keys)) {
+        fprintf(stderr, "pruned %d templates, %d variables, %d keys, "
+                "expecting %d, %d and %d\n", style->prunedTemplates,
+                style->prunedVariables, style->prunedKeys,
+                templates, variables, keys);
+        TEST_FAIL("unexpected pruning");
+    }
+}
+
+static void
+testPrune(void) {
+    xsltStylesheetPtr style;
+    xmlDocPtr doc;
+
+    doc = parseDoc("<doc><item id='a'>x</item><item id='b'>y</item></doc>");
+
+    /* nothing is pruned by default */
+    style = parseStyle(pruneStyle);
+    pruneCheck(style, 0, 0, 0);
+    pruneRun(style, doc, NULL, "1y0U");
+    xsltFreeStylesheet(style);
+
+    xsltSetPruneDefault(1);
+
+    /*
+     * the unused mode, key and variable go, $called is kept since it
+     * calls a template
+     */
+    style = parseStyle(pruneStyle);
+    pruneCheck(style, 2, 1, 1);
+    pruneRun(style, doc, NULL, "1y0U");
+    xsltFreeStylesheet(style);
+
+    /* a pruned variable is still evaluated if looked up */
+    xsltRegisterExtModuleFunction(BAD_CAST "lookup", BAD_CAST PRUNE_NS,
+                                  pruneLookupFunction);
+    style = parseStyle(pruneLookup);
+    pruneCheck(style, 0, 1, 0);
+    pruneRun(style, doc, NULL, "2");
+    xsltFreeStylesheet(style);
+    xsltUnregisterExtModuleFunction(BAD_CAST "lookup", BAD_CAST PRUNE_NS);
+
+    style = parseStyle(pruneComputedKey);
+    pruneCheck(style, 1, 1, 0);
+    pruneRun(style, doc, NULL, "y");
+    xsltFreeStylesheet(style);
+
+    style = parseStyle(pruneDynamic);
+    pruneCheck(style, 1, 0, 0);
+    pruneRun(style, doc, NULL, "2x");
+    xsltFreeStylesheet(style);
+
+    xsltSetPruneDefault(0);
+    xmlFreeDoc(doc);
+}
+
+/************************************************************************
+ *									*
+ *			Stylesheet pipelines				*
+ *									*
+ ************************************************************************/
+
+#define PIPELINE_STAGES 5
+#define PIPELINE_TIMINGS "testAPI.timings"
+
+const char *pipelineStyle = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output omit-xml-declaration='yes'/>\
+<xsl:param name='s'/>\
+<xsl:template match='/'><r><xsl:value-of select='concat(r, $s)'/></r>\
+</xsl:template>\
+</xsl:stylesheet>";
+
+const char *pipelineFailure = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:template match='/'><xsl:message terminate='yes'/></xsl:template>\
+</xsl:stylesheet>";
+
+static void
+quietError(void *ctx ATTRIBUTE_UNUSED, const char *msg ATTRIBUTE_UNUSED,
+           ...) {
+}
+
+static void
+testPipeline(void) {
+    xsltPipelinePtr pipe;
+    xsltStylesheetPtr styles[PIPELINE_STAGES], failure;
+    const char *params[PIPELINE_STAGES][3];
+    const char *values[PIPELINE_STAGES] = { "'1'", "'2'", "'3'", "'4'", "'5'" };
+    xmlDocPtr doc, res;
+    xmlChar *content = NULL;
+    char line[200];
+    FILE *f;
+    int i, len = 0, nbLines, nbStages;
+
+    doc = parseDoc("<r>a</r>");
+    pipe = xsltNewPipeline();
+    if (pipe == NULL) {
+        fprintf(stderr, "Failed to create pipeline\n");
+        exit(1);
+    }
+    xsltSetGenericErrorFunc(NULL, quietError);
+
+    /* an empty pipeline fails */
+    if (xsltPipelineApply(pipe, doc) != NULL)
+        TEST_FAIL("empty pipeline succeeded");
+
+    /* more stages than the initial allocation, each with its parameter */
+    for (i = 0; i < PIPELINE_STAGES; i++) {
+        styles[i] = parseStyle(pipelineStyle);
+        params[i][0] = "s";
+        params[i][1] = values[i];
+        params[i][2] = NULL;
+        if (xsltPipelineAddStage(pipe, styles[i], params[i]) != i)
+            TEST_FAIL("unexpected pipeline stage number");
+    }
+    if (xsltPipelineAddStage(pipe, NULL, NULL) != -1)
+        TEST_FAIL("added a pipeline stage without stylesheet");
+
+    res = xsltPipelineApply(pipe, doc);
+    if (res == NULL) {
+        TEST_FAIL("pipeline failed");
+    } else {
+        xsltSaveResultToString(&content, &len, res,
+                               styles[PIPELINE_STAGES - 1]);
+        if ((content == NULL) ||
+            (strcmp((const char *) content, "<r>a12345</r>\n") != 0))
+            TEST_FAIL("unexpected pipeline output");
+        if (content != NULL)
+            xmlFree(content);
+        xmlFreeDoc(res);
+    }
+    /* the input is left to the caller */
+    if ((doc->children == NULL) ||
+        (!xmlStrEqual(doc->children->name, BAD_CAST "r")))
+        TEST_FAIL("pipeline modified its input");
+
+    /* one line per stage, plus the header and the total */
+    f = fopen(PIPELINE_TIMINGS, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to write %s\n", PIPELINE_TIMINGS);
+        exit(1);
+    }
+    xsltSavePipelineTimings(pipe, f);
+    fclose(f);
+    f = fopen(PIPELINE_TIMINGS, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to read %s\n", PIPELINE_TIMINGS);
+        exit(1);
+    }
+    nbLines = 0;
+    nbStages = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '\n')
+            continue;
+        nbLines++;
+        if (strstr(line, "testAPI.xsl") != NULL)
+            nbStages++;
+    }
+    fclose(f);
+    remove(PIPELINE_TIMINGS);
+    if ((nbLines != PIPELINE_STAGES + 2) || (nbStages != PIPELINE_STAGES))
+        TEST_FAIL("unexpected pipeline timings");
+
+    /* a stopped stage fails the pipeline and frees the intermediate results */
+    failure = parseStyle(pipelineFailure);
+    xsltPipelineAddStage(pipe, failure, NULL);
+    xsltPipelineAddStage(pipe, styles[0], params[0]);
+    if (xsltPipelineApply(pipe, doc) != NULL)
+        TEST_FAIL("failing pipeline succeeded");
+
+    xsltSetGenericErrorFunc(NULL, NULL);
+    xsltFreePipeline(pipe);
+    for (i = 0; i < PIPELINE_STAGES; i++)
+        xsltFreeStylesheet(styles[i]);
+    xsltFreeStylesheet(failure);
+    xmlFreeDoc(doc);
+}
+
+/************************************************************************
+ *									*
+ *			Transformation context caches			*
+ *									*
+ ************************************************************************/
+
+#define CTXT_CACHE_ITEMS 10
+
+/* each iteration creates and releases a variable and a tree fragment */
+const char *ctxtCacheStyle = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:template match='/'>\
+<xsl:for-each select='//item'>\
+<xsl:variable name='v'><b><xsl:value-of select='.'/></b></xsl:variable>\
+<xsl:value-of select='$v'/>\
+</xsl:for-each>\
+</xsl:template>\
+</xsl:stylesheet>";
+
+static void
+ctxtCacheCheckStats(xsltTransformContextPtr ctxt, int newItems,
+                    int reusedItems, int freedItems) {
+    int newRVTs = -1, reusedRVTs = -1, freedRVTs = -1;
+    int newVars = -1, reusedVars = -1, freedVars = -1;
+
+    if (xsltGetCtxtCacheStats(ctxt, &newRVTs, &reusedRVTs, &freedRVTs,
+                              &newVars, &reusedVars, &freedVars) != 0) {
+        TEST_FAIL("failed to get the context cache statistics");
+        return;
+    }
+    if ((newRVTs != newItems) || (reusedRVTs != reusedItems) ||
+        (freedRVTs != freedItems) || (newVars != newItems) ||
+        (reusedVars != reusedItems) || (freedVars != freedItems)) {
+        fprintf(stderr, "tree fragments: %d new, %d reused, %d freed, "
+                "variables: %d new, %d reused, %d freed, "
+                "expecting %d, %d and %d\n", newRVTs, reusedRVTs, freedRVTs,
+                newVars, reusedVars, freedVars,
+                newItems, reusedItems, freedItems);
+        TEST_FAIL("unexpected context cache statistics");
+    }
+}
+
+/*
+ * Applies @style to @doc with the given cache limits, -1 for the
+ * defaults, and returns the context for its statistics
+ */
+static xsltTransformContextPtr
+ctxtCacheRun(xsltStylesheetPtr style, xmlDocPtr doc, int maxRVT,
+             int maxStackItems) {
+    xsltTransformContextPtr ctxt;
+    xmlDocPtr res;
+
+    ctxt = xsltNewTransformContext(style, doc);
+    if (ctxt == NULL) {
+        fprintf(stderr, "Failed to create transformation context\n");
+        exit(1);
+    }
+    if (xsltSetCtxtCacheLimits(ctxt, maxRVT, maxStackItems) != 0)
+        TEST_FAIL("failed to set the context cache limits");
+    res = xsltApplyStylesheetUser(style, doc, NULL, NULL, NULL, ctxt);
+    if (res == NULL)
+        TEST_FAIL("context cache run failed");
+    else
+        xmlFreeDoc(res);
+    return(ctxt);
+}
+
+static void
+testCtxtCache(void) {
+    xsltTransformContextPtr ctxt;
+    xsltStylesheetPtr style;
+    xmlDocPtr doc;
+    xmlBufferPtr input;
+    int i;
+
+    input = xmlBufferCreate();
+    xmlBufferCCat(input, "<doc>");
+    for (i = 0; i < CTXT_CACHE_ITEMS; i++)
+        xmlBufferCCat(input, "<item>x</item>");
+    xmlBufferCCat(input, "</doc>");
+    doc = parseDoc((const char *) xmlBufferContent(input));
+    xmlBufferFree(input);
+    style = parseStyle(ctxtCacheStyle);
+
+    if ((xsltSetCtxtCacheLimits(NULL, 0, 0) != -1) ||
+        (xsltGetCtxtCacheStats(NULL, NULL, NULL, NULL, NULL, NULL,
+                               NULL) != -1))
+        TEST_FAIL("context cache functions accepted a NULL context");
+
+    /* with the default limits the released items are reused */
+    ctxt = ctxtCacheRun(style, doc, -1, -1);
+    ctxtCacheCheckStats(ctxt, 1, CTXT_CACHE_ITEMS - 1, 0);
+
+    /* lowering the limits frees the cached items at once */
+    if (xsltSetCtxtCacheLimits(ctxt, 0, 0) != 0)
+        TEST_FAIL("failed to set the context cache limits");
+    ctxtCacheCheckStats(ctxt, 1, CTXT_CACHE_ITEMS - 1, 1);
+    xsltFreeTransformContext(ctxt);
+
+    /* without cache every released item is freed */
+    ctxt = ctxtCacheRun(style, doc, 0, 0);
+    ctxtCacheCheckStats(ctxt, CTXT_CACHE_ITEMS, 0, CTXT_CACHE_ITEMS);
+    xsltFreeTransformContext(ctxt);
+
+    xsltFreeStylesheet(style);
+    xmlFreeDoc(doc);
+}
+
+/************************************************************************
+ *									*
+ *			Extension module initialization			*
+ *									*
+ ************************************************************************/
+
+#define INIT_NS "http://xmlsoft.org/XSLT/testAPI/init"
+
+/* a module function and element along with EXSLT ones */
+const char *initStyle = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform' \
+xmlns:test='" INIT_NS "' xmlns:func='http://exslt.org/functions' \
+xmlns:dyn='http://exslt.org/dynamic' xmlns:str='http://exslt.org/strings' \
+xmlns:my='http://example.org/my' \
+extension-element-prefixes='test func dyn str'>\
+<xsl:output method='text'/>\
+<func:function name='my:f'><xsl:param name='s'/>\
+<func:result select='str:replace($s, \"-\", \"+\")'/></func:function>\
+<xsl:template match='/'><test:element/>\
+<xsl:value-of select='concat(test:inits(), my:f(doc), dyn:evaluate(doc))'/>\
+</xsl:template>\
+</xsl:stylesheet>";
+
+/* the module namespace is declared but not used */
+const char *initUnused = "<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform' \
+xmlns:test='" INIT_NS "' extension-element-prefixes='test'>\
+<xsl:output method='text'/>\
+<xsl:template match='/'><xsl:value-of select='doc'/></xsl:template>\
+</xsl:stylesheet>";
+
+static int initCalls = 0;
+static int shutdownCalls = 0;
+
+static void *
+initModuleInit(xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+               const xmlChar *URI ATTRIBUTE_UNUSED) {
+    initCalls++;
+    return(&initCalls);
+}
+
+static void
+initModuleShutdown(xsltTransformContextPtr ctxt ATTRIBUTE_UNUSED,
+                   const xmlChar *URI ATTRIBUTE_UNUSED, void *data) {
+    if (data != &initCalls)
+        TEST_FAIL("extension module shut down with other data");
+    shutdownCalls++;
+}
+
+/*
+ * test:inits(): the number of initializations of the module so far
+ */
+static void
+initInitsFunction(xmlXPathParserContextPtr ctxt, int nargs) {
+    if (nargs != 0) {
+        xmlXPathSetArityError(ctxt);
+        return;
+    }
+    if (xsltGetExtData(xsltXPathGetTransformContext(ctxt),
+                       BAD_CAST INIT_NS) != &initCalls)
+        TEST_FAIL("extension module data missing in a function");
+    valuePush(ctxt, xmlXPathNewFloat(initCalls));
+}
+
+/*
+ * test:element: outputs "E"
+ */
+static void
+initElement(xsltTransformContextPtr ctxt, xmlNodePtr node ATTRIBUTE_UNUSED,
+            xmlNodePtr inst ATTRIBUTE_UNUSED,
+            xsltElemPreCompPtr comp ATTRIBUTE_UNUSED) {
+    if (xsltGetExtData(ctxt, BAD_CAST INIT_NS) != &initCalls)
+        TEST_FAIL("extension module data missing in an element");
+    xmlAddChild(ctxt->insert, xmlNewText(BAD_CAST "E"));
+}
+
+static void
+initCheck(int inits, int shutdowns) {
+    if ((initCalls != inits) || (shutdownCalls != shutdowns)) {
+        fprintf(stderr, "%d initializations, %d shutdowns, "
+                "expecting %d and %d\n", initCalls, shutdownCalls,
+                inits, shutdowns);
+        TEST_FAIL("unexpected extension module initializations");
+    }
+}
+
+static void
+testExtInit(void) {
+    xsltStylesheetPtr style;
+    xmlDocPtr doc, other;
+
+    xsltRegisterExtModule(BAD_CAST INIT_NS, initModuleInit,
+                          initModuleShutdown);
+    xsltRegisterExtModuleFunction(BAD_CAST "inits", BAD_CAST INIT_NS,
+                                  initInitsFunction);
+    xsltRegisterExtModuleElement(BAD_CAST "element", BAD_CAST INIT_NS,
+                                 NULL, initElement);
+    doc = parseDoc("<doc>1-2</doc>");
+    other = parseDoc("<doc>3-4</doc>");
+
+    /* one initialization and shutdown per transformation */
+    style = parseStyle(initStyle);
+    pruneRun(style, doc, NULL, "E11+2-1");
+    initCheck(1, 1);
+    pruneRun(style, other, NULL, "E23+4-1");
+    initCheck(2, 2);
+    xsltFreeStylesheet(style);
+
+    /* none if the module isn't used */
+    style = parseStyle(initUnused);
+    pruneRun(style, doc, NULL, "1-2");
+    initCheck(2, 2);
+    xsltFreeStylesheet(style);
+
+    xsltUnregisterExtModuleElement(BAD_CAST "element", BAD_CAST INIT_NS);
+    xsltUnregisterExtModuleFunction(BAD_CAST "inits", BAD_CAST INIT_NS);
+    xsltUnregisterExtModule(BAD_CAST INIT_NS);
+    xmlFreeDoc(doc);
+    xmlFreeDoc(other);
+}
+
+/************************************************************************
+ *									*
+ *			Document order sort				*
+ *									*
+ ************************************************************************/
+
+const char *sortDoc = "<doc a='1' b='2'><x c='3'>t<y/><!--c--></x>\
+<?pi?><z d='4'><w/>u</z></doc>";
+
+static void
+sortCheck(xsltTransformContextPtr ctxt, xmlNodeSetPtr ordered) {
+    xmlNodeSetPtr list;
+    int i, len = ordered->nodeNr;
+
+    list = xmlXPathNodeSetCreate(NULL);
+    /* reversed, then with the halves swapped */
+    for (i = len - 1; i >= 0; i--)
+        xmlXPathNodeSetAdd(list, ordered->nodeTab[i]);
+    xsltCtxtDocumentSortFunction(ctxt, list);
+    for (i = 0; i < len; i++)
+        if (list->nodeTab[i] != ordered->nodeTab[i])
+            break;
+    if ((list->nodeNr != len) || (i < len))
+        TEST_FAIL("reversed nodes not sorted in document order");
+    for (i = 0; i < len; i++)
+        list->nodeTab[i] = ordered->nodeTab[(i + len / 2) % len];
+    if (ctxt == NULL)
+        xsltDocumentSortFunction(list);
+    else
+        xsltCtxtDocumentSortFunction(ctxt, list);
+    for (i = 0; i < len; i++)
+        if (list->nodeTab[i] != ordered->nodeTab[i])
+            break;
+    if (i < len)
+        TEST_FAIL("rotated nodes not sorted in document order");
+    xmlXPathFreeNodeSet(list);
+}
+
+static void
+testDocumentSort(void) {
+    xsltTransformContextPtr ctxt;
+    xsltStylesheetPtr style;
+    xmlXPathContextPtr xpctxt;
+    xmlXPathObjectPtr res;
+    xmlDocPtr doc;
+
+    doc = parseDoc(sortDoc);
+    style = parseStyle(ctxtCacheStyle);
+    xpctxt = xmlXPathNewContext(doc);
+    res = xmlXPathEval(BAD_CAST "//node() | //@*", xpctxt);
+    if ((res == NULL) || (res->nodesetval == NULL) ||
+        (res->nodesetval->nodeNr < 10)) {
+        TEST_FAIL("failed to select the nodes to sort");
+    } else {
+        sortCheck(NULL, res->nodesetval);
+        ctxt = xsltNewTransformContext(style, doc);
+        if (ctxt == NULL) {
+            fprintf(stderr, "Failed to create transformation context\n");
+            exit(1);
+        }
+        sortCheck(ctxt, res->nodesetval);
+        xsltFreeTransformContext(ctxt);
+    }
+    xmlXPathFreeObject(res);
+    xmlXPathFreeContext(xpctxt);
+    xsltFreeStylesheet(style);
+    xmlFreeDoc(doc);
+}
+
+int
+main(void)
+{
+    xmlInitParser();
+    exsltRegisterAll();
+
+    printf("Result cache\n");
+    testResultCache(NULL);
+#if defined(HAVE_SYS_STAT_H) && !defined(_WIN32)
+    mkdir(CACHE_DIR, 0755);
+    testResultCache(CACHE_DIR);
+#endif
+
+    printf("Stylesheet pruning\n");
+    testPrune();
+    printf("Stylesheet pipelines\n");
+    testPipeline();
+    printf("Transformation context caches\n");
+    testCtxtCache();
+    printf("Extension module initialization\n");
+    testExtInit();
+    printf("Document order sort\n");
+    testDocumentSort();
+
+    xsltCleanupGlobals();
+    xmlCleanupParser();
+    xmlMemoryDump();
+    if (errors != 0) {
+        printf("%d errors\n", errors);
+        return(1);
+    }
+    printf("Ok\n");
+    return(0);
+}
@@ -61,6 +61,41 @@ int init = 0;
 const char *doc = "<doc>Failed</doc>";
 const char *expect = "<?xml version=\"1.0\"?>\nSuccess foo\n";
 
+/*
+ * The stylesheets applied concurrently to a shared input in pass 3
+ */
+#define FAN_STYLES 3
+
+const char *fanDoc = "<doc>\n\
+ <item type='a'>1</item>\n\
+ <item type='b'>2</item>\n\
+ <item type='a'>3</item>\n\
+</doc>";
+
+const char *fanStyles[FAN_STYLES] = {
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:key name='type' match='item' use='@type'/>\
+<xsl:template match='/'><xsl:apply-templates select='//item'/></xsl:template>\
+<xsl:template match=\"key('type', 'a')\">A<xsl:value-of select='.'/></xsl:template>\
+<xsl:template match='item'>-</xsl:template>\
+</xsl:stylesheet>",
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:template match='/'><xsl:value-of select='count(//text())'/></xsl:template>\
+</xsl:stylesheet>",
+"<xsl:stylesheet version='1.0' \
+xmlns:xsl='http://www.w3.org/1999/XSL/Transform'>\
+<xsl:output method='text'/>\
+<xsl:strip-space elements='*'/>\
+<xsl:template match='/'><xsl:value-of select='count(//text())'/></xsl:template>\
+</xsl:stylesheet>"
+};
+
+const char *fanExpect[FAN_STYLES] = { "A1-A3", "7", "3" };
+
 static void fooFunction(xmlXPathParserContextPtr ctxt,
                         int nargs ATTRIBUTE_UNUSED) {
     xmlXPathReturnString(ctxt, xmlStrdup(BAD_CAST "foo"));
@@ -89,6 +124,49 @@ static void registerFooModule(void) {
     xsltRegisterExtModule(EXT_NS, registerFooExtensions, shutdownFooExtensions);
 }
 
+/*
+ * In pass 4 half of the threads change the registry while the others
+ * look functions up
+ */
+#define REGISTRY_LOOPS 2000
+
+static void
+barFunction(xmlXPathParserContextPtr ctxt, int nargs ATTRIBUTE_UNUSED) {
+    xmlXPathReturnString(ctxt, xmlStrdup(BAD_CAST "bar"));
+}
+
+static void *
+threadRoutine3(void *data)
+{
+    int id = (int)(unsigned long) data;
+    xmlChar name[20];
+    int i;
+
+    snprintf((char *) name, sizeof(name), "bar%d", id);
+    for (i = 0; i < REGISTRY_LOOPS; i++) {
+        if (id % 2 == 0) {
+            if (xsltExtModuleFunctionLookup(BAD_CAST "foo", EXT_NS) !=
+                fooFunction) {
+                fprintf(stderr, "Thread id %d lost a function\n", id);
+                exit(1);
+            }
+            continue;
+        }
+        if ((xsltRegisterExtModuleFunction(name, EXT_NS, barFunction) != 0) ||
+            (xsltExtModuleFunctionLookup(name, EXT_NS) != barFunction)) {
+            fprintf(stderr, "Thread id %d failed to register\n", id);
+            exit(1);
+        }
+        if ((xsltUnregisterExtModuleFunction(name, EXT_NS) != 0) ||
+            (xsltExtModuleFunctionLookup(name, EXT_NS) != NULL) ||
+            (xsltUnregisterExtModuleFunction(name, EXT_NS) == 0)) {
+            fprintf(stderr, "Thread id %d failed to unregister\n", id);
+            exit(1);
+        }
+    }
+    return(0);
+}
+
 static void *
 threadRoutine1(void *data)
 {
@@ -177,8 +255,10 @@ main(void)
     unsigned int i, repeat;
     unsigned int num_threads = 8;
     void *results[MAX_ARGC];
-    int ret;
+    int ret, used;
 
+    /* the memory use is checked in pass 4 */
+    xmlMemSetup(xmlMemFree, xmlMemMalloc, xmlMemRealloc, xmlMemoryStrdup);
     xmlInitParser();
 
     /*
@@ -257,6 +337,97 @@ main(void)
 	}
         xsltFreeStylesheet(cur);
     }
+
+    /*
+     * Third pass the stylesheets are applied to a single shared input
+     * through the fan-out interface
+     */
+    printf("Pass 3\n");
+    for (repeat = 0;repeat < 100;repeat++) {
+        xmlDocPtr input;
+        xsltStylesheetPtr styles[FAN_STYLES];
+        xsltTransformJob jobs[4 * FAN_STYLES];
+        xmlChar *result;
+        int len;
+
+        input = xmlReadMemory(fanDoc, strlen(fanDoc), "fan.xml", NULL, 0);
+        if (input == NULL) {
+            fprintf(stderr, "Main failed to parse input\n");
+            exit(1);
+        }
+        for (i = 0; i < FAN_STYLES; i++) {
+            xmlDocPtr style;
+
+            style = xmlReadMemory(fanStyles[i], strlen(fanStyles[i]),
+                                  "fan.xsl", NULL, 0);
+            if (style == NULL) {
+                fprintf(stderr, "Main failed to parse stylesheet\n");
+                exit(1);
+            }
+            styles[i] = xsltParseStylesheetDoc(style);
+            if (styles[i] == NULL) {
+                fprintf(stderr, "Main failed to compile stylesheet\n");
+                exit(1);
+            }
+        }
+        memset(jobs, 0, sizeof(jobs));
+        for (i = 0; i < 4 * FAN_STYLES; i++)
+            jobs[i].style = styles[i % FAN_STYLES];
+        if (xsltApplyStylesheetsParallel(input, jobs, 4 * FAN_STYLES,
+                                         num_threads) != 0) {
+            fprintf(stderr, "Fan-out failed to apply stylesheets\n");
+            exit(1);
+        }
+        for (i = 0; i < 4 * FAN_STYLES; i++) {
+            if (xsltSaveResultToString(&result, &len, jobs[i].result,
+                                       jobs[i].style) < 0) {
+                fprintf(stderr, "Fan-out failed to output result\n");
+                exit(1);
+            }
+            if (!xmlStrEqual(BAD_CAST fanExpect[i % FAN_STYLES], result)) {
+                fprintf(stderr, "Fan-out job %d output not conform\n", i);
+                exit(1);
+            }
+            xmlFree(result);
+            xmlFreeDoc(jobs[i].result);
+        }
+        for (i = 0; i < FAN_STYLES; i++)
+            xsltFreeStylesheet(styles[i]);
+        xmlFreeDoc(input);
+    }
+
+    /*
+     * Fourth pass the registry changes while it is read, the copies
+     * of the registry read by the lookups must not pile up
+     */
+    printf("Pass 4\n");
+    xsltRegisterExtModuleFunction(BAD_CAST "foo", EXT_NS, fooFunction);
+    xsltExtModuleFunctionLookup(BAD_CAST "foo", EXT_NS);
+    used = xmlMemUsed();
+    memset(results, 0, sizeof(*results)*num_threads);
+    memset(tid, 0xff, sizeof(*tid)*num_threads);
+    for (i = 0; i < num_threads; i++) {
+        ret = pthread_create(&tid[i], NULL, threadRoutine3,
+                             (void *) (unsigned long) i);
+        if (ret != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (i = 0; i < num_threads; i++) {
+        ret = pthread_join(tid[i], &results[i]);
+        if (ret != 0) {
+            perror("pthread_join");
+            exit(1);
+        }
+    }
+    xsltExtModuleFunctionLookup(BAD_CAST "foo", EXT_NS);
+    if (xmlMemUsed() > used + 4096) {
+        fprintf(stderr, "Registry changes leaked %d bytes\n",
+                xmlMemUsed() - used);
+        exit(1);
+    }
+
     xsltCleanupGlobals();
     xmlCleanupParser();
     xmlMemoryDump();
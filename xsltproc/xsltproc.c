@@ -49,6 +49,8 @@
 #include <libxslt/transform.h>
 #include <libxslt/xsltutils.h>
 #include <libxslt/extensions.h>
+#include <libxslt/documents.h>
+#include <libxslt/preproc.h>
 #include <libxslt/security.h>
 
 #include <libexslt/exsltconfig.h>
@@ -75,6 +77,7 @@ static int debug = 0;
 static int repeat = 0;
 static int timing = 0;
 static int dumpextensions = 0;
+static int memstats = 0;
 static int novalid = 0;
 static int nodtdattr = 0;
 static int noout = 0;
@@ -101,6 +104,7 @@ static int nbstrparams = 0;
 static xmlChar *paths[MAX_PATHS + 1];
 static int nbpaths = 0;
 static char *output = NULL;
+static xsltResultCachePtr resultCache = NULL;
 static int errorno = 0;
 static const char *writesubtree = NULL;
 
@@ -381,7 +385,9 @@ xsltProcess(xmlDocPtr doc, xsltStylesheetPtr cur, const char *filename) {
 #endif
     if (timing)
         startTimer();
-    if (output == NULL) {
+    if ((output == NULL) &&
+        ((resultCache == NULL) || (repeat) || (debug) || (noout) ||
+	 (profile) || (cur->methodURI != NULL))) {
 	if (repeat) {
 	    int j;
 
@@ -477,11 +483,16 @@ xsltProcess(xmlDocPtr doc, xsltStylesheetPtr cur, const char *filename) {
 	ctxt->maxTemplateDepth = xsltMaxDepth;
 	ctxt->maxTemplateVars = xsltMaxVars;
 
+	/*
+	 * Cached results for stdout are written to "-"
+	 */
 	if (profile) {
-	    ret = xsltRunStylesheetUser(cur, doc, params, output,
+	    ret = xsltRunStylesheetUser(cur, doc, params,
+		                        output ? output : "-",
 		                        NULL, NULL, stderr, ctxt);
 	} else {
-	    ret = xsltRunStylesheetUser(cur, doc, params, output,
+	    ret = xsltRunStylesheetUser(cur, doc, params,
+		                        output ? output : "-",
 		                        NULL, NULL, NULL, ctxt);
 	}
 	if (ret == -1)
@@ -509,6 +520,17 @@ static void usage(const char *name) {
     printf("\t--debug: dump the tree of the result instead\n");
 #endif
     printf("\t--dumpextensions: dump the registered extension elements and functions to stdout\n");
+    printf("\t--memstats: report the memory used by the compiled stylesheet\n");
+    printf("\t--prune: drop the template rules, keys and global variables\n");
+    printf("\t         the stylesheet never uses\n");
+    printf("\t--prefetch: parse the documents the stylesheet loads in the\n");
+    printf("\t            background when the transformation starts, and\n");
+    printf("\t            those of node-sets passed to document() concurrently\n");
+    printf("\t--threads n : the number of threads processing the nodes of the\n");
+    printf("\t              libxslt:parallel instructions and the documents\n");
+    printf("\t              of --prefetch, 1 to disable\n");
+    printf("\t--chunksize n : the minimum number of nodes each of those threads\n");
+    printf("\t                processes (default %d)\n", xsltGetParallelChunkSize());
     printf("\t--novalid skip the DTD loading phase\n");
     printf("\t--nodtdattr do not default attributes from the DTD\n");
     printf("\t--noout: do not dump the result\n");
@@ -541,6 +563,7 @@ static void usage(const char *name) {
 #endif
     printf("\t--load-trace : print trace of all external entites loaded\n");
     printf("\t--profile or --norman : dump profiling informations \n");
+    printf("\t--cache dir : reuse the results of previous runs stored in dir\n");
     printf("\nProject libxslt home page: http://xmlsoft.org/XSLT/\n");
     printf("To report bugs and get help: http://xmlsoft.org/XSLT/bugs.html\n");
 }
@@ -664,6 +687,13 @@ main(int argc, char **argv)
                    (!strcmp(argv[i], "--path"))) {
 	    i++;
 	    parsePath(BAD_CAST argv[i]);
+        } else if ((!strcmp(argv[i], "-cache")) ||
+                   (!strcmp(argv[i], "--cache"))) {
+	    i++;
+	    if (resultCache == NULL) {
+		resultCache = xsltNewResultCache(argv[i]);
+		xsltSetResultCache(resultCache);
+	    }
 #ifdef LIBXML_CATALOG_ENABLED
         } else if ((!strcmp(argv[i], "-catalogs")) ||
                    (!strcmp(argv[i], "--catalogs"))) {
@@ -775,6 +805,43 @@ main(int argc, char **argv)
         } else if ((!strcmp(argv[i],"-dumpextensions"))||
 			(!strcmp(argv[i],"--dumpextensions"))) {
 		dumpextensions++;
+        } else if ((!strcmp(argv[i], "-memstats")) ||
+                   (!strcmp(argv[i], "--memstats"))) {
+            memstats++;
+        } else if ((!strcmp(argv[i], "-prune")) ||
+                   (!strcmp(argv[i], "--prune"))) {
+            xsltSetPruneDefault(1);
+        } else if ((!strcmp(argv[i], "-prefetch")) ||
+                   (!strcmp(argv[i], "--prefetch"))) {
+            xsltSetDocumentThreads(-1);
+        } else if ((!strcmp(argv[i], "-threads")) ||
+                   (!strcmp(argv[i], "--threads"))) {
+            int value;
+
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "threads value not specified!\n");
+                return (2);
+            }
+
+            if (sscanf(argv[i], "%d", &value) == 1) {
+                if (value > 0)
+                    xsltSetParallelThreads(value);
+            }
+        } else if ((!strcmp(argv[i], "-chunksize")) ||
+                   (!strcmp(argv[i], "--chunksize"))) {
+            int value;
+
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "chunksize value not specified!\n");
+                return (2);
+            }
+
+            if (sscanf(argv[i], "%d", &value) == 1) {
+                if (value > 0)
+                    xsltSetParallelChunkSize(value);
+            }
 	} else {
             fprintf(stderr, "Unknown option %s\n", argv[i]);
             usage(argv[0]);
@@ -783,6 +850,9 @@ main(int argc, char **argv)
     }
     params[nbparams] = NULL;
 
+    if ((xsltGetDocumentThreads() < 0) && (xsltGetParallelThreads() > 0))
+        xsltSetDocumentThreads(xsltGetParallelThreads());
+
     if (novalid != 0)
 	options = XML_PARSE_NOENT | XML_PARSE_NOCDATA;
     else if (nodtdattr)
@@ -816,6 +886,14 @@ main(int argc, char **argv)
             (!strcmp(argv[i], "--seed-rand"))) {
             i++;
             continue;
+        } else if ((!strcmp(argv[i], "-threads")) ||
+            (!strcmp(argv[i], "--threads"))) {
+            i++;
+            continue;
+        } else if ((!strcmp(argv[i], "-chunksize")) ||
+            (!strcmp(argv[i], "--chunksize"))) {
+            i++;
+            continue;
         } else if ((!strcmp(argv[i], "-o")) ||
                    (!strcmp(argv[i], "-output")) ||
                    (!strcmp(argv[i], "--output"))) {
@@ -833,6 +911,10 @@ main(int argc, char **argv)
                    (!strcmp(argv[i], "--path"))) {
             i++;
 	    continue;
+        } else if ((!strcmp(argv[i], "-cache")) ||
+                   (!strcmp(argv[i], "--cache"))) {
+            i++;
+	    continue;
 	}
         if ((!strcmp(argv[i], "-param")) || (!strcmp(argv[i], "--param"))) {
             i += 2;
@@ -884,6 +966,8 @@ main(int argc, char **argv)
 			errorno = 5;
 			goto done;
 		    }
+		    if (memstats)
+			xsltDumpStylesheetMemory(stderr, cur);
 		    i++;
 		} else {
 		    xmlFreeDoc(style);
@@ -907,7 +991,7 @@ main(int argc, char **argv)
                 doc = htmlReadFile(argv[i], encoding, options);
             else
 #endif
-                doc = xmlReadFile(argv[i], encoding, options);
+                doc = xsltParseInputFile(cur, argv[i], encoding, options);
             if (doc == NULL) {
                 fprintf(stderr, "unable to parse %s\n", argv[i]);
 		errorno = 6;
@@ -919,6 +1003,17 @@ main(int argc, char **argv)
         }
     }
 done:
+    if (resultCache != NULL) {
+	if (timing) {
+	    long hits = 0, misses = 0;
+
+	    xsltResultCacheGetStats(resultCache, &hits, &misses, NULL);
+	    fprintf(stderr, "Result cache: %ld hits, %ld misses\n",
+		    hits, misses);
+	}
+	xsltSetResultCache(NULL);
+	xsltFreeResultCache(resultCache);
+    }
     if (cur != NULL)
         xsltFreeStylesheet(cur);
     for (i = 0;i < nbstrparams;i++)